@@ -0,0 +1,29 @@
+#include "AnalysisFifo.h"
+
+AnalysisFifo::AnalysisFifo(int minimumCapacity)
+{
+    std::uint32_t capacity = 1;
+    while (capacity < (std::uint32_t) std::max(minimumCapacity, 1))
+        capacity <<= 1;
+
+    buffer.assign(capacity, 0.0f);
+    mask = capacity - 1;
+}
+
+int AnalysisFifo::pop(float* destination, int maxSamples)
+{
+    const std::uint32_t read = readPosition.load(std::memory_order_relaxed);
+    const std::uint32_t write = writePosition.load(std::memory_order_acquire);
+    const int count = std::min(maxSamples, static_cast<int>(write - read));
+
+    for (int i = 0; i < count; ++i)
+        destination[i] = buffer[(read + (std::uint32_t) i) & mask];
+
+    readPosition.store(read + (std::uint32_t) count, std::memory_order_release);
+    return count;
+}
+
+int AnalysisFifo::getNumReady() const
+{
+    return static_cast<int>(writePosition.load(std::memory_order_acquire) - readPosition.load(std::memory_order_relaxed));
+}
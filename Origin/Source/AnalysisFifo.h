@@ -0,0 +1,82 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Wait-free single-producer, single-consumer ring of float samples that
+// carries audio from processBlock to the editor's scope and spectrum views.
+//
+// The audio thread pushes and never blocks or allocates: when the editor
+// falls behind, whatever does not fit is dropped. It can also decimate by
+// an integer factor on the way in (a box average, so high sample rates do
+// not fill the ring with content the views cannot show anyway). The
+// message thread pops whatever has arrived.
+class AnalysisFifo
+{
+public:
+    explicit AnalysisFifo(int minimumCapacity);
+
+    // Producer side. Returns how many decimated samples were stored.
+    template <typename SampleType>
+    int push(const SampleType* samples, int numSamples, int decimation);
+
+    // Consumer side
+    int pop(float* destination, int maxSamples);
+    int getNumReady() const;
+
+private:
+    std::vector<float> buffer;
+    std::uint32_t mask = 0;
+
+    std::atomic<std::uint32_t> writePosition { 0 };
+    std::atomic<std::uint32_t> readPosition { 0 };
+
+    // Producer-only decimation state, carried across blocks
+    float decimationSum = 0.0f;
+    int decimationCount = 0;
+
+    JUCE_DECLARE_NON_COPYABLE (AnalysisFifo)
+};
+
+template <typename SampleType>
+int AnalysisFifo::push(const SampleType* samples, int numSamples, int decimation)
+{
+    const std::uint32_t write = writePosition.load(std::memory_order_relaxed);
+    const std::uint32_t read = readPosition.load(std::memory_order_acquire);
+    const int space = static_cast<int>(buffer.size()) - static_cast<int>(write - read);
+
+    float* data = buffer.data();
+    int numWritten = 0;
+
+    if (decimation <= 1)
+    {
+        // At most two contiguous runs, so each is a plain vectorised copy
+        numWritten = std::min(numSamples, space);
+        const int start = static_cast<int>(write & mask);
+        const int firstRun = std::min(numWritten, static_cast<int>(buffer.size()) - start);
+        std::transform(samples, samples + firstRun, data + start, [] (SampleType v) { return static_cast<float>(v); });
+        std::transform(samples + firstRun, samples + numWritten, data, [] (SampleType v) { return static_cast<float>(v); });
+    }
+    else
+    {
+        const float scale = 1.0f / static_cast<float>(decimation);
+        for (int i = 0; i < numSamples; ++i)
+        {
+            decimationSum += static_cast<float>(samples[i]);
+            if (++decimationCount < decimation)
+                continue;
+
+            if (numWritten < space)
+                data[(write + (std::uint32_t) numWritten++) & mask] = decimationSum * scale;
+
+            decimationSum = 0.0f;
+            decimationCount = 0;
+        }
+    }
+
+    writePosition.store(write + (std::uint32_t) numWritten, std::memory_order_release);
+    return numWritten;
+}
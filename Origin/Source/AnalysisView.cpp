@@ -0,0 +1,223 @@
+#include "AnalysisView.h"
+#include "SharedResources.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+// Immutable once built, so one plan serves every open editor
+struct AnalysisFFT
+{
+    explicit AnalysisFFT (int order) : fft (order) {}
+
+    std::size_t getMemoryUsage() const
+    {
+        // Twiddle factors dominate; JUCE does not expose the exact figure
+        return sizeof (AnalysisFFT) + (std::size_t) fft.getSize() * 2 * sizeof (float);
+    }
+
+    juce::dsp::FFT fft;
+};
+
+namespace
+{
+    constexpr float minDecibels = -90.0f;
+    constexpr float minFrequency = 20.0f;
+
+    const juce::Colour inputColour (0xff808080);
+    const juce::Colour outputColour (0xff7cfc7c);
+}
+
+//==============================================================================
+AnalysisView::AnalysisView (OriginAudioProcessor& p)
+    : audioProcessor (p),
+      inputHistory ((size_t) fftSize, 0.0f),
+      outputHistory ((size_t) fftSize, 0.0f),
+      popBuffer ((size_t) fftSize, 0.0f),
+      fftData ((size_t) fftSize * 2, 0.0f),
+      window ((size_t) fftSize, 0.0f)
+{
+    fft = SharedResources::getInstance().getOrCreate<AnalysisFFT> ("analysis fft " + std::to_string (fftOrder), []
+    {
+        return std::make_shared<AnalysisFFT> (fftOrder);
+    });
+
+    // Hann, normalised so a full-scale sine reads about 0 dB
+    for (int i = 0; i < fftSize; ++i)
+        window[(size_t) i] = 0.5f - 0.5f * std::cos (juce::MathConstants<float>::twoPi * (float) i / (float) fftSize);
+
+    const float windowSum = std::accumulate (window.begin(), window.end(), 0.0f);
+    for (auto& w : window)
+        w *= 2.0f / windowSum;
+
+    setOpaque (true);
+    audioProcessor.setAnalysisActive (true);
+    startTimerHz (frameRate);
+}
+
+AnalysisView::~AnalysisView()
+{
+    stopTimer();
+    audioProcessor.setAnalysisActive (false);
+}
+
+//==============================================================================
+void AnalysisView::paint (juce::Graphics& g)
+{
+    if (cachedImage.isNull())
+        g.fillAll (juce::Colour (0xff1e1e1e));
+    else
+        g.drawImageAt (cachedImage, 0, 0);
+}
+
+void AnalysisView::resized()
+{
+    cachedImage = juce::Image();
+    hasNewAudio = true;
+    render();
+}
+
+void AnalysisView::timerCallback()
+{
+    // Keep draining while hidden so the FIFOs never fill up, but skip the drawing
+    auto& inputFifo = audioProcessor.getInputAnalysisFifo();
+    auto& outputFifo = audioProcessor.getOutputAnalysisFifo();
+
+    // Popping the same count from both keeps input and output aligned
+    int numReady = std::min (inputFifo.getNumReady(), outputFifo.getNumReady());
+    while (numReady > 0)
+    {
+        const int count = std::min (numReady, fftSize);
+        appendToHistory (inputHistory, popBuffer.data(), inputFifo.pop (popBuffer.data(), count));
+        appendToHistory (outputHistory, popBuffer.data(), outputFifo.pop (popBuffer.data(), count));
+        numReady -= count;
+        hasNewAudio = true;
+    }
+
+    if (hasNewAudio && isShowing())
+    {
+        render();
+        repaint();
+    }
+}
+
+void AnalysisView::appendToHistory (std::vector<float>& history, const float* samples, int numSamples)
+{
+    const int size = static_cast<int>(history.size());
+    numSamples = std::min (numSamples, size);
+
+    std::move (history.begin() + numSamples, history.end(), history.begin());
+    std::copy (samples, samples + numSamples, history.end() - numSamples);
+}
+
+//==============================================================================
+void AnalysisView::render()
+{
+    if (getWidth() <= 0 || getHeight() <= 0)
+        return;
+
+    if (cachedImage.isNull())
+        cachedImage = juce::Image (juce::Image::RGB, getWidth(), getHeight(), true);
+
+    juce::Graphics g (cachedImage);
+    g.fillAll (juce::Colour (0xff1e1e1e));
+
+    auto bounds = getLocalBounds().toFloat();
+    auto scopeArea = bounds.removeFromLeft (bounds.getWidth() * 0.5f).reduced (4.0f);
+    auto spectrumArea = bounds.reduced (4.0f);
+
+    drawScope (g, scopeArea);
+    drawSpectrum (g, spectrumArea);
+    hasNewAudio = false;
+}
+
+void AnalysisView::drawScope (juce::Graphics& g, juce::Rectangle<float> area)
+{
+    g.setColour (juce::Colours::darkgrey);
+    g.drawRect (area, 1.0f);
+    g.drawHorizontalLine ((int) area.getCentreY(), area.getX(), area.getRight());
+
+    // One vertical min/max stroke per pixel column, so the cost follows
+    // the width rather than the number of samples
+    auto makeScopePath = [area] (const std::vector<float>& history)
+    {
+        juce::Path path;
+        const int numColumns = juce::jmax (1, (int) area.getWidth());
+        const float* samples = history.data() + history.size() - scopeSamples;
+        const float halfHeight = area.getHeight() * 0.5f;
+
+        path.preallocateSpace (numColumns * 6);
+        for (int column = 0; column < numColumns; ++column)
+        {
+            const int start = column * scopeSamples / numColumns;
+            const int end = juce::jmax (start + 1, (column + 1) * scopeSamples / numColumns);
+            auto range = std::minmax_element (samples + start, samples + end);
+
+            const float x = area.getX() + (float) column;
+            const float top = area.getCentreY() - juce::jlimit (-1.0f, 1.0f, *range.second) * halfHeight;
+            const float bottom = area.getCentreY() - juce::jlimit (-1.0f, 1.0f, *range.first) * halfHeight;
+
+            if (column == 0)
+                path.startNewSubPath (x, top);
+            else
+                path.lineTo (x, top);
+
+            path.lineTo (x, bottom + 0.5f);
+        }
+
+        return path;
+    };
+
+    g.setColour (inputColour);
+    g.strokePath (makeScopePath (inputHistory), juce::PathStrokeType (1.0f));
+    g.setColour (outputColour);
+    g.strokePath (makeScopePath (outputHistory), juce::PathStrokeType (1.0f));
+}
+
+void AnalysisView::drawSpectrum (juce::Graphics& g, juce::Rectangle<float> area)
+{
+    g.setColour (juce::Colours::darkgrey);
+    g.drawRect (area, 1.0f);
+
+    g.setColour (inputColour);
+    g.strokePath (makeSpectrumPath (inputHistory, area), juce::PathStrokeType (1.0f));
+    g.setColour (outputColour);
+    g.strokePath (makeSpectrumPath (outputHistory, area), juce::PathStrokeType (1.0f));
+}
+
+juce::Path AnalysisView::makeSpectrumPath (const std::vector<float>& history, juce::Rectangle<float> area)
+{
+    std::transform (history.begin(), history.end(), window.begin(), fftData.begin(), std::multiplies<float>());
+    std::fill (fftData.begin() + fftSize, fftData.end(), 0.0f);
+    fft->fft.performFrequencyOnlyForwardTransform (fftData.data(), true);
+
+    // Log frequency axis from minFrequency to Nyquist, one point per pixel column
+    const float nyquist = static_cast<float> (audioProcessor.getAnalysisSampleRate() * 0.5);
+    const float binWidth = nyquist / (float) (fftSize / 2);
+    const float logRange = std::log (nyquist / minFrequency);
+    const int numColumns = juce::jmax (2, (int) area.getWidth());
+
+    juce::Path path;
+    path.preallocateSpace (numColumns * 3);
+
+    for (int column = 0; column < numColumns; ++column)
+    {
+        const float lowFrequency = minFrequency * std::exp (logRange * (float) column / (float) numColumns);
+        const float highFrequency = minFrequency * std::exp (logRange * (float) (column + 1) / (float) numColumns);
+        const int lowBin = juce::jlimit (1, fftSize / 2 - 1, (int) (lowFrequency / binWidth));
+        const int highBin = juce::jlimit (lowBin + 1, fftSize / 2, (int) (highFrequency / binWidth) + 1);
+
+        // Peak over the bins a column covers, so narrow tones don't vanish at high frequencies
+        const float magnitude = *std::max_element (fftData.begin() + lowBin, fftData.begin() + highBin);
+        const float decibels = juce::jmax (minDecibels, juce::Decibels::gainToDecibels (magnitude, minDecibels));
+
+        const float x = area.getX() + (float) column;
+        const float y = area.getY() + area.getHeight() * (decibels / minDecibels);
+
+        if (column == 0)
+            path.startNewSubPath (x, y);
+        else
+            path.lineTo (x, y);
+    }
+
+    return path;
+}
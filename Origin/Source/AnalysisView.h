@@ -0,0 +1,52 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include <memory>
+#include <vector>
+
+struct AnalysisFFT;
+
+// Scope (left) and spectrum (right) of the processor's first channel,
+// input in grey and output in green.
+//
+// Everything here runs on the message thread. A timer capped at
+// frameRate drains the processor's AnalysisFifos; only when new audio has
+// arrived are the FFT and paths computed and drawn into a cached image,
+// so paint() is a single image blit and a stopped transport costs nothing.
+// The FFT plan is shared by every open editor through SharedResources.
+class AnalysisView  : public juce::Component, private juce::Timer
+{
+public:
+    explicit AnalysisView (OriginAudioProcessor&);
+    ~AnalysisView() override;
+
+    void paint (juce::Graphics&) override;
+    void resized() override;
+
+    static constexpr int fftOrder = 11;
+    static constexpr int fftSize = 1 << fftOrder;
+    static constexpr int scopeSamples = 512; // About 10 ms at 48 kHz
+    static constexpr int frameRate = 30;
+
+private:
+    OriginAudioProcessor& audioProcessor;
+    std::shared_ptr<const AnalysisFFT> fft;
+
+    // The last fftSize samples of each signal, oldest first
+    std::vector<float> inputHistory, outputHistory;
+    std::vector<float> popBuffer, fftData, window;
+
+    juce::Image cachedImage;
+    bool hasNewAudio = false;
+
+    void timerCallback() override;
+    void render();
+    void drawScope (juce::Graphics&, juce::Rectangle<float> area);
+    void drawSpectrum (juce::Graphics&, juce::Rectangle<float> area);
+    juce::Path makeSpectrumPath (const std::vector<float>& history, juce::Rectangle<float> area);
+
+    static void appendToHistory (std::vector<float>& history, const float* samples, int numSamples);
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AnalysisView)
+};
@@ -0,0 +1,154 @@
+#include "ChannelWorkerPool.h"
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+    // Helpers spin briefly after a job in case the next block arrives
+    // quickly, then sleep until run() wakes them, so an idle pool costs no
+    // CPU at all
+    constexpr int spinIterationsBeforeSleep = 256;
+}
+
+class ChannelWorkerPool::Helper : public juce::Thread
+{
+public:
+    explicit Helper(ChannelWorkerPool& owner)
+        : juce::Thread("Origin channel worker"), pool(owner) {}
+
+    void run() override { pool.workerLoop(*this); }
+
+private:
+    ChannelWorkerPool& pool;
+};
+
+ChannelWorkerPool::ChannelWorkerPool(int numWorkers, Priority priority)
+{
+    workers.reserve(static_cast<size_t>(std::max(numWorkers, 0)));
+    for (int i = 0; i < numWorkers; ++i)
+    {
+        workers.push_back(std::make_unique<Helper>(*this));
+
+        // An audio thread waits on its helpers, so they need the priority
+        // it has; where that is not allowed (Linux without rtprio) the
+        // highest normal one is the next best thing
+        auto& helper = *workers.back();
+        if (priority == Priority::Normal)
+            helper.startThread(juce::Thread::Priority::normal);
+        else if (!helper.startRealtimeThread(juce::Thread::RealtimeOptions().withPriority(10)))
+            helper.startThread(juce::Thread::Priority::highest);
+    }
+}
+
+ChannelWorkerPool::~ChannelWorkerPool()
+{
+    for (auto& worker : workers)
+        worker->signalThreadShouldExit();
+
+    // stopThread() wakes a sleeping helper and waits for it to leave
+    for (auto& worker : workers)
+        worker->stopThread(-1);
+}
+
+std::shared_ptr<ChannelWorkerPool> ChannelWorkerPool::getShared()
+{
+    static std::mutex mutex;
+    static std::weak_ptr<ChannelWorkerPool> shared;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto pool = shared.lock();
+    if (pool == nullptr)
+    {
+        pool = std::make_shared<ChannelWorkerPool>(juce::jlimit(0, maxSharedWorkers, juce::SystemStats::getNumCpus() - 1),
+                                                   Priority::Realtime);
+        shared = pool;
+    }
+
+    return pool;
+}
+
+void ChannelWorkerPool::run(int numJobs, JobFunction function, void* context)
+{
+    if (numJobs <= 0)
+        return;
+
+    // Another instance's block has the helpers, so this one runs alone
+    if (workers.empty() || numJobs == 1 || busy.exchange(true, std::memory_order_acquire))
+    {
+        for (int i = 0; i < numJobs; ++i)
+            function(context, i);
+        return;
+    }
+
+    // A helper that was still scanning the previous job must leave before
+    // the job description can be rewritten
+    while (activeHelpers.load() != 0)
+        std::this_thread::yield();
+
+    jobFunction = function;
+    jobContext = context;
+    jobCount = numJobs;
+    nextJob.store(0);
+    jobsFinished.store(0);
+
+    jobOpen.store(true);
+    generation.fetch_add(1);
+
+    // The calling thread takes one index itself. A helper's wake-up stays
+    // pending if it is still spinning, so none is lost.
+    const int numToWake = std::min(numJobs - 1, getNumWorkers());
+    for (int i = 0; i < numToWake; ++i)
+        workers[(size_t) i]->notify();
+
+    drainJobs();
+
+    // Late helpers must not start on a job that is about to be retired
+    jobOpen.store(false);
+
+    while (jobsFinished.load() < numJobs)
+        std::this_thread::yield();
+
+    busy.store(false, std::memory_order_release);
+}
+
+void ChannelWorkerPool::drainJobs()
+{
+    for (;;)
+    {
+        int index = nextJob.fetch_add(1);
+        if (index >= jobCount)
+            break;
+
+        jobFunction(jobContext, index);
+        jobsFinished.fetch_add(1);
+    }
+}
+
+void ChannelWorkerPool::workerLoop(Helper& helper)
+{
+    // Flush-to-zero is per thread, so helpers need their own guard
+    juce::ScopedNoDenormals noDenormals;
+    unsigned int lastGeneration = generation.load();
+
+    while (!helper.threadShouldExit())
+    {
+        for (int spin = 0; spin < spinIterationsBeforeSleep && generation.load() == lastGeneration; ++spin)
+            std::this_thread::yield();
+
+        if (generation.load() == lastGeneration)
+        {
+            helper.wait(-1);
+            continue;
+        }
+
+        // Register before looking at the job so run() cannot rewrite it underneath us
+        activeHelpers.fetch_add(1);
+        lastGeneration = generation.load();
+
+        if (jobOpen.load() && !helper.threadShouldExit())
+            drainJobs();
+
+        activeHelpers.fetch_sub(1);
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Small fixed-size pool of helper threads used to process independent
+// channels of one block concurrently.
+//
+// Helpers working for an audio thread run at real-time priority, so one that
+// is preempted in the middle of a channel is back as soon as the audio
+// thread would be. Pools for offline work use normal priority instead, so a
+// long render leaves the rest of the machine responsive. The audio thread never allocates: it publishes a job, wakes as many
+// helpers as the job can use, works on it alongside them and spins until
+// every claimed index has finished. Helpers that wake up late simply find
+// nothing left to do, so correctness never depends on how quickly they are
+// scheduled.
+//
+// Plugin instances share one pool, see getShared(). Only one job runs at a
+// time; an audio thread that finds the pool busy with another instance's
+// block processes its own indices itself, which is what a host running
+// tracks on several threads has the cores for anyway.
+class ChannelWorkerPool
+{
+public:
+    enum class Priority
+    {
+        Realtime, // Helpers for an audio thread
+        Normal    // Helpers for offline rendering
+    };
+
+    ChannelWorkerPool(int numWorkers, Priority priority);
+    ~ChannelWorkerPool();
+
+    // The process-wide pool, created on first use with a helper for each
+    // spare core (up to maxSharedWorkers) and destroyed with its last user.
+    // Message thread; creating and joining threads is not for the audio thread.
+    static std::shared_ptr<ChannelWorkerPool> getShared();
+    static constexpr int maxSharedWorkers = 3;
+
+    int getNumWorkers() const { return static_cast<int>(workers.size()); }
+
+    // Calls function(index) exactly once for every index in [0, numJobs)
+    // and returns when all of them have completed.
+    template <typename Function>
+    void parallelFor(int numJobs, Function& function)
+    {
+        run(numJobs, [](void* context, int index) { (*static_cast<Function*>(context))(index); }, &function);
+    }
+
+private:
+    using JobFunction = void (*)(void* context, int index);
+    class Helper;
+
+    void run(int numJobs, JobFunction function, void* context);
+    void workerLoop(Helper& helper);
+    void drainJobs();
+
+    std::vector<std::unique_ptr<Helper>> workers;
+
+    // Job description, only rewritten while no helper is inside drainJobs()
+    JobFunction jobFunction = nullptr;
+    void* jobContext = nullptr;
+    int jobCount = 0;
+
+    std::atomic<int> nextJob { 0 };
+    std::atomic<int> jobsFinished { 0 };
+    std::atomic<int> activeHelpers { 0 };
+    std::atomic<bool> jobOpen { false };
+    std::atomic<bool> busy { false }; // Some thread is inside run() with the helpers
+    std::atomic<unsigned int> generation { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE (ChannelWorkerPool)
+};
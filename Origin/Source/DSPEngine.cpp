@@ -1,216 +1,1450 @@
-#include "DSPEngine.h"
-#include <cmath>
-#include <algorithm>
-#include <memory>
-
-// DelayLine Implementation
-DelayLine::DelayLine(int maxDelay) : maxDelaySize(maxDelay)
-{
-    buffer.resize(maxDelaySize, 0.0f);
-}
-
-void DelayLine::setMaxDelay(int samples)
-{
-    maxDelaySize = samples;
-    buffer.resize(maxDelaySize, 0.0f);
-    writeIndex = 0;
-}
-
-float DelayLine::process(float input, int delaySamples)
-{
-    // Clamp delay to valid range
-    delaySamples = std::clamp(delaySamples, 0, maxDelaySize - 1);
-    
-    // Calculate read index
-    int readIndex = writeIndex - delaySamples;
-    if (readIndex < 0)
-        readIndex += maxDelaySize;
-    
-    // Get delayed sample
-    float output = buffer[readIndex];
-    
-    // Store new input
-    buffer[writeIndex] = input;
-    
-    // Advance write index
-    writeIndex = (writeIndex + 1) % maxDelaySize;
-    
-    return output;
-}
-
-void DelayLine::clear()
-{
-    std::fill(buffer.begin(), buffer.end(), 0.0f);
-    writeIndex = 0;
-}
-
-// DSPEngine Implementation
-DSPEngine::DSPEngine()
-{
-    parser = std::make_unique<MatlabParser>();
-    
-    // Initialize common variables
-    variables["pi"] = static_cast<float>(M_PI);
-    variables["e"] = static_cast<float>(M_E);
-    variables["x"] = 0.0f; // Current input sample
-}
-
-DSPEngine::~DSPEngine() = default;
-
-void DSPEngine::setSampleRate(double sr)
-{
-    sampleRate = sr;
-    variables["fs"] = static_cast<float>(sr);
-    variables["Fs"] = static_cast<float>(sr); // MATLAB convention
-}
-
-void DSPEngine::setEquation(const std::string& equation)
-{
-    errorMessage.clear();
-    equationValid = false;
-    
-    if (parser->parseEquation(equation))
-    {
-        // For now, we'll store the equation string and re-parse as needed
-        // In a full implementation, we'd store the AST properly
-        equationValid = true;
-    }
-    else
-    {
-        errorMessage = parser->getErrorMessage();
-    }
-}
-
-float DSPEngine::processSample(float input)
-{
-    if (!equationValid)
-        return input; // Pass through if no valid equation
-    
-    variables["x"] = input; // Set current input
-    
-    // For this basic version, implement simple equation processing
-    // In a full implementation, we'd evaluate the stored AST
-    return input * 0.5f; // Simple example: half volume
-}
-
-void DSPEngine::reset()
-{
-    // Clear all delay lines
-    for (auto& pair : delayLines)
-    {
-        pair.second->clear();
-    }
-    
-    // Reset input variable
-    variables["x"] = 0.0f;
-}
-
-void DSPEngine::setVariable(const std::string& name, float value)
-{
-    variables[name] = value;
-}
-
-float DSPEngine::getVariable(const std::string& name) const
-{
-    auto it = variables.find(name);
-    if (it != variables.end())
-        return it->second;
-    return 0.0f;
-}
-
-float DSPEngine::evaluateNode(const MatlabParser::ASTNode* node, float currentInput)
-{
-    if (!node) return 0.0f;
-    
-    switch (node->type)
-    {
-        case MatlabParser::ASTNode::Type::Number:
-            return static_cast<float>(node->numericValue);
-            
-        case MatlabParser::ASTNode::Type::Variable:
-        {
-            auto it = variables.find(node->value);
-            if (it != variables.end())
-                return it->second;
-            return 0.0f; // Unknown variable defaults to 0
-        }
-        
-        case MatlabParser::ASTNode::Type::Delay:
-        {
-            DelayLine* delayLine = getDelayLine(node->delayAmount);
-            return delayLine->process(currentInput, node->delayAmount);
-        }
-        
-        case MatlabParser::ASTNode::Type::BinaryOp:
-        {
-            if (node->children.size() != 2) return 0.0f;
-            float left = evaluateNode(node->children[0].get(), currentInput);
-            float right = evaluateNode(node->children[1].get(), currentInput);
-            return evaluateBinaryOp(node->value, left, right);
-        }
-        
-        case MatlabParser::ASTNode::Type::Function:
-        {
-            std::vector<float> args;
-            for (const auto& child : node->children)
-            {
-                args.push_back(evaluateNode(child.get(), currentInput));
-            }
-            return evaluateFunction(node->value, args);
-        }
-        
-        default:
-            return 0.0f;
-    }
-}
-
-float DSPEngine::evaluateFunction(const std::string& name, const std::vector<float>& args)
-{
-    if (args.empty()) return 0.0f;
-    
-    float arg0 = args[0];
-    
-    if (name == "sin") return std::sin(arg0);
-    if (name == "cos") return std::cos(arg0);
-    if (name == "tan") return std::tan(arg0);
-    if (name == "exp") return std::exp(arg0);
-    if (name == "log") return std::log(arg0);
-    if (name == "log10") return std::log10(arg0);
-    if (name == "sqrt") return std::sqrt(arg0);
-    if (name == "abs") return std::abs(arg0);
-    
-    // More complex functions would require additional implementation
-    if (name == "filter" && args.size() >= 2)
-    {
-        // Basic first-order filter: y = a*x + b*x_prev
-        // This is a simplified version - real filter would need coefficients
-        return arg0 * 0.5f + args[1] * 0.5f;
-    }
-    
-    return 0.0f; // Unknown function
-}
-
-float DSPEngine::evaluateBinaryOp(const std::string& op, float left, float right)
-{
-    if (op == "+") return left + right;
-    if (op == "-") return left - right;
-    if (op == "*") return left * right;
-    if (op == "/") return (right != 0.0f) ? left / right : 0.0f;
-    if (op == "^") return std::pow(left, right);
-    
-    return 0.0f; // Unknown operator
-}
-
-DelayLine* DSPEngine::getDelayLine(int delayAmount)
-{
-    auto it = delayLines.find(delayAmount);
-    if (it == delayLines.end())
-    {
-        // Create new delay line for this delay amount
-        auto delayLine = std::make_unique<DelayLine>(std::max(delayAmount + 1, 1024));
-        DelayLine* ptr = delayLine.get();
-        delayLines[delayAmount] = std::move(delayLine);
-        return ptr;
-    }
-    return it->second.get();
-}
\ No newline at end of file
+#include "DSPEngine.h"
+#include "EquationCache.h"
+#include "EquationNoise.h"
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace
+{
+    // Gathers from the ring only vectorise once the compiler knows the
+    // buffers can't overlap, hence the restrict-qualified helpers. The
+    // min/max order also maps NaN delays onto the minimum.
+    template <typename SampleType>
+    void readTruncated(const SampleType* __restrict data, int mask, int start, const SampleType* __restrict delays,
+                       SampleType* __restrict output, int numSamples, SampleType minDelay, SampleType maxDelay)
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            int whole = static_cast<int>(std::min(maxDelay, std::max(minDelay, delays[i])));
+            output[i] = data[(start + i - whole) & mask];
+        }
+    }
+    
+    template <typename SampleType>
+    void readLinear(const SampleType* __restrict data, int mask, int start, const SampleType* __restrict delays,
+                    SampleType* __restrict output, int numSamples, SampleType minDelay, SampleType maxDelay)
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            SampleType delay = std::min(maxDelay, std::max(minDelay, delays[i]));
+            int whole = static_cast<int>(delay);
+            SampleType frac = delay - static_cast<SampleType>(whole);
+            int index = start + i - whole;
+            SampleType a = data[index & mask];
+            SampleType b = data[(index - 1) & mask];
+            output[i] = a + frac * (b - a);
+        }
+    }
+    
+    template <typename SampleType>
+    void readLagrange3rd(const SampleType* __restrict data, int mask, int start, const SampleType* __restrict delays,
+                         SampleType* __restrict output, int numSamples, SampleType minDelay, SampleType maxDelay)
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            SampleType delay = std::min(maxDelay, std::max(minDelay, delays[i]));
+            int whole = static_cast<int>(delay) - 1;
+            SampleType frac = delay - static_cast<SampleType>(whole);
+            int index = start + i - whole;
+            SampleType v1 = data[index & mask];
+            SampleType v2 = data[(index - 1) & mask];
+            SampleType v3 = data[(index - 2) & mask];
+            SampleType v4 = data[(index - 3) & mask];
+            SampleType d1 = frac - SampleType(1.0), d2 = frac - SampleType(2.0), d3 = frac - SampleType(3.0);
+            output[i] = v1 * (-d1 * d2 * d3 / SampleType(6.0))
+                      + frac * (v2 * (d2 * d3 * SampleType(0.5)) + v3 * (-d1 * d3 * SampleType(0.5)) + v4 * (d1 * d2 / SampleType(6.0)));
+        }
+    }
+    
+    template <typename SampleType>
+    void lookupLinear(const float* __restrict values, int lastSegment, SampleType inputMin, SampleType inputMax, SampleType scale,
+                      const SampleType* __restrict input, SampleType* __restrict output, int numSamples)
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            SampleType clamped = std::max(inputMin, std::min(inputMax, input[i]));
+            SampleType position = (clamped - inputMin) * scale;
+            int index = std::min(static_cast<int>(position), lastSegment);
+            SampleType frac = position - static_cast<SampleType>(index);
+            output[i] = values[index] + frac * (values[index + 1] - values[index]);
+        }
+    }
+    
+    // Engines made one after another still get unrelated noise
+    std::uint32_t makeInstanceSeed()
+    {
+        static std::atomic<std::uint32_t> numEngines { 0 };
+        return EquationNoise::hash(numEngines.fetch_add(1, std::memory_order_relaxed));
+    }
+}
+
+// DelayLine Implementation
+template <typename SampleType>
+DelayLine<SampleType>::DelayLine(int maxDelay) : maxDelaySize(maxDelay)
+{
+    setMaxDelay(maxDelay);
+}
+
+template <typename SampleType>
+void DelayLine<SampleType>::setMaxDelay(int samples, int maxBlockSize)
+{
+    maxDelaySize = std::max(samples, 1);
+    
+    // Room for the longest delay, one block written ahead of the reads and
+    // the extra points the Lagrange interpolator looks at
+    int required = maxDelaySize + std::max(maxBlockSize, 1) + 4;
+    int size = 1;
+    while (size < required)
+        size <<= 1;
+    
+    buffer.assign(static_cast<size_t>(size), SampleType(0));
+    mask = size - 1;
+    writeIndex = 0;
+}
+
+template <typename SampleType>
+SampleType DelayLine<SampleType>::getMinimumDelay() const
+{
+    // Lagrange and Thiran need one newer sample than the point they read
+    return (interpolation == Interpolation::Lagrange3rd || interpolation == Interpolation::Thiran) ? SampleType(1.0) : SampleType(0.0);
+}
+
+template <typename SampleType>
+void DelayLine<SampleType>::write(SampleType input)
+{
+    buffer[static_cast<size_t>(writeIndex)] = input;
+    writeIndex = (writeIndex + 1) & mask;
+}
+
+template <typename SampleType>
+void DelayLine<SampleType>::writeBlock(const SampleType* input, int numSamples)
+{
+    for (int i = 0; i < numSamples; ++i)
+        buffer[static_cast<size_t>((writeIndex + i) & mask)] = input[i];
+    
+    writeIndex = (writeIndex + numSamples) & mask;
+}
+
+template <typename SampleType>
+SampleType DelayLine<SampleType>::read(int delaySamples, int samplesAhead) const
+{
+    delaySamples = std::clamp(delaySamples, 0, maxDelaySize);
+    return buffer[static_cast<size_t>((writeIndex - 1 - samplesAhead - delaySamples) & mask)];
+}
+
+template <typename SampleType>
+SampleType DelayLine<SampleType>::read(SampleType delaySamples, AllpassState& state, int samplesAhead) const
+{
+    SampleType delay = std::clamp(delaySamples, getMinimumDelay(), static_cast<SampleType>(maxDelaySize));
+    int newest = writeIndex - 1 - samplesAhead;
+    
+    switch (interpolation)
+    {
+        case Interpolation::None:
+            return buffer[static_cast<size_t>((newest - static_cast<int>(delay)) & mask)];
+            
+        case Interpolation::Linear:
+        {
+            int whole = static_cast<int>(delay);
+            SampleType frac = delay - static_cast<SampleType>(whole);
+            SampleType a = buffer[static_cast<size_t>((newest - whole) & mask)];
+            SampleType b = buffer[static_cast<size_t>((newest - whole - 1) & mask)];
+            return a + frac * (b - a);
+        }
+        
+        case Interpolation::Lagrange3rd:
+        {
+            // Points at delays whole .. whole+3 with frac in [1, 2) sits in the middle span
+            int whole = static_cast<int>(delay) - 1;
+            SampleType frac = delay - static_cast<SampleType>(whole);
+            SampleType v1 = buffer[static_cast<size_t>((newest - whole) & mask)];
+            SampleType v2 = buffer[static_cast<size_t>((newest - whole - 1) & mask)];
+            SampleType v3 = buffer[static_cast<size_t>((newest - whole - 2) & mask)];
+            SampleType v4 = buffer[static_cast<size_t>((newest - whole - 3) & mask)];
+            SampleType d1 = frac - SampleType(1.0), d2 = frac - SampleType(2.0), d3 = frac - SampleType(3.0);
+            return v1 * (-d1 * d2 * d3 / SampleType(6.0))
+                 + frac * (v2 * (d2 * d3 * SampleType(0.5)) + v3 * (-d1 * d3 * SampleType(0.5)) + v4 * (d1 * d2 / SampleType(6.0)));
+        }
+        
+        case Interpolation::Thiran:
+        {
+            int whole = static_cast<int>(delay);
+            SampleType frac = delay - static_cast<SampleType>(whole);
+            if (frac < SampleType(0.618) && whole >= 1)
+            {
+                // Keep the allpass coefficient away from the poorly-behaved region near 0
+                frac += SampleType(1.0);
+                --whole;
+            }
+            SampleType alpha = (SampleType(1.0) - frac) / (SampleType(1.0) + frac);
+            SampleType v1 = buffer[static_cast<size_t>((newest - whole) & mask)];
+            SampleType v2 = buffer[static_cast<size_t>((newest - whole - 1) & mask)];
+            SampleType output = v2 + alpha * (v1 - state.previousOutput);
+            state.previousOutput = output;
+            return output;
+        }
+    }
+    
+    return SampleType(0.0);
+}
+
+template <typename SampleType>
+void DelayLine<SampleType>::readBlock(int delaySamples, SampleType* output, int numSamples) const
+{
+    delaySamples = std::clamp(delaySamples, 0, maxDelaySize);
+    int start = writeIndex - numSamples - delaySamples;
+    
+    for (int i = 0; i < numSamples; ++i)
+        output[i] = buffer[static_cast<size_t>((start + i) & mask)];
+}
+
+template <typename SampleType>
+const SampleType* DelayLine<SampleType>::getBlock(int delaySamples, SampleType* scratch, int numSamples) const
+{
+    delaySamples = std::clamp(delaySamples, 0, maxDelaySize);
+    int start = (writeIndex - numSamples - delaySamples) & mask;
+    
+    if (start + numSamples <= static_cast<int>(buffer.size()))
+        return buffer.data() + start;
+    
+    readBlock(delaySamples, scratch, numSamples);
+    return scratch;
+}
+
+template <typename SampleType>
+void DelayLine<SampleType>::readBlock(const SampleType* delays, SampleType* output, int numSamples, AllpassState& state) const
+{
+    const SampleType minDelay = getMinimumDelay();
+    const SampleType maxDelay = static_cast<SampleType>(maxDelaySize);
+    const int start = writeIndex - numSamples; // Position of input[0] of the block
+    const SampleType* data = buffer.data();
+    
+    // The stateless interpolators are straight loops with no branches so
+    // the compiler can vectorise them (gathers on AVX2)
+    switch (interpolation)
+    {
+        case Interpolation::None:
+            readTruncated(data, mask, start, delays, output, numSamples, minDelay, maxDelay);
+            break;
+            
+        case Interpolation::Linear:
+            readLinear(data, mask, start, delays, output, numSamples, minDelay, maxDelay);
+            break;
+            
+        case Interpolation::Lagrange3rd:
+            readLagrange3rd(data, mask, start, delays, output, numSamples, minDelay, maxDelay);
+            break;
+            
+        case Interpolation::Thiran:
+        {
+            // Recursive, so this one stays scalar
+            SampleType previous = state.previousOutput;
+            for (int i = 0; i < numSamples; ++i)
+            {
+                SampleType delay = std::min(maxDelay, std::max(minDelay, delays[i]));
+                int whole = static_cast<int>(delay);
+                SampleType frac = delay - static_cast<SampleType>(whole);
+                if (frac < SampleType(0.618) && whole >= 1)
+                {
+                    frac += SampleType(1.0);
+                    --whole;
+                }
+                SampleType alpha = (SampleType(1.0) - frac) / (SampleType(1.0) + frac);
+                int index = start + i - whole;
+                SampleType v1 = data[index & mask];
+                SampleType v2 = data[(index - 1) & mask];
+                previous = v2 + alpha * (v1 - previous);
+                output[i] = previous;
+            }
+            state.previousOutput = previous;
+            break;
+        }
+    }
+}
+
+template <typename SampleType>
+void DelayLine<SampleType>::clear()
+{
+    std::fill(buffer.begin(), buffer.end(), SampleType(0.0));
+    writeIndex = 0;
+}
+
+// DSPEngine Implementation
+template <typename SampleType>
+DSPEngine<SampleType>::DSPEngine()
+    : noiseSeed(makeInstanceSeed())
+{
+    // Initialize common variables
+    variables["pi"] = M_PI;
+    variables["e"] = M_E;
+    variables["x"] = 0.0; // Current input sample
+}
+
+template <typename SampleType>
+DSPEngine<SampleType>::~DSPEngine() = default;
+
+template <typename SampleType>
+void DSPEngine<SampleType>::prepare(double sr, int newMaxBlockSize)
+{
+    sampleRate = sr;
+    maxBlockSize = std::max(newMaxBlockSize, 1);
+    variables["fs"] = sr;
+    variables["Fs"] = sr; // MATLAB convention
+    
+    prepareProgram();
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::setSampleRate(double sr)
+{
+    prepare(sr, maxBlockSize);
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::setEquation(const std::string& equation)
+{
+    errorMessage.clear();
+    equationValid = false;
+    program.reset();
+    equationText = equation;
+    
+    // Every other engine running this equation shares the same program
+    program = EquationCache::getInstance().getOrCompile(equation, compilerOptions, errorMessage);
+    equationValid = program != nullptr;
+    
+    prepareProgram();
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::setCompilerOptions(const EquationCompiler::Options& options)
+{
+    compilerOptions = options;
+    
+    if (!equationText.empty())
+        setEquation(equationText);
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::setEquation(const std::string& equation, const EquationCompiler::Options& options)
+{
+    compilerOptions = options;
+    setEquation(equation);
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::setDelayInterpolation(DelayInterpolation interpolation)
+{
+    inputHistory.setInterpolation(interpolation);
+    std::fill(tapStates.begin(), tapStates.end(), typename DelayLine<SampleType>::AllpassState());
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::prepareProgram()
+{
+    // All allocation happens here, never on the audio thread
+    registerData.clear();
+    blockRateInstructions.clear();
+    controlRateInstructions.clear();
+    blockwiseInstructions.clear();
+    perSampleInstructions.clear();
+    scalarValues.clear();
+    expandedBlockRegisters.clear();
+    expandedControlRegisters.clear();
+    controlPoints.clear();
+    wetInstructions.clear();
+    kernelScratch.clear();
+    feedbackScratch.clear();
+    lookAheadA1 = lookAheadA2 = std::numeric_limits<SampleType>::quiet_NaN();
+    kernelFunction = nullptr;
+    complexity = 0;
+    tapStates.clear();
+    variableValues.clear();
+    noiseKeys.clear();
+    phases.clear();
+    windowStates.clear();
+    tailSamples = std::numeric_limits<double>::infinity();
+    bypassed = false;
+    
+    int maxDelay = 1;
+    
+    if (program != nullptr)
+    {
+        maxDelay = std::max(program->maxDelay, 1);
+        if (program->hasModulatedDelay)
+            maxDelay = std::max(maxDelay, static_cast<int>(std::ceil(maxModulatedDelaySeconds * sampleRate)));
+        
+        registerData.assign((size_t) program->getNumRegisters() * (size_t) maxBlockSize, SampleType(0));
+        tapStates.resize((size_t) program->numDelayTaps);
+        
+        for (const auto& name : program->variableNames)
+            variableValues.push_back(static_cast<SampleType>(getVariable(name)));
+        
+        const int numRegisters = program->getNumRegisters();
+        scalarValues.assign((size_t) numRegisters, SampleType(0));
+        
+        // Slower values only need a full register when audio rate code reads them
+        std::vector<bool> readAtAudioRate((size_t) numRegisters, false);
+        readAtAudioRate[(size_t) program->outputRegister] = true;
+        for (const auto& instruction : program->instructions)
+        {
+            // An oscillator works its phase out itself, see evaluatePhase()
+            if (instruction.rate != Rate::Audio || instruction.op == OpCode::Oscillator)
+                continue;
+            if (instruction.a >= 0) readAtAudioRate[(size_t) instruction.a] = true;
+            if (instruction.b >= 0) readAtAudioRate[(size_t) instruction.b] = true;
+        }
+        
+        for (int i = 0; i < numRegisters; ++i)
+        {
+            const auto& instruction = program->instructions[(size_t) i];
+            const bool expand = readAtAudioRate[(size_t) i];
+            
+            switch (instruction.rate)
+            {
+                case Rate::Constant:
+                    scalarValues[(size_t) i] = static_cast<SampleType>(instruction.constant);
+                    std::fill_n(getRegister(i), maxBlockSize, scalarValues[(size_t) i]);
+                    break;
+                    
+                case Rate::Block:
+                    blockRateInstructions.push_back(i);
+                    if (expand)
+                        expandedBlockRegisters.push_back(i);
+                    break;
+                    
+                case Rate::Control:
+                    controlRateInstructions.push_back(i);
+                    
+                    // t itself is cheap to compute exactly
+                    if (expand && instruction.op == OpCode::Time)
+                        blockwiseInstructions.push_back(i);
+                    else if (expand)
+                        expandedControlRegisters.push_back(i);
+                    break;
+                    
+                case Rate::Audio:
+                    if (instruction.perSample)
+                        perSampleInstructions.push_back(i);
+                    else
+                        blockwiseInstructions.push_back(i);
+                    break;
+            }
+        }
+        
+        for (const auto& instruction : program->instructions)
+        {
+            if (instruction.op == OpCode::Rand || instruction.op == OpCode::Randn)
+            {
+                noiseKeys.assign((size_t) numRegisters, 0);
+                updateNoiseKeys();
+                break;
+            }
+        }
+        
+        for (const auto& instruction : program->instructions)
+        {
+            if (instruction.op == OpCode::Oscillator)
+            {
+                phases.assign((size_t) numRegisters, {});
+                break;
+            }
+        }
+        
+        windowStates.resize(program->windows.size());
+        for (const auto& instruction : program->instructions)
+        {
+            if (!CompiledEquation::isWindow(instruction.op))
+                continue;
+            
+            const auto& window = program->windows[(size_t) instruction.slot];
+            auto& state = windowStates[(size_t) instruction.slot];
+            
+            if (instruction.op == OpCode::MovingMean || instruction.op == OpCode::MovingRms)
+                state.sum.setLength(window.length);
+            else if (instruction.op == OpCode::MovingMax || instruction.op == OpCode::MovingMin)
+                state.extreme.setLength(window.length);
+            
+            state.attack = EquationWindows::smoothingCoefficient(window.attack, sampleRate);
+            state.release = EquationWindows::smoothingCoefficient(window.release, sampleRate);
+        }
+        
+        controlPointsPerBlock = maxBlockSize / program->controlInterval + 2;
+        controlPoints.assign(expandedControlRegisters.size() * (size_t) controlPointsPerBlock, SampleType(0));
+        
+        complexity = static_cast<int>(blockwiseInstructions.size() + perSampleInstructions.size());
+        selectKernel();
+        
+        const auto& kernel = program->kernel;
+        bypassed = kernel.shape == CompiledEquation::KernelShape::Gain
+                && kernel.tapCoefficients[0].reg < 0 && kernel.tapCoefficients[0].scale == 1.0;
+    }
+    
+    inputHistory.setMaxDelay(maxDelay, maxBlockSize);
+    updateActiveProfiler();
+    reset();
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::setNoiseSeed(std::uint32_t seed)
+{
+    noiseSeed = seed;
+    updateNoiseKeys();
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::updateNoiseKeys()
+{
+    if (program == nullptr || noiseKeys.empty())
+        return;
+    
+    for (int i = 0; i < program->getNumRegisters(); ++i)
+    {
+        const auto& instruction = program->instructions[(size_t) i];
+        if (instruction.op != OpCode::Rand && instruction.op != OpCode::Randn)
+            continue;
+        
+        // rand(n) and randn(n) are the same everywhere, but not the same as each other
+        if (std::isnan(instruction.constant))
+            noiseKeys[(size_t) i] = EquationNoise::makeKey(EquationNoise::hash(noiseSeed), static_cast<std::uint32_t>(instruction.slot));
+        else
+            noiseKeys[(size_t) i] = EquationNoise::makeKey(static_cast<std::uint32_t>(instruction.constant),
+                                                           instruction.op == OpCode::Randn ? 1u : 0u);
+    }
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::setProfiler(std::shared_ptr<EquationProfiler> newProfiler)
+{
+    profiler = std::move(newProfiler);
+    updateActiveProfiler();
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::updateActiveProfiler()
+{
+    // A profiler for another program would put the cycles against the wrong text
+    const bool matches = profiler != nullptr && program != nullptr && profiler->getProgram() == program.get();
+    activeProfiler = matches ? profiler.get() : nullptr;
+    profileCycles.assign(matches ? (size_t) profiler->getNumEntries() : 0, 0);
+    timerOverhead = matches ? profiler->getTimerOverhead() : 0;
+    blocksUntilProfiled = 0;
+}
+
+template <typename SampleType>
+SampleType DSPEngine<SampleType>::processSample(SampleType input)
+{
+    processBlock(&input, 1);
+    return input;
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::processBlock(SampleType* samples, int numSamples)
+{
+    if (!equationValid || program == nullptr || bypassed)
+        return; // Pass through if no valid equation, or nothing to do
+    
+    lastGuardAction = GuardAction::None;
+    
+    // The input has to be looked at before it is overwritten
+    const bool skipping = std::isfinite(tailSamples);
+    const bool silentInput = skipping && isSilent(samples, numSamples);
+    
+    if (skipping && !silentInput)
+    {
+        wake();
+        silentSamples = 0.0;
+    }
+    else if (asleep)
+    {
+        // Time keeps running so LFOs are where they should be on waking
+        std::fill_n(samples, numSamples, SampleType(0));
+        samplePosition += numSamples;
+        return;
+    }
+    
+    // Hosts may send more than they announced in prepareToPlay
+    for (int start = 0; start < numSamples; start += maxBlockSize)
+    {
+        const int count = std::min(maxBlockSize, numSamples - start);
+        
+        if (activeProfiler != nullptr && --blocksUntilProfiled <= 0)
+        {
+            blocksUntilProfiled = EquationProfiler::sampleInterval;
+            processChunk<true>(samples + start, count);
+        }
+        else
+        {
+            processChunk<false>(samples + start, count);
+        }
+        
+        if (guardEnabled)
+            guardChunk(samples + start, count);
+    }
+    
+    if (silentInput)
+    {
+        silentSamples += numSamples;
+        
+        // Checking the output as well covers equations whose measured
+        // tail was too short for some input
+        if (silentSamples > tailSamples && isSilent(samples, numSamples))
+        {
+            clearState();
+            asleep = true;
+        }
+    }
+}
+
+template <typename SampleType>
+bool DSPEngine<SampleType>::isSilent(const SampleType* samples, int numSamples)
+{
+    // Counting keeps this vectorisable, as in guardChunk()
+    const SampleType threshold = SampleType(silenceThreshold);
+    int numLoud = 0;
+    for (int i = 0; i < numSamples; ++i)
+        numLoud += std::abs(samples[i]) <= threshold ? 0 : 1;
+    
+    return numLoud == 0;
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::guardChunk(SampleType* samples, int numSamples)
+{
+    // One branch-free pass over the block. A single comparison catches both
+    // failure modes, since inf is out of range and NaN never compares true;
+    // counting (rather than a float max or sum) keeps it vectorisable
+    // without fast-math.
+    const SampleType limit = SampleType(runawayLevel);
+    int numOutOfRange = 0;
+    for (int i = 0; i < numSamples; ++i)
+        numOutOfRange += std::abs(samples[i]) <= limit ? 0 : 1;
+    
+    if (numOutOfRange > 0)
+    {
+        bool finite = true;
+        for (int i = 0; i < numSamples && finite; ++i)
+            finite = std::isfinite(samples[i]);
+        
+        if (!finite)
+        {
+            std::fill_n(samples, numSamples, SampleType(0));
+            clearState();
+            lastGuardAction = GuardAction::Reset;
+            return;
+        }
+        
+        // Unity up to full scale, then bending towards +6 dBFS
+        auto softClip = [] (SampleType v)
+        {
+            SampleType magnitude = std::abs(v);
+            SampleType over = std::max(magnitude - SampleType(1), SampleType(0));
+            return std::copysign(std::min(magnitude, SampleType(1)) + over / (SampleType(1) + over), v);
+        };
+        
+        for (int i = 0; i < numSamples; ++i)
+            samples[i] = softClip(samples[i]);
+        
+        // Restart the feedback from the clipped values rather than letting it keep growing
+        outputHistory[0] = softClip(outputHistory[0]);
+        outputHistory[1] = softClip(outputHistory[1]);
+        lastGuardAction = std::max(lastGuardAction, GuardAction::SoftClipped);
+    }
+    
+    // A decaying y_prev or Thiran allpass would otherwise end up denormal
+    // and stay there, costing far more per sample than a normal value
+    for (auto& value : outputHistory)
+        if (std::abs(value) < SampleType(denormalThreshold))
+            value = 0;
+    
+    for (auto& state : tapStates)
+        if (std::abs(state.previousOutput) < SampleType(denormalThreshold))
+            state.previousOutput = 0;
+    
+    for (auto& state : windowStates)
+        if (state.envelope < denormalThreshold)
+            state.envelope = 0.0;
+}
+
+template <typename SampleType>
+template <bool Profiled>
+void DSPEngine<SampleType>::processChunk(SampleType* samples, int numSamples)
+{
+    [[maybe_unused]] std::uint64_t chunkStart = 0;
+    if constexpr (Profiled)
+    {
+        std::fill(profileCycles.begin(), profileCycles.end(), 0);
+        numProfileTimings = 0;
+        profileEachSample = !profileEachSample && kernelFunction == nullptr && !perSampleInstructions.empty();
+        chunkStart = EquationProfiler::readCycleCounter();
+    }
+    
+    // The block goes into the history first, so z^-0 reads the current sample
+    inputHistory.writeBlock(samples, numSamples);
+    
+    for (int index : blockRateInstructions)
+        timed<Profiled>(index, [&] { scalarValues[(size_t) index] = evaluateScalar(index, 0.0); });
+    
+    for (int index : expandedBlockRegisters)
+        std::fill_n(getRegister(index), numSamples, scalarValues[(size_t) index]);
+    
+    if (!controlRateInstructions.empty())
+        runControlRate<Profiled>(numSamples);
+    
+    if (kernelFunction != nullptr)
+    {
+        timed<Profiled>(program->getNumRegisters(), [&] { (this->*kernelFunction)(samples, numSamples); });
+    }
+    else
+    {
+        for (int index : blockwiseInstructions)
+            timed<Profiled>(index, [&] { runBlockInstruction(index, samples, numSamples); });
+        
+        const SampleType* output = getRegister(program->outputRegister);
+        
+        if (perSampleInstructions.empty())
+        {
+            std::copy(output, output + numSamples, samples);
+            
+            outputHistory[0] = output[numSamples - 1];
+            outputHistory[1] = numSamples > 1 ? output[numSamples - 2] : outputHistory[0];
+        }
+        else if (Profiled && profileEachSample)
+        {
+            runSampleLoop<true>(samples, numSamples);
+        }
+        else
+        {
+            timed<Profiled>(program->getNumRegisters() + 1, [&] { runSampleLoop<false>(samples, numSamples); });
+        }
+    }
+    
+    samplePosition += numSamples;
+    
+    if constexpr (Profiled)
+    {
+        const auto cycles = EquationProfiler::readCycleCounter() - chunkStart;
+        activeProfiler->addBlock(profileCycles.data(), cycles - std::min(cycles, numProfileTimings * timerOverhead), numSamples,
+                                 profileEachSample);
+    }
+}
+
+template <typename SampleType>
+template <bool Profiled>
+void DSPEngine<SampleType>::runSampleLoop(SampleType* samples, int numSamples)
+{
+    // Feedback: everything else has already run ahead over the block, only
+    // the part that reads y_prev is stepped one sample at a time
+    SampleType* result = getRegister(program->outputRegister);
+    for (int n = 0; n < numSamples; ++n)
+    {
+        for (int index : perSampleInstructions)
+            timed<Profiled>(index, [&] { getRegister(index)[n] = runSampleInstruction(index, n, numSamples); });
+        
+        outputHistory[1] = outputHistory[0];
+        outputHistory[0] = result[n];
+    }
+    std::copy(result, result + numSamples, samples);
+}
+
+template <typename SampleType>
+SampleType DSPEngine<SampleType>::evaluateScalar(int index, double time) const
+{
+    const auto& instruction = program->instructions[(size_t) index];
+    
+    switch (instruction.op)
+    {
+        case OpCode::Constant:
+            return static_cast<SampleType>(instruction.constant);
+            
+        case OpCode::Time:
+            return static_cast<SampleType>(time);
+            
+        case OpCode::Variable:
+            return variableValues[(size_t) instruction.slot];
+            
+        default:
+        {
+            SampleType a = instruction.a >= 0 ? scalarValues[(size_t) instruction.a] : SampleType(0);
+            SampleType b = instruction.b >= 0 ? scalarValues[(size_t) instruction.b] : SampleType(0);
+            return CompiledEquation::apply(instruction.op, a, b);
+        }
+    }
+}
+
+template <typename SampleType>
+std::pair<double, double> DSPEngine<SampleType>::evaluatePhase(int index, double time)
+{
+    // An oscillator's phase is slope * t + offset, with a slope and offset
+    // that only change between blocks. Working value and slope out together
+    // in double, block rate parts included, keeps it accurate at any t; a
+    // float t an hour in moves in steps of a tenth of a 440 Hz cycle.
+    for (int i = 0; i <= index; ++i)
+    {
+        const auto& instruction = program->instructions[(size_t) i];
+        auto& phase = phases[(size_t) i];
+        
+        switch (instruction.rate)
+        {
+            case Rate::Constant: phase = { instruction.constant, 0.0 }; continue;
+            case Rate::Audio:    phase = { 0.0, 0.0 }; continue;
+            default:             break;
+        }
+        
+        if (instruction.op == OpCode::Time)
+        {
+            phase = { time, 1.0 };
+            continue;
+        }
+        
+        if (instruction.op == OpCode::Variable)
+        {
+            phase = { static_cast<double>(variableValues[(size_t) instruction.slot]), 0.0 };
+            continue;
+        }
+        
+        const auto a = instruction.a >= 0 ? phases[(size_t) instruction.a] : std::pair<double, double>();
+        const auto b = instruction.b >= 0 ? phases[(size_t) instruction.b] : std::pair<double, double>();
+        
+        switch (instruction.op)
+        {
+            case OpCode::Negate:   phase = { -a.first, -a.second }; break;
+            case OpCode::Add:      phase = { a.first + b.first, a.second + b.second }; break;
+            case OpCode::Subtract: phase = { a.first - b.first, a.second - b.second }; break;
+            case OpCode::Multiply: phase = { a.first * b.first, a.second * b.first + a.first * b.second }; break;
+            case OpCode::Divide:   phase = b.first != 0.0 ? std::make_pair(a.first / b.first, a.second / b.first) : std::make_pair(0.0, 0.0); break;
+            default:               phase = { CompiledEquation::apply(instruction.op, a.first, b.first), 0.0 }; break;
+        }
+    }
+    
+    return phases[(size_t) index];
+}
+
+template <typename SampleType>
+SampleType DSPEngine<SampleType>::getCoefficient(const CompiledEquation::Coefficient& coefficient) const
+{
+    double value = coefficient.scale;
+    if (coefficient.reg >= 0)
+        value *= static_cast<double>(scalarValues[(size_t) coefficient.reg]);
+    return static_cast<SampleType>(value);
+}
+
+template <typename SampleType>
+bool DSPEngine<SampleType>::getTransferFunction(TransferFunction& result)
+{
+    using Shape = CompiledEquation::KernelShape;
+    
+    if (!equationValid || program == nullptr)
+        return false;
+    
+    const auto& kernel = program->kernel;
+    if (kernel.shape == Shape::General || kernel.shape == Shape::DryWet)
+        return false;
+    
+    // Coefficients may read fs or variables, which are otherwise only
+    // evaluated when a block is processed
+    for (int index : blockRateInstructions)
+        scalarValues[(size_t) index] = evaluateScalar(index, 0.0);
+    
+    auto coefficient = [this] (const CompiledEquation::Coefficient& c)
+    {
+        return c.reg >= 0 ? c.scale * static_cast<double>(scalarValues[(size_t) c.reg]) : c.scale;
+    };
+    
+    result.delays = kernel.tapDelays;
+    result.b.clear();
+    for (const auto& tap : kernel.tapCoefficients)
+        result.b.push_back(coefficient(tap));
+    
+    result.a1 = coefficient(kernel.feedback[0]);
+    result.a2 = coefficient(kernel.feedback[1]);
+    return true;
+}
+
+template <typename SampleType>
+int DSPEngine<SampleType>::getMemoryLength() const
+{
+    if (!equationValid || program == nullptr || bypassed)
+        return 0;
+    
+    if (program->usesOutputFeedback)
+        return -1;
+    
+    // A window's input reaches back over its length, and a moving sum
+    // needs two of them to land on the same rounding, see EquationWindows
+    juce::int64 windowMemory = 0;
+    for (const auto& instruction : program->instructions)
+    {
+        if (instruction.op == OpCode::ModulatedDelay && inputHistory.getInterpolation() == DelayInterpolation::Thiran)
+            return -1;
+        
+        if (instruction.op == OpCode::Envelope)
+            return -1;
+        
+        if (instruction.op == OpCode::MovingMean || instruction.op == OpCode::MovingRms)
+            windowMemory += 2 * program->windows[(size_t) instruction.slot].length;
+        else if (instruction.op == OpCode::MovingMax || instruction.op == OpCode::MovingMin)
+            windowMemory += program->windows[(size_t) instruction.slot].length;
+    }
+    
+    // Reads are clamped to the history, and Lagrange looks two samples past that
+    const juce::int64 memory = inputHistory.getMaxDelay() + 3 + windowMemory;
+    return memory <= std::numeric_limits<int>::max() / 2 ? static_cast<int>(memory) : -1;
+}
+
+template <typename SampleType>
+double DSPEngine<SampleType>::estimateTailLength()
+{
+    constexpr double infinite = std::numeric_limits<double>::infinity();
+    
+    if (!equationValid || program == nullptr)
+        return 0.0;
+    
+    TransferFunction transfer;
+    if (getTransferFunction(transfer))
+    {
+        const double longestTap = transfer.delays.empty() ? 0.0
+                                : static_cast<double>(*std::max_element(transfer.delays.begin(), transfer.delays.end()));
+        if (transfer.a1 == 0.0 && transfer.a2 == 0.0)
+            return longestTap;
+        
+        const double radius = EquationKernels::poleRadius(transfer.a1, transfer.a2);
+        if (radius >= 1.0)
+            return infinite;
+        
+        // |h[n]| stays below sum|b| / (1 - r)^order * r^n, so wait until that is quiet
+        double gain = 0.0;
+        for (double b : transfer.b)
+            gain += std::abs(b);
+        
+        const int order = transfer.a2 != 0.0 ? 2 : 1;
+        const double bound = gain / std::pow(1.0 - radius, order);
+        if (radius == 0.0 || bound <= silenceThreshold)
+            return longestTap + order;
+        
+        return longestTap + std::ceil(std::log(silenceThreshold / bound) / std::log(radius));
+    }
+    
+    // Run an impulse until the output has stayed quiet for longer than
+    // anything the equation can remember from its input. The guard would
+    // hide a runaway, so it is off while measuring.
+    const bool wasGuardEnabled = guardEnabled;
+    guardEnabled = false;
+    reset();
+    
+    // A modulated delay may reach further than the impulse shows, so the
+    // longest it can ever read is a lower bound on the tail
+    double longestDelay = program->maxDelay;
+    if (program->hasModulatedDelay)
+        longestDelay = std::max(longestDelay, std::ceil(maxModulatedDelaySeconds * sampleRate));
+    
+    // A moving window can hold on to an impulse too quiet to show for its whole length
+    for (const auto& instruction : program->instructions)
+        if (CompiledEquation::isWindow(instruction.op))
+            longestDelay += program->windows[(size_t) instruction.slot].length;
+    
+    const int blockSize = std::min(maxBlockSize, 1024);
+    const double quietWindow = std::max<double>(longestDelay, blockSize);
+    const double limit = maxMeasuredTailSeconds * sampleRate;
+    std::vector<SampleType> block((size_t) blockSize, SampleType(0));
+    
+    double lastLoud = 0.0;
+    for (double position = 0.0; position < limit; position += blockSize)
+    {
+        std::fill(block.begin(), block.end(), SampleType(0));
+        if (position == 0.0)
+            block[0] = SampleType(1);
+        
+        processBlock(block.data(), blockSize);
+        
+        for (int i = 0; i < blockSize; ++i)
+            if (!(std::abs(block[(size_t) i]) <= SampleType(silenceThreshold)))
+                lastLoud = position + i;
+        
+        if (position + blockSize - lastLoud > quietWindow)
+        {
+            guardEnabled = wasGuardEnabled;
+            reset();
+            return std::max(lastLoud + 1.0, longestDelay);
+        }
+    }
+    
+    guardEnabled = wasGuardEnabled;
+    reset();
+    return infinite;
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::setTailLength(double samples)
+{
+    if (samples == tailSamples)
+        return;
+    
+    tailSamples = samples;
+    
+    // A longer tail may no longer allow sleeping; the state is clear either
+    // way. The silence already counted still stands, so an engine that was
+    // allowed to sleep goes straight back if its output stays quiet.
+    wake();
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::wake()
+{
+    asleep = false;
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::selectKernel()
+{
+    using Shape = CompiledEquation::KernelShape;
+    const auto& kernel = program->kernel;
+    const int numTaps = static_cast<int>(kernel.tapDelays.size());
+    
+    switch (kernel.shape)
+    {
+        case Shape::General:
+            return;
+            
+        case Shape::Gain:
+            kernelFunction = &DSPEngine::runGainKernel;
+            break;
+            
+        case Shape::Fir:
+        case Shape::Comb:
+            kernelFunction = selectTapKernel<false, false>(numTaps);
+            break;
+            
+        case Shape::OnePole:
+        case Shape::FeedbackComb:
+        case Shape::TwoPole:
+            if (kernel.feedback[0].scale != 0.0 && kernel.feedback[1].scale != 0.0)
+                kernelFunction = selectTapKernel<true, true>(numTaps);
+            else if (kernel.feedback[0].scale != 0.0)
+                kernelFunction = selectTapKernel<true, false>(numTaps);
+            else
+                kernelFunction = selectTapKernel<false, true>(numTaps);
+            break;
+            
+        case Shape::DryWet:
+        {
+            // Only the part of the program that produces the wet signal still runs
+            std::vector<bool> needed((size_t) program->getNumRegisters(), false);
+            needed[(size_t) kernel.wetRegister] = true;
+            for (int i = kernel.wetRegister; i >= 0; --i)
+            {
+                if (!needed[(size_t) i])
+                    continue;
+                const auto& instruction = program->instructions[(size_t) i];
+                if (instruction.a >= 0) needed[(size_t) instruction.a] = true;
+                if (instruction.b >= 0) needed[(size_t) instruction.b] = true;
+            }
+            
+            for (int index : blockwiseInstructions)
+                if (needed[(size_t) index])
+                    wetInstructions.push_back(index);
+            
+            kernelFunction = &DSPEngine::runDryWetKernel;
+            break;
+        }
+    }
+    
+    kernelScratch.assign((size_t) numTaps * (size_t) maxBlockSize, SampleType(0));
+    if (program->usesOutputFeedback)
+        feedbackScratch.assign((size_t) maxBlockSize, SampleType(0));
+    
+    complexity = numTaps + static_cast<int>(wetInstructions.size()) + 1;
+}
+
+template <typename SampleType>
+template <bool UsesPrev, bool UsesPrev2>
+typename DSPEngine<SampleType>::KernelFunction DSPEngine<SampleType>::selectTapKernel(int numTaps) const
+{
+    static_assert(CompiledEquation::maxKernelTaps == 4, "add the missing tap counts below");
+    
+    switch (numTaps)
+    {
+        case 1: return &DSPEngine::runTapKernel<1, UsesPrev, UsesPrev2>;
+        case 2: return &DSPEngine::runTapKernel<2, UsesPrev, UsesPrev2>;
+        case 3: return &DSPEngine::runTapKernel<3, UsesPrev, UsesPrev2>;
+        case 4: return &DSPEngine::runTapKernel<4, UsesPrev, UsesPrev2>;
+        default: return nullptr;
+    }
+}
+
+template <typename SampleType>
+template <int NumTaps, bool UsesPrev, bool UsesPrev2>
+void DSPEngine<SampleType>::runTapKernel(SampleType* samples, int numSamples)
+{
+    const auto& kernel = program->kernel;
+    const SampleType* taps[NumTaps];
+    SampleType coefficients[NumTaps];
+    
+    for (int k = 0; k < NumTaps; ++k)
+    {
+        SampleType* scratch = kernelScratch.data() + (size_t) k * (size_t) maxBlockSize;
+        taps[k] = inputHistory.getBlock(kernel.tapDelays[(size_t) k], scratch, numSamples);
+        coefficients[k] = getCoefficient(kernel.tapCoefficients[(size_t) k]);
+    }
+    
+    if constexpr (UsesPrev || UsesPrev2)
+    {
+        const SampleType a1 = getCoefficient(kernel.feedback[0]);
+        const SampleType a2 = getCoefficient(kernel.feedback[1]);
+        
+        // Coefficients can move from block to block, but usually do not
+        if (a1 != lookAheadA1 || a2 != lookAheadA2)
+        {
+            lookAhead.prepare(a1, a2);
+            lookAheadA1 = a1;
+            lookAheadA2 = a2;
+        }
+        
+        if (lookAhead.accurate && numSamples > 3 * EquationKernels::lookAheadLength)
+            EquationKernels::recursiveLookAhead<SampleType, NumTaps>(taps, coefficients, a1, a2, lookAhead,
+                                                                     samples, feedbackScratch.data(), numSamples, outputHistory);
+        else
+            EquationKernels::recursive<SampleType, NumTaps, UsesPrev, UsesPrev2>(taps, coefficients, a1, a2,
+                                                                                 samples, numSamples, outputHistory);
+    }
+    else
+    {
+        EquationKernels::fir<SampleType, NumTaps>(taps, coefficients, samples, numSamples);
+        
+        outputHistory[1] = numSamples > 1 ? samples[numSamples - 2] : outputHistory[0];
+        outputHistory[0] = samples[numSamples - 1];
+    }
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::runGainKernel(SampleType* samples, int numSamples)
+{
+    EquationKernels::gain(samples, numSamples, getCoefficient(program->kernel.tapCoefficients[0]));
+    
+    outputHistory[1] = numSamples > 1 ? samples[numSamples - 2] : outputHistory[0];
+    outputHistory[0] = samples[numSamples - 1];
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::runDryWetKernel(SampleType* samples, int numSamples)
+{
+    const auto& kernel = program->kernel;
+    
+    for (int index : wetInstructions)
+        runBlockInstruction(index, samples, numSamples);
+    
+    EquationKernels::dryWet(samples, getRegister(kernel.wetRegister),
+                            getCoefficient(kernel.tapCoefficients[0]), getCoefficient(kernel.wetCoefficient), numSamples);
+    
+    outputHistory[1] = numSamples > 1 ? samples[numSamples - 2] : outputHistory[0];
+    outputHistory[0] = samples[numSamples - 1];
+}
+
+template <typename SampleType>
+template <bool Profiled>
+void DSPEngine<SampleType>::runControlRate(int numSamples)
+{
+    const int interval = program->controlInterval;
+    const int numPoints = (numSamples + interval - 1) / interval + 1;
+    const double inverseRate = 1.0 / sampleRate;
+    
+    // The last point sits at the end of the block, which is where the next
+    // block's first point will be, so the segments join up across blocks
+    for (int point = 0; point < numPoints; ++point)
+    {
+        int offset = std::min(point * interval, numSamples);
+        double time = static_cast<double>(samplePosition + offset) * inverseRate;
+        
+        for (int index : controlRateInstructions)
+            timed<Profiled>(index, [&] { scalarValues[(size_t) index] = evaluateScalar(index, time); });
+        
+        for (size_t r = 0; r < expandedControlRegisters.size(); ++r)
+            controlPoints[r * (size_t) controlPointsPerBlock + (size_t) point] = scalarValues[(size_t) expandedControlRegisters[r]];
+    }
+    
+    for (size_t r = 0; r < expandedControlRegisters.size(); ++r)
+    {
+        SampleType* out = getRegister(expandedControlRegisters[r]);
+        const SampleType* points = controlPoints.data() + r * (size_t) controlPointsPerBlock;
+        
+        for (int point = 0; point + 1 < numPoints; ++point)
+        {
+            int start = point * interval;
+            int end = std::min(start + interval, numSamples);
+            SampleType value = points[point];
+            SampleType step = (points[point + 1] - value) / static_cast<SampleType>(end - start);
+            
+            for (int i = start; i < end; ++i)
+                out[i] = value + step * static_cast<SampleType>(i - start);
+        }
+    }
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::runBlockInstruction(int index, const SampleType* input, int numSamples)
+{
+    const auto& instruction = program->instructions[(size_t) index];
+    SampleType* out = getRegister(index);
+    const SampleType* a = instruction.a >= 0 ? getRegister(instruction.a) : nullptr;
+    const SampleType* b = instruction.b >= 0 ? getRegister(instruction.b) : nullptr;
+    
+    // One simple loop per opcode so the compiler can vectorise each of them
+    switch (instruction.op)
+    {
+        case OpCode::Constant:
+            break; // Filled once in prepareProgram()
+            
+        case OpCode::Input:
+            std::copy(input, input + numSamples, out);
+            break;
+            
+        case OpCode::Time:
+        {
+            const double inverseRate = 1.0 / sampleRate;
+            for (int i = 0; i < numSamples; ++i)
+                out[i] = static_cast<SampleType>(static_cast<double>(samplePosition + i) * inverseRate);
+            break;
+        }
+        
+        case OpCode::Variable:
+            std::fill_n(out, numSamples, variableValues[(size_t) instruction.slot]);
+            break;
+            
+        case OpCode::Delay:
+            inputHistory.readBlock(static_cast<int>(instruction.constant), out, numSamples);
+            break;
+            
+        case OpCode::ModulatedDelay:
+            inputHistory.readBlock(a, out, numSamples, tapStates[(size_t) instruction.slot]);
+            break;
+            
+        case OpCode::Negate:   for (int i = 0; i < numSamples; ++i) out[i] = -a[i]; break;
+        case OpCode::Add:      for (int i = 0; i < numSamples; ++i) out[i] = a[i] + b[i]; break;
+        case OpCode::Subtract: for (int i = 0; i < numSamples; ++i) out[i] = a[i] - b[i]; break;
+        case OpCode::Multiply: for (int i = 0; i < numSamples; ++i) out[i] = a[i] * b[i]; break;
+        case OpCode::Divide:   for (int i = 0; i < numSamples; ++i) out[i] = (b[i] != SampleType(0)) ? a[i] / b[i] : SampleType(0); break;
+        case OpCode::Power:    for (int i = 0; i < numSamples; ++i) out[i] = std::pow(a[i], b[i]); break;
+        case OpCode::Sin:      for (int i = 0; i < numSamples; ++i) out[i] = std::sin(a[i]); break;
+        case OpCode::Cos:      for (int i = 0; i < numSamples; ++i) out[i] = std::cos(a[i]); break;
+        case OpCode::Tan:      for (int i = 0; i < numSamples; ++i) out[i] = std::tan(a[i]); break;
+        case OpCode::Exp:      for (int i = 0; i < numSamples; ++i) out[i] = std::exp(a[i]); break;
+        case OpCode::Log:      for (int i = 0; i < numSamples; ++i) out[i] = std::log(a[i]); break;
+        case OpCode::Log10:    for (int i = 0; i < numSamples; ++i) out[i] = std::log10(a[i]); break;
+        case OpCode::Sqrt:     for (int i = 0; i < numSamples; ++i) out[i] = std::sqrt(a[i]); break;
+        case OpCode::Abs:      for (int i = 0; i < numSamples; ++i) out[i] = std::abs(a[i]); break;
+        case OpCode::Filter:   for (int i = 0; i < numSamples; ++i) out[i] = a[i] * SampleType(0.5) + b[i] * SampleType(0.5); break;
+            
+        // Compares rather than branches, so these vectorise like the
+        // arithmetic above whatever the signal does
+        case OpCode::Less:      for (int i = 0; i < numSamples; ++i) out[i] = static_cast<SampleType>(a[i] < b[i]); break;
+        case OpCode::LessEqual: for (int i = 0; i < numSamples; ++i) out[i] = static_cast<SampleType>(a[i] <= b[i]); break;
+        case OpCode::Equal:     for (int i = 0; i < numSamples; ++i) out[i] = static_cast<SampleType>(a[i] == b[i]); break;
+        case OpCode::NotEqual:  for (int i = 0; i < numSamples; ++i) out[i] = static_cast<SampleType>(a[i] != b[i]); break;
+        case OpCode::Min:       for (int i = 0; i < numSamples; ++i) out[i] = std::min(a[i], b[i]); break;
+        case OpCode::Max:       for (int i = 0; i < numSamples; ++i) out[i] = std::max(a[i], b[i]); break;
+        case OpCode::Sign:      for (int i = 0; i < numSamples; ++i) out[i] = static_cast<SampleType>(a[i] > SampleType(0)) - static_cast<SampleType>(a[i] < SampleType(0)); break;
+            
+        // b is read whichever way each select goes; a read only on one side
+        // would leave a branch the compiler can't turn into a mask
+        case OpCode::Select:
+            for (int i = 0; i < numSamples; ++i)
+            {
+                const SampleType value = b[i];
+                out[i] = (a[i] != SampleType(0)) ? value : SampleType(0);
+            }
+            break;
+            
+        case OpCode::SelectNot:
+            for (int i = 0; i < numSamples; ++i)
+            {
+                const SampleType value = b[i];
+                out[i] = (a[i] != SampleType(0)) ? SampleType(0) : value;
+            }
+            break;
+            
+        case OpCode::Lookup:
+        {
+            const auto& table = *program->lookupTables[(size_t) instruction.slot];
+            lookupLinear(table.values.data(), static_cast<int>(table.values.size()) - 2,
+                         static_cast<SampleType>(table.inputMin), static_cast<SampleType>(table.inputMax),
+                         static_cast<SampleType>(table.scale), a, out, numSamples);
+            
+            // Rare, so a separate predictable pass keeps the loop above branch-free
+            if (table.exactOutsideRange)
+            {
+                for (int i = 0; i < numSamples; ++i)
+                    if (a[i] < table.inputMin || a[i] > table.inputMax)
+                        out[i] = static_cast<SampleType>(table.evaluateExact(a[i]));
+            }
+            break;
+        }
+            
+        case OpCode::Rand:
+            EquationNoise::fill<SampleType, false>(out, numSamples, samplePosition, noiseKeys[(size_t) index]);
+            break;
+            
+        case OpCode::Randn:
+            EquationNoise::fill<SampleType, true>(out, numSamples, samplePosition, noiseKeys[(size_t) index]);
+            break;
+            
+        case OpCode::Oscillator:
+        {
+            const double inverseRate = 1.0 / sampleRate;
+            const auto phase = evaluatePhase(instruction.a, static_cast<double>(samplePosition) * inverseRate);
+            EquationKernels::oscillator(out, numSamples, phase.first, phase.second * inverseRate, instruction.slot == 1);
+            break;
+        }
+            
+        case OpCode::MovingMean:
+            windowStates[(size_t) instruction.slot].sum.template process<SampleType, false>(a, out, numSamples, samplePosition);
+            break;
+            
+        case OpCode::MovingRms:
+            windowStates[(size_t) instruction.slot].sum.template process<SampleType, true>(a, out, numSamples, samplePosition);
+            break;
+            
+        case OpCode::MovingMax:
+            windowStates[(size_t) instruction.slot].extreme.template process<true>(a, out, numSamples);
+            break;
+            
+        case OpCode::MovingMin:
+            windowStates[(size_t) instruction.slot].extreme.template process<false>(a, out, numSamples);
+            break;
+            
+        case OpCode::Envelope:
+        {
+            auto& state = windowStates[(size_t) instruction.slot];
+            EquationWindows::followEnvelope(a, out, numSamples, state.envelope, state.attack, state.release);
+            break;
+        }
+            
+        case OpCode::OutputHistory:
+            break; // Always per sample
+    }
+}
+
+template <typename SampleType>
+SampleType DSPEngine<SampleType>::runSampleInstruction(int index, int sampleIndex, int numSamples)
+{
+    const auto& instruction = program->instructions[(size_t) index];
+    SampleType a = instruction.a >= 0 ? getRegister(instruction.a)[sampleIndex] : SampleType(0);
+    SampleType b = instruction.b >= 0 ? getRegister(instruction.b)[sampleIndex] : SampleType(0);
+    
+    switch (instruction.op)
+    {
+        case OpCode::OutputHistory:
+            return outputHistory[instruction.slot - 1];
+            
+        case OpCode::ModulatedDelay:
+            // The history already holds the rest of this block
+            return inputHistory.read(a, tapStates[(size_t) instruction.slot], numSamples - 1 - sampleIndex);
+            
+        case OpCode::Lookup:
+        {
+            const auto& table = *program->lookupTables[(size_t) instruction.slot];
+            bool outside = a < table.inputMin || a > table.inputMax;
+            return static_cast<SampleType>((outside && table.exactOutsideRange) ? table.evaluateExact(a) : table.lookup(a));
+        }
+            
+        case OpCode::MovingMean:
+        case OpCode::MovingRms:
+        {
+            auto& sum = windowStates[(size_t) instruction.slot].sum;
+            if (sampleIndex == 0)
+                sum.seek(samplePosition);
+            
+            const double value = static_cast<double>(a);
+            return static_cast<SampleType>(instruction.op == OpCode::MovingRms ? sum.pushRms(value) : sum.pushMean(value));
+        }
+            
+        case OpCode::MovingMax:
+            return windowStates[(size_t) instruction.slot].extreme.template push<true>(a);
+            
+        case OpCode::MovingMin:
+            return windowStates[(size_t) instruction.slot].extreme.template push<false>(a);
+            
+        case OpCode::Envelope:
+        {
+            auto& state = windowStates[(size_t) instruction.slot];
+            state.envelope = EquationWindows::followEnvelope(state.envelope, std::abs(static_cast<double>(a)), state.attack, state.release);
+            return static_cast<SampleType>(state.envelope);
+        }
+            
+        default:
+            return CompiledEquation::apply(instruction.op, a, b);
+    }
+}
+
+template <typename SampleType>
+std::size_t DSPEngine<SampleType>::getStateMemoryUsage() const
+{
+    auto bytesOf = [] (const auto& vector) { return vector.capacity() * sizeof(vector[0]); };
+    
+    std::size_t windowBytes = 0;
+    for (const auto& state : windowStates)
+        windowBytes += state.sum.getMemoryUsage() + state.extreme.getMemoryUsage();
+    
+    return sizeof(DSPEngine) + inputHistory.getMemoryUsage()
+         + bytesOf(variableValues) + bytesOf(tapStates) + bytesOf(registerData) + bytesOf(scalarValues)
+         + bytesOf(controlPoints) + bytesOf(kernelScratch) + bytesOf(feedbackScratch) + bytesOf(profileCycles)
+         + bytesOf(blockRateInstructions) + bytesOf(controlRateInstructions) + bytesOf(blockwiseInstructions)
+         + bytesOf(perSampleInstructions) + bytesOf(expandedBlockRegisters) + bytesOf(expandedControlRegisters)
+         + bytesOf(wetInstructions) + bytesOf(noiseKeys) + bytesOf(phases) + bytesOf(windowStates) + windowBytes;
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::clearState()
+{
+    inputHistory.clear();
+    outputHistory[0] = outputHistory[1] = 0;
+    std::fill(tapStates.begin(), tapStates.end(), typename DelayLine<SampleType>::AllpassState());
+    
+    for (auto& state : windowStates)
+    {
+        state.sum.clear();
+        state.extreme.clear();
+        state.envelope = 0.0;
+    }
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::reset()
+{
+    clearState();
+    samplePosition = 0;
+    silentSamples = 0.0;
+    asleep = false;
+    
+    // Reset input variable
+    variables["x"] = 0.0;
+}
+
+template <typename SampleType>
+void DSPEngine<SampleType>::setVariable(const std::string& name, double value)
+{
+    variables[name] = value;
+    
+    if (program != nullptr)
+    {
+        const auto& names = program->variableNames;
+        for (size_t i = 0; i < names.size() && i < variableValues.size(); ++i)
+            if (names[i] == name)
+                setVariableSlot(static_cast<int>(i), value);
+    }
+}
+
+template <typename SampleType>
+double DSPEngine<SampleType>::getVariable(const std::string& name) const
+{
+    auto it = variables.find(name);
+    if (it != variables.end())
+        return it->second;
+    return 0.0;
+}
+
+
+template class DelayLine<float>;
+template class DelayLine<double>;
+template class DSPEngine<float>;
+template class DSPEngine<double>;
\ No newline at end of file
@@ -1,59 +1,364 @@
-#pragma once
-
-#include <JuceHeader.h>
-#include "MatlabParser.h"
-#include <map>
-#include <vector>
-#include <memory>
-
-class DelayLine
-{
-public:
-    DelayLine(int maxDelay = 1024);
-    ~DelayLine() = default;
-
-    void setMaxDelay(int samples);
-    float process(float input, int delaySamples);
-    void clear();
-
-private:
-    std::vector<float> buffer;
-    int writeIndex = 0;
-    int maxDelaySize;
-};
-
-class DSPEngine
-{
-public:
-    DSPEngine();
-    ~DSPEngine();
-
-    void setSampleRate(double sampleRate);
-    void setEquation(const std::string& equation);
-    bool isEquationValid() const { return equationValid; }
-    std::string getErrorMessage() const { return errorMessage; }
-
-    float processSample(float input);
-    void reset();
-
-    // Variable management
-    void setVariable(const std::string& name, float value);
-    float getVariable(const std::string& name) const;
-
-private:
-    std::unique_ptr<MatlabParser> parser;
-    std::unique_ptr<MatlabParser::ASTNode> ast;
-    
-    std::map<std::string, float> variables;
-    std::map<int, std::unique_ptr<DelayLine>> delayLines; // delay amount -> delay line
-    
-    double sampleRate = 44100.0;
-    bool equationValid = false;
-    std::string errorMessage;
-    
-    float evaluateNode(const MatlabParser::ASTNode* node, float currentInput);
-    float evaluateFunction(const std::string& name, const std::vector<float>& args);
-    float evaluateBinaryOp(const std::string& op, float left, float right);
-    
-    DelayLine* getDelayLine(int delayAmount);
-};
\ No newline at end of file
+#pragma once
+
+#include <JuceHeader.h>
+#include "MatlabParser.h"
+#include "EquationCompiler.h"
+#include "EquationKernels.h"
+#include "EquationProfiler.h"
+#include "EquationWindows.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+#include <memory>
+
+// How fractional and modulated delays are read
+enum class DelayInterpolation
+{
+    None,        // Truncate to whole samples
+    Linear,      // Cheapest, slight high-frequency loss on modulated delays
+    Lagrange3rd, // 4-point, flatter response for chorus/vibrato
+    Thiran       // 1st-order allpass, flat magnitude but needs per-tap state
+};
+
+// Input history for z^-n taps. The ring is a power of two long and sized for
+// the longest delay plus one block, so a whole block can be written first and
+// then read back with one branch-free, vectorisable loop per tap.
+// Instantiated for float and double.
+template <typename SampleType>
+class DelayLine
+{
+public:
+    using Interpolation = DelayInterpolation;
+
+    // Recursive state of the Thiran interpolator, one per read tap
+    struct AllpassState
+    {
+        SampleType previousOutput = 0;
+    };
+
+    DelayLine(int maxDelay = 1024);
+    ~DelayLine() = default;
+
+    void setMaxDelay(int samples, int maxBlockSize = 0);
+    int getMaxDelay() const { return maxDelaySize; }
+    void setInterpolation(Interpolation newInterpolation) { interpolation = newInterpolation; }
+    Interpolation getInterpolation() const { return interpolation; }
+    void clear();
+    std::size_t getMemoryUsage() const { return buffer.capacity() * sizeof(SampleType); }
+
+    void write(SampleType input);
+    void writeBlock(const SampleType* input, int numSamples);
+
+    // Delays are measured back from the most recently written sample, so a
+    // delay of 0 returns that sample. samplesAhead skips samples that were
+    // written after the one the delay is relative to (e.g. later in a block).
+    SampleType read(int delaySamples, int samplesAhead = 0) const;
+    SampleType read(SampleType delaySamples, AllpassState& state, int samplesAhead = 0) const;
+
+    // Call after writeBlock(): output[i] is the sample that came delay
+    // samples before input[i] of that block
+    void readBlock(int delaySamples, SampleType* output, int numSamples) const;
+    void readBlock(const SampleType* delays, SampleType* output, int numSamples, AllpassState& state) const;
+    
+    // The same block as readBlock(delaySamples, ...), but pointing straight
+    // into the ring unless it wraps around, in which case it is copied into
+    // scratch first
+    const SampleType* getBlock(int delaySamples, SampleType* scratch, int numSamples) const;
+
+private:
+    std::vector<SampleType> buffer;
+    int mask = 0;
+    int writeIndex = 0; // Where the next sample goes
+    int maxDelaySize;
+    Interpolation interpolation = Interpolation::Linear;
+
+    SampleType getMinimumDelay() const;
+};
+
+// Runs one compiled equation on a single channel. Every piece of per-sample
+// state (input history, y_prev, interpolator state, moving windows) lives
+// here, so a multichannel processor owns one engine per channel and
+// channels never share memory.
+//
+// Instructions that do not depend on y_prev are executed a whole block at a
+// time (one tight loop per instruction); only the feedback part of the
+// program is stepped sample by sample. Work that does not depend on the
+// audio at all (coefficients, LFOs) is evaluated once per block or at
+// control points and interpolated, see CompiledEquation::Rate.
+//
+// SampleType is the internal precision (float or double). It is independent
+// of the host's buffer format: low-cutoff and high-order recursive equations
+// that drift or blow up in float usually stay stable in double.
+template <typename SampleType>
+class DSPEngine
+{
+public:
+    DSPEngine();
+    ~DSPEngine();
+
+    void prepare(double sampleRate, int maxBlockSize);
+    void setSampleRate(double sampleRate);
+    void setEquation(const std::string& equation);
+    bool isEquationValid() const { return equationValid; }
+    std::string getErrorMessage() const { return errorMessage; }
+
+    void setDelayInterpolation(DelayInterpolation interpolation);
+
+    // Recompiles the current equation when the options change
+    void setCompilerOptions(const EquationCompiler::Options& options);
+
+    // Both at once, so only the new equation is compiled
+    void setEquation(const std::string& equation, const EquationCompiler::Options& options);
+
+    std::shared_ptr<const CompiledEquation> getProgram() const { return program; }
+
+    SampleType processSample(SampleType input);
+    void processBlock(SampleType* samples, int numSamples);
+    void reset();
+
+    // Rough per-sample cost of the current equation (number of audio rate
+    // instructions), used to decide whether a block is worth spreading
+    // across threads
+    int getComplexity() const { return complexity; }
+
+    // Bytes of per-instance state this engine owns (history, registers,
+    // scratch). The program and its tables are shared and not included.
+    std::size_t getStateMemoryUsage() const;
+
+    // H(z) = sum of b[k] z^-delays[k] over 1 - a1 z^-1 - a2 z^-2, for
+    // equations that matched a linear kernel shape (gain, FIR, comb, one-
+    // and two-pole). Coefficients are evaluated at the current sample rate
+    // and variable values. Returns false for anything else.
+    struct TransferFunction
+    {
+        std::vector<int> delays;
+        std::vector<double> b;
+        double a1 = 0.0;
+        double a2 = 0.0;
+    };
+    
+    bool getTransferFunction(TransferFunction& result);
+    
+    // Per-block protection against equations that blow up. A block with
+    // inf or NaN in it is silenced and the engine's state cleared, so one
+    // bad sample cannot poison the delay lines; a block that runs away past
+    // runawayLevel is soft-clipped along with y_prev. Feedback state that
+    // decays below denormalThreshold is flushed to zero between blocks.
+    enum class GuardAction
+    {
+        None,
+        SoftClipped,
+        Reset
+    };
+    
+    void setStabilityGuardEnabled(bool shouldBeEnabled) { guardEnabled = shouldBeEnabled; }
+    GuardAction getLastGuardAction() const { return lastGuardAction; } // Worst action in the last processBlock()
+    
+    static constexpr double runawayLevel = 64.0; // About +36 dBFS
+    static constexpr double denormalThreshold = 1.0e-15;
+    
+    // Silence skipping. Once the input has stayed below silenceThreshold
+    // for longer than the tail and the output has died away too, the state
+    // is cleared and blocks are zeroed without running the equation until
+    // the input comes back. The tail must be set again after every
+    // equation, option or sample rate change; until then it is infinite
+    // and nothing is skipped.
+    void setTailLength(double samples);
+    bool isAsleep() const { return asleep; }
+    
+    // How many samples the output can keep going after the input stops.
+    // Exact for the linear kernel shapes, from the longest tap and the
+    // poles; otherwise measured by running an impulse through this engine
+    // (so use a scratch one) for up to maxMeasuredTailSeconds. Infinite
+    // for unstable equations and ones that make sound on their own.
+    double estimateTailLength();
+    
+    // The equation is plain x, so processBlock() leaves the samples alone
+    bool isBypassed() const { return bypassed; }
+    
+    // How many past input samples the output can depend on, or -1 when it
+    // depends on all of them (y_prev, envelope, or the Thiran interpolator's
+    // allpass state). An engine fed that much input ahead of some point produces
+    // from there on exactly what one fed everything before it would.
+    int getMemoryLength() const;
+    
+    // Times one block in EquationProfiler::sampleInterval into profiler
+    // while it was made for the current program; nullptr stops. Without
+    // one, blocks run a copy of the loop with no timing code at all.
+    void setProfiler(std::shared_ptr<EquationProfiler> newProfiler);
+    
+    // Moves t; the next block starts at this many samples since reset()
+    void setSamplePosition(juce::int64 position) { samplePosition = position; }
+    
+    // Seeds the rand and randn calls that have no seed of their own. Every
+    // engine starts with a different one, so channels and instances make
+    // unrelated noise; offline renders set it so a rerun matches.
+    void setNoiseSeed(std::uint32_t seed);
+    
+    static constexpr double silenceThreshold = 1.0e-5; // About -100 dBFS
+    static constexpr double maxMeasuredTailSeconds = 2.0;
+
+    // Variable management
+    void setVariable(const std::string& name, double value);
+    double getVariable(const std::string& name) const;
+    
+    // Sets the program's variable at this index in its variableNames, with
+    // no lookup or allocation, for the audio thread. Only lasts until the
+    // program is prepared again, and getVariable() does not see it.
+    void setVariableSlot(int slot, double value)
+    {
+        if (slot < 0 || slot >= static_cast<int>(variableValues.size()))
+            return;
+        
+        const auto newValue = static_cast<SampleType>(value);
+        if (variableValues[(size_t) slot] != newValue)
+        {
+            variableValues[(size_t) slot] = newValue;
+            wake(); // e.g. a gate opening on an equation that makes its own sound
+        }
+    }
+
+    // Upper bound for delays whose length is an expression, e.g. z^-(d + lfo)
+    static constexpr double maxModulatedDelaySeconds = 1.0;
+
+private:
+    using Instruction = CompiledEquation::Instruction;
+    using OpCode = CompiledEquation::OpCode;
+    using Rate = CompiledEquation::Rate;
+
+    std::shared_ptr<const CompiledEquation> program;
+    EquationCompiler::Options compilerOptions;
+    std::string equationText;
+
+    std::map<std::string, double> variables;
+    std::vector<SampleType> variableValues; // Indexed by the program's variable slots
+
+    DelayLine<SampleType> inputHistory; // x[n], x[n-1], ... shared by every z^-n tap
+    std::vector<typename DelayLine<SampleType>::AllpassState> tapStates;
+    SampleType outputHistory[2] = { 0, 0 }; // y_prev, y_prev2
+    
+    std::uint32_t noiseSeed = 0;
+    std::vector<std::uint32_t> noiseKeys; // Per register, the stream keys of rand and randn
+    std::vector<std::pair<double, double>> phases; // Per register, value and slope in t, see evaluatePhase()
+    
+    // Indexed by the program's window slots; each only sets up the part its instruction uses
+    struct WindowState
+    {
+        EquationWindows::MovingSum sum;                     // movmean, movrms
+        EquationWindows::MovingExtreme<SampleType> extreme; // movmax, movmin
+        double envelope = 0.0;
+        double attack = 0.0, release = 0.0;                 // Coefficients at the current sample rate
+    };
+    
+    std::vector<WindowState> windowStates;
+
+    // One block-sized buffer per instruction, plus the instructions of each
+    // rate in evaluation order
+    std::vector<SampleType> registerData;
+    std::vector<int> blockRateInstructions;
+    std::vector<int> controlRateInstructions;
+    std::vector<int> blockwiseInstructions; // Audio rate, run over the whole block
+    std::vector<int> perSampleInstructions;
+    
+    // Block and control rate values are computed as scalars. Only those an
+    // audio rate instruction or the output reads are written out to their
+    // block-sized register.
+    std::vector<SampleType> scalarValues;
+    std::vector<int> expandedBlockRegisters;
+    std::vector<int> expandedControlRegisters;
+    std::vector<SampleType> controlPoints; // controlPointsPerBlock values per expanded control register
+    int controlPointsPerBlock = 0;
+    int complexity = 0;
+    
+    // Dedicated loop for the program's KernelShape, nullptr for the general path
+    using KernelFunction = void (DSPEngine::*)(SampleType* samples, int numSamples);
+    KernelFunction kernelFunction = nullptr;
+    std::vector<int> wetInstructions;     // DryWet: the instructions the wet signal needs
+    std::vector<SampleType> kernelScratch; // One block per tap, used when a tap wraps around the history
+    
+    // Recursive kernels run in look-ahead form when it is accurate enough
+    // for the current feedback coefficients, see EquationKernels::LookAhead
+    EquationKernels::LookAhead<SampleType> lookAhead;
+    SampleType lookAheadA1 = 0, lookAheadA2 = 0; // What lookAhead was prepared for
+    std::vector<SampleType> feedbackScratch;
+
+    double sampleRate = 44100.0;
+    int maxBlockSize = 512;
+    juce::int64 samplePosition = 0; // Drives the time variable t
+
+    bool equationValid = false;
+    std::string errorMessage;
+    
+    std::shared_ptr<EquationProfiler> profiler;
+    EquationProfiler* activeProfiler = nullptr; // profiler, when it matches the program
+    std::vector<std::uint64_t> profileCycles;   // The timed block's, see EquationProfiler::addBlock()
+    std::uint64_t timerOverhead = 0;
+    std::uint64_t numProfileTimings = 0; // In the timed block, whose overhead is not the equation's
+    int blocksUntilProfiled = 0;
+    bool profileEachSample = false; // Whether the timed block times each per-sample instruction
+    
+    bool guardEnabled = true;
+    GuardAction lastGuardAction = GuardAction::None;
+    
+    double tailSamples = std::numeric_limits<double>::infinity();
+    double silentSamples = 0.0; // Input below silenceThreshold for this long
+    bool asleep = false;
+    bool bypassed = false;
+
+    void prepareProgram();
+    void updateNoiseKeys();
+    void updateActiveProfiler();
+    template <bool Profiled>
+    void processChunk(SampleType* samples, int numSamples);
+    void guardChunk(SampleType* samples, int numSamples);
+    static bool isSilent(const SampleType* samples, int numSamples);
+    void clearState();
+    void wake(); // Runs the equation again; only loud input restarts the silence count
+
+    SampleType* getRegister(int index) { return registerData.data() + (size_t) index * (size_t) maxBlockSize; }
+    SampleType evaluateScalar(int index, double time) const;
+    std::pair<double, double> evaluatePhase(int index, double time);
+    SampleType getCoefficient(const CompiledEquation::Coefficient& coefficient) const;
+    
+    void selectKernel();
+    template <bool UsesPrev, bool UsesPrev2>
+    KernelFunction selectTapKernel(int numTaps) const;
+    template <int NumTaps, bool UsesPrev, bool UsesPrev2>
+    void runTapKernel(SampleType* samples, int numSamples);
+    void runGainKernel(SampleType* samples, int numSamples);
+    void runDryWetKernel(SampleType* samples, int numSamples);
+    template <bool Profiled>
+    void runControlRate(int numSamples);
+    void runBlockInstruction(int index, const SampleType* input, int numSamples);
+    SampleType runSampleInstruction(int index, int sampleIndex, int numSamples);
+    template <bool Profiled>
+    void runSampleLoop(SampleType* samples, int numSamples);
+    
+    // Runs step, adding its cycles to profileCycles[entry] when Profiled
+    template <bool Profiled, typename Step>
+    void timed(int entry, Step&& step)
+    {
+        if constexpr (Profiled)
+        {
+            const auto start = EquationProfiler::readCycleCounter();
+            step();
+            const auto cycles = EquationProfiler::readCycleCounter() - start;
+            profileCycles[(size_t) entry] += cycles - std::min(cycles, timerOverhead);
+            ++numProfileTimings;
+        }
+        else
+        {
+            step();
+        }
+    }
+};
+
+// Defined in DSPEngine.cpp
+extern template class DelayLine<float>;
+extern template class DelayLine<double>;
+extern template class DSPEngine<float>;
+extern template class DSPEngine<double>;
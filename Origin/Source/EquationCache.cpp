@@ -0,0 +1,218 @@
+#include "EquationCache.h"
+#include "MatlabParser.h"
+#include "PerformanceTrace.h"
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+
+namespace
+{
+    bool isWordChar(char c)
+    {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.';
+    }
+
+    // Errors are found in the normalised text; this walks equation the way
+    // normaliseEquation() does to find where such an offset came from
+    int toOriginalPosition(const std::string& equation, int normalisedPosition)
+    {
+        if (normalisedPosition < 0)
+            return -1;
+
+        int length = 0;
+        char last = 0;
+        bool pendingSpace = false;
+
+        for (size_t i = 0; i < equation.size(); ++i)
+        {
+            const char c = equation[i];
+            if (std::isspace(static_cast<unsigned char>(c)))
+            {
+                pendingSpace = true;
+                continue;
+            }
+
+            if (pendingSpace && length > 0 && isWordChar(last) && isWordChar(c))
+                ++length;
+
+            if (length >= normalisedPosition)
+                return static_cast<int>(i);
+
+            ++length;
+            last = c;
+            pendingSpace = false;
+        }
+
+        return static_cast<int>(equation.size());
+    }
+}
+
+EquationCache& EquationCache::getInstance()
+{
+    static EquationCache instance;
+    return instance;
+}
+
+std::string EquationCache::normaliseEquation(const std::string& equation)
+{
+    std::string result;
+    result.reserve(equation.size());
+    bool pendingSpace = false;
+
+    for (char c : equation)
+    {
+        if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            pendingSpace = true;
+            continue;
+        }
+
+        // A space only matters between two parts of words or numbers
+        if (pendingSpace && !result.empty() && isWordChar(result.back()) && isWordChar(c))
+            result += ' ';
+
+        result += c;
+        pendingSpace = false;
+    }
+
+    return result;
+}
+
+std::string EquationCache::makeKey(const std::string& equation, const EquationCompiler::Options& options)
+{
+    const auto& tables = options.lookupTables;
+    const auto& rates = options.rates;
+
+    std::ostringstream key;
+    key.precision(9);
+    key << normaliseEquation(equation) << '\n'
+        << tables.enabled << ' ' << tables.size << ' ' << tables.inputMin << ' ' << tables.inputMax << ' '
+        << tables.exactOutsideRange << ' ' << tables.maxError << ' ' << tables.minimumCost << ' '
+        << rates.enabled << ' ' << rates.controlInterval << ' ' << rates.maxControlFrequency << ' '
+        << options.useKernels;
+    return key.str();
+}
+
+std::shared_ptr<const CompiledEquation> EquationCache::getOrCompile(const std::string& equation,
+                                                                    const EquationCompiler::Options& options,
+                                                                    std::string& errorMessage,
+                                                                    int* errorPosition)
+{
+    const std::string key = makeKey(equation, options);
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = entries.find(key);
+        if (it != entries.end())
+        {
+            ++statistics.hits;
+            it->second.lastUsed = ++useCounter;
+            errorMessage = it->second.errorMessage;
+            if (errorPosition != nullptr)
+                *errorPosition = toOriginalPosition(equation, it->second.errorPosition);
+            return it->second.program;
+        }
+
+        ++statistics.misses;
+    }
+
+    // Compile without holding the lock so other instances are not held up;
+    // if two threads race on the same equation the first one to finish wins.
+    // The normalised text is what gets parsed, so every spelling that shares
+    // an entry also shares the same result.
+    Entry entry;
+    MatlabParser parser;
+    bool parsed = false;
+    {
+        ORIGIN_TRACE_SCOPE("compile", "parse");
+        parsed = parser.parseEquation(normaliseEquation(equation));
+    }
+
+    if (parsed)
+    {
+        ORIGIN_TRACE_SCOPE("compile", "compile");
+        EquationCompiler compiler(options);
+        entry.program = compiler.compile(*parser.getAST());
+        entry.errorMessage = compiler.getErrorMessage();
+        entry.errorPosition = compiler.getErrorPosition();
+    }
+    else
+    {
+        entry.errorMessage = parser.getErrorMessage();
+        entry.errorPosition = parser.getErrorPosition();
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    entry.lastUsed = ++useCounter;
+    auto inserted = entries.emplace(key, std::move(entry)).first;
+    evictUnusedEntries();
+
+    errorMessage = inserted->second.errorMessage;
+    if (errorPosition != nullptr)
+        *errorPosition = toOriginalPosition(equation, inserted->second.errorPosition);
+    return inserted->second.program;
+}
+
+std::shared_ptr<const CompiledEquation> EquationCache::insert(const std::string& equation,
+                                                              const EquationCompiler::Options& options,
+                                                              std::shared_ptr<const CompiledEquation> program)
+{
+    const std::string key = makeKey(equation, options);
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto& entry = entries[key];
+    if (entry.program == nullptr && entry.errorMessage.empty())
+        entry.program = std::move(program);
+
+    entry.lastUsed = ++useCounter;
+    auto result = entry.program;
+    evictUnusedEntries();
+    return result;
+}
+
+void EquationCache::evictUnusedEntries()
+{
+    // Only the cache holds these, so dropping them frees nothing anyone uses
+    auto isUnused = [] (const Entry& entry) { return entry.program == nullptr || entry.program.use_count() == 1; };
+
+    int numUnused = 0;
+    for (const auto& item : entries)
+        if (isUnused(item.second))
+            ++numUnused;
+
+    while (numUnused > maxUnusedEntries)
+    {
+        auto oldest = entries.end();
+        for (auto it = entries.begin(); it != entries.end(); ++it)
+            if (isUnused(it->second) && (oldest == entries.end() || it->second.lastUsed < oldest->second.lastUsed))
+                oldest = it;
+
+        entries.erase(oldest);
+        ++statistics.evictions;
+        --numUnused;
+    }
+}
+
+EquationCache::Statistics EquationCache::getStatistics() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    Statistics result = statistics;
+    result.numEntries = static_cast<int>(entries.size());
+    result.numEntriesInUse = static_cast<int>(std::count_if(entries.begin(), entries.end(), [] (const auto& item)
+    {
+        return item.second.program != nullptr && item.second.program.use_count() > 1;
+    }));
+
+    for (const auto& item : entries)
+        if (item.second.program != nullptr)
+            result.programBytes += item.second.program->getMemoryUsage();
+
+    return result;
+}
+
+void EquationCache::clear()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    entries.clear();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "EquationCompiler.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Process-wide cache of compiled equations, shared by every plugin instance
+// and every channel engine in the process.
+//
+// Entries are keyed by the whitespace-normalised equation text plus the
+// compiler options. A compiled program does not depend on the sample rate
+// (fs is read once per block) or on the engine precision (constants are
+// double), so one entry serves every rate and precision. Programs are
+// immutable and handed out as shared pointers, which are the reference
+// count: entries still held by an engine are never evicted, and unused ones
+// are dropped least recently used first once there are more than
+// maxUnusedEntries of them. Parse and compile errors are cached too.
+class EquationCache
+{
+public:
+    struct Statistics
+    {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+        int numEntries = 0;
+        int numEntriesInUse = 0; // Held by at least one engine
+        std::size_t programBytes = 0; // Compiled programs, excluding their shared lookup tables
+    };
+
+    static EquationCache& getInstance();
+
+    // Returns the compiled program, or nullptr with errorMessage set when
+    // the equation does not parse or compile; errorPosition, if given, gets
+    // the offset in equation the error points at, or -1. Safe to call from
+    // any non-audio thread.
+    std::shared_ptr<const CompiledEquation> getOrCompile(const std::string& equation,
+                                                         const EquationCompiler::Options& options,
+                                                         std::string& errorMessage,
+                                                         int* errorPosition = nullptr);
+
+    // Adds a program that was compiled elsewhere, e.g. restored with plugin
+    // state, so the engines that follow skip compilation. The caller must
+    // have checked that it is what compiling equation with options gives.
+    // Returns the entry already cached for this key if there is one.
+    std::shared_ptr<const CompiledEquation> insert(const std::string& equation,
+                                                   const EquationCompiler::Options& options,
+                                                   std::shared_ptr<const CompiledEquation> program);
+
+    Statistics getStatistics() const;
+    void clear();
+
+    // Drops whitespace that cannot change the meaning, e.g. "0.5 * x" and
+    // "0.5*x" share an entry but "x y" and "xy" do not
+    static std::string normaliseEquation(const std::string& equation);
+
+    // The normalised equation plus every compiler option that affects the result
+    static std::string makeKey(const std::string& equation, const EquationCompiler::Options& options);
+
+    static constexpr int maxUnusedEntries = 64;
+
+private:
+    EquationCache() = default;
+
+    struct Entry
+    {
+        std::shared_ptr<const CompiledEquation> program;
+        std::string errorMessage;
+        int errorPosition = -1; // In the normalised text
+        std::uint64_t lastUsed = 0;
+    };
+
+    void evictUnusedEntries();
+
+    mutable std::mutex lock;
+    std::unordered_map<std::string, Entry> entries;
+    std::uint64_t useCounter = 0;
+    Statistics statistics;
+
+    JUCE_DECLARE_NON_COPYABLE (EquationCache)
+};
@@ -0,0 +1,1171 @@
+#include "EquationCodeGenerator.h"
+#include "EquationCache.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+    using OpCode = CompiledEquation::OpCode;
+    using Rate = CompiledEquation::Rate;
+
+    // Round-trips the value exactly; the non-finite ones have no literal
+    std::string literal(double value)
+    {
+        if (std::isnan(value))
+            return "std::numeric_limits<double>::quiet_NaN()";
+        if (std::isinf(value))
+            return value > 0.0 ? "std::numeric_limits<double>::infinity()" : "-std::numeric_limits<double>::infinity()";
+
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.17g", value);
+        std::string result(text);
+        if (result.find_first_of(".e") == std::string::npos)
+            result += ".0";
+        return result;
+    }
+
+    std::string floatLiteral(float value)
+    {
+        if (!std::isfinite(value))
+            return "static_cast<float>(" + literal(value) + ")";
+
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.9g", static_cast<double>(value));
+        std::string result(text);
+        if (result.find_first_of(".e") == std::string::npos)
+            result += ".0";
+        return result + "f";
+    }
+
+    // CompiledEquation::apply() written out for operands a and b
+    std::string applyExpression(OpCode op, const std::string& a, const std::string& b, const std::string& type)
+    {
+        switch (op)
+        {
+            case OpCode::Negate:   return "-" + a;
+            case OpCode::Add:      return a + " + " + b;
+            case OpCode::Subtract: return a + " - " + b;
+            case OpCode::Multiply: return a + " * " + b;
+            case OpCode::Divide:   return "(" + b + " != " + type + "(0)) ? " + a + " / " + b + " : " + type + "(0)";
+            case OpCode::Power:    return "std::pow(" + a + ", " + b + ")";
+            case OpCode::Sin:      return "std::sin(" + a + ")";
+            case OpCode::Cos:      return "std::cos(" + a + ")";
+            case OpCode::Tan:      return "std::tan(" + a + ")";
+            case OpCode::Exp:      return "std::exp(" + a + ")";
+            case OpCode::Log:      return "std::log(" + a + ")";
+            case OpCode::Log10:    return "std::log10(" + a + ")";
+            case OpCode::Sqrt:     return "std::sqrt(" + a + ")";
+            case OpCode::Abs:      return "std::abs(" + a + ")";
+            case OpCode::Filter:   return a + " * " + type + "(0.5) + " + b + " * " + type + "(0.5)";
+            case OpCode::Less:      return type + "(" + a + " < " + b + ")";
+            case OpCode::LessEqual: return type + "(" + a + " <= " + b + ")";
+            case OpCode::Equal:     return type + "(" + a + " == " + b + ")";
+            case OpCode::NotEqual:  return type + "(" + a + " != " + b + ")";
+            case OpCode::Min:       return "std::min(" + a + ", " + b + ")";
+            case OpCode::Max:       return "std::max(" + a + ", " + b + ")";
+            case OpCode::Sign:      return type + "(" + a + " > " + type + "(0)) - " + type + "(" + a + " < " + type + "(0))";
+            case OpCode::Select:    return "(" + a + " != " + type + "(0)) ? " + b + " : " + type + "(0)";
+            case OpCode::SelectNot: return "(" + a + " != " + type + "(0)) ? " + type + "(0) : " + b;
+            default:               return type + "(0)";
+        }
+    }
+
+    bool isIdentifier(const std::string& name)
+    {
+        if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0])))
+            return false;
+
+        return std::all_of(name.begin(), name.end(),
+                           [] (char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; });
+    }
+
+    // Writes the class for one program. Registers are named by where their
+    // value lives: kN constants, bN block rate, cN inside the control point
+    // loop, controlN[i] interpolated control values, aN audio rate values
+    // inside the loop computing them and audioN[i] those the per-sample
+    // loop reads back.
+    class Generator
+    {
+    public:
+        Generator(const CompiledEquation& programToGenerate, const EquationCodeGenerator::Options& generatorOptions)
+            : program(programToGenerate), options(generatorOptions)
+        {
+            const int numRegisters = program.getNumRegisters();
+            readAtAudioRate.assign((size_t) numRegisters, false);
+            readPerSample.assign((size_t) numRegisters, false);
+            neededAtControlPoints.assign((size_t) numRegisters, false);
+            neededForPhase.assign((size_t) numRegisters, false);
+            usedConstant.assign((size_t) numRegisters, false);
+            usedBlock.assign((size_t) numRegisters, false);
+
+            // Which slower values audio rate code reads, as DSPEngine::prepareProgram() works it out
+            readAtAudioRate[(size_t) program.outputRegister] = true;
+            for (const auto& instruction : program.instructions)
+            {
+                hasPerSample = hasPerSample || (instruction.rate == Rate::Audio && instruction.perSample);
+                if (instruction.rate != Rate::Audio || instruction.op == OpCode::Oscillator)
+                    continue;
+
+                for (int operand : { instruction.a, instruction.b })
+                {
+                    if (operand < 0)
+                        continue;
+                    readAtAudioRate[(size_t) operand] = true;
+                    if (instruction.perSample)
+                        readPerSample[(size_t) operand] = true;
+                }
+            }
+
+            if (hasPerSample)
+                readPerSample[(size_t) program.outputRegister] = true;
+
+            // Block rate values are only written out when something other
+            // than an oscillator's phase reads them
+            if (program.instructions[(size_t) program.outputRegister].rate == Rate::Block)
+                usedBlock[(size_t) program.outputRegister] = true;
+
+            for (int i = numRegisters - 1; i >= 0; --i)
+            {
+                const auto& instruction = program.instructions[(size_t) i];
+                if (isInterpolated(i))
+                    neededAtControlPoints[(size_t) i] = true;
+
+                const bool computed = instruction.rate != Rate::Constant
+                                   && (instruction.rate != Rate::Block || usedBlock[(size_t) i])
+                                   && (instruction.rate != Rate::Control || neededAtControlPoints[(size_t) i] || isInAheadLoop(i));
+                if (!computed)
+                    continue;
+
+                for (int operand : { instruction.a, instruction.b })
+                {
+                    if (operand < 0)
+                        continue;
+                    const auto operandRate = program.instructions[(size_t) operand].rate;
+                    if (operandRate == Rate::Constant)
+                        usedConstant[(size_t) operand] = true;
+                    else if (operandRate == Rate::Block)
+                        usedBlock[(size_t) operand] = true;
+                    else if (operandRate == Rate::Control && instruction.rate == Rate::Control)
+                        neededAtControlPoints[(size_t) operand] = true;
+                }
+            }
+
+            if (program.instructions[(size_t) program.outputRegister].rate == Rate::Constant)
+                usedConstant[(size_t) program.outputRegister] = true;
+
+            for (int i = 0; i < numRegisters; ++i)
+            {
+                const auto& instruction = program.instructions[(size_t) i];
+                if (isInterpolated(i))
+                    interpolated.push_back(i);
+                if (isInAheadLoop(i) && readPerSample[(size_t) i])
+                    storedForPerSample.push_back(i);
+                if (instruction.op == OpCode::Delay || instruction.op == OpCode::ModulatedDelay)
+                    usesHistory = true;
+                if (instruction.op == OpCode::ModulatedDelay)
+                    modulatedDelays.push_back(i);
+                if (instruction.op == OpCode::Rand || instruction.op == OpCode::Randn)
+                    noiseSources.push_back(i);
+                if (instruction.op == OpCode::Oscillator)
+                {
+                    oscillators.push_back(i);
+                    neededForPhase[(size_t) instruction.a] = true;
+                }
+                if (CompiledEquation::isWindow(instruction.op))
+                    windows.push_back(i);
+                if (instruction.op == OpCode::Time && (isInAheadLoop(i) || neededAtControlPoints[(size_t) i]))
+                    usesTime = true;
+            }
+
+            // The block and control rate registers oscillator phases are worked out from
+            for (int i = numRegisters - 1; i >= 0; --i)
+            {
+                const auto& instruction = program.instructions[(size_t) i];
+                if (!neededForPhase[(size_t) i] || instruction.rate == Rate::Constant)
+                    continue;
+
+                for (int operand : { instruction.a, instruction.b })
+                    if (operand >= 0)
+                        neededForPhase[(size_t) operand] = true;
+            }
+
+            usesTime = usesTime || !interpolated.empty() || !oscillators.empty();
+            sampleType = options.doublePrecision ? "double" : "float";
+        }
+
+        std::string run(const std::string& equation)
+        {
+            writeHeader(equation);
+            writePublic();
+            writePrivate();
+            return out.str();
+        }
+
+    private:
+        enum class Context
+        {
+            ControlPoint,
+            Ahead,
+            PerSample
+        };
+
+        const CompiledEquation& program;
+        const EquationCodeGenerator::Options& options;
+        std::ostringstream out;
+        std::string sampleType;
+
+        std::vector<bool> readAtAudioRate, readPerSample, neededAtControlPoints, neededForPhase, usedConstant, usedBlock;
+        std::vector<int> interpolated, storedForPerSample, modulatedDelays, noiseSources, oscillators, windows;
+        bool hasPerSample = false;
+        bool usesHistory = false;
+        bool usesTime = false;
+
+        const CompiledEquation::Instruction& instruction(int reg) const { return program.instructions[(size_t) reg]; }
+
+        // Control values audio rate code reads, bar t which is exact there
+        bool isInterpolated(int reg) const
+        {
+            return instruction(reg).rate == Rate::Control && readAtAudioRate[(size_t) reg] && instruction(reg).op != OpCode::Time;
+        }
+
+        bool usesWindow(bool (*matches)(OpCode)) const
+        {
+            return std::any_of(windows.begin(), windows.end(), [&] (int reg) { return matches(instruction(reg).op); });
+        }
+
+        static bool isMovingSum(OpCode op) { return op == OpCode::MovingMean || op == OpCode::MovingRms; }
+        static bool isMovingExtreme(OpCode op) { return op == OpCode::MovingMax || op == OpCode::MovingMin; }
+
+        // As DelayLine::getMinimumDelay()
+        bool needsNewerSample() const
+        {
+            return options.delayInterpolation == DelayInterpolation::Lagrange3rd
+                || options.delayInterpolation == DelayInterpolation::Thiran;
+        }
+
+        bool isInAheadLoop(int reg) const
+        {
+            const auto& i = instruction(reg);
+            return (i.rate == Rate::Audio && !i.perSample)
+                || (i.rate == Rate::Control && i.op == OpCode::Time && readAtAudioRate[(size_t) reg]);
+        }
+
+        std::string name(int reg, Context context) const
+        {
+            const std::string index = std::to_string(reg);
+
+            switch (instruction(reg).rate)
+            {
+                case Rate::Constant: return "k" + index;
+                case Rate::Block:    return "b" + index;
+                case Rate::Control:
+                    if (context == Context::ControlPoint)
+                        return "c" + index;
+                    if (!isInAheadLoop(reg))
+                        return "control" + index + "[i]";
+                    break;
+                case Rate::Audio:
+                    break;
+            }
+
+            if (instruction(reg).perSample || context == Context::Ahead)
+                return "a" + index;
+
+            return "audio" + index + "[i]";
+        }
+
+        std::string operands(int reg, Context context, std::string& b) const
+        {
+            const auto& i = instruction(reg);
+            b = i.b >= 0 ? name(i.b, context) : sampleType + "(0)";
+            return i.a >= 0 ? name(i.a, context) : sampleType + "(0)";
+        }
+
+        void writeHeader(const std::string& equation)
+        {
+            std::string quoted = equation;
+            std::replace(quoted.begin(), quoted.end(), '\n', ' ');
+
+            out << "// Generated from the ORIGIN equation\n"
+                << "//\n"
+                << "//     " << quoted << "\n"
+                << "//\n"
+                << "// by EquationCodeGenerator. Regenerate rather than edit.\n"
+                << "\n"
+                << "#pragma once\n"
+                << "\n"
+                << "#include <algorithm>\n"
+                << "#include <cmath>\n"
+                << "#include <cstdint>\n"
+                << "#include <limits>\n"
+                << "#include <string_view>\n"
+                << "#include <vector>\n"
+                << "\n"
+                << "class " << options.className << "\n"
+                << "{\n";
+        }
+
+        void writePublic()
+        {
+            const auto& names = program.variableNames;
+
+            out << "public:\n"
+                << "    using SampleType = " << sampleType << ";\n"
+                << "\n"
+                << "    void prepare(double newSampleRate, int newMaxBlockSize)\n"
+                << "    {\n"
+                << "        sampleRate = newSampleRate;\n"
+                << "        maxBlockSize = std::max(newMaxBlockSize, 1);\n";
+
+            if (!names.empty())
+                out << "        setVariable(\"fs\", sampleRate);\n"
+                    << "        setVariable(\"Fs\", sampleRate);\n";
+
+            if (usesHistory)
+            {
+                out << "\n"
+                    << "        maxDelaySize = " << std::max(program.maxDelay, 1) << ";\n";
+                if (program.hasModulatedDelay)
+                    out << "        maxDelaySize = std::max(maxDelaySize, static_cast<int>(std::ceil(" << literal(DSPEngine<float>::maxModulatedDelaySeconds) << " * sampleRate)));\n";
+                out << "        int size = 1;\n"
+                    << "        while (size < maxDelaySize + maxBlockSize + 4)\n"
+                    << "            size <<= 1;\n"
+                    << "        history.assign(static_cast<size_t>(size), SampleType(0));\n"
+                    << "        historyMask = size - 1;\n";
+            }
+
+            if (!interpolated.empty() || !storedForPerSample.empty() || !oscillators.empty())
+                out << "\n";
+            for (int reg : interpolated)
+                out << "        controlPoints" << reg << ".assign(static_cast<size_t>(maxBlockSize / controlInterval + 2), SampleType(0));\n"
+                    << "        controlValues" << reg << ".assign(static_cast<size_t>(maxBlockSize), SampleType(0));\n";
+            for (int reg : storedForPerSample)
+                out << "        audioValues" << reg << ".assign(static_cast<size_t>(maxBlockSize), SampleType(0));\n";
+            for (int reg : oscillators)
+                out << "        oscillatorValues" << reg << ".assign(static_cast<size_t>(maxBlockSize), SampleType(0));\n";
+
+            if (!windows.empty())
+                out << "\n";
+            for (int reg : windows)
+            {
+                const auto& i = instruction(reg);
+                const auto& window = program.windows[(size_t) i.slot];
+                const std::string n = std::to_string(i.slot);
+
+                if (i.op == OpCode::Envelope)
+                {
+                    // As EquationWindows::smoothingCoefficient()
+                    for (auto time : { std::make_pair("attack", window.attack), std::make_pair("release", window.release) })
+                        out << "        " << time.first << n << " = "
+                            << (time.second > 0.0 ? "std::exp(-1.0 / (" + literal(time.second) + " * sampleRate))" : std::string("0.0")) << ";\n";
+                }
+                else
+                {
+                    out << "        window" << n << ".setLength(" << window.length << ");\n";
+                }
+            }
+
+            out << "\n"
+                << "        reset();\n"
+                << "    }\n"
+                << "\n"
+                << "    void reset()\n"
+                << "    {\n"
+                << "        samplePosition = 0;\n";
+            if (usesHistory)
+                out << "        std::fill(history.begin(), history.end(), SampleType(0));\n"
+                    << "        writeIndex = 0;\n";
+            if (hasPerSample)
+                out << "        outputHistory[0] = outputHistory[1] = SampleType(0);\n";
+            for (int reg : modulatedDelays)
+                if (options.delayInterpolation == DelayInterpolation::Thiran)
+                    out << "        allpass" << instruction(reg).slot << " = SampleType(0);\n";
+            for (int reg : windows)
+                out << "        " << (instruction(reg).op == OpCode::Envelope ? "envelope" : "window") << instruction(reg).slot
+                    << (instruction(reg).op == OpCode::Envelope ? " = 0.0;\n" : ".clear();\n");
+            out << "    }\n"
+                << "\n";
+
+            out << "    // Names other than these are ignored; fs and Fs are set by prepare()\n"
+                << "    void setVariable(std::string_view name, double value)\n"
+                << "    {\n";
+            if (names.empty())
+            {
+                out << "        (void) name;\n"
+                    << "        (void) value;\n";
+            }
+            for (size_t i = 0; i < names.size(); ++i)
+                out << "        if (name == \"" << names[i] << "\") variables[" << i << "] = static_cast<SampleType>(value);\n";
+            out << "    }\n"
+                << "\n";
+
+            if (!noiseSources.empty())
+                out << "    // Seeds rand and randn calls without a seed of their own; give each channel its own\n"
+                    << "    void setNoiseSeed(std::uint32_t seed) { noiseSeed = seed; }\n"
+                    << "\n";
+
+            out << "    void process(SampleType* samples, int numSamples)\n"
+                << "    {\n"
+                << "        for (int start = 0; start < numSamples; start += maxBlockSize)\n"
+                << "            processBlock(samples + start, std::min(maxBlockSize, numSamples - start));\n"
+                << "    }\n"
+                << "\n";
+        }
+
+        void writePrivate()
+        {
+            out << "private:\n"
+                << "    static constexpr int controlInterval = " << program.controlInterval << ";\n"
+                << "\n"
+                << "    double sampleRate = 44100.0;\n"
+                << "    int maxBlockSize = 512;\n"
+                << "    std::int64_t samplePosition = 0;\n";
+
+            if (!program.variableNames.empty())
+                out << "    SampleType variables[" << program.variableNames.size() << "] = {};\n";
+            if (usesHistory)
+                out << "    std::vector<SampleType> history;\n"
+                    << "    int historyMask = 0;\n"
+                    << "    int writeIndex = 0;\n"
+                    << "    int maxDelaySize = 1;\n";
+            if (hasPerSample)
+                out << "    SampleType outputHistory[2] = {}; // y_prev, y_prev2\n";
+            if (!noiseSources.empty())
+                out << "    std::uint32_t noiseSeed = 0;\n";
+            for (int reg : modulatedDelays)
+                if (options.delayInterpolation == DelayInterpolation::Thiran)
+                    out << "    SampleType allpass" << instruction(reg).slot << " = SampleType(0);\n";
+            for (int reg : interpolated)
+                out << "    std::vector<SampleType> controlPoints" << reg << ", controlValues" << reg << ";\n";
+            for (int reg : storedForPerSample)
+                out << "    std::vector<SampleType> audioValues" << reg << ";\n";
+            for (int reg : oscillators)
+                out << "    std::vector<SampleType> oscillatorValues" << reg << ";\n";
+
+            writeLookupTables();
+            writeNoiseFunctions();
+            writeOscillatorFunction();
+            writeWindowState();
+
+            if (!interpolated.empty())
+                out << "\n"
+                    << "    // Straight lines between control points, the last of which sits at the end of the block\n"
+                    << "    static void interpolate(const SampleType* points, SampleType* values, int numPoints, int numSamples)\n"
+                    << "    {\n"
+                    << "        for (int point = 0; point + 1 < numPoints; ++point)\n"
+                    << "        {\n"
+                    << "            const int start = point * controlInterval;\n"
+                    << "            const int end = std::min(start + controlInterval, numSamples);\n"
+                    << "            const SampleType value = points[point];\n"
+                    << "            const SampleType step = (points[point + 1] - value) / static_cast<SampleType>(end - start);\n"
+                    << "\n"
+                    << "            for (int i = start; i < end; ++i)\n"
+                    << "                values[i] = value + step * static_cast<SampleType>(i - start);\n"
+                    << "        }\n"
+                    << "    }\n";
+
+            writeProcessBlock();
+            out << "};\n";
+        }
+
+        void writeLookupTables()
+        {
+            for (size_t slot = 0; slot < program.lookupTables.size(); ++slot)
+            {
+                const auto& table = *program.lookupTables[slot];
+                const std::string index = std::to_string(slot);
+
+                out << "\n"
+                    << "    static constexpr float lookupTable" << index << "[" << table.values.size() << "] =\n"
+                    << "    {";
+                for (size_t i = 0; i < table.values.size(); ++i)
+                    out << (i % 8 == 0 ? "\n        " : " ") << floatLiteral(table.values[i]) << (i + 1 < table.values.size() ? "," : "");
+                out << "\n"
+                    << "    };\n";
+
+                // The subtree the table replaced, for inputs outside it
+                out << "\n"
+                    << "    static double exactLookup" << index << "(double x)\n"
+                    << "    {\n";
+                const auto& exact = table.exactProgram;
+                for (size_t i = 0; i < exact.size(); ++i)
+                {
+                    const auto& step = exact[i];
+                    const std::string a = step.a >= 0 ? "r" + std::to_string(step.a) : "0.0";
+                    const std::string b = step.b >= 0 ? "r" + std::to_string(step.b) : "0.0";
+                    out << "        const double r" << i << " = ";
+                    if (step.op == OpCode::Input)
+                        out << "x";
+                    else if (step.op == OpCode::Constant)
+                        out << literal(step.constant);
+                    else
+                        out << applyExpression(step.op, a, b, "double");
+                    out << ";\n";
+                }
+                out << "        return " << (exact.empty() ? std::string("0.0") : "r" + std::to_string(exact.size() - 1)) << ";\n"
+                    << "    }\n";
+            }
+        }
+
+        void writeProcessBlock()
+        {
+            out << "\n"
+                << "    void processBlock(SampleType* samples, int numSamples)\n"
+                << "    {\n";
+
+            for (int i = 0; i < program.getNumRegisters(); ++i)
+                if (usedConstant[(size_t) i])
+                    out << "        const SampleType k" << i << " = static_cast<SampleType>(" << literal(instruction(i).constant) << ");\n";
+
+            if (usesTime)
+                out << "        const double inverseRate = 1.0 / sampleRate;\n";
+
+            if (usesHistory)
+            {
+                out << "\n"
+                    << "        // The block goes into the history first, so z^-0 reads the current sample\n"
+                    << "        for (int i = 0; i < numSamples; ++i)\n"
+                    << "            history[static_cast<size_t>((writeIndex + i) & historyMask)] = samples[i];\n"
+                    << "        writeIndex = (writeIndex + numSamples) & historyMask;\n"
+                    << "        const int historyStart = writeIndex - numSamples;\n"
+                    << "        const SampleType* const historyData = history.data();\n";
+                if (!modulatedDelays.empty())
+                    out << "        const SampleType minDelay = SampleType(" << (needsNewerSample() ? "1" : "0") << ");\n"
+                        << "        const SampleType maxDelay = static_cast<SampleType>(maxDelaySize);\n";
+            }
+
+            bool first = true;
+            for (int i = 0; i < program.getNumRegisters(); ++i)
+            {
+                if (instruction(i).rate != Rate::Block || !usedBlock[(size_t) i])
+                    continue;
+                if (first)
+                    out << "\n";
+                first = false;
+
+                std::string b;
+                const std::string a = operands(i, Context::ControlPoint, b);
+                out << "        const SampleType b" << i << " = " << scalarExpression(i, a, b) << ";\n";
+            }
+
+            writeControlPoints();
+            writeOscillators();
+
+            // Moving sums are indexed by sample position, see EquationWindows::MovingSum
+            bool firstSum = true;
+            for (int reg : windows)
+            {
+                if (!isMovingSum(instruction(reg).op))
+                    continue;
+                out << (firstSum ? "\n" : "") << "        window" << instruction(reg).slot << ".seek(samplePosition);\n";
+                firstSum = false;
+            }
+
+            writeLoops();
+
+            out << "\n"
+                << "        samplePosition += numSamples;\n"
+                << "    }\n";
+        }
+
+        // Block rate and control point values, as DSPEngine::evaluateScalar()
+        std::string scalarExpression(int reg, const std::string& a, const std::string& b) const
+        {
+            const auto& i = instruction(reg);
+            switch (i.op)
+            {
+                case OpCode::Constant: return "static_cast<SampleType>(" + literal(i.constant) + ")";
+                case OpCode::Time:     return "static_cast<SampleType>(time)";
+                case OpCode::Variable: return "variables[" + std::to_string(i.slot) + "]";
+                default:               return applyExpression(i.op, a, b, "SampleType");
+            }
+        }
+
+        void writeControlPoints()
+        {
+            if (interpolated.empty())
+                return;
+
+            out << "\n"
+                << "        const int numPoints = (numSamples + controlInterval - 1) / controlInterval + 1;\n"
+                << "        for (int point = 0; point < numPoints; ++point)\n"
+                << "        {\n"
+                << "            const int offset = std::min(point * controlInterval, numSamples);\n"
+                << "            const double time = static_cast<double>(samplePosition + offset) * inverseRate;\n";
+
+            bool timeUsed = false;
+            for (int i = 0; i < program.getNumRegisters(); ++i)
+            {
+                if (instruction(i).rate != Rate::Control || !neededAtControlPoints[(size_t) i])
+                    continue;
+
+                timeUsed = timeUsed || instruction(i).op == OpCode::Time;
+                std::string b;
+                const std::string a = operands(i, Context::ControlPoint, b);
+                out << "            const SampleType c" << i << " = " << scalarExpression(i, a, b) << ";\n";
+            }
+
+            if (!timeUsed)
+                out << "            (void) time;\n";
+
+            for (int reg : interpolated)
+                out << "            controlPoints" << reg << "[static_cast<size_t>(point)] = c" << reg << ";\n";
+
+            out << "        }\n"
+                << "\n";
+
+            for (int reg : interpolated)
+                out << "        interpolate(controlPoints" << reg << ".data(), controlValues" << reg << ".data(), numPoints, numSamples);\n";
+        }
+
+        // EquationNoise, which DSPEngine uses
+        void writeNoiseFunctions()
+        {
+            if (noiseSources.empty())
+                return;
+
+            out << "\n"
+                << "    // Counter based noise: a hash of the sample position and the stream's key\n"
+                << "    static std::uint32_t noiseHash(std::uint32_t x)\n"
+                << "    {\n"
+                << "        x ^= x >> 16;\n"
+                << "        x *= 0x7feb352du;\n"
+                << "        x ^= x >> 15;\n"
+                << "        x *= 0x846ca68bu;\n"
+                << "        x ^= x >> 16;\n"
+                << "        return x;\n"
+                << "    }\n"
+                << "\n"
+                << "    static std::uint32_t noiseKey(std::uint32_t seed, std::uint32_t stream)\n"
+                << "    {\n"
+                << "        return noiseHash(seed ^ noiseHash(stream + 0x9e3779b9u));\n"
+                << "    }\n"
+                << "\n"
+                << "    static std::uint32_t noiseBlockKey(std::int64_t position, std::uint32_t key)\n"
+                << "    {\n"
+                << "        return key ^ noiseHash(static_cast<std::uint32_t>(static_cast<std::uint64_t>(position) >> 32));\n"
+                << "    }\n"
+                << "\n"
+                << "    static std::uint32_t noiseBits(std::uint32_t counter, std::uint32_t blockKey)\n"
+                << "    {\n"
+                << "        return noiseHash(noiseHash(counter + blockKey) ^ blockKey);\n"
+                << "    }\n";
+        }
+
+        // EquationKernels::oscillator()
+        void writeOscillatorFunction()
+        {
+            if (oscillators.empty())
+                return;
+
+            out << "\n"
+                << "    // sin or cos of phase + step * i by turning four phasors a sample apart,\n"
+                << "    // restarted from the exact phase every " << EquationKernels::oscillatorResyncInterval << " samples\n"
+                << "    static void oscillator(SampleType* output, int numSamples, double phase, double step, bool cosine)\n"
+                << "    {\n"
+                << "        double turnCos[4], turnSin[4];\n"
+                << "        for (int k = 0; k < 4; ++k)\n"
+                << "        {\n"
+                << "            turnCos[k] = std::cos(step * (k + 1));\n"
+                << "            turnSin[k] = std::sin(step * (k + 1));\n"
+                << "        }\n"
+                << "\n"
+                << "        for (int start = 0; start < numSamples; start += " << EquationKernels::oscillatorResyncInterval << ")\n"
+                << "        {\n"
+                << "            const int end = std::min(start + " << EquationKernels::oscillatorResyncInterval << ", numSamples);\n"
+                << "            const double angle = phase + step * start;\n"
+                << "\n"
+                << "            double re[4], im[4];\n"
+                << "            re[0] = std::cos(angle);\n"
+                << "            im[0] = std::sin(angle);\n"
+                << "            for (int k = 1; k < 4; ++k)\n"
+                << "            {\n"
+                << "                re[k] = re[0] * turnCos[k - 1] - im[0] * turnSin[k - 1];\n"
+                << "                im[k] = re[0] * turnSin[k - 1] + im[0] * turnCos[k - 1];\n"
+                << "            }\n"
+                << "\n"
+                << "            const double* values = cosine ? re : im;\n"
+                << "            int i = start;\n"
+                << "            for (; i + 4 <= end; i += 4)\n"
+                << "            {\n"
+                << "                for (int k = 0; k < 4; ++k)\n"
+                << "                {\n"
+                << "                    output[i + k] = static_cast<SampleType>(values[k]);\n"
+                << "                    const double turned = re[k] * turnCos[3] - im[k] * turnSin[3];\n"
+                << "                    im[k] = re[k] * turnSin[3] + im[k] * turnCos[3];\n"
+                << "                    re[k] = turned;\n"
+                << "                }\n"
+                << "            }\n"
+                << "\n"
+                << "            for (int k = 0; i < end; ++i, ++k)\n"
+                << "                output[i] = static_cast<SampleType>(values[k]);\n"
+                << "        }\n"
+                << "    }\n";
+        }
+
+        // EquationWindows::MovingSum and MovingExtreme, and the state of each window
+        void writeWindowState()
+        {
+            if (usesWindow(isMovingSum))
+                out << "\n"
+                    << "    // Sum of the last values pushed. A second sum of the values pushed since the\n"
+                    << "    // ring last wrapped takes over at each wrap after a whole lap, so rounding\n"
+                    << "    // cannot build up; the ring is indexed by sample position\n"
+                    << "    struct MovingSum\n"
+                    << "    {\n"
+                    << "        std::vector<double> ring;\n"
+                    << "        double sum = 0.0, lapSum = 0.0;\n"
+                    << "        int index = 0;\n"
+                    << "        bool lapComplete = true;\n"
+                    << "\n"
+                    << "        void setLength(int length) { ring.assign(static_cast<size_t>(length), 0.0); clear(); }\n"
+                    << "        void clear() { std::fill(ring.begin(), ring.end(), 0.0); sum = lapSum = 0.0; index = 0; lapComplete = true; }\n"
+                    << "\n"
+                    << "        void seek(std::int64_t position)\n"
+                    << "        {\n"
+                    << "            const int newIndex = static_cast<int>(position % static_cast<std::int64_t>(ring.size()));\n"
+                    << "            if (newIndex != index)\n"
+                    << "            {\n"
+                    << "                index = newIndex;\n"
+                    << "                lapSum = 0.0;\n"
+                    << "                lapComplete = false;\n"
+                    << "            }\n"
+                    << "        }\n"
+                    << "\n"
+                    << "        double push(double value)\n"
+                    << "        {\n"
+                    << "            sum += value - ring[static_cast<size_t>(index)];\n"
+                    << "            ring[static_cast<size_t>(index)] = value;\n"
+                    << "            lapSum += value;\n"
+                    << "            if (++index == static_cast<int>(ring.size()))\n"
+                    << "            {\n"
+                    << "                if (lapComplete)\n"
+                    << "                    sum = lapSum;\n"
+                    << "                index = 0;\n"
+                    << "                lapSum = 0.0;\n"
+                    << "                lapComplete = true;\n"
+                    << "            }\n"
+                    << "            return sum;\n"
+                    << "        }\n"
+                    << "\n"
+                    << "        double pushMean(double value) { return push(value) / static_cast<double>(ring.size()); }\n"
+                    << "        double pushRms(double value) { return std::sqrt(std::max(push(value * value), 0.0) / static_cast<double>(ring.size())); }\n"
+                    << "    };\n";
+
+            if (usesWindow(isMovingExtreme))
+                out << "\n"
+                    << "    // Largest or smallest of the last values pushed, from a queue of the values\n"
+                    << "    // that can still become it; the silence before the start is one entry\n"
+                    << "    struct MovingExtreme\n"
+                    << "    {\n"
+                    << "        std::vector<SampleType> values;\n"
+                    << "        std::vector<std::int64_t> ages;\n"
+                    << "        int length = 1, mask = 0, head = 0, tail = 0;\n"
+                    << "        std::int64_t count = 0;\n"
+                    << "\n"
+                    << "        void setLength(int newLength)\n"
+                    << "        {\n"
+                    << "            length = newLength;\n"
+                    << "            int size = 1;\n"
+                    << "            while (size < length + 1)\n"
+                    << "                size <<= 1;\n"
+                    << "            values.assign(static_cast<size_t>(size), SampleType(0));\n"
+                    << "            ages.assign(static_cast<size_t>(size), 0);\n"
+                    << "            mask = size - 1;\n"
+                    << "            clear();\n"
+                    << "        }\n"
+                    << "\n"
+                    << "        void clear()\n"
+                    << "        {\n"
+                    << "            values[0] = SampleType(0);\n"
+                    << "            ages[0] = -1;\n"
+                    << "            head = 0;\n"
+                    << "            tail = 1;\n"
+                    << "            count = 0;\n"
+                    << "        }\n"
+                    << "\n"
+                    << "        template <bool Maximum>\n"
+                    << "        SampleType push(SampleType value)\n"
+                    << "        {\n"
+                    << "            if (head != tail && ages[static_cast<size_t>(head)] <= count - length)\n"
+                    << "                head = (head + 1) & mask;\n"
+                    << "            while (head != tail && !(Maximum ? values[static_cast<size_t>((tail - 1) & mask)] > value\n"
+                    << "                                             : values[static_cast<size_t>((tail - 1) & mask)] < value))\n"
+                    << "                tail = (tail - 1) & mask;\n"
+                    << "            values[static_cast<size_t>(tail)] = value;\n"
+                    << "            ages[static_cast<size_t>(tail)] = count++;\n"
+                    << "            tail = (tail + 1) & mask;\n"
+                    << "            return values[static_cast<size_t>(head)];\n"
+                    << "        }\n"
+                    << "    };\n";
+
+            // After the types they use
+            if (!windows.empty())
+                out << "\n";
+            for (int reg : windows)
+            {
+                const auto& i = instruction(reg);
+                if (i.op == OpCode::Envelope)
+                    out << "    double envelope" << i.slot << " = 0.0, attack" << i.slot << " = 0.0, release" << i.slot << " = 0.0;\n";
+                else
+                    out << "    " << (isMovingSum(i.op) ? "MovingSum" : "MovingExtreme") << " window" << i.slot << ";\n";
+            }
+        }
+
+        std::string phaseValue(int reg) const
+        {
+            if (reg < 0)
+                return "0.0";
+
+            return instruction(reg).rate == Rate::Constant ? literal(instruction(reg).constant) : "phase" + std::to_string(reg);
+        }
+
+        std::string phaseSlope(int reg) const
+        {
+            return reg >= 0 && instruction(reg).rate != Rate::Constant ? "slope" + std::to_string(reg) : "0.0";
+        }
+
+        // Each oscillator's block, from its phase at the block's start in
+        // double, as DSPEngine::evaluatePhase()
+        void writeOscillators()
+        {
+            if (oscillators.empty())
+                return;
+
+            out << "\n"
+                << "        const double phaseTime = static_cast<double>(samplePosition) * inverseRate;\n";
+
+            for (int reg = 0; reg < program.getNumRegisters(); ++reg)
+            {
+                const auto& i = instruction(reg);
+                if (!neededForPhase[(size_t) reg] || i.rate == Rate::Constant)
+                    continue;
+
+                const std::string a = phaseValue(i.a), b = phaseValue(i.b);
+                const std::string slopeA = phaseSlope(i.a), slopeB = phaseSlope(i.b);
+                std::string value, slope;
+
+                switch (i.op)
+                {
+                    case OpCode::Time:     value = "phaseTime"; slope = "1.0"; break;
+                    case OpCode::Variable: value = "static_cast<double>(variables[" + std::to_string(i.slot) + "])"; slope = "0.0"; break;
+                    case OpCode::Negate:   value = "-" + a; slope = "-" + slopeA; break;
+                    case OpCode::Add:      value = a + " + " + b; slope = slopeA + " + " + slopeB; break;
+                    case OpCode::Subtract: value = a + " - " + b; slope = slopeA + " - " + slopeB; break;
+                    case OpCode::Multiply: value = a + " * " + b; slope = slopeA + " * " + b + " + " + a + " * " + slopeB; break;
+                    case OpCode::Divide:
+                        value = applyExpression(i.op, a, b, "double");
+                        slope = "(" + b + " != 0.0) ? " + slopeA + " / " + b + " : 0.0";
+                        break;
+                    default:
+                        value = applyExpression(i.op, a, b, "double");
+                        slope = "0.0";
+                        break;
+                }
+
+                out << "        const double phase" << reg << " = " << value << ";\n"
+                    << "        const double slope" << reg << " = " << slope << ";\n";
+            }
+
+            for (int reg : oscillators)
+            {
+                const auto& i = instruction(reg);
+                out << "        oscillator(oscillatorValues" << reg << ".data(), numSamples, " << phaseValue(i.a) << ", "
+                    << phaseSlope(i.a) << " * inverseRate, " << (i.slot == 1 ? "true" : "false") << ");\n";
+            }
+        }
+
+        void writeNoiseKeys()
+        {
+            if (noiseSources.empty())
+                return;
+
+            // The key changes with the position's high half, which can tick over mid-block
+            out << "\n"
+                << "        const auto noiseLow = static_cast<std::uint32_t>(static_cast<std::uint64_t>(samplePosition));\n"
+                << "        const std::int64_t noiseWrap = 0x100000000ll - noiseLow;\n";
+
+            for (int reg : noiseSources)
+            {
+                const auto& i = instruction(reg);
+                const std::string n = std::to_string(reg);
+                const std::string key = std::isnan(i.constant)
+                    ? "noiseKey(noiseHash(noiseSeed), " + std::to_string(i.slot) + "u)"
+                    : "noiseKey(" + std::to_string(static_cast<std::uint32_t>(i.constant)) + "u, " + (i.op == OpCode::Randn ? "1u" : "0u") + ")";
+
+                out << "        const std::uint32_t key" << n << " = " << key << ";\n"
+                    << "        const std::uint32_t keyBefore" << n << " = noiseBlockKey(samplePosition, key" << n << ");\n"
+                    << "        const std::uint32_t keyAfter" << n << " = noiseBlockKey(samplePosition + numSamples - 1, key" << n << ");\n";
+            }
+        }
+
+        void writeLoops()
+        {
+            writeNoiseKeys();
+            out << "\n";
+            for (int reg : interpolated)
+                out << "        const SampleType* const control" << reg << " = controlValues" << reg << ".data();\n";
+            for (int reg : storedForPerSample)
+                out << "        SampleType* const audio" << reg << " = audioValues" << reg << ".data();\n";
+            for (int reg : oscillators)
+                out << "        const SampleType* const oscillator" << reg << " = oscillatorValues" << reg << ".data();\n";
+            for (int reg : modulatedDelays)
+                if (options.delayInterpolation == DelayInterpolation::Thiran)
+                    out << "        SampleType allpassState" << instruction(reg).slot << " = allpass" << instruction(reg).slot << ";\n";
+
+            // Everything that does not wait on y_prev runs ahead over the block
+            std::vector<int> ahead;
+            for (int i = 0; i < program.getNumRegisters(); ++i)
+                if (isInAheadLoop(i))
+                    ahead.push_back(i);
+
+            if (!ahead.empty() || !hasPerSample)
+            {
+                out << "\n"
+                    << "        for (int i = 0; i < numSamples; ++i)\n"
+                    << "        {\n";
+                for (int reg : ahead)
+                {
+                    writeAudioInstruction(reg, Context::Ahead);
+                    if (readPerSample[(size_t) reg])
+                        out << "            audio" << reg << "[i] = a" << reg << ";\n";
+                }
+                if (!hasPerSample)
+                    out << "            samples[i] = " << name(program.outputRegister, Context::Ahead) << ";\n";
+                out << "        }\n";
+            }
+
+            if (hasPerSample)
+            {
+                out << "\n"
+                    << "        // Feedback: only what reads y_prev is stepped a sample at a time\n"
+                    << "        SampleType y1 = outputHistory[0], y2 = outputHistory[1];\n"
+                    << "        for (int i = 0; i < numSamples; ++i)\n"
+                    << "        {\n";
+                for (int reg = 0; reg < program.getNumRegisters(); ++reg)
+                    if (instruction(reg).rate == Rate::Audio && instruction(reg).perSample)
+                        writeAudioInstruction(reg, Context::PerSample);
+                out << "            const SampleType output = " << name(program.outputRegister, Context::PerSample) << ";\n"
+                    << "            samples[i] = output;\n"
+                    << "            y2 = y1;\n"
+                    << "            y1 = output;\n"
+                    << "        }\n"
+                    << "        outputHistory[0] = y1;\n"
+                    << "        outputHistory[1] = y2;\n";
+            }
+
+            for (int reg : modulatedDelays)
+                if (options.delayInterpolation == DelayInterpolation::Thiran)
+                    out << "        allpass" << instruction(reg).slot << " = allpassState" << instruction(reg).slot << ";\n";
+        }
+
+        void writeAudioInstruction(int reg, Context context)
+        {
+            const auto& i = instruction(reg);
+            const std::string result = "a" + std::to_string(reg);
+            std::string b;
+            const std::string a = operands(reg, context, b);
+            const std::string indent = "            ";
+
+            switch (i.op)
+            {
+                case OpCode::Input:
+                    out << indent << "const SampleType " << result << " = samples[i];\n";
+                    return;
+
+                case OpCode::Time:
+                    out << indent << "const SampleType " << result << " = static_cast<SampleType>(static_cast<double>(samplePosition + i) * inverseRate);\n";
+                    return;
+
+                case OpCode::Variable:
+                    out << indent << "const SampleType " << result << " = variables[" << i.slot << "];\n";
+                    return;
+
+                case OpCode::OutputHistory:
+                    out << indent << "const SampleType " << result << " = " << (i.slot == 1 ? "y1" : "y2") << ";\n";
+                    return;
+
+                case OpCode::Delay:
+                    out << indent << "const SampleType " << result << " = historyData[(historyStart + i - "
+                        << static_cast<int>(i.constant) << ") & historyMask];\n";
+                    return;
+
+                case OpCode::ModulatedDelay:
+                    writeModulatedDelay(reg, a);
+                    return;
+
+                case OpCode::Lookup:
+                    writeLookup(reg, a, context);
+                    return;
+
+                case OpCode::Rand:
+                case OpCode::Randn:
+                    writeNoise(reg);
+                    return;
+
+                case OpCode::Oscillator:
+                    out << indent << "const SampleType " << result << " = oscillator" << reg << "[i];\n";
+                    return;
+
+                case OpCode::MovingMean:
+                case OpCode::MovingRms:
+                    out << indent << "const SampleType " << result << " = static_cast<SampleType>(window" << i.slot
+                        << (i.op == OpCode::MovingRms ? ".pushRms" : ".pushMean") << "(static_cast<double>(" << a << ")));\n";
+                    return;
+
+                case OpCode::MovingMax:
+                case OpCode::MovingMin:
+                    out << indent << "const SampleType " << result << " = window" << i.slot
+                        << (i.op == OpCode::MovingMax ? ".push<true>(" : ".push<false>(") << a << ");\n";
+                    return;
+
+                case OpCode::Envelope:
+                {
+                    // As EquationWindows::followEnvelope()
+                    const std::string n = std::to_string(i.slot), level = "level" + std::to_string(reg);
+                    out << indent << "const double " << level << " = std::abs(static_cast<double>(" << a << "));\n"
+                        << indent << "envelope" << n << " = " << level << " + (" << level << " > envelope" << n << " ? attack" << n
+                        << " : release" << n << ") * (envelope" << n << " - " << level << ");\n"
+                        << indent << "const SampleType " << result << " = static_cast<SampleType>(envelope" << n << ");\n";
+                    return;
+                }
+
+                default:
+                    out << indent << "const SampleType " << result << " = " << applyExpression(i.op, a, b, "SampleType") << ";\n";
+                    return;
+            }
+        }
+
+        // DelayLine's readers, for the interpolation baked in
+        void writeModulatedDelay(int reg, const std::string& delay)
+        {
+            const std::string n = std::to_string(reg);
+            const std::string indent = "            ";
+            const std::string at = "historyData[(index" + n;
+
+            out << indent << "const SampleType delay" << n << " = std::min(maxDelay, std::max(minDelay, " << delay << "));\n";
+
+            switch (options.delayInterpolation)
+            {
+                case DelayInterpolation::None:
+                    out << indent << "const SampleType a" << n << " = historyData[(historyStart + i - static_cast<int>(delay" << n << ")) & historyMask];\n";
+                    break;
+
+                case DelayInterpolation::Linear:
+                    out << indent << "const int whole" << n << " = static_cast<int>(delay" << n << ");\n"
+                        << indent << "const SampleType frac" << n << " = delay" << n << " - static_cast<SampleType>(whole" << n << ");\n"
+                        << indent << "const int index" << n << " = historyStart + i - whole" << n << ";\n"
+                        << indent << "const SampleType a" << n << " = " << at << ") & historyMask] + frac" << n
+                        << " * (" << at << " - 1) & historyMask] - " << at << ") & historyMask]);\n";
+                    break;
+
+                case DelayInterpolation::Lagrange3rd:
+                    out << indent << "const int whole" << n << " = static_cast<int>(delay" << n << ") - 1;\n"
+                        << indent << "const SampleType frac" << n << " = delay" << n << " - static_cast<SampleType>(whole" << n << ");\n"
+                        << indent << "const int index" << n << " = historyStart + i - whole" << n << ";\n"
+                        << indent << "const SampleType d1_" << n << " = frac" << n << " - SampleType(1.0), d2_" << n << " = frac" << n
+                        << " - SampleType(2.0), d3_" << n << " = frac" << n << " - SampleType(3.0);\n"
+                        << indent << "const SampleType a" << n << " = " << at << ") & historyMask] * (-d1_" << n << " * d2_" << n << " * d3_" << n << " / SampleType(6.0))\n"
+                        << indent << "    + frac" << n << " * (" << at << " - 1) & historyMask] * (d2_" << n << " * d3_" << n << " * SampleType(0.5))\n"
+                        << indent << "        + " << at << " - 2) & historyMask] * (-d1_" << n << " * d3_" << n << " * SampleType(0.5))\n"
+                        << indent << "        + " << at << " - 3) & historyMask] * (d1_" << n << " * d2_" << n << " / SampleType(6.0)));\n";
+                    break;
+
+                case DelayInterpolation::Thiran:
+                {
+                    const std::string state = "allpassState" + std::to_string(instruction(reg).slot);
+                    out << indent << "int whole" << n << " = static_cast<int>(delay" << n << ");\n"
+                        << indent << "SampleType frac" << n << " = delay" << n << " - static_cast<SampleType>(whole" << n << ");\n"
+                        << indent << "if (frac" << n << " < SampleType(0.618) && whole" << n << " >= 1)\n"
+                        << indent << "{\n"
+                        << indent << "    frac" << n << " += SampleType(1.0);\n"
+                        << indent << "    --whole" << n << ";\n"
+                        << indent << "}\n"
+                        << indent << "const SampleType alpha" << n << " = (SampleType(1.0) - frac" << n << ") / (SampleType(1.0) + frac" << n << ");\n"
+                        << indent << "const int index" << n << " = historyStart + i - whole" << n << ";\n"
+                        << indent << state << " = " << at << " - 1) & historyMask] + alpha" << n << " * (" << at << ") & historyMask] - " << state << ");\n"
+                        << indent << "const SampleType a" << n << " = " << state << ";\n";
+                    break;
+                }
+            }
+        }
+
+        // EquationNoise::uniform() and gaussian()
+        void writeNoise(int reg)
+        {
+            const std::string n = std::to_string(reg);
+            const std::string indent = "            ";
+            const std::string step = "SampleType(1.0 / 16777216.0)";
+
+            out << indent << "const std::uint32_t bits" << n << " = noiseBits(noiseLow + static_cast<std::uint32_t>(i), i < noiseWrap ? keyBefore"
+                << n << " : keyAfter" << n << ");\n";
+
+            if (instruction(reg).op == OpCode::Rand)
+            {
+                out << indent << "const SampleType a" << n << " = static_cast<SampleType>(bits" << n << " >> 8) * " << step << ";\n";
+                return;
+            }
+
+            out << indent << "const SampleType radius" << n << " = (static_cast<SampleType>(bits" << n << " >> 8) + SampleType(1)) * " << step << ";\n"
+                << indent << "const SampleType angle" << n << " = static_cast<SampleType>(noiseHash(bits" << n << " ^ 0x5bd1e995u) >> 8) * " << step << ";\n"
+                << indent << "const SampleType a" << n << " = std::sqrt(SampleType(-2) * std::log(radius" << n
+                << ")) * std::cos(SampleType(6.283185307179586) * angle" << n << ");\n";
+        }
+
+        // The block path interpolates in SampleType and the per-sample path
+        // in double, as DSPEngine's two paths do
+        void writeLookup(int reg, const std::string& input, Context context)
+        {
+            const auto& table = *program.lookupTables[(size_t) instruction(reg).slot];
+            const std::string n = std::to_string(reg);
+            const std::string values = "lookupTable" + std::to_string(instruction(reg).slot);
+            const std::string exact = "exactLookup" + std::to_string(instruction(reg).slot);
+            const std::string type = context == Context::Ahead ? std::string("SampleType") : std::string("double");
+            const std::string min = floatLiteral(table.inputMin), max = floatLiteral(table.inputMax);
+            const std::string indent = "            ";
+
+            out << indent << "const SampleType in" << n << " = " << input << ";\n"
+                << indent << "const " << type << " position" << n << " = (std::max(static_cast<" << type << ">(" << min << "), std::min(static_cast<"
+                << type << ">(" << max << "), static_cast<" << type << ">(in" << n << "))) - static_cast<" << type << ">(" << min << ")) * static_cast<"
+                << type << ">(" << floatLiteral(table.scale) << ");\n"
+                << indent << "const int index" << n << " = std::min(static_cast<int>(position" << n << "), " << static_cast<int>(table.values.size()) - 2 << ");\n"
+                << indent << "const " << type << " frac" << n << " = position" << n << " - static_cast<" << type << ">(index" << n << ");\n";
+
+            const std::string interpolatedValue = values + "[index" + n + "] + frac" + n + " * (" + values + "[index" + n + " + 1] - " + values + "[index" + n + "])";
+            if (table.exactOutsideRange)
+                out << indent << "const SampleType a" << n << " = (in" << n << " < " << min << " || in" << n << " > " << max << ")\n"
+                    << indent << "    ? static_cast<SampleType>(" << exact << "(static_cast<double>(in" << n << ")))\n"
+                    << indent << "    : static_cast<SampleType>(" << interpolatedValue << ");\n";
+            else
+                out << indent << "const SampleType a" << n << " = static_cast<SampleType>(" << interpolatedValue << ");\n";
+        }
+    };
+}
+
+namespace EquationCodeGenerator
+{
+    std::string generate(const CompiledEquation& program, const std::string& equation, const Options& options)
+    {
+        return Generator(program, options).run(equation);
+    }
+
+    bool generate(const std::string& equation, const Options& options, std::string& source, std::string& errorMessage)
+    {
+        if (!isIdentifier(options.className))
+        {
+            errorMessage = "'" + options.className + "' is not a valid class name";
+            return false;
+        }
+
+        auto program = EquationCache::getInstance().getOrCompile(equation, options.compilerOptions, errorMessage);
+        if (program == nullptr)
+            return false;
+
+        source = generate(*program, equation, options);
+        return true;
+    }
+}
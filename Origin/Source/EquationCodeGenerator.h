@@ -0,0 +1,47 @@
+#pragma once
+
+#include "EquationCompiler.h"
+#include "DSPEngine.h"
+#include <string>
+
+// Ahead-of-time form of an equation, for effects that ship with a fixed
+// one: a self-contained C++ class with no parser, compiler or instruction
+// dispatch left in it, and no dependency on JUCE or on this code.
+//
+// The class is generated from the compiled program and runs it the way
+// DSPEngine's general path does. Constants are written in as literals and
+// lookup tables as arrays; block and control rate values and oscillator
+// phases are worked out once per block and at control points as DSPEngine
+// does; every audio rate instruction that can run ahead over the block goes
+// into one fused loop for the compiler to vectorise, and the part that
+// reads y_prev into a second loop stepped a sample at a time. Comparisons,
+// min, max and ifelse are written as selects rather than branches, though
+// GCC without -fno-trapping-math (which -ffast-math implies) still branches
+// around arithmetic only one side of an ifelse uses. Moving windows and
+// envelope followers are members stepped in whichever loop reads them. Fed
+// the same blocks, its output matches DSPEngine's to rounding (the engine's
+// kernels compute the same sums in another order); Codegen --verify checks
+// that over a fixed set of equations. The engine's stability guard and
+// silence skipping are left out; a frozen effect is expected to be stable.
+//
+// The generated class has prepare(sampleRate, maxBlockSize), reset(),
+// setVariable(name, value) and process(samples, numSamples), and
+// setNoiseSeed(seed) when the equation uses rand or randn.
+namespace EquationCodeGenerator
+{
+    struct Options
+    {
+        std::string className = "FrozenEquation";
+        bool doublePrecision = false;
+        DelayInterpolation delayInterpolation = DelayInterpolation::Linear; // Baked in for z^-(expr)
+        EquationCompiler::Options compilerOptions;
+    };
+
+    // Compiles equation with options.compilerOptions and generates its
+    // class. Returns false with errorMessage set when it does not parse or
+    // className is not a C++ identifier.
+    bool generate(const std::string& equation, const Options& options, std::string& source, std::string& errorMessage);
+
+    // From a program compiled elsewhere; equation is only quoted in a comment
+    std::string generate(const CompiledEquation& program, const std::string& equation, const Options& options);
+}
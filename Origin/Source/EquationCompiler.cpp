@@ -0,0 +1,1398 @@
+#include "EquationCompiler.h"
+#include "SharedResources.h"
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+    // Something that parsed but cannot be compiled, and the offset in the
+    // equation text of the node it was found in
+    struct CompileError : std::runtime_error
+    {
+        CompileError(const std::string& message, size_t where)
+            : std::runtime_error(message), position(where) {}
+
+        size_t position;
+    };
+}
+
+const char* CompiledEquation::getKernelName(KernelShape shape)
+{
+    switch (shape)
+    {
+        case KernelShape::Gain:         return "gain";
+        case KernelShape::Fir:          return "FIR";
+        case KernelShape::Comb:         return "comb";
+        case KernelShape::OnePole:      return "one-pole";
+        case KernelShape::FeedbackComb: return "feedback comb";
+        case KernelShape::TwoPole:      return "two-pole";
+        case KernelShape::DryWet:       return "dry/wet";
+        case KernelShape::General:      break;
+    }
+
+    return "general";
+}
+
+bool CompiledEquation::isWindow(OpCode op)
+{
+    return op == OpCode::MovingMean || op == OpCode::MovingRms || op == OpCode::MovingMax
+        || op == OpCode::MovingMin || op == OpCode::Envelope;
+}
+
+const char* CompiledEquation::getOpName(OpCode op)
+{
+    switch (op)
+    {
+        case OpCode::Constant:       return "constant";
+        case OpCode::Input:          return "x";
+        case OpCode::Time:           return "t";
+        case OpCode::Variable:       return "variable";
+        case OpCode::OutputHistory:  return "y_prev";
+        case OpCode::Delay:          return "delay";
+        case OpCode::ModulatedDelay: return "modulated delay";
+        case OpCode::Negate:         return "negate";
+        case OpCode::Add:            return "+";
+        case OpCode::Subtract:       return "-";
+        case OpCode::Multiply:       return "*";
+        case OpCode::Divide:         return "/";
+        case OpCode::Power:          return "^";
+        case OpCode::Sin:            return "sin";
+        case OpCode::Cos:            return "cos";
+        case OpCode::Tan:            return "tan";
+        case OpCode::Exp:            return "exp";
+        case OpCode::Log:            return "log";
+        case OpCode::Log10:          return "log10";
+        case OpCode::Sqrt:           return "sqrt";
+        case OpCode::Abs:            return "abs";
+        case OpCode::Filter:         return "filter";
+        case OpCode::Lookup:         return "lookup table";
+        case OpCode::Rand:           return "rand";
+        case OpCode::Randn:          return "randn";
+        case OpCode::Oscillator:     return "oscillator";
+        case OpCode::MovingMean:     return "movmean";
+        case OpCode::MovingRms:      return "movrms";
+        case OpCode::MovingMax:      return "movmax";
+        case OpCode::MovingMin:      return "movmin";
+        case OpCode::Envelope:       return "envelope";
+        case OpCode::Less:           return "<";
+        case OpCode::LessEqual:      return "<=";
+        case OpCode::Equal:          return "==";
+        case OpCode::NotEqual:       return "~=";
+        case OpCode::Min:            return "min";
+        case OpCode::Max:            return "max";
+        case OpCode::Sign:           return "sign";
+        case OpCode::Select:         return "select";
+        case OpCode::SelectNot:      return "select not";
+    }
+
+    return "?";
+}
+
+std::size_t CompiledEquation::getMemoryUsage() const
+{
+    std::size_t bytes = sizeof(CompiledEquation)
+                      + instructions.capacity() * sizeof(Instruction)
+                      + lookupTables.capacity() * sizeof(lookupTables[0])
+                      + windows.capacity() * sizeof(Window)
+                      + kernel.tapDelays.capacity() * sizeof(int)
+                      + kernel.tapCoefficients.capacity() * sizeof(Coefficient);
+
+    for (const auto& name : variableNames)
+        bytes += sizeof(name) + name.capacity();
+
+    return bytes;
+}
+
+std::size_t CompiledEquation::LookupTable::getMemoryUsage() const
+{
+    return sizeof(LookupTable) + values.capacity() * sizeof(float) + exactProgram.capacity() * sizeof(Instruction);
+}
+
+double CompiledEquation::LookupTable::lookup(double x) const
+{
+    // min/max in this order also map NaN onto the range
+    double clamped = std::max<double>(inputMin, std::min<double>(inputMax, x));
+    double position = (clamped - inputMin) * scale;
+    int index = std::min(static_cast<int>(position), static_cast<int>(values.size()) - 2);
+    double frac = position - static_cast<double>(index);
+    return values[(size_t) index] + frac * (values[(size_t) index + 1] - values[(size_t) index]);
+}
+
+double CompiledEquation::LookupTable::evaluateExact(double x) const
+{
+    double registers[maxLookupSubtreeSize];
+    const int numInstructions = std::min(static_cast<int>(exactProgram.size()), maxLookupSubtreeSize);
+
+    for (int i = 0; i < numInstructions; ++i)
+    {
+        const auto& instruction = exactProgram[(size_t) i];
+
+        if (instruction.op == OpCode::Input)
+            registers[i] = x;
+        else if (instruction.op == OpCode::Constant)
+            registers[i] = instruction.constant;
+        else
+            registers[i] = apply(instruction.op,
+                                 instruction.a >= 0 ? registers[instruction.a] : 0.0,
+                                 instruction.b >= 0 ? registers[instruction.b] : 0.0);
+    }
+
+    return numInstructions > 0 ? registers[numInstructions - 1] : 0.0;
+}
+
+std::string CompiledEquation::LookupTable::makeSharingKey(int size, float inputMin, float inputMax, bool exactOutsideRange,
+                                                         const std::vector<Instruction>& exactProgram)
+{
+    std::ostringstream key;
+    key << std::hexfloat << size << ' ' << inputMin << ' ' << inputMax << ' ' << exactOutsideRange;
+    for (const auto& instruction : exactProgram)
+        key << ';' << static_cast<int>(instruction.op) << ' ' << instruction.a << ' ' << instruction.b << ' '
+            << instruction.slot << ' ' << instruction.constant;
+
+    return key.str();
+}
+
+std::shared_ptr<const CompiledEquation> EquationCompiler::compile(const MatlabParser::ASTNode& root)
+{
+    program = std::make_shared<CompiledEquation>();
+    numNoiseStreams = 0;
+    errorMessage.clear();
+    errorPosition = -1;
+
+    try
+    {
+        program->outputRegister = compileNode(root);
+    }
+    catch (const CompileError& e)
+    {
+        errorMessage = e.what();
+        errorPosition = static_cast<int>(e.position);
+        program.reset();
+        return nullptr;
+    }
+
+    reduceStrength();
+    removeUnusedInstructions();
+
+    bakeLookupTables();
+    removeUnusedInstructions();
+
+    classifyRates();
+    matchKernel();
+
+    std::shared_ptr<const CompiledEquation> result = std::move(program);
+    program.reset();
+    return result;
+}
+
+int EquationCompiler::compileNode(const MatlabParser::ASTNode& node)
+{
+    // Whatever this node emits points back at its text; its children set
+    // their own and hand this one back on the way out
+    const auto* outerNode = sourceNode;
+    sourceNode = &node;
+    const int reg = compileNodeBody(node);
+    sourceNode = outerNode;
+    return reg;
+}
+
+void EquationCompiler::fail(const std::string& message) const
+{
+    throw CompileError(message, sourceNode != nullptr ? sourceNode->position : 0);
+}
+
+int EquationCompiler::compileNodeBody(const MatlabParser::ASTNode& node)
+{
+    using Type = MatlabParser::ASTNode::Type;
+
+    switch (node.type)
+    {
+        case Type::Number:
+            return emitConstant(node.numericValue);
+
+        case Type::Variable:
+        {
+            CompiledEquation::Instruction instruction;
+
+            if (node.value == "x")
+            {
+                instruction.op = OpCode::Input;
+            }
+            else if (node.value == "t")
+            {
+                instruction.op = OpCode::Time;
+            }
+            else if (node.value == "y_prev" || node.value == "y_prev2")
+            {
+                instruction.op = OpCode::OutputHistory;
+                instruction.slot = node.value == "y_prev" ? 1 : 2;
+                program->usesOutputFeedback = true;
+            }
+            else if (node.value == "pi")
+            {
+                return emitConstant(M_PI);
+            }
+            else if (node.value == "e")
+            {
+                return emitConstant(M_E);
+            }
+            else
+            {
+                // Unknown names become variables that default to 0 until set
+                instruction.op = OpCode::Variable;
+                instruction.slot = variableSlot(node.value);
+            }
+            return emit(instruction);
+        }
+
+        case Type::Delay:
+        {
+            CompiledEquation::Instruction instruction;
+
+            if (node.children.empty())
+            {
+                if (node.delayAmount <= 0)
+                {
+                    instruction.op = OpCode::Input;
+                    return emit(instruction);
+                }
+
+                instruction.op = OpCode::Delay;
+                instruction.constant = static_cast<double>(node.delayAmount);
+                program->maxDelay = std::max(program->maxDelay, node.delayAmount);
+            }
+            else
+            {
+                int length = compileNode(*node.children[0]);
+
+                if (isConstant(length))
+                {
+                    // Checked before clamping, since std::max lets NaN through
+                    const double requested = program->instructions[(size_t) length].constant;
+                    if (std::isnan(requested))
+                        fail("Delay length is not a number");
+                    if (requested > MatlabParser::maxDelayLength)
+                        fail("Delays can be at most " + std::to_string(MatlabParser::maxDelayLength) + " samples long");
+
+                    double samples = std::max(requested, 0.0);
+                    program->maxDelay = std::max(program->maxDelay, static_cast<int>(std::ceil(samples)));
+
+                    if (samples == std::floor(samples))
+                    {
+                        if (samples == 0.0)
+                        {
+                            instruction.op = OpCode::Input;
+                            return emit(instruction);
+                        }
+
+                        instruction.op = OpCode::Delay;
+                        instruction.constant = samples;
+                    }
+                    else
+                    {
+                        instruction.op = OpCode::ModulatedDelay;
+                        instruction.a = length;
+                    }
+                }
+                else
+                {
+                    instruction.op = OpCode::ModulatedDelay;
+                    instruction.a = length;
+                    program->hasModulatedDelay = true;
+                }
+            }
+
+            instruction.slot = program->numDelayTaps++;
+            return emit(instruction);
+        }
+
+        case Type::UnaryOp:
+        {
+            if (node.children.size() != 1)
+                return emitConstant(0.0);
+
+            int operand = compileNode(*node.children[0]);
+            if (node.value != "-")
+                return operand;
+
+            CompiledEquation::Instruction instruction;
+            instruction.op = OpCode::Negate;
+            instruction.a = operand;
+            return emit(instruction);
+        }
+
+        case Type::BinaryOp:
+        {
+            if (node.children.size() != 2)
+                return emitConstant(0.0);
+
+            CompiledEquation::Instruction instruction;
+            if      (node.value == "+") instruction.op = OpCode::Add;
+            else if (node.value == "-") instruction.op = OpCode::Subtract;
+            else if (node.value == "*") instruction.op = OpCode::Multiply;
+            else if (node.value == "/") instruction.op = OpCode::Divide;
+            else if (node.value == "^") instruction.op = OpCode::Power;
+            else if (node.value == "<" || node.value == ">") instruction.op = OpCode::Less;
+            else if (node.value == "<=" || node.value == ">=") instruction.op = OpCode::LessEqual;
+            else if (node.value == "==") instruction.op = OpCode::Equal;
+            else if (node.value == "~=" || node.value == "!=") instruction.op = OpCode::NotEqual;
+            else return emitConstant(0.0); // Unknown operator
+
+            instruction.a = compileNode(*node.children[0]);
+            instruction.b = compileNode(*node.children[1]);
+
+            // a > b is b < a; the operands are still compiled in the order written
+            if (node.value == ">" || node.value == ">=")
+                std::swap(instruction.a, instruction.b);
+
+            return emit(instruction);
+        }
+
+        case Type::Function:
+            return compileFunction(node);
+
+        default:
+            return emitConstant(0.0);
+    }
+}
+
+int EquationCompiler::compileFunction(const MatlabParser::ASTNode& node)
+{
+    static const std::pair<const char*, OpCode> unaryFunctions[] = {
+        { "sin", OpCode::Sin }, { "cos", OpCode::Cos }, { "tan", OpCode::Tan },
+        { "exp", OpCode::Exp }, { "log", OpCode::Log }, { "log10", OpCode::Log10 },
+        { "sqrt", OpCode::Sqrt }, { "abs", OpCode::Abs }, { "sign", OpCode::Sign }
+    };
+
+    CompiledEquation::Instruction instruction;
+
+    if (node.value == "rand" || node.value == "randn")
+    {
+        // Each call is its own stream. A seed (the parser only allows a
+        // number) makes it the same in every engine and every run; without
+        // one it comes from the engine's seed, see DSPEngine::setNoiseSeed().
+        instruction.op = node.value == "rand" ? OpCode::Rand : OpCode::Randn;
+        instruction.slot = numNoiseStreams++;
+        instruction.constant = std::numeric_limits<double>::quiet_NaN();
+
+        if (!node.children.empty())
+        {
+            const double seed = node.children[0]->numericValue;
+            instruction.constant = std::isfinite(seed) ? std::fmod(std::floor(std::abs(seed)), 4294967296.0) : 0.0;
+        }
+
+        return emit(instruction);
+    }
+
+    if (node.children.empty())
+        return emitConstant(0.0);
+
+    static const std::pair<const char*, OpCode> windowFunctions[] = {
+        { "movmean", OpCode::MovingMean }, { "movrms", OpCode::MovingRms },
+        { "movmax", OpCode::MovingMax }, { "movmin", OpCode::MovingMin }
+    };
+
+    // The parser only allows numbers for the length and times, since the
+    // engine's state is sized from them
+    for (const auto& function : windowFunctions)
+    {
+        if (node.value == function.first && node.children.size() == 2)
+        {
+            CompiledEquation::Window window;
+            window.length = static_cast<int>(std::min<double>(std::max(node.children[1]->numericValue, 1.0),
+                                                              MatlabParser::maxWindowLength));
+            instruction.op = function.second;
+            instruction.a = compileNode(*node.children[0]);
+            instruction.slot = static_cast<int>(program->windows.size());
+            program->windows.push_back(window);
+            return emit(instruction);
+        }
+    }
+
+    if (node.value == "envelope" && node.children.size() == 3)
+    {
+        CompiledEquation::Window window;
+        window.attack = std::max(node.children[1]->numericValue, 0.0);
+        window.release = std::max(node.children[2]->numericValue, 0.0);
+        instruction.op = OpCode::Envelope;
+        instruction.a = compileNode(*node.children[0]);
+        instruction.slot = static_cast<int>(program->windows.size());
+        program->windows.push_back(window);
+        return emit(instruction);
+    }
+
+    if ((node.value == "min" || node.value == "max") && node.children.size() == 2)
+    {
+        instruction.op = node.value == "min" ? OpCode::Min : OpCode::Max;
+        instruction.a = compileNode(*node.children[0]);
+        instruction.b = compileNode(*node.children[1]);
+        return emit(instruction);
+    }
+
+    if (node.value == "clamp" && node.children.size() == 3)
+    {
+        // min(max(x, lo), hi), which gives hi when the limits are crossed
+        instruction.op = OpCode::Max;
+        instruction.a = compileNode(*node.children[0]);
+        instruction.b = compileNode(*node.children[1]);
+        instruction.a = emit(instruction);
+        instruction.op = OpCode::Min;
+        instruction.b = compileNode(*node.children[2]);
+        return emit(instruction);
+    }
+
+    if (node.value == "ifelse" && node.children.size() == 3)
+    {
+        // Both values are worked out for every sample and the condition
+        // keeps one of them, so a piecewise equation has no branch in the
+        // per-sample loop. Only one of the two selects is non-zero, so
+        // their sum is exactly the value kept, even when the other is not
+        // finite. A condition known when compiling just picks its side.
+        const int condition = compileNode(*node.children[0]);
+        const int whenTrue = compileNode(*node.children[1]);
+        const int whenFalse = compileNode(*node.children[2]);
+
+        if (isConstant(condition))
+            return program->instructions[(size_t) condition].constant != 0.0 ? whenTrue : whenFalse;
+
+        auto isZero = [this] (int reg) { return isConstant(reg) && program->instructions[(size_t) reg].constant == 0.0; };
+        auto select = [&] (OpCode op, int value)
+        {
+            instruction.op = op;
+            instruction.a = condition;
+            instruction.b = value;
+            return emit(instruction);
+        };
+
+        if (isZero(whenFalse))
+            return isZero(whenTrue) ? whenTrue : select(OpCode::Select, whenTrue);
+
+        if (isZero(whenTrue))
+            return select(OpCode::SelectNot, whenFalse);
+
+        const int kept = select(OpCode::Select, whenTrue);
+        const int otherwise = select(OpCode::SelectNot, whenFalse);
+        instruction.op = OpCode::Add;
+        instruction.a = kept;
+        instruction.b = otherwise;
+        return emit(instruction);
+    }
+
+    for (const auto& function : unaryFunctions)
+    {
+        if (node.value == function.first)
+        {
+            instruction.op = function.second;
+            instruction.a = compileNode(*node.children[0]);
+            return emit(instruction);
+        }
+    }
+
+    if (node.value == "filter" && node.children.size() >= 2)
+    {
+        instruction.op = OpCode::Filter;
+        instruction.a = compileNode(*node.children[0]);
+        instruction.b = compileNode(*node.children[1]);
+        return emit(instruction);
+    }
+
+    // Analysis functions (fft, freqz, ...) have no per-sample meaning
+    return emitConstant(0.0);
+}
+
+int EquationCompiler::emit(CompiledEquation::Instruction instruction)
+{
+    auto& instructions = program->instructions;
+
+    bool hasOperands = instruction.a >= 0;
+    bool allConstant = hasOperands && isConstant(instruction.a) && (instruction.b < 0 || isConstant(instruction.b));
+    bool foldable = instruction.op != OpCode::ModulatedDelay && !CompiledEquation::isWindow(instruction.op);
+
+    if (allConstant && foldable)
+    {
+        double a = instructions[(size_t) instruction.a].constant;
+        double b = instruction.b >= 0 ? instructions[(size_t) instruction.b].constant : 0.0;
+        return emitConstant(CompiledEquation::apply(instruction.op, a, b));
+    }
+
+    instruction.perSample = instruction.op == OpCode::OutputHistory
+                         || (instruction.a >= 0 && instructions[(size_t) instruction.a].perSample)
+                         || (instruction.b >= 0 && instructions[(size_t) instruction.b].perSample);
+
+    if (sourceNode != nullptr)
+    {
+        instruction.source = { static_cast<int>(sourceNode->position),
+                                static_cast<int>(sourceNode->position + sourceNode->length) };
+        instruction.token = { static_cast<int>(sourceNode->tokenPosition),
+                              static_cast<int>(sourceNode->tokenPosition + sourceNode->tokenLength) };
+    }
+
+    instructions.push_back(instruction);
+    return static_cast<int>(instructions.size()) - 1;
+}
+
+int EquationCompiler::emitConstant(double value)
+{
+    CompiledEquation::Instruction instruction;
+    instruction.op = OpCode::Constant;
+    instruction.constant = value;
+    program->instructions.push_back(instruction);
+    return static_cast<int>(program->instructions.size()) - 1;
+}
+
+int EquationCompiler::variableSlot(const std::string& name)
+{
+    auto& names = program->variableNames;
+    auto it = std::find(names.begin(), names.end(), name);
+    if (it != names.end())
+        return static_cast<int>(it - names.begin());
+
+    names.push_back(name);
+    return static_cast<int>(names.size()) - 1;
+}
+
+void EquationCompiler::removeUnusedInstructions()
+{
+    // Constant folding leaves the folded operands behind; drop anything the
+    // output no longer reaches and renumber the registers that remain
+    auto& instructions = program->instructions;
+    std::vector<bool> used(instructions.size(), false);
+    used[(size_t) program->outputRegister] = true;
+
+    for (int i = program->outputRegister; i >= 0; --i)
+    {
+        if (!used[(size_t) i])
+            continue;
+
+        const auto& instruction = instructions[(size_t) i];
+        if (instruction.a >= 0) used[(size_t) instruction.a] = true;
+        if (instruction.b >= 0) used[(size_t) instruction.b] = true;
+    }
+
+    std::vector<int> remap(instructions.size(), -1);
+    std::vector<CompiledEquation::Instruction> kept;
+    kept.reserve(instructions.size());
+
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        if (!used[i])
+            continue;
+
+        auto instruction = instructions[i];
+        if (instruction.a >= 0) instruction.a = remap[(size_t) instruction.a];
+        if (instruction.b >= 0) instruction.b = remap[(size_t) instruction.b];
+
+        remap[i] = static_cast<int>(kept.size());
+        kept.push_back(instruction);
+    }
+
+    program->outputRegister = remap[(size_t) program->outputRegister];
+    instructions = std::move(kept);
+}
+
+void EquationCompiler::reduceStrength()
+{
+    // Rewrites operations that have a cheaper equivalent, each within a few
+    // roundings of the original:
+    //  - x^n for whole n up to maxMultipliedPower becomes multiplies by
+    //    repeated squaring, within (n - 1) roundings relative to the exact
+    //    power where pow is within one
+    //  - x/c for a constant c becomes x * (1/c), within two roundings and
+    //    exact when c is a power of two; x/0 is the 0 the divide would give
+    //  - x/v where v only reads constants and variables becomes a multiply
+    //    by 1/v, worked out once per block with the same guard against 0
+    //  - v * c for a comparison c that changes within the block becomes a
+    //    select of v by c, the same for finite v and 0 rather than NaN
+    //    where v is not and c is 0; compilers keep a select branch-free in
+    //    a fused loop more readily than a multiply by 0 or 1. Comparisons
+    //    fixed for the block stay weights the kernels can use.
+    // sin and cos of fast phases in t are left to classifyRates().
+    auto& instructions = program->instructions;
+    std::vector<CompiledEquation::Instruction> reduced;
+    std::vector<bool> invariant;   // Same for the whole block, by reduced register
+    std::vector<int> reciprocalOf; // Register holding 1/v, by reduced register of v
+    std::vector<int> remap(instructions.size(), -1);
+    reduced.reserve(instructions.size());
+
+    auto add = [&] (const CompiledEquation::Instruction& instruction)
+    {
+        bool same = false;
+        switch (instruction.op)
+        {
+            case OpCode::Constant:
+            case OpCode::Variable:
+                same = true;
+                break;
+
+            case OpCode::Input:
+            case OpCode::Time:
+            case OpCode::OutputHistory:
+            case OpCode::Delay:
+            case OpCode::ModulatedDelay:
+            case OpCode::Lookup:
+            case OpCode::Rand:
+            case OpCode::Randn:
+            case OpCode::Oscillator:
+            case OpCode::MovingMean:
+            case OpCode::MovingRms:
+            case OpCode::MovingMax:
+            case OpCode::MovingMin:
+            case OpCode::Envelope:
+                break;
+
+            default:
+                same = (instruction.a < 0 || invariant[(size_t) instruction.a])
+                    && (instruction.b < 0 || invariant[(size_t) instruction.b]);
+                break;
+        }
+
+        reduced.push_back(instruction);
+        invariant.push_back(same);
+        reciprocalOf.push_back(-1);
+        return static_cast<int>(reduced.size()) - 1;
+    };
+
+    auto addConstant = [&] (double value)
+    {
+        CompiledEquation::Instruction constant;
+        constant.op = OpCode::Constant;
+        constant.constant = value;
+        return add(constant);
+    };
+
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        auto instruction = instructions[i];
+        if (instruction.a >= 0) instruction.a = remap[(size_t) instruction.a];
+        if (instruction.b >= 0) instruction.b = remap[(size_t) instruction.b];
+
+        const auto* right = instruction.b >= 0 ? &reduced[(size_t) instruction.b] : nullptr;
+        const bool constantRight = right != nullptr && right->op == OpCode::Constant;
+
+        auto isComparison = [&] (int reg)
+        {
+            const OpCode op = reduced[(size_t) reg].op;
+            return !invariant[(size_t) reg]
+                && (op == OpCode::Less || op == OpCode::LessEqual || op == OpCode::Equal || op == OpCode::NotEqual);
+        };
+
+        if (instruction.op == OpCode::Multiply && (isComparison(instruction.a) || isComparison(instruction.b)))
+        {
+            if (!isComparison(instruction.a))
+                std::swap(instruction.a, instruction.b);
+
+            instruction.op = OpCode::Select;
+            remap[i] = add(instruction);
+            continue;
+        }
+
+        if (instruction.op == OpCode::Power && constantRight && right->constant == std::floor(right->constant)
+            && right->constant >= 0.0 && right->constant <= CompiledEquation::maxMultipliedPower)
+        {
+            // pow(x, 0) is 1 even for NaN
+            int exponent = static_cast<int>(right->constant);
+            if (exponent == 0)
+            {
+                remap[i] = addConstant(1.0);
+                continue;
+            }
+
+            // The squares of x and the product so far carry the original's text
+            auto multiply = instruction;
+            multiply.op = OpCode::Multiply;
+            int result = -1;
+            int square = instruction.a;
+
+            for (;;)
+            {
+                if (exponent & 1)
+                {
+                    if (result < 0)
+                    {
+                        result = square;
+                    }
+                    else
+                    {
+                        multiply.a = result;
+                        multiply.b = square;
+                        result = add(multiply);
+                    }
+                }
+
+                exponent >>= 1;
+                if (exponent == 0)
+                    break;
+
+                multiply.a = multiply.b = square;
+                square = add(multiply);
+            }
+
+            remap[i] = result;
+            continue;
+        }
+
+        if (instruction.op == OpCode::Divide && constantRight)
+        {
+            const double reciprocal = 1.0 / right->constant;
+            if (right->constant == 0.0)
+            {
+                remap[i] = addConstant(0.0);
+                continue;
+            }
+
+            // 1/c for tiny c overflows, and x * inf is not what x/c was
+            if (std::isnormal(reciprocal))
+            {
+                instruction.op = OpCode::Multiply;
+                instruction.b = addConstant(reciprocal);
+            }
+        }
+        else if (instruction.op == OpCode::Divide && invariant[(size_t) instruction.b] && !invariant[(size_t) instruction.a])
+        {
+            if (reciprocalOf[(size_t) instruction.b] < 0)
+            {
+                auto divide = instruction;
+                divide.a = addConstant(1.0);
+                divide.perSample = false;
+                reciprocalOf[(size_t) instruction.b] = add(divide);
+            }
+
+            instruction.op = OpCode::Multiply;
+            instruction.b = reciprocalOf[(size_t) instruction.b];
+        }
+
+        remap[i] = add(instruction);
+    }
+
+    program->outputRegister = remap[(size_t) program->outputRegister];
+    instructions = std::move(reduced);
+}
+
+void EquationCompiler::bakeLookupTables()
+{
+    const auto& settings = options.lookupTables;
+    if (!settings.enabled || settings.size < 2 || !(settings.inputMax > settings.inputMin))
+        return;
+
+    auto& instructions = program->instructions;
+    const int numInstructions = static_cast<int>(instructions.size());
+
+    // Registers that are pure functions of x and constants
+    std::vector<bool> inputOnly((size_t) numInstructions, false);
+    std::vector<bool> readsInput((size_t) numInstructions, false);
+
+    for (int i = 0; i < numInstructions; ++i)
+    {
+        const auto& instruction = instructions[(size_t) i];
+
+        switch (instruction.op)
+        {
+            case OpCode::Input:
+                inputOnly[(size_t) i] = readsInput[(size_t) i] = true;
+                break;
+
+            case OpCode::Constant:
+                inputOnly[(size_t) i] = true;
+                break;
+
+            case OpCode::Time:
+            case OpCode::Variable:
+            case OpCode::OutputHistory:
+            case OpCode::Delay:
+            case OpCode::ModulatedDelay:
+            case OpCode::Lookup:
+            case OpCode::Rand:
+            case OpCode::Randn:
+            case OpCode::MovingMean:
+            case OpCode::MovingRms:
+            case OpCode::MovingMax:
+            case OpCode::MovingMin:
+            case OpCode::Envelope:
+                break;
+
+            default:
+                inputOnly[(size_t) i] = (instruction.a < 0 || inputOnly[(size_t) instruction.a])
+                                     && (instruction.b < 0 || inputOnly[(size_t) instruction.b]);
+                readsInput[(size_t) i] = (instruction.a >= 0 && readsInput[(size_t) instruction.a])
+                                      || (instruction.b >= 0 && readsInput[(size_t) instruction.b]);
+                break;
+        }
+    }
+
+    // Only bake the largest such subtrees: ones used by the output or by
+    // something that is not itself a function of x alone
+    std::vector<bool> isRoot((size_t) numInstructions, false);
+    isRoot[(size_t) program->outputRegister] = true;
+
+    for (int i = 0; i < numInstructions; ++i)
+    {
+        const auto& instruction = instructions[(size_t) i];
+        if (inputOnly[(size_t) i])
+            continue;
+
+        if (instruction.a >= 0) isRoot[(size_t) instruction.a] = true;
+        if (instruction.b >= 0) isRoot[(size_t) instruction.b] = true;
+    }
+
+    for (int root = numInstructions - 1; root >= 0; --root)
+    {
+        if (!isRoot[(size_t) root] || !inputOnly[(size_t) root] || !readsInput[(size_t) root]
+            || instructions[(size_t) root].op == OpCode::Input)
+            continue;
+
+        // Collect the subtree and what it costs to evaluate per sample
+        std::vector<int> subtree;
+        std::vector<int> pending { root };
+        std::vector<bool> visited((size_t) numInstructions, false);
+        int cost = 0;
+
+        while (!pending.empty())
+        {
+            int index = pending.back();
+            pending.pop_back();
+            if (visited[(size_t) index])
+                continue;
+
+            visited[(size_t) index] = true;
+            subtree.push_back(index);
+
+            const auto& instruction = instructions[(size_t) index];
+            cost += estimateCost(instruction.op);
+            if (instruction.a >= 0) pending.push_back(instruction.a);
+            if (instruction.b >= 0) pending.push_back(instruction.b);
+        }
+
+        if (cost < settings.minimumCost || static_cast<int>(subtree.size()) > CompiledEquation::maxLookupSubtreeSize)
+            continue;
+
+        std::sort(subtree.begin(), subtree.end());
+        bakeSubtree(root, subtree);
+    }
+}
+
+bool EquationCompiler::bakeSubtree(int root, const std::vector<int>& subtree)
+{
+    const auto& settings = options.lookupTables;
+    auto& instructions = program->instructions;
+
+    // Copy the subtree into a standalone program; sorted indices keep it in evaluation order
+    auto localIndex = [&subtree] (int reg)
+    {
+        return static_cast<int>(std::lower_bound(subtree.begin(), subtree.end(), reg) - subtree.begin());
+    };
+
+    std::vector<CompiledEquation::Instruction> exactProgram;
+    int inputRegister = -1;
+    for (int index : subtree)
+    {
+        auto instruction = instructions[(size_t) index];
+        if (instruction.a >= 0) instruction.a = localIndex(instruction.a);
+        if (instruction.b >= 0) instruction.b = localIndex(instruction.b);
+        if (instruction.op == OpCode::Input && inputRegister < 0)
+            inputRegister = index;
+
+        exactProgram.push_back(instruction);
+    }
+
+    if (inputRegister < 0)
+        return false;
+
+    // Any equation baking the same function with the same layout shares the table
+    auto key = CompiledEquation::LookupTable::makeSharingKey(settings.size, settings.inputMin, settings.inputMax,
+                                                             settings.exactOutsideRange, exactProgram);
+
+    auto table = SharedResources::getInstance().getOrCreate<CompiledEquation::LookupTable>(key, [&]
+    {
+        auto baked = std::make_shared<CompiledEquation::LookupTable>();
+        baked->inputMin = settings.inputMin;
+        baked->inputMax = settings.inputMax;
+        baked->scale = static_cast<float>(settings.size - 1) / (settings.inputMax - settings.inputMin);
+        baked->exactOutsideRange = settings.exactOutsideRange;
+        baked->exactProgram = exactProgram;
+
+        baked->values.resize((size_t) settings.size);
+        for (int i = 0; i < settings.size; ++i)
+        {
+            float x = baked->inputMin + static_cast<float>(i) / baked->scale;
+            float value = static_cast<float>(baked->evaluateExact(x));
+
+            // Poles and domain errors (tan near pi/2, log of negatives) can't be tabulated
+            if (!std::isfinite(value))
+                return std::shared_ptr<CompiledEquation::LookupTable>();
+
+            baked->values[(size_t) i] = value;
+        }
+
+        // Measure the interpolation error between table points
+        for (int i = 0; i + 1 < settings.size; ++i)
+        {
+            for (float offset : { 0.25f, 0.5f, 0.75f })
+            {
+                float x = baked->inputMin + (static_cast<float>(i) + offset) / baked->scale;
+                float error = static_cast<float>(std::abs(baked->lookup(x) - baked->evaluateExact(x)));
+                if (!(error <= baked->maxError))
+                {
+                    baked->maxError = error;
+                    baked->maxErrorInput = x;
+                }
+            }
+        }
+
+        return baked;
+    });
+
+    if (table == nullptr)
+        return false;
+
+    float peak = 0.0f;
+    for (float value : table->values)
+        peak = std::max(peak, std::abs(value));
+
+    if (!(table->maxError <= settings.maxError * std::max(1.0f, peak)))
+        return false;
+
+    CompiledEquation::Instruction lookup;
+    lookup.op = OpCode::Lookup;
+    lookup.a = inputRegister;
+    lookup.slot = static_cast<int>(program->lookupTables.size());
+    lookup.source = instructions[(size_t) root].source;
+    lookup.token = instructions[(size_t) root].token;
+    program->lookupTables.push_back(std::move(table));
+
+    instructions[(size_t) root] = lookup;
+    return true;
+}
+
+void EquationCompiler::classifyRates()
+{
+    using Rate = CompiledEquation::Rate;
+    auto& instructions = program->instructions;
+    const auto& settings = options.rates;
+    program->controlInterval = std::max(settings.controlInterval, 1);
+
+    // Slope of each register with respect to t where it is known to be
+    // affine in t (slope * t + offset), NaN otherwise. This is what tells an
+    // LFO like sin(2*pi*0.5*t) apart from an audio oscillator.
+    const double unknown = std::numeric_limits<double>::quiet_NaN();
+    std::vector<double> slope(instructions.size(), unknown);
+
+    // Whether a register is slope * t + offset with a slope and offset that
+    // only change between blocks, e.g. 2*pi*f*t for a variable f
+    std::vector<bool> affine(instructions.size(), false);
+
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        auto& instruction = instructions[i];
+        const Rate rateA = instruction.a >= 0 ? instructions[(size_t) instruction.a].rate : Rate::Constant;
+        const Rate rateB = instruction.b >= 0 ? instructions[(size_t) instruction.b].rate : Rate::Constant;
+        const double slopeA = instruction.a >= 0 ? slope[(size_t) instruction.a] : 0.0;
+        const double slopeB = instruction.b >= 0 ? slope[(size_t) instruction.b] : 0.0;
+
+        switch (instruction.op)
+        {
+            case OpCode::Constant:
+                instruction.rate = Rate::Constant;
+                slope[i] = 0.0;
+                affine[i] = true;
+                continue;
+
+            case OpCode::Time:
+                instruction.rate = Rate::Control;
+                slope[i] = 1.0;
+                affine[i] = true;
+                continue;
+
+            case OpCode::Variable:
+                instruction.rate = Rate::Block;
+                slope[i] = 0.0;
+                affine[i] = true;
+                continue;
+
+            case OpCode::Input:
+            case OpCode::OutputHistory:
+            case OpCode::Delay:
+            case OpCode::ModulatedDelay:
+            case OpCode::Lookup:
+            case OpCode::Rand:
+            case OpCode::Randn:
+            case OpCode::Oscillator:
+            case OpCode::MovingMean:
+            case OpCode::MovingRms:
+            case OpCode::MovingMax:
+            case OpCode::MovingMin:
+            case OpCode::Envelope:
+                instruction.rate = Rate::Audio;
+                continue;
+
+            default:
+                break;
+        }
+
+        // Anything left unfolded still has to be evaluated once per block
+        instruction.rate = std::max({ rateA, rateB, Rate::Block });
+
+        // Linear interpolation between control points would turn a step
+        // into a ramp, so anything that jumps with a control rate operand
+        // runs per sample
+        const bool steps = instruction.op == OpCode::Less || instruction.op == OpCode::LessEqual
+                        || instruction.op == OpCode::Equal || instruction.op == OpCode::NotEqual
+                        || instruction.op == OpCode::Sign
+                        || ((instruction.op == OpCode::Select || instruction.op == OpCode::SelectNot) && rateA == Rate::Control);
+        if (steps && instruction.rate == Rate::Control)
+            instruction.rate = Rate::Audio;
+
+        switch (instruction.op)
+        {
+            case OpCode::Negate:   slope[i] = -slopeA; break;
+            case OpCode::Add:      slope[i] = slopeA + slopeB; break;
+            case OpCode::Subtract: slope[i] = slopeA - slopeB; break;
+
+            case OpCode::Multiply:
+                if (rateA == Rate::Constant)
+                    slope[i] = slopeB * instructions[(size_t) instruction.a].constant;
+                else if (rateB == Rate::Constant)
+                    slope[i] = slopeA * instructions[(size_t) instruction.b].constant;
+                else if (slopeA == 0.0 && slopeB == 0.0)
+                    slope[i] = 0.0;
+                break;
+
+            case OpCode::Divide:
+                if (rateB == Rate::Constant && instructions[(size_t) instruction.b].constant != 0.0)
+                    slope[i] = slopeA / instructions[(size_t) instruction.b].constant;
+                else if (slopeA == 0.0 && slopeB == 0.0)
+                    slope[i] = 0.0;
+                break;
+
+            default:
+                if (slopeA == 0.0 && slopeB == 0.0)
+                    slope[i] = 0.0;
+                break;
+        }
+
+        const bool affineA = instruction.a >= 0 && affine[(size_t) instruction.a];
+        const bool affineB = instruction.b >= 0 && affine[(size_t) instruction.b];
+
+        switch (instruction.op)
+        {
+            case OpCode::Negate:   affine[i] = affineA; break;
+            case OpCode::Add:
+            case OpCode::Subtract: affine[i] = affineA && affineB; break;
+            case OpCode::Multiply: affine[i] = affineA && affineB && (rateA <= Rate::Block || rateB <= Rate::Block); break;
+            case OpCode::Divide:   affine[i] = affineA && rateB <= Rate::Block; break;
+            default:               affine[i] = instruction.rate <= Rate::Block; break;
+        }
+
+        // Periodic functions of t are only control rate when they are slow
+        // enough for linear interpolation to follow them
+        bool periodic = instruction.op == OpCode::Sin || instruction.op == OpCode::Cos || instruction.op == OpCode::Tan;
+        if (periodic && instruction.rate == Rate::Control)
+        {
+            double frequency = std::abs(slopeA) / (2.0 * M_PI);
+            if (!(frequency <= settings.maxControlFrequency))
+            {
+                instruction.rate = Rate::Audio;
+
+                // Faster sines of a phase that moves in a straight line are a
+                // rotating phasor, a few multiplies a sample instead of a call
+                if (settings.enabled && affineA && instruction.op != OpCode::Tan)
+                {
+                    instruction.slot = instruction.op == OpCode::Cos ? 1 : 0;
+                    instruction.op = OpCode::Oscillator;
+                }
+            }
+        }
+    }
+
+    if (!settings.enabled)
+    {
+        for (auto& instruction : instructions)
+            if (instruction.rate != Rate::Constant)
+                instruction.rate = Rate::Audio;
+    }
+}
+
+namespace
+{
+    using Coefficient = CompiledEquation::Coefficient;
+
+    // A register's value written as a weighted sum of input taps, y_prev
+    // terms and at most one other audio rate register (the wet signal)
+    struct LinearForm
+    {
+        bool valid = false;
+        std::vector<std::pair<int, Coefficient>> taps; // Delay in samples, weight
+        Coefficient feedback[2];
+        int wetRegister = -1;
+        Coefficient wetCoefficient;
+    };
+
+    // Weights are scale * register, so two of them only add up to another
+    // weight when they share the register
+    bool addCoefficient(Coefficient& target, Coefficient other)
+    {
+        if (other.scale == 0.0)
+            return true;
+
+        if (target.scale == 0.0)
+        {
+            target = other;
+            return true;
+        }
+
+        if (target.reg != other.reg)
+            return false;
+
+        target.scale += other.scale;
+        return true;
+    }
+
+    bool multiplyCoefficient(Coefficient& target, const Coefficient& factor)
+    {
+        if (target.reg >= 0 && factor.reg >= 0)
+            return false;
+
+        target.scale *= factor.scale;
+        if (factor.reg >= 0)
+            target.reg = factor.reg;
+        return true;
+    }
+
+    bool scaleForm(LinearForm& form, const Coefficient& factor)
+    {
+        bool ok = multiplyCoefficient(form.wetCoefficient, factor)
+               && multiplyCoefficient(form.feedback[0], factor)
+               && multiplyCoefficient(form.feedback[1], factor);
+
+        for (auto& tap : form.taps)
+            ok = ok && multiplyCoefficient(tap.second, factor);
+
+        return ok;
+    }
+
+    bool addForm(LinearForm& target, const LinearForm& other, double sign)
+    {
+        auto negated = [sign] (Coefficient c) { c.scale *= sign; return c; };
+
+        for (const auto& tap : other.taps)
+        {
+            auto existing = std::find_if(target.taps.begin(), target.taps.end(),
+                                         [&tap] (const auto& t) { return t.first == tap.first; });
+            if (existing == target.taps.end())
+                target.taps.push_back({ tap.first, negated(tap.second) });
+            else if (!addCoefficient(existing->second, negated(tap.second)))
+                return false;
+        }
+
+        if (!addCoefficient(target.feedback[0], negated(other.feedback[0]))
+            || !addCoefficient(target.feedback[1], negated(other.feedback[1])))
+            return false;
+
+        if (other.wetRegister >= 0)
+        {
+            if (target.wetRegister >= 0 && target.wetRegister != other.wetRegister)
+                return false;
+
+            target.wetRegister = other.wetRegister;
+            return addCoefficient(target.wetCoefficient, negated(other.wetCoefficient));
+        }
+
+        return true;
+    }
+}
+
+void EquationCompiler::matchKernel()
+{
+    using Rate = CompiledEquation::Rate;
+    using Shape = CompiledEquation::KernelShape;
+
+    program->kernel = {};
+    if (!options.useKernels)
+        return;
+
+    const auto& instructions = program->instructions;
+    std::vector<LinearForm> forms(instructions.size());
+
+    // Constant and block rate registers can be read once per block, so
+    // they are the only ones allowed as weights
+    auto asCoefficient = [&instructions] (int reg, Coefficient& coefficient)
+    {
+        const auto& instruction = instructions[(size_t) reg];
+        if (instruction.rate == Rate::Constant)
+            coefficient = { -1, instruction.constant };
+        else if (instruction.rate == Rate::Block)
+            coefficient = { reg, 1.0 };
+        else
+            return false;
+        return true;
+    };
+
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        const auto& instruction = instructions[i];
+        auto& form = forms[i];
+        Coefficient factor;
+
+        switch (instruction.op)
+        {
+            case OpCode::Input:
+                form.valid = true;
+                form.taps.push_back({ 0, { -1, 1.0 } });
+                break;
+
+            case OpCode::Delay:
+                form.valid = true;
+                form.taps.push_back({ static_cast<int>(instruction.constant), { -1, 1.0 } });
+                break;
+
+            case OpCode::OutputHistory:
+                form.valid = true;
+                form.feedback[instruction.slot - 1] = { -1, 1.0 };
+                break;
+
+            case OpCode::Negate:
+                if (forms[(size_t) instruction.a].valid)
+                {
+                    form = forms[(size_t) instruction.a];
+                    form.valid = scaleForm(form, { -1, -1.0 });
+                }
+                break;
+
+            case OpCode::Add:
+            case OpCode::Subtract:
+                if (forms[(size_t) instruction.a].valid && forms[(size_t) instruction.b].valid)
+                {
+                    form = forms[(size_t) instruction.a];
+                    form.valid = addForm(form, forms[(size_t) instruction.b], instruction.op == OpCode::Subtract ? -1.0 : 1.0);
+                }
+                break;
+
+            case OpCode::Multiply:
+                if (forms[(size_t) instruction.a].valid && asCoefficient(instruction.b, factor))
+                {
+                    form = forms[(size_t) instruction.a];
+                    form.valid = scaleForm(form, factor);
+                }
+                else if (forms[(size_t) instruction.b].valid && asCoefficient(instruction.a, factor))
+                {
+                    form = forms[(size_t) instruction.b];
+                    form.valid = scaleForm(form, factor);
+                }
+                break;
+
+            case OpCode::Divide:
+            {
+                const auto& divisor = instructions[(size_t) instruction.b];
+                if (forms[(size_t) instruction.a].valid && divisor.rate == Rate::Constant && divisor.constant != 0.0)
+                {
+                    form = forms[(size_t) instruction.a];
+                    form.valid = scaleForm(form, { -1, 1.0 / divisor.constant });
+                }
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        // Anything else that runs ahead over the block can be the wet half of a mix
+        if (!form.valid && instruction.rate == Rate::Audio && !instruction.perSample)
+        {
+            form = {};
+            form.valid = true;
+            form.wetRegister = static_cast<int>(i);
+            form.wetCoefficient = { -1, 1.0 };
+        }
+    }
+
+    const auto& output = forms[(size_t) program->outputRegister];
+    if (!output.valid)
+        return;
+
+    CompiledEquation::Kernel kernel;
+    auto taps = output.taps;
+    std::sort(taps.begin(), taps.end(), [] (const auto& a, const auto& b) { return a.first < b.first; });
+    for (const auto& tap : taps)
+    {
+        if (tap.second.scale != 0.0)
+        {
+            kernel.tapDelays.push_back(tap.first);
+            kernel.tapCoefficients.push_back(tap.second);
+        }
+    }
+
+    kernel.feedback[0] = output.feedback[0];
+    kernel.feedback[1] = output.feedback[1];
+    const bool usesPrev = kernel.feedback[0].scale != 0.0;
+    const bool usesPrev2 = kernel.feedback[1].scale != 0.0;
+    const int numTaps = static_cast<int>(kernel.tapDelays.size());
+    const bool dryOnly = numTaps == 1 && kernel.tapDelays[0] == 0;
+
+    if (output.wetRegister >= 0 && output.wetCoefficient.scale != 0.0)
+    {
+        // Only a plain mix with the dry input is worth its own kernel
+        if (!dryOnly || usesPrev || usesPrev2)
+            return;
+
+        kernel.shape = Shape::DryWet;
+        kernel.wetRegister = output.wetRegister;
+        kernel.wetCoefficient = output.wetCoefficient;
+    }
+    else if (numTaps == 0 || numTaps > CompiledEquation::maxKernelTaps)
+    {
+        return;
+    }
+    else if (usesPrev && usesPrev2)
+    {
+        kernel.shape = Shape::TwoPole;
+    }
+    else if (usesPrev || usesPrev2)
+    {
+        kernel.shape = (usesPrev && dryOnly) ? Shape::OnePole : Shape::FeedbackComb;
+    }
+    else if (dryOnly)
+    {
+        kernel.shape = Shape::Gain;
+    }
+    else
+    {
+        kernel.shape = (numTaps == 2 && kernel.tapDelays[0] == 0) ? Shape::Comb : Shape::Fir;
+    }
+
+    program->kernel = std::move(kernel);
+}
+
+int EquationCompiler::estimateCost(OpCode op)
+{
+    // Rough relative cost per sample; a linear table read is about 6
+    switch (op)
+    {
+        case OpCode::Constant:
+        case OpCode::Input:
+            return 0;
+
+        case OpCode::Divide:
+        case OpCode::Sqrt:
+            return 4;
+
+        case OpCode::Power:
+        case OpCode::Sin:
+        case OpCode::Cos:
+        case OpCode::Tan:
+        case OpCode::Exp:
+        case OpCode::Log:
+        case OpCode::Log10:
+        case OpCode::Randn:
+            return 20;
+
+        default:
+            return 1;
+    }
+}
+
+bool EquationCompiler::isConstant(int reg) const
+{
+    return reg >= 0 && program->instructions[(size_t) reg].op == OpCode::Constant;
+}
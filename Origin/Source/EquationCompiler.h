@@ -0,0 +1,319 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "MatlabParser.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Flat, immutable form of a parsed equation. Instructions are stored in
+// evaluation order and instruction i writes register i, so the engine can
+// run each one over a whole block before moving on to the next.
+struct CompiledEquation
+{
+    enum class OpCode
+    {
+        Constant,
+        Input,          // x
+        Time,           // t, seconds since the last reset
+        Variable,       // fs, user variables
+        OutputHistory,  // y_prev (slot 1), y_prev2 (slot 2)
+        Delay,          // z^-n with a fixed whole-sample length
+        ModulatedDelay, // z^-(expr), length in operand a
+        Negate,
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Power,
+        Sin,
+        Cos,
+        Tan,
+        Exp,
+        Log,
+        Log10,
+        Sqrt,
+        Abs,
+        Filter,
+        Lookup,         // Baked table for a memoryless function of operand a (x)
+        Rand,           // Uniform noise in [0, 1), see EquationNoise
+        Randn,          // Gaussian noise, zero mean and unit variance
+        Oscillator,     // sin (slot 0) or cos (slot 1) of operand a, affine in t, see EquationKernels::oscillator()
+        MovingMean,     // Of operand a over windows[slot], see EquationWindows
+        MovingRms,
+        MovingMax,
+        MovingMin,
+        Envelope,       // Peak follower of operand a with windows[slot]'s attack and release
+        Less,           // 1 where a < b, else 0; a > b and a >= b are compiled with the operands swapped
+        LessEqual,
+        Equal,
+        NotEqual,
+        Min,
+        Max,
+        Sign,           // -1, 0 or 1
+        Select,         // b where a is non-zero, else 0; ifelse(c, p, q) is Select(c, p) + SelectNot(c, q)
+        SelectNot       // b where a is zero, else 0
+    };
+
+    // How often an instruction's value can change. Everything below Audio
+    // is hoisted out of the inner loop: Block once per block, Control at
+    // points controlInterval samples apart with linear interpolation between.
+    enum class Rate
+    {
+        Constant, // Folded or filled once when the program is prepared
+        Block,    // fs and user variables
+        Control,  // t and slow functions of it, e.g. LFOs
+        Audio     // Depends on x, delays or y_prev
+    };
+
+    // Characters [start, end) of the equation text, empty when unknown
+    struct SourceRange
+    {
+        int start = -1;
+        int end = -1;
+
+        bool isEmpty() const { return end <= start; }
+    };
+
+    struct Instruction
+    {
+        OpCode op = OpCode::Constant;
+        int a = -1;             // First operand register
+        int b = -1;             // Second operand register
+        int slot = -1;          // Variable index, delay tap, output history depth, noise stream or window
+        double constant = 0.0;  // Value of a Constant, length of a fixed Delay, seed of rand/randn (NaN for none)
+        bool perSample = false; // Depends on y_prev, so it cannot run ahead over a block
+        Rate rate = Rate::Audio;
+
+        // What it was compiled from, for showing costs against the text:
+        // the whole expression and its operator, function name or operand,
+        // as offsets into the text given to the parser
+        SourceRange source;
+        SourceRange token;
+    };
+
+    // A subtree that only depends on x, baked into a linearly interpolated
+    // table. Inputs outside the range either clamp or run the original subtree.
+    struct LookupTable
+    {
+        float inputMin = -1.0f;
+        float inputMax = 1.0f;
+        float scale = 0.0f; // Table points per unit of input
+        std::vector<float> values;
+        bool exactOutsideRange = true;
+
+        // The subtree that was replaced, result in its last register
+        std::vector<Instruction> exactProgram;
+
+        // Accuracy report, measured between the table points
+        float maxError = 0.0f;
+        float maxErrorInput = 0.0f;
+
+        double lookup(double x) const;
+        double evaluateExact(double x) const;
+        std::size_t getMemoryUsage() const;
+
+        // Everything that determines a table's contents, used to share it
+        // through SharedResources
+        static std::string makeSharingKey(int size, float inputMin, float inputMax, bool exactOutsideRange,
+                                          const std::vector<Instruction>& exactProgram);
+    };
+
+    static constexpr int maxLookupSubtreeSize = 64;
+
+    // Common equation shapes that run on a dedicated kernel instead of the
+    // instruction list, see EquationKernels.h
+    enum class KernelShape
+    {
+        General,      // No match, run the instructions
+        Gain,         // g*x
+        Fir,          // b0*x + b1*z^-d1 + ... (up to maxKernelTaps)
+        Comb,         // b0*x + b1*z^-D
+        OnePole,      // b0*x + a1*y_prev
+        FeedbackComb, // FIR part plus a single y_prev or y_prev2 term
+        TwoPole,      // FIR part plus both y_prev and y_prev2
+        DryWet        // dry*x + wet*(any other audio rate expression)
+    };
+
+    // scale times the value of register (a Constant or Block rate register
+    // such as exp(-2*pi*fc/fs)), or just scale when register is -1. Read
+    // once per block, so coefficients are runtime values, not baked in.
+    struct Coefficient
+    {
+        int reg = -1;
+        double scale = 0.0;
+    };
+
+    struct Kernel
+    {
+        KernelShape shape = KernelShape::General;
+        std::vector<int> tapDelays; // x[n - tapDelays[i]]
+        std::vector<Coefficient> tapCoefficients;
+        Coefficient feedback[2];    // y_prev, y_prev2, zero scale when unused
+        int wetRegister = -1;       // DryWet: computed by the instructions it depends on
+        Coefficient wetCoefficient;
+    };
+
+    static constexpr int maxKernelTaps = 4;
+
+    // Largest whole exponent written out as multiplies, see EquationCompiler::reduceStrength()
+    static constexpr int maxMultipliedPower = 16;
+
+    // Bump whenever compile() output or this layout changes, so programs
+    // saved with plugin state by another version are recompiled instead
+    static constexpr int formatVersion = 6;
+
+    std::vector<Instruction> instructions;
+    int outputRegister = -1;
+    
+    // Indexed by Lookup slots. Tables come from SharedResources, so equations
+    // that bake the same subtree with the same settings share one copy.
+    std::vector<std::shared_ptr<const LookupTable>> lookupTables;
+
+    std::vector<std::string> variableNames; // Indexed by Variable slots
+
+    // What movmean, movrms, movmax, movmin and envelope were called with,
+    // indexed by their slots. Fixed when compiling, since they size state.
+    struct Window
+    {
+        int length = 1;       // Samples, for the moving ones
+        double attack = 0.0;  // Seconds, for envelope
+        double release = 0.0;
+    };
+
+    std::vector<Window> windows;
+    int numDelayTaps = 0;
+    int maxDelay = 0; // Longest delay known at compile time, in samples
+    bool hasModulatedDelay = false;
+    bool usesOutputFeedback = false;
+    int controlInterval = 32; // Samples between Control rate evaluations
+    Kernel kernel;
+
+    int getNumRegisters() const { return static_cast<int>(instructions.size()); }
+    static const char* getKernelName(KernelShape shape);
+    static const char* getOpName(OpCode op);
+
+    // movmean, movrms, movmax, movmin and envelope, which carry state from
+    // block to block in the engine's windows
+    static bool isWindow(OpCode op);
+    
+    // Bytes owned by this program, not counting the shared lookup tables
+    std::size_t getMemoryUsage() const;
+
+    // Scalar semantics shared by constant folding and the per-sample path
+    template <typename SampleType>
+    static SampleType apply(OpCode op, SampleType a, SampleType b);
+};
+
+template <typename SampleType>
+SampleType CompiledEquation::apply(OpCode op, SampleType a, SampleType b)
+{
+    switch (op)
+    {
+        case OpCode::Negate:   return -a;
+        case OpCode::Add:      return a + b;
+        case OpCode::Subtract: return a - b;
+        case OpCode::Multiply: return a * b;
+        case OpCode::Divide:   return (b != SampleType(0)) ? a / b : SampleType(0);
+        case OpCode::Power:    return std::pow(a, b);
+        case OpCode::Sin:      return std::sin(a);
+        case OpCode::Cos:      return std::cos(a);
+        case OpCode::Tan:      return std::tan(a);
+        case OpCode::Exp:      return std::exp(a);
+        case OpCode::Log:      return std::log(a);
+        case OpCode::Log10:    return std::log10(a);
+        case OpCode::Sqrt:     return std::sqrt(a);
+        case OpCode::Abs:      return std::abs(a);
+
+        // Selects rather than branches, as in the engine's block loops
+        case OpCode::Less:      return SampleType(a < b);
+        case OpCode::LessEqual: return SampleType(a <= b);
+        case OpCode::Equal:     return SampleType(a == b);
+        case OpCode::NotEqual:  return SampleType(a != b);
+        case OpCode::Min:       return std::min(a, b);
+        case OpCode::Max:       return std::max(a, b);
+        case OpCode::Sign:      return SampleType(a > SampleType(0)) - SampleType(a < SampleType(0));
+        case OpCode::Select:    return (a != SampleType(0)) ? b : SampleType(0);
+        case OpCode::SelectNot: return (a != SampleType(0)) ? SampleType(0) : b;
+
+        // Basic first-order filter: y = a*x + b*x_prev
+        // This is a simplified version - real filter would need coefficients
+        case OpCode::Filter:   return a * SampleType(0.5) + b * SampleType(0.5);
+
+        default:               return SampleType(0);
+    }
+}
+
+class EquationCompiler
+{
+public:
+    struct LookupTableOptions
+    {
+        bool enabled = true;
+        int size = 4096;
+        float inputMin = -1.0f;
+        float inputMax = 1.0f;
+        bool exactOutsideRange = true; // false clamps the input to the range instead
+        float maxError = 1.0e-5f;      // Relative to the table's peak; less accurate tables are discarded
+        int minimumCost = 8;           // Subtrees cheaper than this stay as they are
+    };
+
+    struct RateOptions
+    {
+        bool enabled = true;             // false runs every instruction at audio rate
+        int controlInterval = 32;
+        float maxControlFrequency = 20.0f; // sin/cos/tan of t faster than this (Hz) stay audio rate
+    };
+
+    struct Options
+    {
+        LookupTableOptions lookupTables;
+        RateOptions rates;
+        bool useKernels = true; // false always runs the general instruction path
+    };
+
+    EquationCompiler() = default;
+    explicit EquationCompiler(const Options& compilerOptions) : options(compilerOptions) {}
+
+    // Returns nullptr when the tree parsed but cannot be run, e.g. a delay
+    // whose length folds to NaN or more than MatlabParser::maxDelayLength
+    std::shared_ptr<const CompiledEquation> compile(const MatlabParser::ASTNode& root);
+
+    // Why the last compile() failed, and the offset in the parsed text of
+    // what it failed on, as MatlabParser reports them
+    std::string getErrorMessage() const { return errorMessage; }
+    int getErrorPosition() const { return errorPosition; }
+
+private:
+    using OpCode = CompiledEquation::OpCode;
+
+    Options options;
+    std::shared_ptr<CompiledEquation> program;
+    std::string errorMessage;
+    int errorPosition = -1;
+    const MatlabParser::ASTNode* sourceNode = nullptr; // What instructions being emitted are attributed to
+    int numNoiseStreams = 0;
+
+    int compileNode(const MatlabParser::ASTNode& node);
+    [[noreturn]] void fail(const std::string& message) const; // Blames sourceNode
+    int compileNodeBody(const MatlabParser::ASTNode& node);
+    int compileFunction(const MatlabParser::ASTNode& node);
+    int emit(CompiledEquation::Instruction instruction);
+    int emitConstant(double value);
+    int variableSlot(const std::string& name);
+    void removeUnusedInstructions();
+    void reduceStrength();
+    void bakeLookupTables();
+    bool bakeSubtree(int root, const std::vector<int>& subtree);
+    void classifyRates();
+    void matchKernel();
+
+    static int estimateCost(OpCode op);
+
+    bool isConstant(int reg) const;
+
+    JUCE_DECLARE_NON_COPYABLE (EquationCompiler)
+};
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Fixed-structure loops for the equation shapes EquationCompiler recognises
+// (see CompiledEquation::KernelShape). The number of taps and which feedback
+// terms exist are template parameters, so every instantiation is a straight
+// loop the compiler can unroll and vectorise. Coefficients stay runtime
+// values, so equations of the same shape share one kernel.
+namespace EquationKernels
+{
+    template <typename SampleType>
+    void gain(SampleType* samples, int numSamples, SampleType g)
+    {
+        for (int i = 0; i < numSamples; ++i)
+            samples[i] *= g;
+    }
+
+    // output[i] = sum over k of coefficients[k] * taps[k][i]
+    template <typename SampleType, int NumTaps>
+    void fir(const SampleType* const* taps, const SampleType* coefficients, SampleType* output, int numSamples)
+    {
+        const SampleType* tap[NumTaps];
+        SampleType c[NumTaps];
+        for (int k = 0; k < NumTaps; ++k)
+        {
+            tap[k] = taps[k];
+            c[k] = coefficients[k];
+        }
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            SampleType sum = c[0] * tap[0][i];
+            for (int k = 1; k < NumTaps; ++k)
+                sum += c[k] * tap[k][i];
+            output[i] = sum;
+        }
+    }
+
+    // Direct form I: the FIR part plus a1 * y[n-1] and/or a2 * y[n-2].
+    // state holds y[n-1] and y[n-2] across blocks.
+    template <typename SampleType, int NumTaps, bool UsesPrev, bool UsesPrev2>
+    void recursive(const SampleType* const* taps, const SampleType* coefficients, SampleType a1, SampleType a2,
+                   SampleType* output, int numSamples, SampleType* state)
+    {
+        // The feed-forward part has no loop-carried dependency, so it runs
+        // vectorised first and only the feedback is left for the serial loop
+        fir<SampleType, NumTaps>(taps, coefficients, output, numSamples);
+
+        SampleType y1 = state[0], y2 = state[1];
+        for (int i = 0; i < numSamples; ++i)
+        {
+            SampleType y = output[i];
+            if constexpr (UsesPrev)
+                y += a1 * y1;
+            if constexpr (UsesPrev2)
+                y += a2 * y2;
+
+            y2 = y1;
+            y1 = y;
+            output[i] = y;
+        }
+
+        state[0] = y1;
+        state[1] = y2;
+    }
+
+    // Largest pole radius of 1 / (1 - a1 z^-1 - a2 z^-2), i.e. of z^2 - a1 z - a2
+    inline double poleRadius(double a1, double a2)
+    {
+        const double discriminant = a1 * a1 + 4.0 * a2;
+        return discriminant >= 0.0 ? 0.5 * (std::abs(a1) + std::sqrt(discriminant)) : std::sqrt(-a2);
+    }
+
+    // Bound on the sum of the absolute impulse response of the same filter,
+    // i.e. how much rounding errors fed into it can grow. Two poles close
+    // together resonate far more than two spread apart.
+    inline double noiseGain(double a1, double a2)
+    {
+        const double radius = poleRadius(a1, a2);
+        if (a2 == 0.0)
+            return 1.0 / (1.0 - radius);
+
+        const double separation = std::sqrt(std::abs(a1 * a1 + 4.0 * a2)); // |p1 - p2|
+        return std::min(1.0 / ((1.0 - radius) * (1.0 - radius)), 2.0 / ((1.0 - radius) * separation));
+    }
+
+    // Scattered look-ahead form of the feedback in recursive(). With p1, p2
+    // the poles and L = lookAheadLength, multiplying top and bottom by
+    // (1 + p1 z^-1 + ... + p1^(L-1) z^-(L-1)) and the same for p2 gives
+    //
+    //     y[n] = sum over j < 2L-1 of g[j] u[n-j] + c1 y[n-L] + c2 y[n-2L]
+    //
+    // with c1 = p1^L + p2^L and c2 = -(p1 p2)^L, where u is the FIR part.
+    // The first sum has no feedback in it and runs vectorised like the FIR,
+    // and the L outputs of each step only read ones at least L back, so a
+    // whole step is one vector operation instead of L dependent ones. The
+    // new recursion's poles are the L-th roots of p1^L and p2^L, so it is
+    // stable exactly when the original is.
+    constexpr int lookAheadLength = 8;
+
+    template <typename SampleType>
+    struct LookAhead
+    {
+        static constexpr int numTaps = 2 * lookAheadLength - 1;
+
+        SampleType g[numTaps] = {};
+        SampleType c1 = 0, c2 = 0;
+
+        // Only used when its rounding error is bounded close to the direct
+        // form's: each output now sums 2L-1 more products, but the
+        // feedback only sees every L-th sample, so its errors die away
+        // faster.
+        bool accurate = false;
+
+        void prepare(double a1, double a2)
+        {
+            constexpr int L = lookAheadLength;
+
+            // Impulse response of 1 / (1 - a1 z^-1 - a2 z^-2)
+            double h[numTaps];
+            h[0] = 1.0;
+            h[1] = a1;
+            for (int j = 2; j < numTaps; ++j)
+                h[j] = a1 * h[j - 1] + a2 * h[j - 2];
+
+            // Power sums p1^k + p2^k follow the same recursion
+            double powerSum = a1, previous = 2.0;
+            for (int k = 2; k <= L; ++k)
+            {
+                const double next = a1 * powerSum + a2 * previous;
+                previous = powerSum;
+                powerSum = next;
+            }
+
+            // p1 p2 = -a2; a first-order recursion has p2 = 0
+            const double back1 = a2 != 0.0 ? powerSum : std::pow(a1, L);
+            const double back2 = -std::pow(-a2, L);
+
+            double sum = std::abs(back1) + std::abs(back2);
+            for (int j = 0; j < numTaps; ++j)
+            {
+                double tap = h[j];
+                if (j >= L)
+                    tap -= back1 * h[j - L];
+
+                g[j] = static_cast<SampleType>(tap);
+                sum += std::abs(tap);
+            }
+
+            c1 = static_cast<SampleType>(back1);
+            c2 = static_cast<SampleType>(back2);
+
+            if (!(poleRadius(a1, a2) < 1.0))
+            {
+                accurate = false; // Unstable either way, keep the familiar form
+                return;
+            }
+
+            // Per-sample error bounds in units of epsilon: each form's sum of
+            // absolute coefficients times the noise gain of its feedback.
+            // When p1^L and p2^L land close together the look-ahead's gain
+            // grows far past the original's.
+            const double direct = (1.0 + std::abs(a1) + std::abs(a2)) * noiseGain(a1, a2);
+            const double lookAhead = sum * noiseGain(back1, back2);
+            accurate = lookAhead <= direct;
+        }
+    };
+
+    // Same result as recursive() up to rounding, see LookAhead. scratch
+    // needs numSamples values; blocks must be longer than 3 * lookAheadLength.
+    template <typename SampleType, int NumTaps>
+    void recursiveLookAhead(const SampleType* const* taps, const SampleType* coefficients, SampleType a1, SampleType a2,
+                            const LookAhead<SampleType>& lookAhead, SampleType* output, SampleType* __restrict scratch,
+                            int numSamples, SampleType* state)
+    {
+        constexpr int L = lookAheadLength;
+        constexpr int numPreTaps = LookAhead<SampleType>::numTaps;
+        fir<SampleType, NumTaps>(taps, coefficients, output, numSamples);
+
+        // The first 2L outputs reach back into the previous block, so they
+        // are stepped the usual way; from then on everything the look-ahead
+        // reads is in this block. The pre-filter goes first, while output
+        // still holds u.
+        const int head = 2 * L;
+
+        SampleType g[numPreTaps];
+        std::copy(lookAhead.g, lookAhead.g + numPreTaps, g);
+
+        for (int n = head; n < numSamples; ++n)
+        {
+            SampleType sum = g[0] * output[n];
+            for (int j = 1; j < numPreTaps; ++j)
+                sum += g[j] * output[n - j];
+            scratch[n] = sum;
+        }
+
+        SampleType y1 = state[0], y2 = state[1];
+        for (int n = 0; n < head; ++n)
+        {
+            const SampleType y = output[n] + a1 * y1 + a2 * y2;
+            y2 = y1;
+            y1 = y;
+            output[n] = y;
+        }
+
+        const SampleType c1 = lookAhead.c1, c2 = lookAhead.c2;
+        int n = head;
+        for (; n + L <= numSamples; n += L)
+            for (int i = 0; i < L; ++i)
+                output[n + i] = scratch[n + i] + c1 * output[n + i - L] + c2 * output[n + i - 2 * L];
+
+        for (; n < numSamples; ++n)
+            output[n] = scratch[n] + c1 * output[n - L] + c2 * output[n - 2 * L];
+
+        state[0] = output[numSamples - 1];
+        state[1] = output[numSamples - 2];
+    }
+
+    template <typename SampleType>
+    void dryWet(SampleType* samples, const SampleType* wet, SampleType dryGain, SampleType wetGain, int numSamples)
+    {
+        for (int i = 0; i < numSamples; ++i)
+            samples[i] = dryGain * samples[i] + wetGain * wet[i];
+    }
+
+    // Samples between restarts of oscillator() from the exact phase
+    constexpr int oscillatorResyncInterval = 256;
+
+    // sin, or cos when cosine is set, of phase + step * i, by turning a
+    // phasor rather than calling sin for every sample. Four phasors a sample
+    // apart each turn by 4 * step, so neighbouring samples don't wait on one
+    // another, and they restart from the exact phase every
+    // oscillatorResyncInterval samples so rounding can't build up: the
+    // result is within 1e-13 of std::sin(phase + step * i) in double.
+    template <typename SampleType>
+    void oscillator(SampleType* output, int numSamples, double phase, double step, bool cosine)
+    {
+        double turnCos[4], turnSin[4]; // By 1, 2, 3 and 4 steps
+        for (int k = 0; k < 4; ++k)
+        {
+            turnCos[k] = std::cos(step * (k + 1));
+            turnSin[k] = std::sin(step * (k + 1));
+        }
+
+        for (int start = 0; start < numSamples; start += oscillatorResyncInterval)
+        {
+            const int end = std::min(start + oscillatorResyncInterval, numSamples);
+            const double angle = phase + step * start;
+
+            double re[4], im[4];
+            re[0] = std::cos(angle);
+            im[0] = std::sin(angle);
+            for (int k = 1; k < 4; ++k)
+            {
+                re[k] = re[0] * turnCos[k - 1] - im[0] * turnSin[k - 1];
+                im[k] = re[0] * turnSin[k - 1] + im[0] * turnCos[k - 1];
+            }
+
+            const double* values = cosine ? re : im;
+            int i = start;
+            for (; i + 4 <= end; i += 4)
+            {
+                for (int k = 0; k < 4; ++k)
+                {
+                    output[i + k] = static_cast<SampleType>(values[k]);
+                    const double turned = re[k] * turnCos[3] - im[k] * turnSin[3];
+                    im[k] = re[k] * turnSin[3] + im[k] * turnCos[3];
+                    re[k] = turned;
+                }
+            }
+
+            for (int k = 0; i < end; ++i, ++k)
+                output[i] = static_cast<SampleType>(values[k]);
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// The generator behind rand and randn. It is counter based: a sample's value
+// is a hash of its position since reset() and its stream's key, with no
+// state carried from one sample to the next. A block is then one loop of
+// integer mixing with no loop-carried dependency, which vectorises like any
+// other, and an engine that jumps to a position (an offline render chunk,
+// see OfflineRenderer) makes exactly the noise one that ran up to it would.
+namespace EquationNoise
+{
+    // Chris Wellons' lowbias32: two multiplies, every input bit reaching
+    // every output bit
+    inline std::uint32_t hash(std::uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    // One rand or randn call's stream. Keys that differ by any amount give
+    // unrelated streams, not shifted copies of each other.
+    inline std::uint32_t makeKey(std::uint32_t seed, std::uint32_t stream)
+    {
+        return hash(seed ^ hash(stream + 0x9e3779b9u));
+    }
+
+    // The bits for the sample whose position's low half is counter, with
+    // blockKey = key ^ hash(the position's high half)
+    inline std::uint32_t bits(std::uint32_t counter, std::uint32_t blockKey)
+    {
+        return hash(hash(counter + blockKey) ^ blockKey);
+    }
+
+    inline std::uint32_t blockKey(std::int64_t position, std::uint32_t key)
+    {
+        return key ^ hash(static_cast<std::uint32_t>(static_cast<std::uint64_t>(position) >> 32));
+    }
+
+    // [0, 1) in steps of 2^-24, exact in float as well as double
+    template <typename SampleType>
+    SampleType uniform(std::uint32_t bits)
+    {
+        return static_cast<SampleType>(bits >> 8) * SampleType(1.0 / 16777216.0);
+    }
+
+    // Zero mean, unit variance, by Box-Muller. The radius uses (0, 1] so the
+    // log is finite, which bounds the output at about 5.8.
+    template <typename SampleType>
+    SampleType gaussian(std::uint32_t bits)
+    {
+        const SampleType radius = (static_cast<SampleType>(bits >> 8) + SampleType(1)) * SampleType(1.0 / 16777216.0);
+        const SampleType angle = uniform<SampleType>(hash(bits ^ 0x5bd1e995u));
+        return std::sqrt(SampleType(-2) * std::log(radius)) * std::cos(SampleType(6.283185307179586) * angle);
+    }
+
+    // numSamples values of the stream starting at position. The hashing is
+    // plain integer arithmetic and vectorises; randn's log and cos do too
+    // where the compiler has vector versions of them (libmvec with
+    // -ffast-math), and otherwise cost what they would in an equation.
+    template <typename SampleType, bool Gaussian>
+    void fill(SampleType* out, int numSamples, std::int64_t position, std::uint32_t key)
+    {
+        for (int start = 0; start < numSamples;)
+        {
+            // The high half only changes every 2^32 samples, about a day at 48 kHz
+            const auto low = static_cast<std::uint32_t>(static_cast<std::uint64_t>(position + start));
+            const std::uint32_t segmentKey = blockKey(position + start, key);
+            const int count = static_cast<int>(std::min<std::uint64_t>(static_cast<std::uint64_t>(numSamples - start),
+                                                                       0x100000000ull - low));
+            SampleType* segment = out + start;
+
+            for (int i = 0; i < count; ++i)
+            {
+                const std::uint32_t b = bits(low + static_cast<std::uint32_t>(i), segmentKey);
+                if constexpr (Gaussian)
+                    segment[i] = gaussian<SampleType>(b);
+                else
+                    segment[i] = uniform<SampleType>(b);
+            }
+
+            start += count;
+        }
+    }
+}
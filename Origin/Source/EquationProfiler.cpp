@@ -0,0 +1,207 @@
+#include "EquationProfiler.h"
+#include "EquationCache.h"
+#include <algorithm>
+#include <cctype>
+#include <limits>
+
+namespace
+{
+    const char* getRateName(CompiledEquation::Rate rate)
+    {
+        switch (rate)
+        {
+            case CompiledEquation::Rate::Constant: return "constant";
+            case CompiledEquation::Rate::Block:    return "block";
+            case CompiledEquation::Rate::Control:  return "control";
+            case CompiledEquation::Rate::Audio:    break;
+        }
+
+        return "audio";
+    }
+}
+
+EquationProfiler::EquationProfiler(std::shared_ptr<const CompiledEquation> newProgram, const std::string& newEquation)
+    : program(std::move(newProgram)), equation(newEquation)
+{
+    numEntries = (program != nullptr ? program->getNumRegisters() : 0) + 2;
+    entryCycles = std::make_unique<std::atomic<std::uint64_t>[]>((size_t) numEntries);
+    clear();
+
+    // Programs are compiled from the normalised text, which only drops
+    // whitespace, so its characters map onto the typed ones in order
+    const auto normalised = EquationCache::normaliseEquation(equation);
+    size_t original = 0;
+    for (char c : normalised)
+    {
+        while (original < equation.length() && !(equation[original] == c || (c == ' ' && std::isspace(static_cast<unsigned char>(equation[original])))))
+            ++original;
+
+        originalOffsets.push_back(static_cast<int>(original));
+        original = std::min(original + 1, equation.length());
+    }
+
+    // The cheapest of a few back-to-back reads
+    timerOverhead = std::numeric_limits<std::uint64_t>::max();
+    for (int i = 0; i < 64; ++i)
+    {
+        const auto start = readCycleCounter();
+        timerOverhead = std::min(timerOverhead, readCycleCounter() - start);
+    }
+}
+
+void EquationProfiler::addBlock(const std::uint64_t* cycles, std::uint64_t blockCycles, int numSamples,
+                                bool timedEachSample) noexcept
+{
+    // Everything else in such a block ran slower for being measured
+    for (int i = 0; i < numEntries; ++i)
+        if (cycles[i] != 0 && (!timedEachSample || (i < getKernelEntry() && program->instructions[(size_t) i].perSample)))
+            entryCycles[(size_t) i].fetch_add(cycles[i], std::memory_order_relaxed);
+
+    if (timedEachSample)
+        return;
+
+    totalCycles.fetch_add(blockCycles, std::memory_order_relaxed);
+    totalSamples.fetch_add(static_cast<std::uint64_t>(numSamples), std::memory_order_relaxed);
+}
+
+void EquationProfiler::clear()
+{
+    for (int i = 0; i < numEntries; ++i)
+        entryCycles[(size_t) i] = 0;
+
+    totalCycles = 0;
+    totalSamples = 0;
+}
+
+EquationProfiler::Report EquationProfiler::getReport() const
+{
+    Report report;
+    report.equation = equation;
+    report.kernel = program != nullptr ? CompiledEquation::getKernelName(program->kernel.shape) : "";
+
+    const auto samples = totalSamples.load(std::memory_order_relaxed);
+    const auto total = totalCycles.load(std::memory_order_relaxed);
+    report.numSamples = static_cast<juce::int64>(samples);
+    if (program == nullptr || samples == 0 || total == 0)
+        return report;
+
+    report.cyclesPerSample = static_cast<double>(total) / static_cast<double>(samples);
+
+    // Ranges come from the compiler or saved state, so they are checked
+    // before being moved onto the typed text
+    const int length = static_cast<int>(equation.length());
+    auto toOriginal = [this] (CompiledEquation::SourceRange range) -> CompiledEquation::SourceRange
+    {
+        if (range.isEmpty() || range.start < 0 || range.end > static_cast<int>(originalOffsets.size()))
+            return {};
+
+        return { originalOffsets[(size_t) range.start], originalOffsets[(size_t) range.end - 1] + 1 };
+    };
+
+    auto textOf = [this] (CompiledEquation::SourceRange range)
+    {
+        return range.isEmpty() ? std::string() : equation.substr((size_t) range.start, (size_t) (range.end - range.start));
+    };
+
+    std::uint64_t attributed = 0;
+    auto addEntry = [&report, samples, total] (Entry entry, std::uint64_t cycles)
+    {
+        entry.cyclesPerSample = static_cast<double>(cycles) / static_cast<double>(samples);
+        entry.share = static_cast<double>(cycles) / static_cast<double>(total);
+        report.entries.push_back(std::move(entry));
+    };
+
+    // The per-sample instructions' own timings only say how to share out
+    // the loop's total
+    const int numRegisters = program->getNumRegisters();
+    const auto loopCycles = entryCycles[(size_t) getSampleLoopEntry()].load(std::memory_order_relaxed);
+    std::uint64_t loopWeights = 0;
+    for (int i = 0; i < numRegisters; ++i)
+        if (program->instructions[(size_t) i].perSample)
+            loopWeights += entryCycles[(size_t) i].load(std::memory_order_relaxed);
+
+    for (int i = 0; i < numRegisters; ++i)
+    {
+        const auto& instruction = program->instructions[(size_t) i];
+        auto cycles = entryCycles[(size_t) i].load(std::memory_order_relaxed);
+        if (instruction.perSample)
+            cycles = loopWeights > 0 ? static_cast<std::uint64_t>(static_cast<double>(loopCycles) * static_cast<double>(cycles)
+                                                                    / static_cast<double>(loopWeights)) : 0;
+
+        if (cycles == 0)
+            continue;
+
+        Entry entry;
+        entry.label = CompiledEquation::getOpName(instruction.op);
+        entry.source = toOriginal(instruction.source);
+        entry.token = toOriginal(instruction.token);
+        entry.text = textOf(entry.source);
+        entry.rate = getRateName(instruction.rate);
+        addEntry(std::move(entry), cycles);
+        attributed += cycles;
+    }
+
+    if (loopWeights == 0 && loopCycles > 0)
+    {
+        Entry entry;
+        entry.label = "feedback loop";
+        entry.rate = "audio";
+        addEntry(std::move(entry), loopCycles);
+        attributed += loopCycles;
+    }
+
+    // The kernel stands in for the whole equation
+    if (const auto cycles = entryCycles[(size_t) getKernelEntry()].load(std::memory_order_relaxed))
+    {
+        Entry entry;
+        entry.label = report.kernel + " kernel";
+        entry.source = { 0, length };
+        entry.text = equation;
+        addEntry(std::move(entry), cycles);
+        attributed += cycles;
+    }
+
+    Entry engine;
+    engine.label = "engine";
+    addEntry(std::move(engine), total - std::min(attributed, total));
+
+    std::stable_sort(report.entries.begin(), report.entries.end(),
+                     [] (const Entry& a, const Entry& b) { return a.cyclesPerSample > b.cyclesPerSample; });
+    return report;
+}
+
+juce::String EquationProfiler::toJSON() const
+{
+    const auto report = getReport();
+
+    juce::Array<juce::var> nodes;
+    for (const auto& entry : report.entries)
+    {
+        auto node = std::make_unique<juce::DynamicObject>();
+        node->setProperty("op", juce::String(entry.label));
+        node->setProperty("text", juce::String(entry.text));
+        node->setProperty("start", entry.source.start);
+        node->setProperty("end", entry.source.end);
+        node->setProperty("tokenStart", entry.token.start);
+        node->setProperty("tokenEnd", entry.token.end);
+        node->setProperty("rate", juce::String(entry.rate));
+        node->setProperty("cyclesPerSample", entry.cyclesPerSample);
+        node->setProperty("share", entry.share);
+        nodes.add(juce::var(node.release()));
+    }
+
+    auto root = std::make_unique<juce::DynamicObject>();
+    root->setProperty("equation", juce::String(report.equation));
+    root->setProperty("kernel", juce::String(report.kernel));
+   #if JUCE_INTEL
+    root->setProperty("clock", "cycles");
+   #else
+    root->setProperty("clock", "ticks");
+   #endif
+    root->setProperty("cyclesPerSample", report.cyclesPerSample);
+    root->setProperty("timedSamples", report.numSamples);
+    root->setProperty("sampleInterval", sampleInterval);
+    root->setProperty("nodes", nodes);
+
+    return juce::JSON::toString(juce::var(root.release()));
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "EquationCompiler.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if JUCE_INTEL
+ #if JUCE_MSVC
+  #include <intrin.h>
+ #else
+  #include <x86intrin.h>
+ #endif
+#endif
+
+// Opt-in breakdown of where an equation's time goes, per instruction of
+// its compiled program, so a slow equation shows whether it is the pow,
+// the sin or the delay taps.
+//
+// An engine given a profiler times one block in every sampleInterval with
+// the CPU's cycle counter: each instruction it runs, the kernel when the
+// program matched one, and the block as a whole, what is left over being
+// the engine's own work (input history, register fills, output copy).
+// Reading the counter around every instruction of every sample would cost
+// more than the feedback loop itself, so that loop is timed as a whole,
+// and every other timed block times its instructions one by one only to
+// share that total out between them. Totals are atomics, so every
+// channel's engine adds into one profiler from whichever thread runs it.
+// Engines without a profiler run a separate instantiation of their block
+// loop with no timing code in it.
+//
+// Instructions carry the part of the equation text they were compiled
+// from, which is what the report and its JSON form are keyed on. Those
+// ranges are into the whitespace-normalised text (see EquationCache);
+// reports move them onto the equation as the user typed it.
+class EquationProfiler
+{
+public:
+    EquationProfiler(std::shared_ptr<const CompiledEquation> program, const std::string& equation);
+
+    // Only engines running this very program use the profiler
+    const CompiledEquation* getProgram() const { return program.get(); }
+
+    static constexpr int sampleInterval = 8; // One block in this many is timed
+
+    // Cycles on x86, the high resolution timer's ticks elsewhere
+    static std::uint64_t readCycleCounter() noexcept
+    {
+       #if JUCE_INTEL
+        return __rdtsc();
+       #else
+        return static_cast<std::uint64_t>(juce::Time::getHighResolutionTicks());
+       #endif
+    }
+
+    // What reading the counter twice costs, taken off every measurement
+    std::uint64_t getTimerOverhead() const { return timerOverhead; }
+
+    // Audio thread. cycles has getNumEntries() values, as an engine
+    // accumulates them over a block: one per register, then the kernel's
+    // and the per-sample loop's. A block that timed each per-sample
+    // instruction only counts towards how the loop's total is shared.
+    void addBlock(const std::uint64_t* cycles, std::uint64_t blockCycles, int numSamples, bool timedEachSample) noexcept;
+
+    int getNumEntries() const { return numEntries; }
+    int getKernelEntry() const { return numEntries - 2; }
+    int getSampleLoopEntry() const { return numEntries - 1; }
+
+    struct Entry
+    {
+        std::string label;                // Operation, "... kernel" or "engine"
+        std::string text;                 // The part of the equation it came from
+        CompiledEquation::SourceRange source;
+        CompiledEquation::SourceRange token; // Its operator, function name or operand
+        std::string rate;                 // "block", "control" or "audio"
+        double cyclesPerSample = 0.0;
+        double share = 0.0;               // Of the timed blocks' total, 0 to 1
+    };
+
+    struct Report
+    {
+        std::string equation;
+        std::string kernel;
+        std::vector<Entry> entries; // Most expensive first
+        double cyclesPerSample = 0.0;
+        juce::int64 numSamples = 0; // How many samples were timed
+    };
+
+    // Any thread
+    Report getReport() const;
+    juce::String toJSON() const;
+    void clear();
+
+private:
+    std::shared_ptr<const CompiledEquation> program;
+    std::string equation;
+    std::vector<int> originalOffsets; // Where each character of the normalised equation is in equation
+    int numEntries = 0;
+    std::uint64_t timerOverhead = 0;
+
+    std::unique_ptr<std::atomic<std::uint64_t>[]> entryCycles;
+    std::atomic<std::uint64_t> totalCycles { 0 };
+    std::atomic<std::uint64_t> totalSamples { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE (EquationProfiler)
+};
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The state behind movmean, movrms, movmax, movmin and envelope. Each costs
+// the same per sample whatever its window length: the moving sums add the
+// newest value and take away the one leaving the window, and the moving
+// extremes keep a queue of the values that can still become the extreme.
+// Windows reach back over silence at the start, as delay lines do.
+namespace EquationWindows
+{
+    // Sum of the last length values pushed. Adding and subtracting leaves
+    // rounding behind that would otherwise build up for as long as the
+    // plugin runs, so a second sum counts only the values pushed since the
+    // ring last wrapped and takes over from the running one at each wrap,
+    // once a whole lap has replaced every value: O(1) per sample. The ring
+    // is indexed by sample position, which makes an engine that starts part
+    // way through (an offline render chunk, see OfflineRenderer) agree
+    // exactly with one that ran from the start once it has been fed
+    // 2 * length samples.
+    class MovingSum
+    {
+    public:
+        void setLength(int length)
+        {
+            ring.assign((size_t) length, 0.0);
+            clear();
+        }
+
+        void clear()
+        {
+            std::fill(ring.begin(), ring.end(), 0.0);
+            sum = 0.0;
+            lapSum = 0.0;
+            index = 0;
+            lapComplete = true;
+        }
+
+        // Where the next value goes, for the sample at position
+        void seek(std::int64_t position)
+        {
+            const int newIndex = static_cast<int>(position % static_cast<std::int64_t>(ring.size()));
+            if (newIndex == index)
+                return;
+
+            // lapSum is missing the start of this lap, so it waits for the next
+            index = newIndex;
+            lapSum = 0.0;
+            lapComplete = false;
+        }
+
+        double push(double value)
+        {
+            sum += value - ring[(size_t) index];
+            ring[(size_t) index] = value;
+            lapSum += value;
+
+            if (++index == static_cast<int>(ring.size()))
+            {
+                if (lapComplete)
+                    sum = lapSum;
+
+                index = 0;
+                lapSum = 0.0;
+                lapComplete = true;
+            }
+
+            return sum;
+        }
+
+        double pushMean(double value) { return push(value) / static_cast<double>(ring.size()); }
+
+        // Rounding can leave a sum of squares slightly below 0
+        double pushRms(double value) { return std::sqrt(std::max(push(value * value), 0.0) / static_cast<double>(ring.size())); }
+
+        // movmean, or movrms when Rms, of numSamples values starting at position
+        template <typename SampleType, bool Rms>
+        void process(const SampleType* input, SampleType* output, int numSamples, std::int64_t position)
+        {
+            seek(position);
+            for (int i = 0; i < numSamples; ++i)
+            {
+                const double value = static_cast<double>(input[i]);
+                output[i] = static_cast<SampleType>(Rms ? pushRms(value) : pushMean(value));
+            }
+        }
+
+        std::size_t getMemoryUsage() const { return ring.capacity() * sizeof(double); }
+
+    private:
+        std::vector<double> ring;
+        double sum = 0.0;
+        double lapSum = 0.0;      // Of ring[0, index), when lapComplete
+        int index = 0;
+        bool lapComplete = true;  // This lap started at index 0
+    };
+
+    // Largest (or smallest) of the last length values pushed. The queue holds
+    // the values that are larger than everything pushed after them, oldest
+    // first, so the front is the answer and each value is added and removed
+    // once. Exact, so there is nothing to correct.
+    template <typename SampleType>
+    class MovingExtreme
+    {
+    public:
+        void setLength(int newLength)
+        {
+            length = newLength;
+
+            int size = 1;
+            while (size < length + 1)
+                size <<= 1;
+
+            values.assign((size_t) size, SampleType(0));
+            ages.assign((size_t) size, 0);
+            mask = size - 1;
+            clear();
+        }
+
+        // The silence before the first sample, as its most recent sample
+        void clear()
+        {
+            if (values.empty())
+                return;
+
+            values[0] = SampleType(0);
+            ages[0] = -1;
+            head = 0;
+            tail = 1;
+            count = 0;
+        }
+
+        template <bool Maximum>
+        SampleType push(SampleType value)
+        {
+            // Ages only grow, so at most the oldest entry has left the window
+            if (head != tail && ages[(size_t) head] <= count - length)
+                head = (head + 1) & mask;
+
+            while (head != tail && !(Maximum ? values[(size_t) ((tail - 1) & mask)] > value
+                                             : values[(size_t) ((tail - 1) & mask)] < value))
+                tail = (tail - 1) & mask;
+
+            values[(size_t) tail] = value;
+            ages[(size_t) tail] = count++;
+            tail = (tail + 1) & mask;
+            return values[(size_t) head];
+        }
+
+        template <bool Maximum>
+        void process(const SampleType* input, SampleType* output, int numSamples)
+        {
+            for (int i = 0; i < numSamples; ++i)
+                output[i] = push<Maximum>(input[i]);
+        }
+
+        std::size_t getMemoryUsage() const { return values.capacity() * sizeof(SampleType) + ages.capacity() * sizeof(std::int64_t); }
+
+    private:
+        std::vector<SampleType> values;
+        std::vector<std::int64_t> ages; // Samples pushed before each entry
+        int length = 1;
+        int mask = 0;
+        int head = 0, tail = 0;         // Entries are [head, tail) around the ring
+        std::int64_t count = 0;
+    };
+
+    // The per-sample factor for a one-pole smoother that covers 1 - 1/e of a
+    // step in seconds; 0 follows at once
+    inline double smoothingCoefficient(double seconds, double sampleRate)
+    {
+        return seconds > 0.0 ? std::exp(-1.0 / (seconds * sampleRate)) : 0.0;
+    }
+
+    // Peak envelope of the input: rises towards |input| with the attack
+    // coefficient and falls with the release one. The state is in double,
+    // since release times of seconds put the coefficient within float's
+    // rounding of 1.
+    inline double followEnvelope(double envelope, double level, double attack, double release)
+    {
+        return level + (level > envelope ? attack : release) * (envelope - level);
+    }
+
+    template <typename SampleType>
+    void followEnvelope(const SampleType* input, SampleType* output, int numSamples, double& envelope,
+                        double attack, double release)
+    {
+        double value = envelope;
+        for (int i = 0; i < numSamples; ++i)
+        {
+            value = followEnvelope(value, std::abs(static_cast<double>(input[i])), attack, release);
+            output[i] = static_cast<SampleType>(value);
+        }
+
+        envelope = value;
+    }
+}
@@ -0,0 +1,67 @@
+#include "LiveCompiler.h"
+#include "EquationCache.h"
+
+namespace
+{
+    // Its own thread so a long response analysis never holds up a compile
+    juce::ThreadPool& getCompilePool()
+    {
+        static juce::ThreadPool pool (1);
+        return pool;
+    }
+}
+
+LiveCompiler::LiveCompiler()
+    : state(std::make_shared<State>())
+{
+    state->owner = this;
+}
+
+LiveCompiler::~LiveCompiler()
+{
+    stopTimer();
+    ++state->generation;
+    state->owner = nullptr;
+}
+
+LiveCompiler::Status LiveCompiler::check(const std::string& equation)
+{
+    Status status;
+    status.valid = parser.parseEquation(equation);
+    status.message = parser.getErrorMessage();
+    status.errorPosition = parser.getErrorPosition();
+    return status;
+}
+
+void LiveCompiler::compileLater(const std::string& equation, const EquationCompiler::Options& options)
+{
+    pendingEquation = equation;
+    pendingOptions = options;
+
+    // Anything already queued or running is for older text now
+    ++state->generation;
+    startTimer(debounceMilliseconds);
+}
+
+void LiveCompiler::timerCallback()
+{
+    stopTimer();
+    const std::uint64_t generation = state->generation.load();
+
+    getCompilePool().addJob([jobState = state, equation = pendingEquation, options = pendingOptions, generation]
+    {
+        if (jobState->generation.load() != generation)
+            return;
+
+        std::string errorMessage;
+        int errorPosition = -1;
+        auto program = EquationCache::getInstance().getOrCompile(equation, options, errorMessage, &errorPosition);
+
+        juce::MessageManager::callAsync([jobState, equation, program, errorMessage, errorPosition, generation]
+        {
+            auto* owner = jobState->owner;
+            if (owner != nullptr && jobState->generation.load() == generation && owner->onCompiled != nullptr)
+                owner->onCompiled(equation, program, errorMessage, errorPosition);
+        });
+    });
+}
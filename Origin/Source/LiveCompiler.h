@@ -0,0 +1,59 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "EquationCompiler.h"
+#include "MatlabParser.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+// Checks an equation on every keystroke and compiles it in the background
+// once typing pauses, so the editor can show errors as they are made and
+// pressing Return finds the program already in EquationCache.
+//
+// check() runs on the message thread and only parses; its parser is kept
+// between calls so each keystroke re-tokenizes from the edit onwards.
+// compileLater() restarts a debounce timer, and when it fires the compile
+// goes to a background thread shared by every instance. A newer request
+// makes older ones stale: their results are dropped and onCompiled only
+// ever reports the latest text.
+class LiveCompiler  : private juce::Timer
+{
+public:
+    struct Status
+    {
+        bool valid = false;
+        std::string message;
+        int errorPosition = -1; // Offset into the text, or -1
+    };
+
+    LiveCompiler();
+    ~LiveCompiler() override;
+
+    Status check(const std::string& equation);
+    void compileLater(const std::string& equation, const EquationCompiler::Options& options);
+
+    // Called on the message thread with the text compiled and its result
+    std::function<void(const std::string& equation, std::shared_ptr<const CompiledEquation> program,
+                       const std::string& errorMessage, int errorPosition)> onCompiled;
+
+    static constexpr int debounceMilliseconds = 250;
+
+private:
+    struct State
+    {
+        std::atomic<std::uint64_t> generation { 0 };
+        LiveCompiler* owner = nullptr; // Only read and cleared on the message thread
+    };
+
+    std::shared_ptr<State> state;
+    MatlabParser parser;
+    std::string pendingEquation;
+    EquationCompiler::Options pendingOptions;
+
+    void timerCallback() override;
+
+    JUCE_DECLARE_NON_COPYABLE (LiveCompiler)
+};
@@ -1,302 +1,579 @@
-#include "MatlabParser.h"
-#include <regex>
-#include <cctype>
-#include <cmath>
-#include <memory>
-#include <algorithm>
-
-MatlabParser::MatlabParser() = default;
-MatlabParser::~MatlabParser() = default;
-
-bool MatlabParser::parseEquation(const std::string& equation)
-{
-    errorMessage.clear();
-    tokens = tokenize(equation);
-    currentToken = 0;
-
-    if (tokens.empty())
-    {
-        errorMessage = "Empty equation";
-        return false;
-    }
-
-    try
-    {
-        auto ast = parseExpression();
-        if (!isAtEnd())
-        {
-            errorMessage = "Unexpected tokens at end of expression";
-            return false;
-        }
-        return ast != nullptr;
-    }
-    catch (const std::exception& e)
-    {
-        errorMessage = e.what();
-        return false;
-    }
-}
-
-std::vector<MatlabParser::Token> MatlabParser::tokenize(const std::string& equation)
-{
-    std::vector<Token> result;
-    std::string input = equation;
-    
-    // Remove whitespace
-    input.erase(std::remove_if(input.begin(), input.end(), ::isspace), input.end());
-    
-    for (size_t i = 0; i < input.length(); ++i)
-    {
-        char c = input[i];
-        
-        if (std::isdigit(c) || c == '.')
-        {
-            // Parse number
-            std::string number;
-            while (i < input.length() && (std::isdigit(input[i]) || input[i] == '.'))
-            {
-                number += input[i++];
-            }
-            --i; // Back up one
-            
-            Token token;
-            token.type = TokenType::Number;
-            token.value = number;
-            token.numericValue = std::stod(number);
-            result.push_back(token);
-        }
-        else if (std::isalpha(c))
-        {
-            // Parse variable or function
-            std::string name;
-            while (i < input.length() && (std::isalnum(input[i]) || input[i] == '_'))
-            {
-                name += input[i++];
-            }
-            --i; // Back up one
-            
-            Token token;
-            token.type = isSupportedFunction(name) ? TokenType::Function : TokenType::Variable;
-            token.value = name;
-            result.push_back(token);
-        }
-        else if (c == 'z' && i + 2 < input.length() && input[i + 1] == '^' && input[i + 2] == '-')
-        {
-            // Handle z^-n delay notation
-            i += 3; // Skip "z^-"
-            std::string delayNum;
-            while (i < input.length() && std::isdigit(input[i]))
-            {
-                delayNum += input[i++];
-            }
-            --i; // Back up one
-            
-            Token token;
-            token.type = TokenType::Variable;
-            token.value = "z^-" + delayNum;
-            token.numericValue = std::stod(delayNum);
-            result.push_back(token);
-        }
-        else if (isSupportedOperator(c))
-        {
-            Token token;
-            token.type = TokenType::Operator;
-            token.value = c;
-            result.push_back(token);
-        }
-        else if (c == '(')
-        {
-            Token token;
-            token.type = TokenType::LeftParen;
-            token.value = c;
-            result.push_back(token);
-        }
-        else if (c == ')')
-        {
-            Token token;
-            token.type = TokenType::RightParen;
-            token.value = c;
-            result.push_back(token);
-        }
-        else if (c == ',')
-        {
-            Token token;
-            token.type = TokenType::Comma;
-            token.value = c;
-            result.push_back(token);
-        }
-    }
-    
-    Token endToken;
-    endToken.type = TokenType::End;
-    result.push_back(endToken);
-    
-    return result;
-}
-
-std::unique_ptr<MatlabParser::ASTNode> MatlabParser::parseExpression()
-{
-    auto left = parseTerm();
-    
-    while (match(TokenType::Operator) && (peek().value == "+" || peek().value == "-"))
-    {
-        std::string op = advance().value;
-        auto right = parseTerm();
-        
-        auto node = std::make_unique<ASTNode>();
-        node->type = ASTNode::Type::BinaryOp;
-        node->value = op;
-        node->children.push_back(std::move(left));
-        node->children.push_back(std::move(right));
-        left = std::move(node);
-    }
-    
-    return left;
-}
-
-std::unique_ptr<MatlabParser::ASTNode> MatlabParser::parseTerm()
-{
-    auto left = parseFactor();
-    
-    while (match(TokenType::Operator) && (peek().value == "*" || peek().value == "/"))
-    {
-        std::string op = advance().value;
-        auto right = parseFactor();
-        
-        auto node = std::make_unique<ASTNode>();
-        node->type = ASTNode::Type::BinaryOp;
-        node->value = op;
-        node->children.push_back(std::move(left));
-        node->children.push_back(std::move(right));
-        left = std::move(node);
-    }
-    
-    return left;
-}
-
-std::unique_ptr<MatlabParser::ASTNode> MatlabParser::parseFactor()
-{
-    if (match(TokenType::Number))
-    {
-        auto token = advance();
-        auto node = std::make_unique<ASTNode>();
-        node->type = ASTNode::Type::Number;
-        node->numericValue = token.numericValue;
-        node->value = token.value;
-        return node;
-    }
-    
-    if (match(TokenType::Variable))
-    {
-        auto token = advance();
-        auto node = std::make_unique<ASTNode>();
-        
-        if (token.value.find("z^-") == 0)
-        {
-            // This is a delay operation
-            node->type = ASTNode::Type::Delay;
-            node->delayAmount = static_cast<int>(token.numericValue);
-            node->value = token.value;
-        }
-        else
-        {
-            node->type = ASTNode::Type::Variable;
-            node->value = token.value;
-        }
-        return node;
-    }
-    
-    if (match(TokenType::Function))
-    {
-        auto token = advance();
-        return parseFunction(token.value);
-    }
-    
-    if (match(TokenType::LeftParen))
-    {
-        advance(); // consume '('
-        auto expr = parseExpression();
-        if (!match(TokenType::RightParen))
-        {
-            throw std::runtime_error("Expected ')' after expression");
-        }
-        advance(); // consume ')'
-        return expr;
-    }
-    
-    throw std::runtime_error("Unexpected token in expression");
-}
-
-std::unique_ptr<MatlabParser::ASTNode> MatlabParser::parseFunction(const std::string& name)
-{
-    auto node = std::make_unique<ASTNode>();
-    node->type = ASTNode::Type::Function;
-    node->value = name;
-    
-    if (!match(TokenType::LeftParen))
-    {
-        throw std::runtime_error("Expected '(' after function name");
-    }
-    advance(); // consume '('
-    
-    // Parse function arguments
-    if (!match(TokenType::RightParen))
-    {
-        do
-        {
-            node->children.push_back(parseExpression());
-        } while (match(TokenType::Comma) && (advance(), true));
-    }
-    
-    if (!match(TokenType::RightParen))
-    {
-        throw std::runtime_error("Expected ')' after function arguments");
-    }
-    advance(); // consume ')'
-    
-    return node;
-}
-
-bool MatlabParser::isSupportedFunction(const std::string& name)
-{
-    static const std::vector<std::string> functions = {
-        "sin", "cos", "tan", "exp", "log", "log10", "sqrt", "abs",
-        "filter", "conv", "fft", "ifft", "freqz", "butter", "cheby1", "cheby2"
-    };
-    
-    return std::find(functions.begin(), functions.end(), name) != functions.end();
-}
-
-bool MatlabParser::isSupportedOperator(char op)
-{
-    return op == '+' || op == '-' || op == '*' || op == '/' || op == '^';
-}
-
-const MatlabParser::Token& MatlabParser::peek() const
-{
-    if (isAtEnd()) return tokens.back(); // Return End token
-    return tokens[currentToken];
-}
-
-const MatlabParser::Token& MatlabParser::advance()
-{
-    if (!isAtEnd()) ++currentToken;
-    return tokens[currentToken - 1];
-}
-
-bool MatlabParser::match(TokenType type)
-{
-    if (check(type)) return true;
-    return false;
-}
-
-bool MatlabParser::check(TokenType type) const
-{
-    if (isAtEnd()) return false;
-    return peek().type == type;
-}
-
-std::string MatlabParser::getErrorMessage() const
-{
-    return errorMessage;
+#include "MatlabParser.h"
+#include <regex>
+#include <cctype>
+#include <cmath>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <tuple>
+
+namespace
+{
+    // A syntax error and the offset in the equation text it points at
+    struct ParseError : std::runtime_error
+    {
+        ParseError(const std::string& message, size_t where)
+            : std::runtime_error(message), position(where) {}
+
+        size_t position;
+    };
+
+    double parseNumber(const std::string& number, size_t position)
+    {
+        try
+        {
+            return std::stod(number);
+        }
+        catch (const std::exception&)
+        {
+            throw ParseError("Invalid number '" + number + "'", position);
+        }
+    }
+}
+
+MatlabParser::MatlabParser() = default;
+MatlabParser::~MatlabParser() = default;
+
+bool MatlabParser::parseEquation(const std::string& equation)
+{
+    errorMessage.clear();
+    errorPosition = -1;
+    ast.reset();
+    currentToken = 0;
+
+    try
+    {
+        tokenize(equation);
+        if (tokens.size() <= 1) // Only the End token
+        {
+            errorMessage = "Empty equation";
+            errorPosition = 0;
+            return false;
+        }
+        
+        auto root = parseExpression();
+        if (!check(TokenType::End))
+        {
+            errorMessage = "Unexpected tokens at end of expression";
+            errorPosition = static_cast<int>(peek().position);
+            return false;
+        }
+        ast = std::move(root);
+        return ast != nullptr;
+    }
+    catch (const ParseError& e)
+    {
+        errorMessage = e.what();
+        errorPosition = static_cast<int>(e.position);
+        return false;
+    }
+    catch (const std::exception& e)
+    {
+        errorMessage = e.what();
+        return false;
+    }
+}
+
+void MatlabParser::tokenize(const std::string& equation)
+{
+    // Whitespace is dropped before tokenizing, but every character kept
+    // remembers its offset in the equation for error positions
+    std::string input;
+    std::vector<size_t> offsets;
+    input.reserve(equation.length());
+    offsets.reserve(equation.length());
+    
+    for (size_t i = 0; i < equation.length(); ++i)
+    {
+        if (!std::isspace(static_cast<unsigned char>(equation[i])))
+        {
+            input += equation[i];
+            offsets.push_back(i);
+        }
+    }
+    
+    // Tokens decided entirely by the part the edit left alone are still
+    // right; the End token always goes
+    const size_t unchanged = static_cast<size_t>(std::mismatch(tokenizedEquation.begin(),
+                                                               tokenizedEquation.begin() + std::min(tokenizedEquation.length(), equation.length()),
+                                                               equation.begin()).first - tokenizedEquation.begin());
+    
+    numReusedTokens = 0;
+    while (numReusedTokens < tokenExtents.size() && tokens[numReusedTokens].type != TokenType::End
+           && tokenExtents[numReusedTokens].lookahead <= unchanged)
+        ++numReusedTokens;
+    
+    tokens.resize(numReusedTokens);
+    tokenExtents.resize(numReusedTokens);
+    tokenizedEquation.clear(); // Until this succeeds
+    
+    const size_t resumeOffset = numReusedTokens > 0 ? tokenExtents.back().end : 0;
+    const size_t resumeIndex = static_cast<size_t>(std::lower_bound(offsets.begin(), offsets.end(), resumeOffset) - offsets.begin());
+    
+    for (size_t i = resumeIndex; i < input.length(); ++i)
+    {
+        char c = input[i];
+        const size_t tokenStart = offsets[i];
+        const size_t tokenCount = tokens.size();
+        
+        if (std::isdigit(c) || c == '.')
+        {
+            // Parse number
+            std::string number;
+            while (i < input.length() && (std::isdigit(input[i]) || input[i] == '.'))
+            {
+                number += input[i++];
+            }
+            --i; // Back up one
+            
+            Token token;
+            token.type = TokenType::Number;
+            token.value = number;
+            token.numericValue = parseNumber(number, tokenStart);
+            token.position = tokenStart;
+            tokens.push_back(token);
+        }
+        else if (c == 'z' && i + 2 < input.length() && input[i + 1] == '^' && input[i + 2] == '-')
+        {
+            // Handle z^-n delay notation
+            i += 3; // Skip "z^-"
+            std::string delayNum;
+            while (i < input.length() && (std::isdigit(input[i]) || input[i] == '.'))
+            {
+                delayNum += input[i++];
+            }
+            --i; // Back up one
+            
+            Token token;
+            token.type = TokenType::Variable;
+            token.value = "z^-" + delayNum;
+            token.position = tokenStart;
+            
+            if (delayNum.empty())
+            {
+                // z^-(expr) or z^-name: the parser reads the delay length as the next factor
+                if (i + 1 >= input.length() || !(input[i + 1] == '(' || std::isalpha(input[i + 1])))
+                    throw ParseError("Expected delay amount after 'z^-'", tokenStart);
+            }
+            else
+            {
+                token.numericValue = parseNumber(delayNum, tokenStart);
+                if (token.numericValue > maxDelayLength)
+                    throw ParseError("Delays can be at most " + std::to_string(maxDelayLength) + " samples long", tokenStart);
+            }
+            tokens.push_back(token);
+        }
+        else if (std::isalpha(c))
+        {
+            // Parse variable or function
+            std::string name;
+            while (i < input.length() && (std::isalnum(input[i]) || input[i] == '_'))
+            {
+                name += input[i++];
+            }
+            --i; // Back up one
+            
+            Token token;
+            token.type = isSupportedFunction(name) ? TokenType::Function : TokenType::Variable;
+            token.value = name;
+            token.position = tokenStart;
+            tokens.push_back(token);
+        }
+        else if (c == '<' || c == '>' || c == '=' || c == '~' || c == '!')
+        {
+            // Comparisons: < <= > >= == and ~= (or !=) for not equal
+            Token token;
+            token.type = TokenType::Operator;
+            token.value = c;
+            token.position = tokenStart;
+            
+            if (i + 1 < input.length() && input[i + 1] == '=')
+                token.value += input[++i];
+            else if (c == '=')
+                throw ParseError("Use '==' to compare; equations have no assignment", tokenStart);
+            else if (c != '<' && c != '>')
+                throw ParseError("Expected '=' after '" + token.value + "'", tokenStart);
+            tokens.push_back(token);
+        }
+        else if (isSupportedOperator(c))
+        {
+            Token token;
+            token.type = TokenType::Operator;
+            token.value = c;
+            token.position = tokenStart;
+            tokens.push_back(token);
+        }
+        else if (c == '(')
+        {
+            Token token;
+            token.type = TokenType::LeftParen;
+            token.value = c;
+            token.position = tokenStart;
+            tokens.push_back(token);
+        }
+        else if (c == ')')
+        {
+            Token token;
+            token.type = TokenType::RightParen;
+            token.value = c;
+            token.position = tokenStart;
+            tokens.push_back(token);
+        }
+        else if (c == ',')
+        {
+            Token token;
+            token.type = TokenType::Comma;
+            token.value = c;
+            token.position = tokenStart;
+            tokens.push_back(token);
+        }
+        
+        // Every branch reads at most two characters past the token's last
+        // one (z^- checks, number and name terminators)
+        if (tokens.size() > tokenCount)
+        {
+            TokenExtent extent;
+            extent.end = offsets[i] + 1;
+            extent.lookahead = i + 2 < input.length() ? offsets[i + 2] + 1 : equation.length() + 1;
+            tokenExtents.push_back(extent);
+        }
+    }
+    
+    Token endToken;
+    endToken.type = TokenType::End;
+    endToken.position = equation.length();
+    tokens.push_back(endToken);
+    tokenExtents.push_back({ equation.length(), equation.length() + 1 });
+    
+    tokenizedEquation = equation;
+}
+
+std::unique_ptr<MatlabParser::ASTNode> MatlabParser::parseExpression()
+{
+    const size_t firstToken = currentToken;
+    auto left = parseSum();
+    
+    // Comparisons bind loosest and give 1 or 0, as in MATLAB
+    while (match(TokenType::Operator) && isComparison(peek().value))
+    {
+        const size_t opToken = currentToken;
+        std::string op = advance().value;
+        auto right = parseSum();
+        
+        auto node = std::make_unique<ASTNode>();
+        node->type = ASTNode::Type::BinaryOp;
+        node->value = op;
+        node->children.push_back(std::move(left));
+        node->children.push_back(std::move(right));
+        setSource(*node, firstToken, opToken);
+        left = std::move(node);
+    }
+    
+    return left;
+}
+
+std::unique_ptr<MatlabParser::ASTNode> MatlabParser::parseSum()
+{
+    const size_t firstToken = currentToken;
+    auto left = parseTerm();
+    
+    while (match(TokenType::Operator) && (peek().value == "+" || peek().value == "-"))
+    {
+        const size_t opToken = currentToken;
+        std::string op = advance().value;
+        auto right = parseTerm();
+        
+        auto node = std::make_unique<ASTNode>();
+        node->type = ASTNode::Type::BinaryOp;
+        node->value = op;
+        node->children.push_back(std::move(left));
+        node->children.push_back(std::move(right));
+        setSource(*node, firstToken, opToken);
+        left = std::move(node);
+    }
+    
+    return left;
+}
+
+std::unique_ptr<MatlabParser::ASTNode> MatlabParser::parseTerm()
+{
+    const size_t firstToken = currentToken;
+    auto left = parsePower();
+    
+    while (match(TokenType::Operator) && (peek().value == "*" || peek().value == "/"))
+    {
+        const size_t opToken = currentToken;
+        std::string op = advance().value;
+        auto right = parsePower();
+        
+        auto node = std::make_unique<ASTNode>();
+        node->type = ASTNode::Type::BinaryOp;
+        node->value = op;
+        node->children.push_back(std::move(left));
+        node->children.push_back(std::move(right));
+        setSource(*node, firstToken, opToken);
+        left = std::move(node);
+    }
+    
+    return left;
+}
+
+std::unique_ptr<MatlabParser::ASTNode> MatlabParser::parsePower()
+{
+    const size_t firstToken = currentToken;
+    auto base = parseFactor();
+    
+    // '^' binds tighter than '*' and '/' and is right-associative, as in MATLAB
+    if (match(TokenType::Operator) && peek().value == "^")
+    {
+        const size_t opToken = currentToken;
+        advance(); // consume '^'
+        auto exponent = parsePower();
+        
+        auto node = std::make_unique<ASTNode>();
+        node->type = ASTNode::Type::BinaryOp;
+        node->value = "^";
+        node->children.push_back(std::move(base));
+        node->children.push_back(std::move(exponent));
+        setSource(*node, firstToken, opToken);
+        return node;
+    }
+    
+    return base;
+}
+
+std::unique_ptr<MatlabParser::ASTNode> MatlabParser::parseFactor()
+{
+    const size_t firstToken = currentToken;
+    
+    if (match(TokenType::Operator) && (peek().value == "-" || peek().value == "+"))
+    {
+        std::string op = advance().value;
+        auto operand = parsePower();
+        if (op == "+")
+            return operand;
+        
+        auto node = std::make_unique<ASTNode>();
+        node->type = ASTNode::Type::UnaryOp;
+        node->value = op;
+        node->children.push_back(std::move(operand));
+        setSource(*node, firstToken, firstToken);
+        return node;
+    }
+    
+    if (match(TokenType::Number))
+    {
+        auto token = advance();
+        auto node = std::make_unique<ASTNode>();
+        node->type = ASTNode::Type::Number;
+        node->numericValue = token.numericValue;
+        node->value = token.value;
+        setSource(*node, firstToken, firstToken);
+        return node;
+    }
+    
+    if (match(TokenType::Variable))
+    {
+        auto token = advance();
+        auto node = std::make_unique<ASTNode>();
+        
+        if (token.value.find("z^-") == 0)
+        {
+            // This is a delay operation
+            node->type = ASTNode::Type::Delay;
+            node->value = token.value;
+            
+            if (token.value.size() == 3)
+            {
+                // Fractional or modulated length, e.g. z^-(d + 5*sin(2*pi*0.5*t))
+                node->children.push_back(parseFactor());
+            }
+            else if (token.numericValue != std::floor(token.numericValue))
+            {
+                auto length = std::make_unique<ASTNode>();
+                length->type = ASTNode::Type::Number;
+                length->numericValue = token.numericValue;
+                length->value = token.value.substr(3);
+                setSource(*length, firstToken, firstToken);
+                node->children.push_back(std::move(length));
+            }
+            else
+            {
+                node->delayAmount = static_cast<int>(token.numericValue);
+            }
+        }
+        else
+        {
+            node->type = ASTNode::Type::Variable;
+            node->value = token.value;
+        }
+        
+        setSource(*node, firstToken, firstToken);
+        return node;
+    }
+    
+    if (match(TokenType::Function))
+    {
+        auto token = advance();
+        return parseFunction(token.value);
+    }
+    
+    if (match(TokenType::LeftParen))
+    {
+        advance(); // consume '('
+        auto expr = parseExpression();
+        if (!match(TokenType::RightParen))
+        {
+            fail("Expected ')' after expression");
+        }
+        advance(); // consume ')'
+        return expr;
+    }
+    
+    fail("Unexpected token in expression");
+}
+
+std::unique_ptr<MatlabParser::ASTNode> MatlabParser::parseFunction(const std::string& name)
+{
+    const size_t nameToken = currentToken - 1;
+    auto node = std::make_unique<ASTNode>();
+    node->type = ASTNode::Type::Function;
+    node->value = name;
+    
+    // MATLAB lets rand and randn go without brackets
+    const bool isNoise = name == "rand" || name == "randn";
+    if (isNoise && !match(TokenType::LeftParen))
+    {
+        setSource(*node, nameToken, nameToken);
+        return node;
+    }
+    
+    if (!match(TokenType::LeftParen))
+    {
+        fail("Expected '(' after function name");
+    }
+    advance(); // consume '('
+    
+    // Parse function arguments
+    if (!match(TokenType::RightParen))
+    {
+        do
+        {
+            node->children.push_back(parseExpression());
+        } while (match(TokenType::Comma) && (advance(), true));
+    }
+    
+    if (!match(TokenType::RightParen))
+    {
+        fail("Expected ')' after function arguments");
+    }
+    
+    // The only argument noise takes is a seed, which has to be known when compiling
+    if (isNoise && (node->children.size() > 1 || (node->children.size() == 1 && node->children[0]->type != ASTNode::Type::Number)))
+    {
+        fail(name + " takes at most one argument, a number to seed it with");
+    }
+    
+    // Window lengths and envelope times size the engine's state, so they have to be known when compiling
+    const bool isWindow = name == "movmean" || name == "movrms" || name == "movmax" || name == "movmin";
+    auto isNumber = [&node] (size_t index) { return node->children[index]->type == ASTNode::Type::Number; };
+    
+    if (isWindow && (node->children.size() != 2 || !isNumber(1) || node->children[1]->numericValue < 1.0
+                     || node->children[1]->numericValue > maxWindowLength
+                     || node->children[1]->numericValue != std::floor(node->children[1]->numericValue)))
+    {
+        fail(name + " takes a signal and a window length, a whole number of samples from 1 to " + std::to_string(maxWindowLength));
+    }
+    
+    if (name == "envelope" && (node->children.size() != 3 || !isNumber(1) || !isNumber(2)))
+    {
+        fail("envelope takes a signal, then attack and release times in seconds as numbers");
+    }
+    
+    // Element-wise only, so these take exactly their operands
+    static const std::tuple<const char*, size_t, const char*> fixedArguments[] = {
+        { "min", 2, "min takes two values" },
+        { "max", 2, "max takes two values" },
+        { "clamp", 3, "clamp takes a value, then its lower and upper limits" },
+        { "sign", 1, "sign takes one value" },
+        { "ifelse", 3, "ifelse takes a condition, then the values for when it is non-zero and when it is zero" }
+    };
+    
+    for (const auto& function : fixedArguments)
+    {
+        if (name == std::get<0>(function) && node->children.size() != std::get<1>(function))
+        {
+            fail(std::get<2>(function));
+        }
+    }
+    advance(); // consume ')'
+    
+    // The name was consumed by the caller
+    setSource(*node, nameToken, nameToken);
+    return node;
+}
+
+bool MatlabParser::isSupportedFunction(const std::string& name)
+{
+    static const std::vector<std::string> functions = {
+        "sin", "cos", "tan", "exp", "log", "log10", "sqrt", "abs",
+        "rand", "randn", "movmean", "movrms", "movmax", "movmin", "envelope",
+        "min", "max", "clamp", "sign", "ifelse",
+        "filter", "conv", "fft", "ifft", "freqz", "butter", "cheby1", "cheby2"
+    };
+    
+    return std::find(functions.begin(), functions.end(), name) != functions.end();
+}
+
+bool MatlabParser::isSupportedOperator(char op)
+{
+    return op == '+' || op == '-' || op == '*' || op == '/' || op == '^';
+}
+
+bool MatlabParser::isComparison(const std::string& op)
+{
+    return op == "<" || op == "<=" || op == ">" || op == ">=" || op == "==" || op == "~=" || op == "!=";
+}
+
+const MatlabParser::Token& MatlabParser::peek() const
+{
+    if (isAtEnd()) return tokens.back(); // Return End token
+    return tokens[currentToken];
+}
+
+const MatlabParser::Token& MatlabParser::advance()
+{
+    if (!isAtEnd()) ++currentToken;
+    return tokens[currentToken - 1];
+}
+
+bool MatlabParser::match(TokenType type)
+{
+    if (check(type)) return true;
+    return false;
+}
+
+bool MatlabParser::check(TokenType type) const
+{
+    if (isAtEnd()) return false;
+    return peek().type == type;
+}
+
+void MatlabParser::setSource(ASTNode& node, size_t firstToken, size_t nodeToken) const
+{
+    const size_t end = currentToken > firstToken ? tokenExtents[currentToken - 1].end : tokens[firstToken].position;
+    node.position = tokens[firstToken].position;
+    node.length = end - node.position;
+    node.tokenPosition = tokens[nodeToken].position;
+    node.tokenLength = tokenExtents[nodeToken].end - node.tokenPosition;
+}
+
+void MatlabParser::fail(const std::string& message) const
+{
+    throw ParseError(message, peek().position);
+}
+
+std::string MatlabParser::getErrorMessage() const
+{
+    return errorMessage;
 }
\ No newline at end of file
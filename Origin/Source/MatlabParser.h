@@ -1,68 +1,118 @@
-#pragma once
-
-#include <JuceHeader.h>
-#include <string>
-#include <vector>
-#include <map>
-#include <memory>
-
-class MatlabParser
-{
-public:
-    enum class TokenType
-    {
-        Number,
-        Variable,
-        Operator,
-        Function,
-        LeftParen,
-        RightParen,
-        Comma,
-        End
-    };
-
-    struct Token
-    {
-        TokenType type;
-        std::string value;
-        double numericValue = 0.0;
-    };
-
-    struct ASTNode
-    {
-        enum class Type { Number, Variable, BinaryOp, UnaryOp, Function, Delay };
-        Type type;
-        std::string value;
-        double numericValue = 0.0;
-        int delayAmount = 0; // For z^-n operations
-        std::vector<std::unique_ptr<ASTNode>> children;
-    };
-
-    MatlabParser();
-    ~MatlabParser();
-
-    bool parseEquation(const std::string& equation);
-    std::string getErrorMessage() const;
-
-    // Supported MATLAB-style functions and operators
-    static bool isSupportedFunction(const std::string& name);
-    static bool isSupportedOperator(char op);
-
-private:
-    std::vector<Token> tokenize(const std::string& equation);
-    std::unique_ptr<ASTNode> parseExpression();
-    std::unique_ptr<ASTNode> parseTerm();
-    std::unique_ptr<ASTNode> parseFactor();
-    std::unique_ptr<ASTNode> parseFunction(const std::string& name);
-    std::unique_ptr<ASTNode> parseDelay(); // For z^-n notation
-
-    std::vector<Token> tokens;
-    size_t currentToken = 0;
-    std::string errorMessage;
-
-    bool isAtEnd() const { return currentToken >= tokens.size(); }
-    const Token& peek() const;
-    const Token& advance();
-    bool match(TokenType type);
-    bool check(TokenType type) const;
+#pragma once
+
+#include <JuceHeader.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+class MatlabParser
+{
+public:
+    enum class TokenType
+    {
+        Number,
+        Variable,
+        Operator,
+        Function,
+        LeftParen,
+        RightParen,
+        Comma,
+        End
+    };
+
+    struct Token
+    {
+        TokenType type;
+        std::string value;
+        double numericValue = 0.0;
+        size_t position = 0; // Offset of the first character in the equation text
+    };
+
+    struct ASTNode
+    {
+        enum class Type { Number, Variable, BinaryOp, UnaryOp, Function, Delay };
+        Type type;
+        std::string value;
+        double numericValue = 0.0;
+        int delayAmount = 0; // For z^-n operations; fractional/modulated delays hold their length in children[0]
+        std::vector<std::unique_ptr<ASTNode>> children;
+
+        // Where the node came from in the equation text: the whole
+        // expression, and the token that makes it (operator, function
+        // name, number or name)
+        size_t position = 0;
+        size_t length = 0;
+        size_t tokenPosition = 0;
+        size_t tokenLength = 0;
+    };
+
+    MatlabParser();
+    ~MatlabParser();
+
+    // Parsing the same parser again after an edit only re-tokenizes from
+    // the first token the edit could have changed, so a parser kept alive
+    // for an equation being typed does little work per keystroke
+    bool parseEquation(const std::string& equation);
+    std::string getErrorMessage() const;
+
+    // Offset into the equation text where the last error was found, or -1
+    int getErrorPosition() const { return errorPosition; }
+
+    // Tokens carried over from the previous equation by the last parse
+    size_t getNumReusedTokens() const { return numReusedTokens; }
+
+    // Access to the tree built by the last successful parseEquation() call
+    const ASTNode* getAST() const { return ast.get(); }
+    std::unique_ptr<ASTNode> releaseAST() { return std::move(ast); }
+
+    // Supported MATLAB-style functions and operators
+    static bool isSupportedFunction(const std::string& name);
+    static bool isSupportedOperator(char op);
+    static bool isComparison(const std::string& op); // < <= > >= == ~= !=
+
+    // Longest window movmean, movrms, movmax and movmin accept, in samples
+    static constexpr int maxWindowLength = 1 << 20;
+
+    // Longest z^-n delay, in samples. Engines size their input history from
+    // it, so a longer constant length is an error rather than an allocation;
+    // EquationCompiler checks lengths that are expressions once folded.
+    static constexpr int maxDelayLength = 1 << 24;
+
+private:
+    void tokenize(const std::string& equation);
+    std::unique_ptr<ASTNode> parseExpression();
+    std::unique_ptr<ASTNode> parseSum();
+    std::unique_ptr<ASTNode> parseTerm();
+    std::unique_ptr<ASTNode> parsePower();
+    std::unique_ptr<ASTNode> parseFactor();
+    std::unique_ptr<ASTNode> parseFunction(const std::string& name);
+    std::unique_ptr<ASTNode> parseDelay(); // For z^-n notation
+
+    std::vector<Token> tokens;
+    std::unique_ptr<ASTNode> ast;
+    size_t currentToken = 0;
+    std::string errorMessage;
+    int errorPosition = -1;
+
+    // What the current tokens were made from, and where each one ends in it
+    struct TokenExtent
+    {
+        size_t end = 0;       // Just past the token's last character
+        size_t lookahead = 0; // Just past the last character read to decide where it ends
+    };
+
+    std::string tokenizedEquation;
+    std::vector<TokenExtent> tokenExtents;
+    size_t numReusedTokens = 0;
+
+    bool isAtEnd() const { return currentToken >= tokens.size(); }
+    const Token& peek() const;
+    const Token& advance();
+    bool match(TokenType type);
+    bool check(TokenType type) const;
+    [[noreturn]] void fail(const std::string& message) const; // Error at the current token
+
+    // Records the text from firstToken to the last one consumed, made by nodeToken
+    void setSource(ASTNode& node, size_t firstToken, size_t nodeToken) const;
 };
\ No newline at end of file
@@ -0,0 +1,259 @@
+#include "MidiVariables.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    constexpr double pitchBendSemitones = 2.0;
+    constexpr int defaultNote = 60;
+}
+
+MidiVariables::MidiVariables()
+{
+    slots.fill(-1);
+    for (int source = 0; source < numSources; ++source)
+        values[(size_t) source] = getDefaultValue(source);
+
+    // Reserved up front so the audio thread never allocates
+    usedSources.reserve(numSources);
+    changes.reserve(maxChangesPerBlock);
+}
+
+std::string MidiVariables::getName(int source)
+{
+    switch (source)
+    {
+        case bend: return "bend";
+        case note: return "note";
+        case freq: return "freq";
+        case vel:  return "vel";
+        case gate: return "gate";
+        default:   return "cc" + std::to_string(source - firstController);
+    }
+}
+
+double MidiVariables::getDefaultValue(int source)
+{
+    switch (source)
+    {
+        case note: return defaultNote;
+        case freq: return 440.0 * std::pow(2.0, (defaultNote - 69) / 12.0);
+        default:   return 0.0;
+    }
+}
+
+void MidiVariables::addDefaultValues(std::map<std::string, double>& variables)
+{
+    // Only fills gaps, so a user variable of the same name wins
+    for (int source = 0; source < numSources; ++source)
+        variables.emplace(getName(source), getDefaultValue(source));
+}
+
+std::pair<double, double> MidiVariables::getRange(int source)
+{
+    const auto noteToFrequency = [] (double noteNumber) { return 440.0 * std::pow(2.0, (noteNumber - 69.0) / 12.0); };
+
+    switch (source)
+    {
+        case bend: return { -1.0, 1.0 };
+        case note: return { 0.0, 127.0 };
+        case freq: return { noteToFrequency(0.0 - pitchBendSemitones), noteToFrequency(127.0 + pitchBendSemitones) };
+        default:   return { 0.0, 1.0 };
+    }
+}
+
+void MidiVariables::addRangeValues(std::map<std::string, double>& variables, double position)
+{
+    for (int source = 0; source < numSources; ++source)
+    {
+        const auto range = getRange(source);
+        variables[getName(source)] = range.first + (range.second - range.first) * position;
+    }
+}
+
+std::vector<bool> MidiVariables::findReadingSlots(const CompiledEquation& program)
+{
+    std::vector<bool> reading(program.variableNames.size(), false);
+    for (int source = 0; source < numSources; ++source)
+    {
+        const auto& names = program.variableNames;
+        auto it = std::find(names.begin(), names.end(), getName(source));
+        if (it != names.end())
+            reading[(size_t) (it - names.begin())] = true;
+    }
+
+    return reading;
+}
+
+bool MidiVariables::isReadBy(const CompiledEquation& program)
+{
+    const auto reading = findReadingSlots(program);
+    return std::find(reading.begin(), reading.end(), true) != reading.end();
+}
+
+bool MidiVariables::changesFeedback(const CompiledEquation& program)
+{
+    using OpCode = CompiledEquation::OpCode;
+
+    const auto reading = findReadingSlots(program);
+    std::vector<bool> driven(program.instructions.size(), false); // Registers a MIDI variable reaches
+
+    for (size_t i = 0; i < program.instructions.size(); ++i)
+    {
+        const auto& instruction = program.instructions[i];
+        const bool drivenA = instruction.a >= 0 && driven[(size_t) instruction.a];
+        const bool drivenB = instruction.b >= 0 && driven[(size_t) instruction.b];
+
+        if (instruction.op == OpCode::Variable)
+            driven[i] = instruction.slot >= 0 && reading[(size_t) instruction.slot];
+        else
+            driven[i] = drivenA || drivenB;
+
+        // Sums pass a driven input into the loop without changing how it
+        // decays; anything else, e.g. cc1*y_prev or sin(x*cc1 + y_prev), does
+        const bool additive = instruction.op == OpCode::Add || instruction.op == OpCode::Subtract
+                           || instruction.op == OpCode::Negate;
+        if (instruction.perSample && driven[i] && !additive)
+            return true;
+    }
+
+    return false;
+}
+
+void MidiVariables::setProgram(const CompiledEquation* program)
+{
+    slots.fill(-1);
+    usedSources.clear();
+    changes.clear(); // Slots of the old program
+
+    if (program == nullptr)
+        return;
+
+    for (int source = 0; source < numSources; ++source)
+    {
+        const auto& names = program->variableNames;
+        auto it = std::find(names.begin(), names.end(), getName(source));
+        if (it == names.end())
+            continue;
+
+        slots[(size_t) source] = static_cast<int>(it - names.begin());
+        usedSources.push_back(source);
+    }
+}
+
+void MidiVariables::processMidi(const juce::MidiBuffer& midi, int numSamples)
+{
+    changes.clear();
+
+    for (const auto metadata : midi)
+    {
+        const int offset = juce::jlimit (0, juce::jmax (numSamples - 1, 0), metadata.samplePosition);
+
+        for (size_t i = 0; i < usedSources.size(); ++i)
+            usedValuesBefore[i] = values[(size_t) usedSources[i]];
+
+        handleMessage(metadata.getMessage());
+        recordChanges(offset);
+    }
+}
+
+void MidiVariables::updateValues(const juce::MidiBuffer& midi)
+{
+    for (const auto metadata : midi)
+        handleMessage(metadata.getMessage());
+}
+
+void MidiVariables::recordChanges(int sampleOffset)
+{
+    // The engines only need to hear about what the program reads
+    for (size_t i = 0; i < usedSources.size(); ++i)
+    {
+        const int source = usedSources[i];
+        const double value = values[(size_t) source];
+
+        if (value != usedValuesBefore[i] && (int) changes.size() < maxChangesPerBlock)
+            changes.push_back({ sampleOffset, slots[(size_t) source], value });
+    }
+}
+
+void MidiVariables::handleMessage(const juce::MidiMessage& message)
+{
+    if (message.isController())
+    {
+        values[(size_t) (firstController + message.getControllerNumber())] = message.getControllerValue() / 127.0;
+
+        if (message.isAllNotesOff() || message.isAllSoundOff())
+        {
+            numHeldNotes = 0;
+            values[gate] = 0.0;
+        }
+    }
+    else if (message.isPitchWheel())
+    {
+        // 0 to 16383, centred on 8192
+        values[bend] = juce::jlimit (-1.0, 1.0, (message.getPitchWheelValue() - 8192) / 8191.0);
+        updateNote();
+    }
+    else if (message.isNoteOn())
+    {
+        noteOn(message.getNoteNumber(), message.getFloatVelocity());
+    }
+    else if (message.isNoteOff())
+    {
+        noteOff(message.getNoteNumber());
+    }
+}
+
+void MidiVariables::updateNote()
+{
+    if (numHeldNotes > 0)
+    {
+        values[note] = heldNotes[(size_t) numHeldNotes - 1];
+        values[vel] = heldVelocities[(size_t) numHeldNotes - 1];
+    }
+
+    const double semitones = values[note] + values[bend] * pitchBendSemitones - 69.0;
+    values[freq] = 440.0 * std::pow(2.0, semitones / 12.0);
+    values[gate] = numHeldNotes > 0 ? 1.0 : 0.0;
+}
+
+void MidiVariables::noteOn(int noteNumber, double velocity)
+{
+    removeHeldNote(noteNumber); // A retrigger moves the note to the top
+
+    if (numHeldNotes == maxHeldNotes)
+    {
+        // Forget the oldest
+        std::move(heldNotes.begin() + 1, heldNotes.end(), heldNotes.begin());
+        std::move(heldVelocities.begin() + 1, heldVelocities.end(), heldVelocities.begin());
+        --numHeldNotes;
+    }
+
+    heldNotes[(size_t) numHeldNotes] = noteNumber;
+    heldVelocities[(size_t) numHeldNotes] = velocity;
+    ++numHeldNotes;
+
+    updateNote();
+}
+
+void MidiVariables::noteOff(int noteNumber)
+{
+    removeHeldNote(noteNumber);
+
+    // Releasing keeps the last note's pitch and velocity, only the gate closes
+    updateNote();
+}
+
+void MidiVariables::removeHeldNote(int noteNumber)
+{
+    for (int i = 0; i < numHeldNotes; ++i)
+    {
+        if (heldNotes[(size_t) i] != noteNumber)
+            continue;
+
+        std::move(heldNotes.begin() + i + 1, heldNotes.begin() + numHeldNotes, heldNotes.begin() + i);
+        std::move(heldVelocities.begin() + i + 1, heldVelocities.begin() + numHeldNotes, heldVelocities.begin() + i);
+        --numHeldNotes;
+        break;
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "EquationCompiler.h"
+#include <array>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Equation variables driven by incoming MIDI, on any channel:
+//
+//   cc0 ... cc127  controller value, 0 to 1
+//   bend           pitch bend, -1 to 1
+//   note           MIDI note number of the last held note (60 until one arrives)
+//   freq           its pitch in Hz including bend, for keyboard tracking
+//   vel            its velocity, 0 to 1
+//   gate           1 while any note is held, else 0
+//
+// so e.g. x * (0.2 + 0.8 * cc1) or a one-pole with exp(-2*pi*freq/fs)
+// respond to a controller or the keyboard with no extra setup.
+//
+// The audio thread turns each block's MidiBuffer into a list of changes to
+// the variables the current program reads, with the sample each one lands
+// on. Engines then run the block in segments between those samples, so
+// every segment still takes the block/vectorised path with constant
+// variables while the changes stay sample-accurate.
+class MidiVariables
+{
+public:
+    MidiVariables();
+
+    struct Change
+    {
+        int sampleOffset = 0;
+        int slot = -1; // Index into the program's variableNames
+        double value = 0.0;
+    };
+
+    // Message thread, while the engines are locked: looks up which of the
+    // variables the program reads. nullptr means none.
+    void setProgram(const CompiledEquation* program);
+    bool isUsed() const { return !usedSources.empty(); }
+
+    // Audio thread. Writes the current value of every variable the
+    // program reads into an engine, e.g. at the start of a block.
+    template <typename Engine>
+    void applyCurrentValues(Engine& engine) const
+    {
+        for (int source : usedSources)
+            engine.setVariableSlot(slots[(size_t) source], values[(size_t) source]);
+    }
+
+    // Audio thread, while the engines are locked. Reads the block's events,
+    // in time order, into getChanges() and moves the current values past them.
+    void processMidi(const juce::MidiBuffer& midi, int numSamples);
+    const std::vector<Change>& getChanges() const { return changes; }
+
+    // Audio thread, for a block that could not take the lock: only moves
+    // the current values past its events, so held notes and controllers stay
+    // right. applyCurrentValues() brings the engines up to date afterwards.
+    void updateValues(const juce::MidiBuffer& midi);
+
+    // The values before any MIDI has arrived, for offline analysis
+    static void addDefaultValues(std::map<std::string, double>& variables);
+
+    // For analysis that has to hold whatever MIDI arrives: every variable
+    // this far through its range, from 0 (controllers and gate at 0, lowest
+    // note, bend down) to 1. These replace variables of the same name, as
+    // the MIDI does once it arrives.
+    static void addRangeValues(std::map<std::string, double>& variables, double position);
+
+    // Whether the program reads any of the variables, and whether one of
+    // them reaches a y_prev feedback path other than by being added to it.
+    // There a coefficient anywhere in the range can make the output ring
+    // longest, so no handful of values bounds the tail.
+    static bool isReadBy(const CompiledEquation& program);
+    static bool changesFeedback(const CompiledEquation& program);
+
+    static constexpr int maxChangesPerBlock = 1024; // Any more wait for the next block
+
+private:
+    enum Source
+    {
+        firstController = 0,
+        bend = 128,
+        note,
+        freq,
+        vel,
+        gate,
+        numSources
+    };
+
+    static constexpr int maxHeldNotes = 16;
+
+    // slots, usedSources and changes belong to the program and are only
+    // touched under the engine lock; values and the held notes are the
+    // audio thread's alone
+    std::array<int, numSources> slots;
+    std::array<double, numSources> values;
+    std::array<double, numSources> usedValuesBefore; // Per entry of usedSources, see processMidi()
+    std::vector<int> usedSources;
+    std::vector<Change> changes;
+
+    // Last-note priority: releasing the newest note falls back to the one before
+    std::array<int, maxHeldNotes> heldNotes;
+    std::array<double, maxHeldNotes> heldVelocities;
+    int numHeldNotes = 0;
+
+    static std::string getName(int source);
+    static double getDefaultValue(int source);
+    static std::pair<double, double> getRange(int source);
+    static std::vector<bool> findReadingSlots(const CompiledEquation& program);
+
+    void handleMessage(const juce::MidiMessage& message);
+    void recordChanges(int sampleOffset);
+    void updateNote();
+    void noteOn(int noteNumber, double velocity);
+    void noteOff(int noteNumber);
+    void removeHeldNote(int noteNumber);
+};
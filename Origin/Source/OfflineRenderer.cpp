@@ -0,0 +1,178 @@
+#include "OfflineRenderer.h"
+#include <algorithm>
+#include <cmath>
+
+template <typename SampleType>
+OfflineRenderer<SampleType>::OfflineRenderer(const Settings& newSettings)
+    : settings(newSettings)
+{
+    settings.blockSize = std::max(settings.blockSize, 1);
+    numThreads = settings.numThreads > 0 ? settings.numThreads : juce::SystemStats::getNumCpus();
+    numThreads = std::max(numThreads, 1);
+
+    // The calling thread works too. Rendering is not real-time, so the
+    // helpers must not starve the rest of the machine during a long bounce.
+    if (numThreads > 1)
+        workerPool = std::make_unique<ChannelWorkerPool>(numThreads - 1, ChannelWorkerPool::Priority::Normal);
+
+    auto probe = makeEngine();
+    equationValid = probe->isEquationValid();
+    errorMessage = probe->getErrorMessage();
+    memoryLength = probe->getMemoryLength();
+
+    if (memoryLength >= 0)
+        warmUpLength = (memoryLength + settings.blockSize - 1) / settings.blockSize * settings.blockSize;
+}
+
+template <typename SampleType>
+OfflineRenderer<SampleType>::~OfflineRenderer() = default;
+
+template <typename SampleType>
+std::unique_ptr<DSPEngine<SampleType>> OfflineRenderer<SampleType>::makeEngine() const
+{
+    auto engine = std::make_unique<DSPEngine<SampleType>>();
+    engine->setDelayInterpolation(settings.interpolation);
+    for (const auto& variable : settings.variables)
+        engine->setVariable(variable.first, variable.second);
+
+    engine->setCompilerOptions(settings.compilerOptions);
+    engine->setEquation(settings.equation);
+    engine->prepare(settings.sampleRate, settings.blockSize);
+    return engine;
+}
+
+template <typename SampleType>
+template <typename Function>
+void OfflineRenderer<SampleType>::parallelFor(int numJobs, Function& function)
+{
+    if (workerPool != nullptr && numJobs > 1)
+    {
+        workerPool->parallelFor(numJobs, function);
+    }
+    else
+    {
+        for (int job = 0; job < numJobs; ++job)
+            function(job);
+    }
+}
+
+template <typename SampleType>
+void OfflineRenderer<SampleType>::process(juce::AudioBuffer<SampleType>& buffer)
+{
+    const int numChannels = buffer.getNumChannels();
+    if (!equationValid || numChannels <= 0 || buffer.getNumSamples() <= 0)
+        return;
+
+    jassert (channels.empty() || (int) channels.size() == numChannels);
+    jassert (position % settings.blockSize == 0); // Only the last segment may end mid-block
+
+    if (channels.empty())
+        channels.resize((size_t) numChannels);
+
+    if (isChunkParallel())
+        processChunked(buffer);
+    else
+        processSerial(buffer);
+
+    position += buffer.getNumSamples();
+}
+
+template <typename SampleType>
+void OfflineRenderer<SampleType>::processSerial(juce::AudioBuffer<SampleType>& buffer)
+{
+    const int numSamples = buffer.getNumSamples();
+
+    auto renderChannel = [this, &buffer, numSamples] (int channel)
+    {
+        auto& engine = channels[(size_t) channel].engine;
+        if (engine == nullptr)
+        {
+            engine = makeEngine();
+            engine->setNoiseSeed(settings.noiseSeed + static_cast<std::uint32_t>(channel));
+        }
+
+        engine->processBlock(buffer.getWritePointer(channel), numSamples);
+    };
+
+    parallelFor(buffer.getNumChannels(), renderChannel);
+}
+
+template <typename SampleType>
+void OfflineRenderer<SampleType>::processChunked(juce::AudioBuffer<SampleType>& buffer)
+{
+    const int numChannels = buffer.getNumChannels();
+    const int numSamples = buffer.getNumSamples();
+    const int blockSize = settings.blockSize;
+
+    // Chunks have to be read from the input while neighbouring ones are
+    // being overwritten, so each channel keeps a copy behind its history
+    for (int channel = 0; channel < numChannels; ++channel)
+    {
+        auto& state = channels[(size_t) channel];
+        state.input.resize((size_t) state.historyLength + (size_t) numSamples);
+        std::copy_n(buffer.getReadPointer(channel), numSamples, state.input.begin() + state.historyLength);
+    }
+
+    // Several chunks per thread balance the load; long enough ones keep
+    // the warm-up a small fraction of the work
+    const int chunksPerChannel = std::max(1, (numThreads * 4 + numChannels - 1) / numChannels);
+    int chunkSize = (numSamples + chunksPerChannel - 1) / chunksPerChannel;
+    chunkSize = std::max({ chunkSize, settings.minChunkSize, warmUpLength * 8 });
+    chunkSize = (chunkSize + blockSize - 1) / blockSize * blockSize;
+
+    const int numChunks = (numSamples + chunkSize - 1) / chunkSize;
+    const int numJobs = numChannels * numChunks;
+
+    while ((int) chunkEngines.size() < numJobs)
+    {
+        chunkEngines.push_back(makeEngine());
+        chunkEngines.back()->setStabilityGuardEnabled(false);
+        warmUpScratch.emplace_back((size_t) warmUpLength);
+    }
+
+    auto renderChunk = [this, &buffer, numChunks, chunkSize, numSamples] (int job)
+    {
+        const int channel = job / numChunks;
+        const int start = (job % numChunks) * chunkSize;
+        const int count = std::min(chunkSize, numSamples - start);
+
+        const auto& state = channels[(size_t) channel];
+        auto& engine = *chunkEngines[(size_t) job];
+
+        // Starts on the serial render's block grid: warmUpLength is whole
+        // blocks, or else everything since the very first sample
+        const int available = state.historyLength + start;
+        const int warmUp = std::min(warmUpLength, available);
+
+        engine.reset();
+        engine.setSamplePosition(position + start - warmUp);
+        engine.setNoiseSeed(settings.noiseSeed + static_cast<std::uint32_t>(channel));
+
+        if (warmUp > 0)
+        {
+            auto& scratch = warmUpScratch[(size_t) job];
+            std::copy_n(state.input.begin() + (available - warmUp), warmUp, scratch.begin());
+            engine.processBlock(scratch.data(), warmUp);
+        }
+
+        SampleType* samples = buffer.getWritePointer(channel, start);
+        std::copy_n(state.input.begin() + available, count, samples);
+        engine.processBlock(samples, count);
+
+        for (int i = 0; i < count; ++i)
+            samples[i] = std::isfinite(samples[i]) ? samples[i] : SampleType(0);
+    };
+
+    parallelFor(numJobs, renderChunk);
+
+    // Keep the last warmUpLength samples of input for the next segment
+    for (auto& state : channels)
+    {
+        const int total = static_cast<int>(state.input.size());
+        state.historyLength = std::min(warmUpLength, total);
+        state.input.erase(state.input.begin(), state.input.begin() + (total - state.historyLength));
+    }
+}
+
+template class OfflineRenderer<float>;
+template class OfflineRenderer<double>;
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "DSPEngine.h"
+#include "ChannelWorkerPool.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Renders long files through an equation outside of a host, for bouncing
+// stems. Audio is fed in successive segments, so a file never has to be in
+// memory all at once.
+//
+// When the equation only remembers a bounded stretch of its input (FIR,
+// z^-n taps, moving windows, memoryless; see DSPEngine::getMemoryLength())
+// each segment is split into chunks that run on every core. A chunk's
+// engine is first fed the input just before the chunk, which leaves its
+// delay lines and windows holding exactly what a single engine running
+// through the whole file would have, so the stitched result is
+// bit-identical to a serial render with the same block size, whatever the
+// number of threads or segment sizes. Noise is a function of the sample
+// position, so it stitches the same way.
+//
+// Chunked equations run with the stability guard off, since its resets
+// depend on everything that came before; non-finite samples are zeroed
+// instead. Anything with feedback renders serially, one channel per core,
+// with the guard on as in the plugin.
+template <typename SampleType>
+class OfflineRenderer
+{
+public:
+    struct Settings
+    {
+        std::string equation;
+        EquationCompiler::Options compilerOptions;
+        std::map<std::string, double> variables;
+        DelayInterpolation interpolation = DelayInterpolation::Linear;
+        double sampleRate = 44100.0;
+        int blockSize = 512;         // Control rate values are evaluated on this grid
+        int numThreads = 0;          // 0 uses every core
+        int minChunkSize = 1 << 16;  // Smaller chunks spend too long warming up
+        std::uint32_t noiseSeed = 0; // For rand and randn without a seed; channel c uses noiseSeed + c
+    };
+
+    explicit OfflineRenderer(const Settings& settings);
+    ~OfflineRenderer();
+
+    bool isEquationValid() const { return equationValid; }
+    std::string getErrorMessage() const { return errorMessage; }
+
+    // True when segments are split into chunks, false when every channel
+    // is rendered from start to end by one engine
+    bool isChunkParallel() const { return memoryLength >= 0; }
+    int getNumThreads() const { return numThreads; }
+
+    // Renders the next buffer.getNumSamples() samples of every channel in
+    // place, carrying on from the previous call. The channel count must
+    // not change, and every segment but the last must be a multiple of
+    // the block size.
+    void process(juce::AudioBuffer<SampleType>& buffer);
+
+private:
+    struct ChannelState
+    {
+        std::unique_ptr<DSPEngine<SampleType>> engine; // Serial rendering
+        std::vector<SampleType> input;                 // Chunked: the warm-up history, then this segment's input
+        int historyLength = 0;
+    };
+
+    Settings settings;
+    bool equationValid = false;
+    std::string errorMessage;
+    int memoryLength = -1;
+    int warmUpLength = 0; // memoryLength rounded up to whole blocks
+    int numThreads = 1;
+    juce::int64 position = 0;
+
+    std::unique_ptr<ChannelWorkerPool> workerPool;
+    std::vector<ChannelState> channels;
+    std::vector<std::unique_ptr<DSPEngine<SampleType>>> chunkEngines; // One per job, reused across segments
+    std::vector<std::vector<SampleType>> warmUpScratch;
+
+    std::unique_ptr<DSPEngine<SampleType>> makeEngine() const;
+    void processSerial(juce::AudioBuffer<SampleType>& buffer);
+    void processChunked(juce::AudioBuffer<SampleType>& buffer);
+    template <typename Function>
+    void parallelFor(int numJobs, Function& function);
+
+    JUCE_DECLARE_NON_COPYABLE (OfflineRenderer)
+};
+
+// Defined in OfflineRenderer.cpp
+extern template class OfflineRenderer<float>;
+extern template class OfflineRenderer<double>;
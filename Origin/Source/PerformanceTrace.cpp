@@ -0,0 +1,120 @@
+#include "PerformanceTrace.h"
+#include <algorithm>
+#include <map>
+#include <vector>
+
+PerformanceTrace& PerformanceTrace::getInstance()
+{
+    static PerformanceTrace instance;
+    return instance;
+}
+
+PerformanceTrace::PerformanceTrace()
+    : events(std::make_unique<Event[]>((size_t) capacity)),
+      originTicks(juce::Time::getHighResolutionTicks())
+{
+}
+
+void PerformanceTrace::addSpan(const char* category, const char* name, juce::int64 startTicks, juce::int64 endTicks,
+                               Arg first, Arg second) noexcept
+{
+    add('X', category, name, startTicks, endTicks - startTicks, first, second);
+}
+
+void PerformanceTrace::addInstant(const char* category, const char* name, Arg first, Arg second) noexcept
+{
+    add('i', category, name, juce::Time::getHighResolutionTicks(), 0, first, second);
+}
+
+void PerformanceTrace::add(char phase, const char* category, const char* name, juce::int64 startTicks,
+                           juce::int64 durationTicks, Arg first, Arg second) noexcept
+{
+    const auto index = numEventsAdded.fetch_add(1, std::memory_order_relaxed);
+    auto& event = events[(size_t) (index % (std::uint64_t) capacity)];
+
+    // Readers skip the slot until the new sequence number is published
+    event.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto& data = event.data;
+    data.category = category;
+    data.name = name;
+    data.phase = phase;
+    data.threadId = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(juce::Thread::getCurrentThreadId()));
+    data.startTicks = startTicks;
+    data.durationTicks = durationTicks;
+    data.args[0] = first;
+    data.args[1] = second;
+
+    event.sequence.store(index + 1, std::memory_order_release);
+}
+
+void PerformanceTrace::clear()
+{
+    for (int i = 0; i < capacity; ++i)
+        events[(size_t) i].sequence.store(0, std::memory_order_relaxed);
+}
+
+juce::String PerformanceTrace::toJSON() const
+{
+    // Copy out whatever is complete, checking each slot was not rewritten
+    // while it was being copied
+    std::vector<std::pair<std::uint64_t, EventData>> snapshot;
+    snapshot.reserve((size_t) capacity);
+    for (int i = 0; i < capacity; ++i)
+    {
+        const auto& event = events[(size_t) i];
+        const auto sequence = event.sequence.load(std::memory_order_acquire);
+        if (sequence == 0)
+            continue;
+
+        const EventData copy = event.data;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (event.sequence.load(std::memory_order_relaxed) == sequence)
+            snapshot.emplace_back(sequence, copy);
+    }
+
+    std::sort(snapshot.begin(), snapshot.end(), [] (const auto& a, const auto& b) { return a.first < b.first; });
+
+    // Thread ids are pointers on some platforms; the viewer wants small numbers
+    std::map<std::uint64_t, int> threadNumbers;
+    auto microseconds = [] (juce::int64 ticks) { return juce::Time::highResolutionTicksToSeconds(ticks) * 1.0e6; };
+
+    juce::String json("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    bool firstEvent = true;
+    for (const auto& entry : snapshot)
+    {
+        const auto& event = entry.second;
+        const int thread = threadNumbers.emplace(event.threadId, static_cast<int>(threadNumbers.size()) + 1).first->second;
+
+        json << (firstEvent ? "\n" : ",\n");
+        firstEvent = false;
+
+        json << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category << "\",\"ph\":\"" << juce::String::charToString(event.phase)
+             << "\",\"pid\":1,\"tid\":" << thread
+             << ",\"ts\":" << juce::String(microseconds(event.startTicks - originTicks), 3);
+
+        if (event.phase == 'X')
+            json << ",\"dur\":" << juce::String(microseconds(event.durationTicks), 3);
+        else
+            json << ",\"s\":\"t\"";
+
+        if (event.args[0].name != nullptr)
+        {
+            json << ",\"args\":{\"" << event.args[0].name << "\":" << event.args[0].value;
+            if (event.args[1].name != nullptr)
+                json << ",\"" << event.args[1].name << "\":" << event.args[1].value;
+            json << "}";
+        }
+
+        json << "}";
+    }
+
+    json << "\n]}\n";
+    return json;
+}
+
+bool PerformanceTrace::writeTo(const juce::File& file) const
+{
+    return file.replaceWithText(toJSON());
+}
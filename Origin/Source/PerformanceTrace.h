@@ -0,0 +1,142 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Build-time switch for the timeline below. Add ORIGIN_TRACING=1 to the
+// exporter's preprocessor definitions to record; without it every
+// ORIGIN_TRACE_ macro expands to nothing and no code is generated.
+#ifndef ORIGIN_TRACING
+ #define ORIGIN_TRACING 0
+#endif
+
+// Timeline of what the plugin was doing around a dropout: compiles, program
+// swaps, prepareToPlay and every audio block with its size and load, saved
+// as Chrome trace-event JSON for chrome://tracing or ui.perfetto.dev.
+//
+// Events go into a ring of capacity slots allocated once, so the trace
+// always holds the most recent ones. Adding an event claims a slot with a
+// single atomic increment and takes no lock and allocates nothing, so the
+// audio thread and every compiling thread can add at once. Each slot
+// carries a sequence number written last, which lets a dump running
+// alongside skip slots that are half written. Names, categories and
+// argument names are kept as pointers, so they must be string literals.
+class PerformanceTrace
+{
+public:
+    static PerformanceTrace& getInstance();
+
+    static constexpr int capacity = 1 << 16; // Over ten minutes of one instance's 512-sample blocks at 48 kHz
+
+    // A number to show with an event; {} for none
+    struct Arg
+    {
+        const char* name;
+        double value;
+    };
+
+    // Any thread. A span from startTicks to endTicks, Time::getHighResolutionTicks() both.
+    void addSpan(const char* category, const char* name, juce::int64 startTicks, juce::int64 endTicks,
+                 Arg first = {}, Arg second = {}) noexcept;
+
+    // Any thread. Something that happened at this moment.
+    void addInstant(const char* category, const char* name, Arg first = {}, Arg second = {}) noexcept;
+
+    // Message thread. Oldest event first; events added meanwhile may or may not be in it.
+    juce::String toJSON() const;
+    bool writeTo(const juce::File& file) const;
+    void clear();
+
+    // Adds a span from construction to destruction
+    class Scope
+    {
+    public:
+        Scope(const char* scopeCategory, const char* scopeName, Arg firstArg = {}, Arg secondArg = {}) noexcept
+            : category(scopeCategory), name(scopeName), first(firstArg), second(secondArg),
+              startTicks(juce::Time::getHighResolutionTicks())
+        {}
+
+        ~Scope()
+        {
+            getInstance().addSpan(category, name, startTicks, juce::Time::getHighResolutionTicks(), first, second);
+        }
+
+    private:
+        const char* category;
+        const char* name;
+        Arg first, second;
+        juce::int64 startTicks;
+
+        JUCE_DECLARE_NON_COPYABLE (Scope)
+    };
+
+    // An audio block's span, with its size and the share of its real-time
+    // budget it took: 1 means it took as long as the audio it made lasts
+    class BlockScope
+    {
+    public:
+        BlockScope(int blockSize, double blockSampleRate) noexcept
+            : numSamples(blockSize), sampleRate(blockSampleRate), startTicks(juce::Time::getHighResolutionTicks())
+        {}
+
+        ~BlockScope()
+        {
+            const auto endTicks = juce::Time::getHighResolutionTicks();
+            const double seconds = juce::Time::highResolutionTicksToSeconds(endTicks - startTicks);
+            const double load = numSamples > 0 ? seconds * sampleRate / numSamples : 0.0;
+            getInstance().addSpan("audio", "processBlock", startTicks, endTicks,
+                                  { "samples", static_cast<double>(numSamples) }, { "load", load });
+        }
+
+    private:
+        int numSamples;
+        double sampleRate;
+        juce::int64 startTicks;
+
+        JUCE_DECLARE_NON_COPYABLE (BlockScope)
+    };
+
+private:
+    PerformanceTrace();
+
+    struct EventData
+    {
+        const char* category = nullptr;
+        const char* name = nullptr;
+        char phase = 'X'; // Chrome's: X a span, i an instant
+        std::uint64_t threadId = 0;
+        juce::int64 startTicks = 0;
+        juce::int64 durationTicks = 0;
+        Arg args[2] {};
+    };
+
+    struct Event
+    {
+        std::atomic<std::uint64_t> sequence { 0 }; // 0 while empty or being written
+        EventData data;
+    };
+
+    void add(char phase, const char* category, const char* name, juce::int64 startTicks, juce::int64 durationTicks,
+             Arg first, Arg second) noexcept;
+
+    std::unique_ptr<Event[]> events;
+    std::atomic<std::uint64_t> numEventsAdded { 0 };
+    juce::int64 originTicks = 0; // Time zero of the trace
+
+    JUCE_DECLARE_NON_COPYABLE (PerformanceTrace)
+};
+
+#if ORIGIN_TRACING
+ #define ORIGIN_TRACE_SCOPE(category, name, ...) \
+    const PerformanceTrace::Scope JUCE_JOIN_MACRO (originTraceScope, __LINE__) (category, name, ##__VA_ARGS__)
+ #define ORIGIN_TRACE_BLOCK(numSamples, sampleRate) \
+    const PerformanceTrace::BlockScope JUCE_JOIN_MACRO (originTraceBlock, __LINE__) (numSamples, sampleRate)
+ #define ORIGIN_TRACE_INSTANT(category, name, ...) \
+    PerformanceTrace::getInstance().addInstant(category, name, ##__VA_ARGS__)
+#else
+ #define ORIGIN_TRACE_SCOPE(category, name, ...)
+ #define ORIGIN_TRACE_BLOCK(numSamples, sampleRate)
+ #define ORIGIN_TRACE_INSTANT(category, name, ...)
+#endif
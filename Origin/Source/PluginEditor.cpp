@@ -1,122 +1,352 @@
-/*
-  ==============================================================================
-
-    This file contains the basic framework code for a JUCE plugin editor.
-
-  ==============================================================================
-*/
-
-#include "PluginProcessor.h"
-#include "PluginEditor.h"
-
-//==============================================================================
-OriginAudioProcessorEditor::OriginAudioProcessorEditor (OriginAudioProcessor& p)
-    : AudioProcessorEditor (&p), audioProcessor (p)
-{
-    // Setup equation label
-    equationLabel.setText("MATLAB Equation:", juce::dontSendNotification);
-    equationLabel.setFont(juce::FontOptions(16.0f, juce::Font::bold));
-    equationLabel.setColour(juce::Label::textColourId, juce::Colours::white);
-    addAndMakeVisible(equationLabel);
-    
-    // Setup equation editor
-    equationEditor.setMultiLine(false);
-    equationEditor.setFont(juce::Font(juce::Font::getDefaultMonospacedFontName(), 14.0f, juce::Font::plain));
-    equationEditor.setText(audioProcessor.getCurrentEquation());
-    equationEditor.addListener(this);
-    addAndMakeVisible(equationEditor);
-    
-    // Setup status label
-    statusLabel.setFont(juce::FontOptions(12.0f));
-    statusLabel.setColour(juce::Label::textColourId, juce::Colours::lightgreen);
-    addAndMakeVisible(statusLabel);
-    
-    // Setup examples label
-    examplesLabel.setText("Examples:\n" 
-                         "x (pass-through)\n"
-                         "0.5 * x (half volume)\n"
-                         "x + 0.3 * z^-1 (echo)\n"
-                         "0.1 * x + 0.9 * y_prev (low-pass)\n"
-                         "x - 0.95 * z^-1 (high-pass)\n"
-                         "0.5 * (x + z^-1) (comb filter)", juce::dontSendNotification);
-    examplesLabel.setFont(juce::FontOptions(11.0f));
-    examplesLabel.setColour(juce::Label::textColourId, juce::Colours::lightgrey);
-    examplesLabel.setJustificationType(juce::Justification::topLeft);
-    addAndMakeVisible(examplesLabel);
-    
-    updateStatus();
-    
-    setSize (500, 400);
-}
-
-OriginAudioProcessorEditor::~OriginAudioProcessorEditor()
-{
-}
-
-//==============================================================================
-void OriginAudioProcessorEditor::paint (juce::Graphics& g)
-{
-    // Fill background with dark color
-    g.fillAll (juce::Colour(0xff2a2a2a));
-    
-    // Draw title
-    g.setColour (juce::Colours::white);
-    g.setFont (juce::FontOptions (24.0f, juce::Font::bold));
-    g.drawText ("ORIGIN (SCT#003)", 20, 10, getWidth() - 40, 30, juce::Justification::centred);
-    
-    g.setColour (juce::Colours::lightgrey);
-    g.setFont (juce::FontOptions (12.0f));
-    g.drawText ("MATLAB DSP Equation Processor", 20, 40, getWidth() - 40, 20, juce::Justification::centred);
-}
-
-void OriginAudioProcessorEditor::resized()
-{
-    auto bounds = getLocalBounds();
-    bounds.removeFromTop(70); // Leave space for title
-    bounds.reduce(20, 10);
-    
-    auto topSection = bounds.removeFromTop(80);
-    equationLabel.setBounds(topSection.removeFromTop(25));
-    equationEditor.setBounds(topSection.removeFromTop(30));
-    statusLabel.setBounds(topSection.removeFromTop(20));
-    
-    bounds.removeFromTop(20); // Gap
-    examplesLabel.setBounds(bounds);
-}
-
-void OriginAudioProcessorEditor::textEditorReturnKeyPressed(juce::TextEditor& editor)
-{
-    if (&editor == &equationEditor)
-    {
-        updateEquation();
-    }
-}
-
-void OriginAudioProcessorEditor::textEditorFocusLost(juce::TextEditor& editor)
-{
-    if (&editor == &equationEditor)
-    {
-        updateEquation();
-    }
-}
-
-void OriginAudioProcessorEditor::updateEquation()
-{
-    audioProcessor.setEquation(equationEditor.getText());
-    updateStatus();
-}
-
-void OriginAudioProcessorEditor::updateStatus()
-{
-    if (audioProcessor.isEquationValid())
-    {
-        statusLabel.setText("✓ Equation valid", juce::dontSendNotification);
-        statusLabel.setColour(juce::Label::textColourId, juce::Colours::lightgreen);
-    }
-    else
-    {
-        auto error = audioProcessor.getEquationError();
-        statusLabel.setText("✗ " + error, juce::dontSendNotification);
-        statusLabel.setColour(juce::Label::textColourId, juce::Colours::red);
-    }
-}
+/*
+  ==============================================================================
+
+    This file contains the basic framework code for a JUCE plugin editor.
+
+  ==============================================================================
+*/
+
+#include "PluginProcessor.h"
+#include "PluginEditor.h"
+
+//==============================================================================
+OriginAudioProcessorEditor::OriginAudioProcessorEditor (OriginAudioProcessor& p)
+    : AudioProcessorEditor (&p), audioProcessor (p), profileView (equationEditor), analysisView (p), responseView (p)
+{
+    // Setup equation label
+    equationLabel.setText("MATLAB Equation:", juce::dontSendNotification);
+    equationLabel.setFont(juce::FontOptions(16.0f, juce::Font::bold));
+    equationLabel.setColour(juce::Label::textColourId, juce::Colours::white);
+    addAndMakeVisible(equationLabel);
+    
+    // Setup equation editor
+    equationEditor.setMultiLine(false);
+    equationEditor.setFont(juce::Font(juce::Font::getDefaultMonospacedFontName(), 14.0f, juce::Font::plain));
+    equationEditor.setText(audioProcessor.getCurrentEquation());
+    equationEditor.addListener(this);
+    addAndMakeVisible(equationEditor);
+    
+    // Tints the equation's text by cost while profiling, on top of the editor
+    addAndMakeVisible(profileView);
+    
+    // While typing, errors show at once and the compile happens in the
+    // background, so Return only has to swap in a cached program
+    liveCompiler.onCompiled = [this] (const std::string& equation, std::shared_ptr<const CompiledEquation> program,
+                                      const std::string& error, int errorPosition)
+    {
+        if (equation != equationEditor.getText().toStdString() || equationEditor.getText() == audioProcessor.getCurrentEquation())
+            return;
+        
+        if (program != nullptr)
+            showLiveStatus({ true, "compiled, press Return to apply", -1 });
+        else
+            showLiveStatus({ false, error, errorPosition });
+    };
+    
+    // Setup status label
+    statusLabel.setFont(juce::FontOptions(12.0f));
+    statusLabel.setColour(juce::Label::textColourId, juce::Colours::lightgreen);
+    addAndMakeVisible(statusLabel);
+    
+    // Setup internal precision selector
+    precisionBox.addItem("32-bit float processing", 1);
+    precisionBox.addItem("64-bit double processing", 2);
+    precisionBox.setSelectedId(audioProcessor.getInternalPrecision() == OriginAudioProcessor::InternalPrecision::Double ? 2 : 1,
+                               juce::dontSendNotification);
+    precisionBox.onChange = [this]
+    {
+        audioProcessor.setInternalPrecision(precisionBox.getSelectedId() == 2 ? OriginAudioProcessor::InternalPrecision::Double
+                                                                              : OriginAudioProcessor::InternalPrecision::Float);
+        updateMemoryReport();
+    };
+    addAndMakeVisible(precisionBox);
+    
+    // Setup memory report
+    memoryLabel.setFont(juce::FontOptions(11.0f));
+    memoryLabel.setColour(juce::Label::textColourId, juce::Colours::lightgrey);
+    addAndMakeVisible(memoryLabel);
+    
+    // Per-instruction profile of the running equation
+    profileButton.setToggleState(audioProcessor.isProfilingEnabled(), juce::dontSendNotification);
+    profileButton.onClick = [this]
+    {
+        audioProcessor.setProfilingEnabled(profileButton.getToggleState());
+        updateProfile();
+    };
+    addAndMakeVisible(profileButton);
+    
+    exportProfileButton.onClick = [this] { exportProfile(); };
+    addAndMakeVisible(exportProfileButton);
+    
+   #if ORIGIN_TRACING
+    saveTraceButton.onClick = [this] { saveTrace(); };
+    addAndMakeVisible(saveTraceButton);
+   #endif
+    
+    profileLabel.setFont(juce::FontOptions(11.0f));
+    profileLabel.setColour(juce::Label::textColourId, juce::Colours::lightgrey);
+    addAndMakeVisible(profileLabel);
+    
+    // Scope and spectrum of the first channel
+    addAndMakeVisible(analysisView);
+    
+    // Frequency response and pole-zero plot of the equation
+    addAndMakeVisible(responseView);
+    
+    // Setup examples label
+    examplesLabel.setText("Examples:\n" 
+                         "x (pass-through)\n"
+                         "0.5 * x (half volume)\n"
+                         "x + 0.3 * z^-1 (echo)\n"
+                         "0.1 * x + 0.9 * y_prev (low-pass)\n"
+                         "x - 0.95 * z^-1 (high-pass)\n"
+                         "0.5 * (x + z^-1) (comb filter)\n"
+                         "0.7 * x + 0.5 * z^-(220 + 40 * sin(2*pi*0.5*t)) (chorus)", juce::dontSendNotification);
+    examplesLabel.setFont(juce::FontOptions(11.0f));
+    examplesLabel.setColour(juce::Label::textColourId, juce::Colours::lightgrey);
+    examplesLabel.setJustificationType(juce::Justification::topLeft);
+    addAndMakeVisible(examplesLabel);
+    
+    updateStatus();
+    updateProfile();
+    
+    setSize (500, 750);
+    
+    // Poll for stability guard events from the audio thread
+    startTimerHz (4);
+}
+
+OriginAudioProcessorEditor::~OriginAudioProcessorEditor()
+{
+    stopTimer();
+}
+
+void OriginAudioProcessorEditor::timerCallback()
+{
+    auto report = audioProcessor.getGuardReport();
+    if (report.resets != shownGuardReport.resets || report.softClips != shownGuardReport.softClips)
+        updateStatus();
+    
+    if (audioProcessor.isProfilingEnabled())
+        updateProfile();
+}
+
+//==============================================================================
+void OriginAudioProcessorEditor::paint (juce::Graphics& g)
+{
+    // Fill background with dark color
+    g.fillAll (juce::Colour(0xff2a2a2a));
+    
+    // Draw title
+    g.setColour (juce::Colours::white);
+    g.setFont (juce::FontOptions (24.0f, juce::Font::bold));
+    g.drawText ("ORIGIN (SCT#003)", 20, 10, getWidth() - 40, 30, juce::Justification::centred);
+    
+    g.setColour (juce::Colours::lightgrey);
+    g.setFont (juce::FontOptions (12.0f));
+    g.drawText ("MATLAB DSP Equation Processor", 20, 40, getWidth() - 40, 20, juce::Justification::centred);
+}
+
+void OriginAudioProcessorEditor::resized()
+{
+    auto bounds = getLocalBounds();
+    bounds.removeFromTop(70); // Leave space for title
+    bounds.reduce(20, 10);
+    
+    auto topSection = bounds.removeFromTop(140);
+    equationLabel.setBounds(topSection.removeFromTop(25));
+    equationEditor.setBounds(topSection.removeFromTop(30));
+    profileView.setBounds(equationEditor.getBounds());
+    statusLabel.setBounds(topSection.removeFromTop(20));
+    topSection.removeFromTop(5);
+    auto optionsRow = topSection.removeFromTop(25);
+    precisionBox.setBounds(optionsRow.removeFromLeft(200));
+    optionsRow.removeFromLeft(10);
+    memoryLabel.setBounds(optionsRow);
+    topSection.removeFromTop(5);
+    auto profileRow = topSection.removeFromTop(25);
+    profileButton.setBounds(profileRow.removeFromLeft(80));
+    exportProfileButton.setBounds(profileRow.removeFromLeft(100));
+   #if ORIGIN_TRACING
+    profileRow.removeFromLeft(5);
+    saveTraceButton.setBounds(profileRow.removeFromLeft(90));
+   #endif
+    profileRow.removeFromLeft(10);
+    profileLabel.setBounds(profileRow);
+    
+    bounds.removeFromTop(10); // Gap
+    analysisView.setBounds(bounds.removeFromTop(150));
+    
+    bounds.removeFromTop(10); // Gap
+    responseView.setBounds(bounds.removeFromTop(150));
+    
+    bounds.removeFromTop(10); // Gap
+    examplesLabel.setBounds(bounds);
+}
+
+void OriginAudioProcessorEditor::textEditorTextChanged(juce::TextEditor& editor)
+{
+    if (&editor != &equationEditor)
+        return;
+    
+    // Back to what is running: show its status rather than a draft's
+    auto text = equationEditor.getText();
+    if (text == audioProcessor.getCurrentEquation())
+    {
+        updateStatus();
+        return;
+    }
+    
+    auto status = liveCompiler.check(text.toStdString());
+    if (status.valid)
+    {
+        showLiveStatus({ true, "compiling...", -1 });
+        liveCompiler.compileLater(text.toStdString(), audioProcessor.getCompilerOptions());
+    }
+    else
+    {
+        showLiveStatus(status);
+    }
+}
+
+void OriginAudioProcessorEditor::showLiveStatus(const LiveCompiler::Status& status)
+{
+    if (status.valid)
+    {
+        statusLabel.setText("Edited: " + juce::String (status.message), juce::dontSendNotification);
+        statusLabel.setColour(juce::Label::textColourId, juce::Colours::lightgrey);
+        return;
+    }
+    
+    juce::String text ("✗ " + juce::String (status.message));
+    if (status.errorPosition >= 0)
+        text << " (column " << status.errorPosition + 1 << ")";
+    
+    statusLabel.setText(text, juce::dontSendNotification);
+    statusLabel.setColour(juce::Label::textColourId, juce::Colours::red);
+}
+
+void OriginAudioProcessorEditor::textEditorReturnKeyPressed(juce::TextEditor& editor)
+{
+    if (&editor == &equationEditor)
+    {
+        updateEquation();
+    }
+}
+
+void OriginAudioProcessorEditor::textEditorFocusLost(juce::TextEditor& editor)
+{
+    if (&editor == &equationEditor)
+    {
+        updateEquation();
+    }
+}
+
+void OriginAudioProcessorEditor::updateEquation()
+{
+    audioProcessor.setEquation(equationEditor.getText());
+    updateStatus();
+    updateProfile();
+}
+
+void OriginAudioProcessorEditor::updateStatus()
+{
+    shownGuardReport = audioProcessor.getGuardReport();
+    
+    if (audioProcessor.isEquationValid())
+    {
+        juce::String status ("✓ Equation valid");
+        auto report = audioProcessor.getCompileReport();
+        if (report.isNotEmpty())
+            status << " (" << report << ")";
+        
+        // The equation compiles but does not behave
+        if (shownGuardReport.resets > 0)
+            status << " - ⚠ blew up to inf/NaN " << shownGuardReport.resets << "x, state reset";
+        else if (shownGuardReport.softClips > 0)
+            status << " - ⚠ unstable, soft-clipped " << shownGuardReport.softClips << "x";
+        
+        statusLabel.setText(status, juce::dontSendNotification);
+        statusLabel.setColour(juce::Label::textColourId, shownGuardReport.resets > 0 || shownGuardReport.softClips > 0
+                                                             ? juce::Colours::orange : juce::Colours::lightgreen);
+    }
+    else
+    {
+        // Parsing the text again locally gives the error a column
+        auto status = liveCompiler.check(audioProcessor.getCurrentEquation().toStdString());
+        if (status.valid)
+            status = { false, audioProcessor.getEquationError().toStdString(), -1 };
+        
+        showLiveStatus(status);
+    }
+    
+    updateMemoryReport();
+}
+
+void OriginAudioProcessorEditor::updateMemoryReport()
+{
+    auto report = audioProcessor.getMemoryReport();
+    auto toKilobytes = [] (std::size_t bytes) { return juce::String ((double) bytes / 1024.0, 1) + " KB"; };
+    
+    memoryLabel.setText("State " + toKilobytes(report.instanceBytes) + " per instance, shared "
+                            + toKilobytes(report.sharedProgramBytes + report.sharedResources.bytes),
+                        juce::dontSendNotification);
+}
+
+void OriginAudioProcessorEditor::updateProfile()
+{
+    auto profiler = audioProcessor.getProfiler();
+    exportProfileButton.setEnabled(profiler != nullptr);
+    
+    if (profiler == nullptr)
+    {
+        profileView.clear();
+        profileLabel.setText(audioProcessor.isProfilingEnabled() ? "Nothing to profile" : "", juce::dontSendNotification);
+        return;
+    }
+    
+    auto report = profiler->getReport();
+    profileView.setReport(report);
+    profileLabel.setText(ProfileView::summarise(report), juce::dontSendNotification);
+}
+
+void OriginAudioProcessorEditor::exportProfile()
+{
+    auto profiler = audioProcessor.getProfiler();
+    if (profiler == nullptr)
+        return;
+    
+    fileChooser = std::make_unique<juce::FileChooser>("Export profile",
+                                                      juce::File::getSpecialLocation(juce::File::userDocumentsDirectory)
+                                                          .getChildFile("Origin profile.json"),
+                                                      "*.json");
+    
+    // The profile is written as it stands when the file is picked
+    fileChooser->launchAsync(juce::FileBrowserComponent::saveMode | juce::FileBrowserComponent::canSelectFiles
+                                 | juce::FileBrowserComponent::warnAboutOverwriting,
+                             [profiler] (const juce::FileChooser& chooser)
+                             {
+                                 auto file = chooser.getResult();
+                                 if (file != juce::File())
+                                     file.replaceWithText(profiler->toJSON());
+                             });
+}
+
+#if ORIGIN_TRACING
+void OriginAudioProcessorEditor::saveTrace()
+{
+    fileChooser = std::make_unique<juce::FileChooser>("Save trace",
+                                                      juce::File::getSpecialLocation(juce::File::userDocumentsDirectory)
+                                                          .getChildFile("Origin trace.json"),
+                                                      "*.json");
+    
+    fileChooser->launchAsync(juce::FileBrowserComponent::saveMode | juce::FileBrowserComponent::canSelectFiles
+                                 | juce::FileBrowserComponent::warnAboutOverwriting,
+                             [] (const juce::FileChooser& chooser)
+                             {
+                                 auto file = chooser.getResult();
+                                 if (file != juce::File())
+                                     PerformanceTrace::getInstance().writeTo(file);
+                             });
+}
+#endif
@@ -1,44 +1,74 @@
-/*
-  ==============================================================================
-
-    This file contains the basic framework code for a JUCE plugin editor.
-
-  ==============================================================================
-*/
-
-#pragma once
-
-#include <JuceHeader.h>
-#include "PluginProcessor.h"
-
-//==============================================================================
-/**
-*/
-class OriginAudioProcessorEditor  : public juce::AudioProcessorEditor, public juce::TextEditor::Listener
-{
-public:
-    OriginAudioProcessorEditor (OriginAudioProcessor&);
-    ~OriginAudioProcessorEditor() override;
-
-    //==============================================================================
-    void paint (juce::Graphics&) override;
-    void resized() override;
-    
-    void textEditorReturnKeyPressed(juce::TextEditor& editor) override;
-    void textEditorFocusLost(juce::TextEditor& editor) override;
-
-private:
-    // This reference is provided as a quick way for your editor to
-    // access the processor object that created it.
-    OriginAudioProcessor& audioProcessor;
-    
-    juce::Label equationLabel;
-    juce::TextEditor equationEditor;
-    juce::Label statusLabel;
-    juce::Label examplesLabel;
-    
-    void updateEquation();
-    void updateStatus();
-
-    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OriginAudioProcessorEditor)
-};
+/*
+  ==============================================================================
+
+    This file contains the basic framework code for a JUCE plugin editor.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "AnalysisView.h"
+#include "ResponseView.h"
+#include "LiveCompiler.h"
+#include "ProfileView.h"
+#include "PerformanceTrace.h"
+
+//==============================================================================
+/**
+*/
+class OriginAudioProcessorEditor  : public juce::AudioProcessorEditor, public juce::TextEditor::Listener,
+                                    private juce::Timer
+{
+public:
+    OriginAudioProcessorEditor (OriginAudioProcessor&);
+    ~OriginAudioProcessorEditor() override;
+
+    //==============================================================================
+    void paint (juce::Graphics&) override;
+    void resized() override;
+    
+    void textEditorTextChanged(juce::TextEditor& editor) override;
+    void textEditorReturnKeyPressed(juce::TextEditor& editor) override;
+    void textEditorFocusLost(juce::TextEditor& editor) override;
+
+private:
+    // This reference is provided as a quick way for your editor to
+    // access the processor object that created it.
+    OriginAudioProcessor& audioProcessor;
+    
+    juce::Label equationLabel;
+    juce::TextEditor equationEditor;
+    juce::Label statusLabel;
+    juce::ComboBox precisionBox;
+    juce::Label memoryLabel;
+    ProfileView profileView;
+    juce::ToggleButton profileButton { "Profile" };
+    juce::TextButton exportProfileButton { "Export JSON" };
+    juce::Label profileLabel;
+   #if ORIGIN_TRACING
+    juce::TextButton saveTraceButton { "Save trace" };
+   #endif
+    std::unique_ptr<juce::FileChooser> fileChooser;
+    AnalysisView analysisView;
+    ResponseView responseView;
+    juce::Label examplesLabel;
+    LiveCompiler liveCompiler;
+    
+    void updateEquation();
+    void updateStatus();
+    void showLiveStatus(const LiveCompiler::Status& status);
+    void updateMemoryReport();
+    void updateProfile();
+    void exportProfile();
+   #if ORIGIN_TRACING
+    void saveTrace();
+   #endif
+    void timerCallback() override;
+    
+    OriginAudioProcessor::GuardReport shownGuardReport;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OriginAudioProcessorEditor)
+};
@@ -1,484 +1,703 @@
-/*
-  ==============================================================================
-
-    This file contains the basic framework code for a JUCE plugin processor.
-
-  ==============================================================================
-*/
-
-#include "PluginProcessor.h"
-#include "PluginEditor.h"
-#include <cmath>
-#include <algorithm>
-
-// Simple DelayLine class implementation
-class DelayLine
-{
-public:
-    DelayLine(int maxDelay = 1024) : maxDelaySize(maxDelay)
-    {
-        buffer.resize(maxDelaySize, 0.0f);
-    }
-    
-    float process(float input, int delaySamples)
-    {
-        delaySamples = std::clamp(delaySamples, 1, maxDelaySize - 1); // Minimum 1 sample delay
-        
-        // Store the current input
-        buffer[writeIndex] = input;
-        
-        // Calculate read index for the delayed sample
-        int readIndex = writeIndex - delaySamples;
-        if (readIndex < 0)
-            readIndex += maxDelaySize;
-        
-        // Get the delayed sample
-        float output = buffer[readIndex];
-        
-        // Advance write index
-        writeIndex = (writeIndex + 1) % maxDelaySize;
-        
-        return output;
-    }
-    
-    void clear()
-    {
-        std::fill(buffer.begin(), buffer.end(), 0.0f);
-        writeIndex = 0;
-    }
-
-private:
-    std::vector<float> buffer;
-    int writeIndex = 0;
-    int maxDelaySize;
-};
-
-//==============================================================================
-OriginAudioProcessor::OriginAudioProcessor()
-#ifndef JucePlugin_PreferredChannelConfigurations
-     : AudioProcessor (BusesProperties()
-                     #if ! JucePlugin_IsMidiEffect
-                      #if ! JucePlugin_IsSynth
-                       .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
-                      #endif
-                       .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
-                     #endif
-                       )
-#endif
-{
-    // Initialize variables
-    variables["pi"] = static_cast<float>(M_PI);
-    variables["e"] = static_cast<float>(M_E);
-    variables["x"] = 0.0f;
-    
-    currentEquation = "x"; // Default pass-through
-    equationValid = true;
-}
-
-OriginAudioProcessor::~OriginAudioProcessor()
-{
-}
-
-//==============================================================================
-const juce::String OriginAudioProcessor::getName() const
-{
-    return JucePlugin_Name;
-}
-
-bool OriginAudioProcessor::acceptsMidi() const
-{
-   #if JucePlugin_WantsMidiInput
-    return true;
-   #else
-    return false;
-   #endif
-}
-
-bool OriginAudioProcessor::producesMidi() const
-{
-   #if JucePlugin_ProducesMidiOutput
-    return true;
-   #else
-    return false;
-   #endif
-}
-
-bool OriginAudioProcessor::isMidiEffect() const
-{
-   #if JucePlugin_IsMidiEffect
-    return true;
-   #else
-    return false;
-   #endif
-}
-
-double OriginAudioProcessor::getTailLengthSeconds() const
-{
-    return 0.0;
-}
-
-int OriginAudioProcessor::getNumPrograms()
-{
-    return 1;   // NB: some hosts don't cope very well if you tell them there are 0 programs,
-                // so this should be at least 1, even if you're not really implementing programs.
-}
-
-int OriginAudioProcessor::getCurrentProgram()
-{
-    return 0;
-}
-
-void OriginAudioProcessor::setCurrentProgram (int index)
-{
-}
-
-const juce::String OriginAudioProcessor::getProgramName (int index)
-{
-    return {};
-}
-
-void OriginAudioProcessor::changeProgramName (int index, const juce::String& newName)
-{
-}
-
-//==============================================================================
-void OriginAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
-{
-    // Use this method as the place to do any pre-playback
-    // initialisation that you need..
-    this->sampleRate = sampleRate;
-    variables["fs"] = static_cast<float>(sampleRate);
-    variables["Fs"] = static_cast<float>(sampleRate);
-    resetDSP();
-}
-
-void OriginAudioProcessor::releaseResources()
-{
-    // When playback stops, you can use this as an opportunity to free up any
-    // spare memory, etc.
-    resetDSP();
-}
-
-#ifndef JucePlugin_PreferredChannelConfigurations
-bool OriginAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) const
-{
-  #if JucePlugin_IsMidiEffect
-    juce::ignoreUnused (layouts);
-    return true;
-  #else
-    // This is the place where you check if the layout is supported.
-    // In this template code we only support mono or stereo.
-    // Some plugin hosts, such as certain GarageBand versions, will only
-    // load plugins that support stereo bus layouts.
-    if (layouts.getMainOutputChannelSet() != juce::AudioChannelSet::mono()
-     && layouts.getMainOutputChannelSet() != juce::AudioChannelSet::stereo())
-        return false;
-
-    // This checks if the input layout matches the output layout
-   #if ! JucePlugin_IsSynth
-    if (layouts.getMainOutputChannelSet() != layouts.getMainInputChannelSet())
-        return false;
-   #endif
-
-    return true;
-  #endif
-}
-#endif
-
-void OriginAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
-{
-    juce::ScopedNoDenormals noDenormals;
-    auto totalNumInputChannels  = getTotalNumInputChannels();
-    auto totalNumOutputChannels = getTotalNumOutputChannels();
-
-    // In case we have more outputs than inputs, this code clears any output
-    // channels that didn't contain input data, (because these aren't
-    // guaranteed to be empty - they may contain garbage).
-    // This is here to avoid people getting screaming feedback
-    // when they first compile a plugin, but obviously you don't need to keep
-    // this code if your algorithm always overwrites all the output channels.
-    for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
-        buffer.clear (i, 0, buffer.getNumSamples());
-
-    // This is the place where you'd normally do the guts of your plugin's
-    // audio processing...
-    // Make sure to reset the state if your inner loop is processing
-    // the samples and the outer loop is handling the channels.
-    // Alternatively, you can process the samples with the channels
-    // interleaved by keeping the same state.
-    for (int channel = 0; channel < totalNumInputChannels; ++channel)
-    {
-        auto* channelData = buffer.getWritePointer (channel);
-
-        // Process each sample through our simple DSP
-        for (int sample = 0; sample < buffer.getNumSamples(); ++sample)
-        {
-            float inputSample = channelData[sample];
-            float outputSample = processSample(inputSample);
-            channelData[sample] = outputSample;
-        }
-    }
-}
-
-//==============================================================================
-bool OriginAudioProcessor::hasEditor() const
-{
-    return true; // (change this to false if you choose to not supply an editor)
-}
-
-juce::AudioProcessorEditor* OriginAudioProcessor::createEditor()
-{
-    return new OriginAudioProcessorEditor (*this);
-}
-
-//==============================================================================
-void OriginAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
-{
-    // You should use this method to store your parameters in the memory block.
-    // You could do that either as raw data, or use the XML or ValueTree classes
-    // as intermediaries to make it easy to save and load complex data.
-}
-
-void OriginAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
-{
-    // You should use this method to restore your parameters from this memory block,
-    // whose contents will have been created by the getStateInformation() call.
-}
-
-//==============================================================================
-// This creates new instances of the plugin..
-void OriginAudioProcessor::setEquation(const juce::String& equation)
-{
-    currentEquation = equation;
-    // Simple validation - just check if it's not empty
-    equationValid = !equation.isEmpty();
-    if (!equationValid)
-    {
-        errorMessage = "Empty equation";
-    }
-    else
-    {
-        errorMessage.clear();
-    }
-}
-
-bool OriginAudioProcessor::isEquationValid() const
-{
-    return equationValid;
-}
-
-juce::String OriginAudioProcessor::getEquationError() const
-{
-    return juce::String(errorMessage);
-}
-
-// Real-time mathematical expression evaluator
-float OriginAudioProcessor::processSample(float input)
-{
-    if (!equationValid)
-        return input;
-    
-    // Set current input
-    variables["x"] = input;
-    
-    try
-    {
-        // Evaluate the mathematical expression
-        float output = evaluateExpression(currentEquation, input);
-        
-        // Store output history for future references (y_prev, etc.)
-        outputHistory["y_prev2"] = outputHistory["y_prev"];
-        outputHistory["y_prev"] = output;
-        
-        return output;
-    }
-    catch (...)
-    {
-        return input; // Fall back to pass-through on error
-    }
-}
-
-float OriginAudioProcessor::evaluateExpression(const juce::String& expr, float x)
-{
-    juce::String cleanExpr = expr.removeCharacters(" \t\n\r");
-    int pos = 0;
-    
-    // Handle simple cases first
-    if (cleanExpr == "x") return x;
-    if (cleanExpr == "0") return 0.0f;
-    if (cleanExpr == "1") return 1.0f;
-    
-    return evaluateTerm(cleanExpr, pos);
-}
-
-float OriginAudioProcessor::evaluateTerm(juce::String& expr, int& pos)
-{
-    float result = evaluateFactor(expr, pos);
-    
-    while (pos < expr.length())
-    {
-        skipWhitespace(expr, pos);
-        if (pos >= expr.length()) break;
-        
-        char op = expr[pos];
-        if (op == '+' || op == '-')
-        {
-            pos++;
-            float nextFactor = evaluateFactor(expr, pos);
-            if (op == '+')
-                result += nextFactor;
-            else
-                result -= nextFactor;
-        }
-        else
-        {
-            break;
-        }
-    }
-    
-    return result;
-}
-
-float OriginAudioProcessor::evaluateFactor(juce::String& expr, int& pos)
-{
-    float result = 1.0f;
-    bool firstTerm = true;
-    
-    while (pos < expr.length())
-    {
-        skipWhitespace(expr, pos);
-        if (pos >= expr.length()) break;
-        
-        char ch = expr[pos];
-        
-        // Handle multiplication and division
-        if (!firstTerm && ch != '*' && ch != '/' && ch != '+' && ch != '-')
-        {
-            // Implicit multiplication
-        }
-        else if (ch == '*' || ch == '/')
-        {
-            pos++;
-            skipWhitespace(expr, pos);
-        }
-        else if (ch == '+' || ch == '-')
-        {
-            break; // Let evaluateTerm handle this
-        }
-        
-        float factor = 1.0f;
-        
-        // Parse numbers
-        if (std::isdigit(ch) || ch == '.')
-        {
-            factor = evaluateNumber(expr, pos);
-        }
-        // Parse variables
-        else if (ch == 'x')
-        {
-            pos++;
-            factor = variables["x"];
-        }
-        else if (expr.substring(pos).startsWith("y_prev"))
-        {
-            if (expr.substring(pos).startsWith("y_prev2"))
-            {
-                pos += 7; // "y_prev2"
-                factor = outputHistory["y_prev2"];
-            }
-            else
-            {
-                pos += 6; // "y_prev"
-                factor = outputHistory["y_prev"];
-            }
-        }
-        // Parse z^-n (delay terms)
-        else if (expr.substring(pos).startsWith("z^-"))
-        {
-            pos += 3; // Skip "z^-"
-            int delayAmount = static_cast<int>(evaluateNumber(expr, pos));
-            DelayLine* delay = getDelayLine(delayAmount);
-            factor = delay->process(variables["x"], delayAmount);
-        }
-        // Parse parentheses
-        else if (ch == '(')
-        {
-            pos++; // Skip '('
-            factor = evaluateTerm(expr, pos);
-            if (pos < expr.length() && expr[pos] == ')')
-                pos++; // Skip ')'
-        }
-        else
-        {
-            pos++; // Skip unknown character
-            continue;
-        }
-        
-        if (firstTerm)
-        {
-            result = factor;
-            firstTerm = false;
-        }
-        else
-        {
-            if (pos > 1 && expr[pos-2] == '/')
-                result /= factor;
-            else
-                result *= factor;
-        }
-        
-        skipWhitespace(expr, pos);
-        if (pos >= expr.length() || (expr[pos] != '*' && expr[pos] != '/' && !std::isdigit(expr[pos]) && expr[pos] != 'x' && expr[pos] != 'y' && expr[pos] != 'z' && expr[pos] != '('))
-            break;
-    }
-    
-    return result;
-}
-
-float OriginAudioProcessor::evaluateNumber(juce::String& expr, int& pos)
-{
-    juce::String numberStr;
-    
-    while (pos < expr.length() && (std::isdigit(expr[pos]) || expr[pos] == '.'))
-    {
-        numberStr += expr[pos];
-        pos++;
-    }
-    
-    return numberStr.getFloatValue();
-}
-
-void OriginAudioProcessor::skipWhitespace(const juce::String& expr, int& pos)
-{
-    while (pos < expr.length() && std::isspace(expr[pos]))
-        pos++;
-}
-
-void OriginAudioProcessor::resetDSP()
-{
-    for (auto& pair : delayLines)
-    {
-        pair.second->clear();
-    }
-    variables["x"] = 0.0f;
-}
-
-DelayLine* OriginAudioProcessor::getDelayLine(int delayAmount)
-{
-    auto it = delayLines.find(delayAmount);
-    if (it == delayLines.end())
-    {
-        auto delayLine = std::make_unique<DelayLine>(std::max(delayAmount + 1, 1024));
-        DelayLine* ptr = delayLine.get();
-        delayLines[delayAmount] = std::move(delayLine);
-        return ptr;
-    }
-    return it->second.get();
-}
-
-//==============================================================================
-// This creates new instances of the plugin..
-juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
-{
-    return new OriginAudioProcessor();
-}
+/*
+  ==============================================================================
+
+    This file contains the basic framework code for a JUCE plugin processor.
+
+  ==============================================================================
+*/
+
+#include "PluginProcessor.h"
+#include "PluginEditor.h"
+#include "ChannelWorkerPool.h"
+#include "EquationCache.h"
+#include "PluginState.h"
+#include "PerformanceTrace.h"
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+namespace
+{
+    // Below this many node evaluations per block, waking helper threads
+    // costs more than it saves and channels are processed in sequence
+    constexpr int parallelWorkThreshold = 32768;
+    
+    // Helpers only pay off once there are more channels than a stereo pair
+    constexpr int minChannelsForWorkerPool = 4;
+    
+    // A linear kernel whose coefficients are all constants has a tail no
+    // variable can change, see DSPEngine::estimateTailLength()
+    bool hasFixedTail(const CompiledEquation& program)
+    {
+        using Shape = CompiledEquation::KernelShape;
+        const auto& kernel = program.kernel;
+        if (kernel.shape == Shape::General || kernel.shape == Shape::DryWet)
+            return false;
+        
+        auto isConstant = [] (const CompiledEquation::Coefficient& c) { return c.reg < 0; };
+        return std::all_of(kernel.tapCoefficients.begin(), kernel.tapCoefficients.end(), isConstant)
+            && isConstant(kernel.feedback[0]) && isConstant(kernel.feedback[1]);
+    }
+}
+
+//==============================================================================
+OriginAudioProcessor::OriginAudioProcessor()
+#ifndef JucePlugin_PreferredChannelConfigurations
+     : AudioProcessor (BusesProperties()
+                     #if ! JucePlugin_IsMidiEffect
+                      #if ! JucePlugin_IsSynth
+                       .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
+                      #endif
+                       .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
+                     #endif
+                       )
+#endif
+{
+    currentEquation = "x"; // Default pass-through
+    equationValid = true;
+}
+
+OriginAudioProcessor::~OriginAudioProcessor()
+{
+}
+
+//==============================================================================
+const juce::String OriginAudioProcessor::getName() const
+{
+    return JucePlugin_Name;
+}
+
+bool OriginAudioProcessor::acceptsMidi() const
+{
+   #if JucePlugin_WantsMidiInput
+    return true;
+   #else
+    return false;
+   #endif
+}
+
+bool OriginAudioProcessor::producesMidi() const
+{
+   #if JucePlugin_ProducesMidiOutput
+    return true;
+   #else
+    return false;
+   #endif
+}
+
+bool OriginAudioProcessor::isMidiEffect() const
+{
+   #if JucePlugin_IsMidiEffect
+    return true;
+   #else
+    return false;
+   #endif
+}
+
+double OriginAudioProcessor::getTailLengthSeconds() const
+{
+    return tailSeconds.load (std::memory_order_relaxed);
+}
+
+int OriginAudioProcessor::getNumPrograms()
+{
+    return 1;   // NB: some hosts don't cope very well if you tell them there are 0 programs,
+                // so this should be at least 1, even if you're not really implementing programs.
+}
+
+int OriginAudioProcessor::getCurrentProgram()
+{
+    return 0;
+}
+
+void OriginAudioProcessor::setCurrentProgram (int index)
+{
+}
+
+const juce::String OriginAudioProcessor::getProgramName (int index)
+{
+    return {};
+}
+
+void OriginAudioProcessor::changeProgramName (int index, const juce::String& newName)
+{
+}
+
+//==============================================================================
+void OriginAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
+{
+    ORIGIN_TRACE_SCOPE ("host", "prepareToPlay", { "sampleRate", sampleRate }, { "samplesPerBlock", (double) samplesPerBlock });
+    
+    // Use this method as the place to do any pre-playback
+    // initialisation that you need..
+    this->sampleRate = sampleRate;
+    maxBlockSize = samplesPerBlock;
+    analysisDecimation = juce::jmax (1, static_cast<int> (sampleRate / analysisMaxRate));
+    requestResponseAnalysis();
+    
+    auto numChannels = juce::jmax (getTotalNumInputChannels(), getTotalNumOutputChannels());
+    prepareChannelEngines (numChannels, internalPrecision);
+    updateTailLength();
+    
+    // Every instance shares one pool, created here rather than on the audio thread
+    if (numChannels >= minChannelsForWorkerPool)
+    {
+        if (workerPool == nullptr)
+            workerPool = ChannelWorkerPool::getShared();
+    }
+    else
+    {
+        workerPool.reset();
+    }
+}
+
+void OriginAudioProcessor::releaseResources()
+{
+    // When playback stops, you can use this as an opportunity to free up any
+    // spare memory, etc.
+    resetDSP();
+}
+
+#ifndef JucePlugin_PreferredChannelConfigurations
+bool OriginAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) const
+{
+  #if JucePlugin_IsMidiEffect
+    juce::ignoreUnused (layouts);
+    return true;
+  #else
+    // Every channel runs its own copy of the equation, so any layout works:
+    // mono, stereo, surround (e.g. 7.1.4), ambisonic or plain discrete channels.
+    if (layouts.getMainOutputChannelSet().isDisabled())
+        return false;
+
+    // This checks if the input layout matches the output layout
+   #if ! JucePlugin_IsSynth
+    if (layouts.getMainOutputChannelSet() != layouts.getMainInputChannelSet())
+        return false;
+   #endif
+
+    return true;
+  #endif
+}
+#endif
+
+void OriginAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
+{
+    processAnyPrecision (buffer, midiMessages);
+}
+
+void OriginAudioProcessor::processBlock (juce::AudioBuffer<double>& buffer, juce::MidiBuffer& midiMessages)
+{
+    processAnyPrecision (buffer, midiMessages);
+}
+
+bool OriginAudioProcessor::supportsDoublePrecisionProcessing() const
+{
+    return true;
+}
+
+template <typename HostType>
+void OriginAudioProcessor::processAnyPrecision (juce::AudioBuffer<HostType>& buffer, const juce::MidiBuffer& midiMessages)
+{
+    ORIGIN_TRACE_BLOCK (buffer.getNumSamples(), sampleRate);
+    
+    juce::ScopedNoDenormals noDenormals;
+    auto totalNumInputChannels  = getTotalNumInputChannels();
+    auto totalNumOutputChannels = getTotalNumOutputChannels();
+
+    // In case we have more outputs than inputs, this code clears any output
+    // channels that didn't contain input data, (because these aren't
+    // guaranteed to be empty - they may contain garbage).
+    // This is here to avoid people getting screaming feedback
+    // when they first compile a plugin, but obviously you don't need to keep
+    // this code if your algorithm always overwrites all the output channels.
+    for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
+        buffer.clear (i, 0, buffer.getNumSamples());
+
+    // Only a copy (or box average at high rates) of one channel, and only
+    // while an editor is watching
+    const bool analysing = analysisActive.load (std::memory_order_relaxed) && totalNumInputChannels > 0;
+    if (analysing)
+        inputAnalysis.push (buffer.getReadPointer (0), buffer.getNumSamples(), analysisDecimation);
+    
+    const juce::SpinLock::ScopedTryLockType lock (engineLock);
+    if (! lock.isLocked())
+    {
+        // Equation is being swapped, let this block through untouched. Its
+        // MIDI still moves the variables on, so no note stays held; which
+        // slots they map to is changing, so the engines catch up with
+        // applyCurrentValues() in the next block instead.
+        ORIGIN_TRACE_INSTANT ("audio", "engines busy, block passed through");
+        midiVariables.updateValues (midiMessages);
+        
+        if (analysing)
+            outputAnalysis.push (buffer.getReadPointer (0), buffer.getNumSamples(), analysisDecimation);
+        
+        return;
+    }
+    
+    // Engines start the block where the last one left the MIDI variables,
+    // then step through this block's changes
+    forEachEngine ([this] (auto& engine) { midiVariables.applyCurrentValues (engine); });
+    midiVariables.processMidi (midiMessages, buffer.getNumSamples());
+    
+    if (internalPrecision == InternalPrecision::Double)
+        processChannels (buffer, juce::jmin (totalNumInputChannels, static_cast<int> (doubleEngines.size())), doubleEngines, doubleScratch);
+    else
+        processChannels (buffer, juce::jmin (totalNumInputChannels, static_cast<int> (floatEngines.size())), floatEngines, floatScratch);
+    
+    if (analysing)
+        outputAnalysis.push (buffer.getReadPointer (0), buffer.getNumSamples(), analysisDecimation);
+    
+    // Tally what the stability guard did, for the editor to pick up
+    forEachEngine ([this] (auto& engine)
+    {
+        using Action = typename std::decay_t<decltype (engine)>::GuardAction;
+        
+        if (engine.getLastGuardAction() == Action::Reset)
+            guardResets.fetch_add (1, std::memory_order_relaxed);
+        else if (engine.getLastGuardAction() == Action::SoftClipped)
+            guardSoftClips.fetch_add (1, std::memory_order_relaxed);
+    });
+}
+
+template <typename HostType, typename EngineType>
+void OriginAudioProcessor::processChannels (juce::AudioBuffer<HostType>& buffer, int numChannels,
+                                            std::vector<std::unique_ptr<DSPEngine<EngineType>>>& engines,
+                                            juce::AudioBuffer<EngineType>& scratch)
+{
+    auto numSamples = buffer.getNumSamples();
+    if (numChannels <= 0 || numSamples <= 0)
+        return;
+    
+    const auto& midiChanges = midiVariables.getChanges();
+    
+    auto processChannel = [&buffer, &engines, &scratch, &midiChanges, numSamples] (int channel)
+    {
+        auto& engine = *engines[(size_t) channel];
+        if (engine.isBypassed())
+            return; // x: the buffer already holds the output, skip even the conversion
+        
+        auto* samples = buffer.getWritePointer (channel);
+        
+        auto processSegment = [&engine, &scratch, samples, channel] (int segmentStart, int segmentLength)
+        {
+            if constexpr (std::is_same_v<HostType, EngineType>)
+            {
+                engine.processBlock (samples + segmentStart, segmentLength);
+            }
+            else
+            {
+                // Each channel converts through its own scratch row, so this is
+                // safe to run on the worker pool too
+                auto* converted = scratch.getWritePointer (channel);
+                const int scratchSize = scratch.getNumSamples();
+                
+                for (int start = segmentStart; start < segmentStart + segmentLength; start += scratchSize)
+                {
+                    const int count = juce::jmin (scratchSize, segmentStart + segmentLength - start);
+                    std::transform (samples + start, samples + start + count, converted,
+                                    [] (HostType v) { return static_cast<EngineType> (v); });
+                    engine.processBlock (converted, count);
+                    std::transform (converted, converted + count, samples + start,
+                                    [] (EngineType v) { return static_cast<HostType> (v); });
+                }
+            }
+        };
+        
+        // Split at MIDI changes, so every segment runs with constant variables
+        int segmentStart = 0;
+        for (const auto& change : midiChanges)
+        {
+            if (change.sampleOffset > segmentStart)
+            {
+                processSegment (segmentStart, change.sampleOffset - segmentStart);
+                segmentStart = change.sampleOffset;
+            }
+            
+            engine.setVariableSlot (change.slot, change.value);
+        }
+        
+        processSegment (segmentStart, numSamples - segmentStart);
+    };
+    
+    // Only hand the block to the pool when there is enough work to beat the
+    // cost of waking the helpers; small blocks stay on the audio thread
+    auto blockWork = static_cast<juce::int64> (numSamples) * numChannels * engines[0]->getComplexity();
+    
+    if (workerPool != nullptr && numChannels > 1 && blockWork >= parallelWorkThreshold)
+    {
+        workerPool->parallelFor (numChannels, processChannel);
+    }
+    else
+    {
+        for (int channel = 0; channel < numChannels; ++channel)
+            processChannel (channel);
+    }
+}
+
+//==============================================================================
+bool OriginAudioProcessor::hasEditor() const
+{
+    return true; // (change this to false if you choose to not supply an editor)
+}
+
+juce::AudioProcessorEditor* OriginAudioProcessor::createEditor()
+{
+    return new OriginAudioProcessorEditor (*this);
+}
+
+//==============================================================================
+void OriginAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
+{
+    PluginState::Contents state;
+    state.equation = currentEquation;
+    state.internalPrecision = static_cast<int> (internalPrecision);
+    state.delayInterpolation = delayInterpolation;
+    state.compilerOptions = compilerOptions;
+    state.variables = variables;
+    
+    // Already in the cache, so this only looks it up
+    std::string error;
+    state.program = EquationCache::getInstance().getOrCompile(currentEquation.toStdString(), compilerOptions, error);
+    
+    PluginState::write (state, destData);
+}
+
+void OriginAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
+{
+    ORIGIN_TRACE_SCOPE ("host", "setStateInformation", { "bytes", (double) sizeInBytes });
+    
+    const double startTime = juce::Time::getMillisecondCounterHiRes();
+    
+    PluginState::Contents state;
+    if (!PluginState::read (data, sizeInBytes, state))
+        return;
+    
+    // PluginState only knows the precision as a number
+    if (state.internalPrecision != static_cast<int> (InternalPrecision::Float)
+        && state.internalPrecision != static_cast<int> (InternalPrecision::Double))
+        return;
+    
+    // A program that passed its validity hash goes straight into the cache,
+    // so setEquation() below and every engine find it without compiling
+    lastStateLoad.usedSavedProgram = state.program != nullptr;
+    if (state.program != nullptr)
+        EquationCache::getInstance().insert(state.equation.toStdString(), state.compilerOptions, state.program);
+    
+    // Settings go in quietly, without setVariable() and setCompilerOptions()
+    // analysing and measuring the tail of the old equation each time;
+    // setEquation() swaps in the restored program under the restored
+    // options and does that once
+    {
+        const juce::SpinLock::ScopedLockType lock (engineLock);
+        delayInterpolation = state.delayInterpolation;
+        for (const auto& variable : state.variables)
+            variables[variable.first] = variable.second;
+        
+        forEachEngine([&state] (auto& engine)
+        {
+            engine.setDelayInterpolation(state.delayInterpolation);
+            for (const auto& variable : state.variables)
+                engine.setVariable(variable.first, variable.second);
+        });
+    }
+    
+    compilerOptions = state.compilerOptions;
+    currentEquation = state.equation;
+    
+    // New engines compile what is current, so that is set first
+    auto precision = static_cast<InternalPrecision> (state.internalPrecision);
+    if (precision != internalPrecision)
+        setInternalPrecision (precision);
+    
+    setEquation (state.equation);
+    
+    lastStateLoad.milliseconds = juce::Time::getMillisecondCounterHiRes() - startTime;
+}
+
+//==============================================================================
+// This creates new instances of the plugin..
+void OriginAudioProcessor::setEquation(const juce::String& equation)
+{
+    currentEquation = equation;
+    
+    // Compile once up front so the editor gets an error even before playback
+    // starts; the engines below then pick the same program out of the cache
+    std::string error;
+    auto program = EquationCache::getInstance().getOrCompile(equation.toStdString(), compilerOptions, error);
+    equationValid = program != nullptr;
+    errorMessage = error;
+    
+    updateCompileReport(program.get());
+    
+    // A new equation starts with a clean record
+    guardResets = 0;
+    guardSoftClips = 0;
+    
+    if (equationValid)
+        requestResponseAnalysis();
+    
+    {
+        // How long the audio thread is locked out
+        ORIGIN_TRACE_SCOPE ("program", "swap equation");
+        const juce::SpinLock::ScopedLockType lock (engineLock);
+        forEachEngine([this] (auto& engine) { engine.setEquation(currentEquation.toStdString(), compilerOptions); });
+        midiVariables.setProgram(program.get());
+    }
+    
+    updateProfiler(program);
+    updateTailLength();
+}
+
+void OriginAudioProcessor::setCompilerOptions(const EquationCompiler::Options& options)
+{
+    compilerOptions = options;
+    
+    std::string error;
+    auto program = EquationCache::getInstance().getOrCompile(currentEquation.toStdString(), compilerOptions, error);
+    updateCompileReport(program.get());
+    requestResponseAnalysis();
+    
+    {
+        ORIGIN_TRACE_SCOPE ("program", "swap compiler options");
+        const juce::SpinLock::ScopedLockType lock (engineLock);
+        forEachEngine([this] (auto& engine) { engine.setCompilerOptions(compilerOptions); });
+        midiVariables.setProgram(program.get());
+    }
+    
+    updateProfiler(program);
+    updateTailLength();
+}
+
+void OriginAudioProcessor::setProfilingEnabled(bool shouldProfile)
+{
+    if (shouldProfile == profilingEnabled)
+        return;
+    
+    profilingEnabled = shouldProfile;
+    
+    std::string error;
+    updateProfiler(EquationCache::getInstance().getOrCompile(currentEquation.toStdString(), compilerOptions, error));
+}
+
+void OriginAudioProcessor::updateProfiler(std::shared_ptr<const CompiledEquation> program)
+{
+    // Made outside the lock, it times its counter reads when constructed
+    std::shared_ptr<EquationProfiler> newProfiler;
+    if (profilingEnabled && program != nullptr)
+        newProfiler = std::make_shared<EquationProfiler>(std::move(program), currentEquation.toStdString());
+    
+    const juce::SpinLock::ScopedLockType lock (engineLock);
+    profiler = std::move(newProfiler);
+    forEachEngine([this] (auto& engine) { engine.setProfiler(profiler); });
+}
+
+void OriginAudioProcessor::updateCompileReport(const CompiledEquation* program)
+{
+    compileReport.clear();
+    
+    if (program == nullptr)
+        return;
+    
+    if (program->kernel.shape != CompiledEquation::KernelShape::General)
+        compileReport << CompiledEquation::getKernelName(program->kernel.shape) << " kernel";
+    
+    for (const auto& table : program->lookupTables)
+    {
+        if (compileReport.isNotEmpty())
+            compileReport << ", ";
+        
+        compileReport << "baked " << static_cast<int>(table->values.size()) - 1 << " pts on ["
+                          << juce::String (table->inputMin, 2) << ", " << juce::String (table->inputMax, 2)
+                          << "], max err " << juce::String (table->maxError, 7);
+        
+        if (!table->exactOutsideRange)
+            compileReport << ", clamped";
+    }
+}
+
+void OriginAudioProcessor::requestResponseAnalysis()
+{
+    ResponseAnalyser::Request request;
+    request.equation = currentEquation.toStdString();
+    request.compilerOptions = compilerOptions;
+    request.sampleRate = sampleRate;
+    request.variables = variables;
+    MidiVariables::addDefaultValues(request.variables);
+    
+    responseAnalyser.requestAnalysis(request);
+}
+
+void OriginAudioProcessor::updateTailLength()
+{
+    // Measured on a scratch engine outside the lock, so audio keeps
+    // flowing while a non-linear equation is run to silence
+    auto scratchVariables = variables;
+    MidiVariables::addDefaultValues(scratchVariables);
+    
+    DSPEngine<double> scratch;
+    scratch.prepare(sampleRate, 1024);
+    for (const auto& variable : scratchVariables)
+        scratch.setVariable(variable.first, variable.second);
+    
+    scratch.setCompilerOptions(compilerOptions);
+    scratch.setEquation(currentEquation.toStdString());
+    
+    tailSamples = scratch.estimateTailLength();
+    
+    // MIDI can move its variables anywhere in their ranges, so the defaults
+    // alone say nothing: a closed gate hides sin(2*pi*440*t)*gate and
+    // cc1 = 0 hides x + cc1*y_prev. Feed-forward uses get their worst case
+    // from the ends and middle of the ranges; feedback has no such bound.
+    auto program = scratch.getProgram();
+    if (program != nullptr && MidiVariables::isReadBy(*program))
+    {
+        if (MidiVariables::changesFeedback(*program))
+            tailSamples = std::numeric_limits<double>::infinity();
+        
+        for (double position : { 0.0, 0.5, 1.0 })
+        {
+            if (! std::isfinite (tailSamples))
+                break;
+            
+            auto rangeVariables = variables;
+            MidiVariables::addRangeValues(rangeVariables, position);
+            for (const auto& variable : rangeVariables)
+                scratch.setVariable(variable.first, variable.second);
+            
+            tailSamples = juce::jmax (tailSamples, scratch.estimateTailLength());
+        }
+    }
+    
+    tailSeconds = tailSamples / sampleRate;
+    
+    const juce::SpinLock::ScopedLockType lock (engineLock);
+    forEachEngine([this] (auto& engine) { engine.setTailLength(tailSamples); });
+}
+
+OriginAudioProcessor::GuardReport OriginAudioProcessor::getGuardReport() const
+{
+    return { guardResets.load (std::memory_order_relaxed), guardSoftClips.load (std::memory_order_relaxed) };
+}
+
+OriginAudioProcessor::MemoryReport OriginAudioProcessor::getMemoryReport()
+{
+    MemoryReport report;
+    report.sharedProgramBytes = EquationCache::getInstance().getStatistics().programBytes;
+    report.sharedResources = SharedResources::getInstance().getMemoryReport();
+    
+    const juce::SpinLock::ScopedLockType lock (engineLock);
+    forEachEngine([&report] (auto& engine) { report.instanceBytes += engine.getStateMemoryUsage(); });
+    
+    report.instanceBytes += (std::size_t) floatScratch.getNumChannels() * (std::size_t) floatScratch.getNumSamples() * sizeof(float)
+                          + (std::size_t) doubleScratch.getNumChannels() * (std::size_t) doubleScratch.getNumSamples() * sizeof(double);
+    return report;
+}
+
+void OriginAudioProcessor::setVariable(const std::string& name, double value)
+{
+    {
+        const juce::SpinLock::ScopedLockType lock (engineLock);
+        variables[name] = value;
+        
+        forEachEngine([&name, value] (auto& engine) { engine.setVariable(name, value); });
+    }
+    
+    // Automation calls this many times a second, so only a variable the
+    // program reads is worth a new analysis, and only one that can move
+    // the tail is worth running the equation to silence again
+    std::string error;
+    auto program = EquationCache::getInstance().getOrCompile(currentEquation.toStdString(), compilerOptions, error);
+    if (program == nullptr
+        || std::find (program->variableNames.begin(), program->variableNames.end(), name) == program->variableNames.end())
+        return;
+    
+    requestResponseAnalysis();
+    
+    if (! hasFixedTail (*program))
+        updateTailLength();
+}
+
+void OriginAudioProcessor::setDelayInterpolation(DelayInterpolation interpolation)
+{
+    const juce::SpinLock::ScopedLockType lock (engineLock);
+    delayInterpolation = interpolation;
+    
+    forEachEngine([interpolation] (auto& engine) { engine.setDelayInterpolation(interpolation); });
+}
+
+void OriginAudioProcessor::setInternalPrecision(InternalPrecision precision)
+{
+    if (precision != internalPrecision)
+        prepareChannelEngines(numPreparedChannels, precision);
+}
+
+bool OriginAudioProcessor::isEquationValid() const
+{
+    return equationValid;
+}
+
+juce::String OriginAudioProcessor::getEquationError() const
+{
+    return juce::String(errorMessage);
+}
+
+void OriginAudioProcessor::prepareChannelEngines(int numChannels, InternalPrecision precision)
+{
+    ORIGIN_TRACE_SCOPE ("program", "prepare engines", { "channels", (double) numChannels });
+    const juce::SpinLock::ScopedLockType lock (engineLock);
+    
+    numPreparedChannels = std::max(numChannels, 0);
+    internalPrecision = precision;
+    
+    // Switching precision starts the equation from silence, like a reset
+    if (precision == InternalPrecision::Double)
+    {
+        floatEngines.clear();
+        prepareEngines(doubleEngines, numPreparedChannels);
+        doubleScratch.setSize(numPreparedChannels, maxBlockSize);
+        floatScratch.setSize(0, 0);
+    }
+    else
+    {
+        doubleEngines.clear();
+        prepareEngines(floatEngines, numPreparedChannels);
+        floatScratch.setSize(numPreparedChannels, maxBlockSize);
+        doubleScratch.setSize(0, 0);
+    }
+}
+
+template <typename EngineType>
+void OriginAudioProcessor::prepareEngines(std::vector<std::unique_ptr<DSPEngine<EngineType>>>& engines, int numChannels)
+{
+    engines.resize(static_cast<size_t>(numChannels));
+    for (auto& engine : engines)
+    {
+        if (engine == nullptr)
+            engine = std::make_unique<DSPEngine<EngineType>>();
+        
+        engine->setDelayInterpolation(delayInterpolation);
+        for (const auto& variable : variables)
+            engine->setVariable(variable.first, variable.second);
+        
+        engine->setCompilerOptions(compilerOptions);
+        engine->setEquation(currentEquation.toStdString());
+        engine->prepare(sampleRate, maxBlockSize);
+        engine->setTailLength(tailSamples);
+        engine->setProfiler(profiler);
+    }
+}
+
+void OriginAudioProcessor::resetDSP()
+{
+    const juce::SpinLock::ScopedLockType lock (engineLock);
+    forEachEngine([] (auto& engine) { engine.reset(); });
+}
+
+//==============================================================================
+// This creates new instances of the plugin..
+juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
+{
+    return new OriginAudioProcessor();
+}
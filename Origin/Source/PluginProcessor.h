@@ -1,93 +1,226 @@
-/*
-  ==============================================================================
-
-    This file contains the basic framework code for a JUCE plugin processor.
-
-  ==============================================================================
-*/
-
-#pragma once
-
-#include <JuceHeader.h>
-#include <map>
-#include <vector>
-#include <memory>
-#include <string>
-
-// Forward declarations
-class DelayLine;
-class MatlabParser;
-
-//==============================================================================
-/**
-*/
-class OriginAudioProcessor  : public juce::AudioProcessor
-{
-public:
-    //==============================================================================
-    OriginAudioProcessor();
-    ~OriginAudioProcessor() override;
-
-    //==============================================================================
-    void prepareToPlay (double sampleRate, int samplesPerBlock) override;
-    void releaseResources() override;
-
-   #ifndef JucePlugin_PreferredChannelConfigurations
-    bool isBusesLayoutSupported (const BusesLayout& layouts) const override;
-   #endif
-
-    void processBlock (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
-
-    //==============================================================================
-    juce::AudioProcessorEditor* createEditor() override;
-    bool hasEditor() const override;
-
-    //==============================================================================
-    const juce::String getName() const override;
-
-    bool acceptsMidi() const override;
-    bool producesMidi() const override;
-    bool isMidiEffect() const override;
-    double getTailLengthSeconds() const override;
-
-    //==============================================================================
-    int getNumPrograms() override;
-    int getCurrentProgram() override;
-    void setCurrentProgram (int index) override;
-    const juce::String getProgramName (int index) override;
-    void changeProgramName (int index, const juce::String& newName) override;
-
-    //==============================================================================
-    void getStateInformation (juce::MemoryBlock& destData) override;
-    void setStateInformation (const void* data, int sizeInBytes) override;
-
-    juce::String getCurrentEquation() const { return currentEquation; }
-    void setEquation(const juce::String& equation);
-    bool isEquationValid() const;
-    juce::String getEquationError() const;
-
-private:
-    //==============================================================================
-    // Real-time equation evaluator
-    std::map<std::string, float> variables;
-    std::map<int, std::unique_ptr<DelayLine>> delayLines;
-    std::map<std::string, float> outputHistory; // For y_prev, y_prev2, etc.
-    juce::String currentEquation;
-    bool equationValid = false;
-    std::string errorMessage;
-    double sampleRate = 44100.0;
-    
-    // Equation processing methods
-    float processSample(float input);
-    void resetDSP();
-    DelayLine* getDelayLine(int delayAmount);
-    
-    // Mathematical expression evaluator
-    float evaluateExpression(const juce::String& expr, float x);
-    float evaluateTerm(juce::String& expr, int& pos);
-    float evaluateFactor(juce::String& expr, int& pos);
-    float evaluateNumber(juce::String& expr, int& pos);
-    void skipWhitespace(const juce::String& expr, int& pos);
-    
-    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OriginAudioProcessor)
-};
+/*
+  ==============================================================================
+
+    This file contains the basic framework code for a JUCE plugin processor.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <limits>
+#include <map>
+#include <vector>
+#include <memory>
+#include <string>
+#include "DSPEngine.h"
+#include "SharedResources.h"
+#include "AnalysisFifo.h"
+#include "ResponseAnalyser.h"
+#include "MidiVariables.h"
+
+// Forward declarations
+class ChannelWorkerPool;
+
+//==============================================================================
+/**
+*/
+class OriginAudioProcessor  : public juce::AudioProcessor
+{
+public:
+    //==============================================================================
+    OriginAudioProcessor();
+    ~OriginAudioProcessor() override;
+
+    //==============================================================================
+    void prepareToPlay (double sampleRate, int samplesPerBlock) override;
+    void releaseResources() override;
+
+   #ifndef JucePlugin_PreferredChannelConfigurations
+    bool isBusesLayoutSupported (const BusesLayout& layouts) const override;
+   #endif
+
+    void processBlock (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void processBlock (juce::AudioBuffer<double>&, juce::MidiBuffer&) override;
+    bool supportsDoublePrecisionProcessing() const override;
+
+    //==============================================================================
+    juce::AudioProcessorEditor* createEditor() override;
+    bool hasEditor() const override;
+
+    //==============================================================================
+    const juce::String getName() const override;
+
+    bool acceptsMidi() const override;
+    bool producesMidi() const override;
+    bool isMidiEffect() const override;
+    double getTailLengthSeconds() const override;
+
+    //==============================================================================
+    int getNumPrograms() override;
+    int getCurrentProgram() override;
+    void setCurrentProgram (int index) override;
+    const juce::String getProgramName (int index) override;
+    void changeProgramName (int index, const juce::String& newName) override;
+
+    //==============================================================================
+    void getStateInformation (juce::MemoryBlock& destData) override;
+    void setStateInformation (const void* data, int sizeInBytes) override;
+
+    juce::String getCurrentEquation() const { return currentEquation; }
+    void setEquation(const juce::String& equation);
+    bool isEquationValid() const;
+    juce::String getEquationError() const;
+    
+    // User variables the equation can read, e.g. "g" in g * x. Saved with
+    // the plugin state. MIDI drives a further set, see MidiVariables.
+    void setVariable(const std::string& name, double value);
+    const std::map<std::string, double>& getVariables() const { return variables; }
+    
+    // How fractional and modulated z^-n delays are read
+    void setDelayInterpolation(DelayInterpolation interpolation);
+    DelayInterpolation getDelayInterpolation() const { return delayInterpolation; }
+    
+    // Precision the equation runs at, independent of the host's buffer format
+    enum class InternalPrecision
+    {
+        Float,
+        Double
+    };
+    
+    void setInternalPrecision(InternalPrecision precision);
+    InternalPrecision getInternalPrecision() const { return internalPrecision; }
+    
+    // Lookup-table baking and other compile-time choices, applied to every channel
+    void setCompilerOptions(const EquationCompiler::Options& options);
+    const EquationCompiler::Options& getCompilerOptions() const { return compilerOptions; }
+    
+    // Which kernel the current equation runs on, which parts were baked
+    // into tables and how accurate they are; empty for the general path
+    // with no tables
+    juce::String getCompileReport() const { return compileReport; }
+    
+    // What this instance owns against the read-only data every instance
+    // in the process shares, so N instances cost about N * instanceBytes
+    struct MemoryReport
+    {
+        std::size_t instanceBytes = 0;      // Engine state and conversion buffers
+        std::size_t sharedProgramBytes = 0; // Compiled equations in EquationCache
+        SharedResources::MemoryReport sharedResources; // Lookup tables and other shared data
+    };
+    
+    MemoryReport getMemoryReport();
+    
+    // Input and output of the first channel for the editor's scope and
+    // spectrum, decimated to at most about analysisMaxRate. Nothing is
+    // pushed unless an editor has switched analysis on.
+    void setAnalysisActive(bool shouldBeActive) { analysisActive = shouldBeActive; }
+    AnalysisFifo& getInputAnalysisFifo() { return inputAnalysis; }
+    AnalysisFifo& getOutputAnalysisFifo() { return outputAnalysis; }
+    double getAnalysisSampleRate() const { return sampleRate / analysisDecimation; }
+    
+    static constexpr double analysisMaxRate = 48000.0;
+    
+    // Frequency response and poles/zeros of the current equation, redone
+    // in the background whenever the equation, its variables, the compiler
+    // options or the sample rate change
+    ResponseAnalyser& getResponseAnalyser() { return responseAnalyser; }
+    
+    // How many channel blocks the engines' stability guard has stepped in
+    // on since the equation was last set, see DSPEngine::GuardAction.
+    // Safe to call from any thread.
+    struct GuardReport
+    {
+        int resets = 0;    // inf/NaN, state cleared
+        int softClips = 0; // Ran away past DSPEngine::runawayLevel
+    };
+    
+    GuardReport getGuardReport() const;
+    
+    // How long the last setStateInformation() took and whether it could
+    // use the program saved with the state or had to compile the source
+    struct StateLoadInfo
+    {
+        double milliseconds = 0.0;
+        bool usedSavedProgram = false;
+    };
+    
+    StateLoadInfo getLastStateLoadInfo() const { return lastStateLoad; }
+    
+    // Per-instruction timing of the current equation, see EquationProfiler.
+    // Off by default; a new equation or new options start a new profile.
+    // Message thread.
+    void setProfilingEnabled(bool shouldProfile);
+    bool isProfilingEnabled() const { return profilingEnabled; }
+    std::shared_ptr<const EquationProfiler> getProfiler() const { return profiler; }
+
+private:
+    //==============================================================================
+    // One engine per channel so every channel keeps its own equation state.
+    // Only the set matching internalPrecision is populated.
+    std::vector<std::unique_ptr<DSPEngine<float>>> floatEngines;
+    std::vector<std::unique_ptr<DSPEngine<double>>> doubleEngines;
+    std::shared_ptr<ChannelWorkerPool> workerPool; // Shared by every instance, see ChannelWorkerPool::getShared()
+    juce::SpinLock engineLock; // Guards the engines against equation changes from the message thread
+    
+    // Conversion space for when the host's format differs from internalPrecision
+    juce::AudioBuffer<float> floatScratch;
+    juce::AudioBuffer<double> doubleScratch;
+    
+    juce::String currentEquation;
+    bool equationValid = false;
+    std::string errorMessage;
+    double sampleRate = 44100.0;
+    int maxBlockSize = 512;
+    int numPreparedChannels = 0;
+    DelayInterpolation delayInterpolation = DelayInterpolation::Linear;
+    InternalPrecision internalPrecision = InternalPrecision::Float;
+    EquationCompiler::Options compilerOptions;
+    juce::String compileReport;
+    std::map<std::string, double> variables;
+    StateLoadInfo lastStateLoad;
+    AnalysisFifo inputAnalysis { 16384 };
+    AnalysisFifo outputAnalysis { 16384 };
+    std::atomic<bool> analysisActive { false };
+    int analysisDecimation = 1;
+    ResponseAnalyser responseAnalyser;
+    MidiVariables midiVariables; // Guarded by engineLock like the engines
+    std::atomic<int> guardResets { 0 };
+    std::atomic<int> guardSoftClips { 0 };
+    bool profilingEnabled = false;
+    std::shared_ptr<EquationProfiler> profiler; // Swapped under engineLock
+    double tailSamples = std::numeric_limits<double>::infinity(); // See DSPEngine::estimateTailLength()
+    std::atomic<double> tailSeconds { 0.0 };
+    
+    void updateCompileReport(const CompiledEquation* program);
+    void requestResponseAnalysis();
+    void updateTailLength();
+    void updateProfiler(std::shared_ptr<const CompiledEquation> program);
+    void prepareChannelEngines(int numChannels, InternalPrecision precision);
+    void resetDSP();
+    
+    template <typename EngineType>
+    void prepareEngines(std::vector<std::unique_ptr<DSPEngine<EngineType>>>& engines, int numChannels);
+    
+    template <typename HostType>
+    void processAnyPrecision(juce::AudioBuffer<HostType>& buffer, const juce::MidiBuffer& midiMessages);
+    
+    template <typename HostType, typename EngineType>
+    void processChannels(juce::AudioBuffer<HostType>& buffer, int numChannels,
+                         std::vector<std::unique_ptr<DSPEngine<EngineType>>>& engines,
+                         juce::AudioBuffer<EngineType>& scratch);
+    
+    // Calls function on every engine, whichever precision it runs at
+    template <typename Function>
+    void forEachEngine(Function&& function)
+    {
+        for (auto& engine : floatEngines)
+            function(*engine);
+        for (auto& engine : doubleEngines)
+            function(*engine);
+    }
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OriginAudioProcessor)
+};
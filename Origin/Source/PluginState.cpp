@@ -0,0 +1,462 @@
+#include "PluginState.h"
+#include "EquationCache.h"
+#include "SharedResources.h"
+
+namespace
+{
+    constexpr int stateMagic = 0x4e47524f; // "ORGN"
+
+    // Limits on what a saved program and its options may contain, so
+    // damaged data cannot make a restore allocate without bound
+    constexpr int maxSavedInstructions = 1 << 16;
+    constexpr int maxSavedTableSize = 1 << 20;
+
+    using Instruction = CompiledEquation::Instruction;
+    using OpCode = CompiledEquation::OpCode;
+
+    //==============================================================================
+    void writeOptions(juce::MemoryOutputStream& out, const EquationCompiler::Options& options)
+    {
+        const auto& tables = options.lookupTables;
+        out.writeBool(tables.enabled);
+        out.writeCompressedInt(tables.size);
+        out.writeFloat(tables.inputMin);
+        out.writeFloat(tables.inputMax);
+        out.writeBool(tables.exactOutsideRange);
+        out.writeFloat(tables.maxError);
+        out.writeCompressedInt(tables.minimumCost);
+
+        out.writeBool(options.rates.enabled);
+        out.writeCompressedInt(options.rates.controlInterval);
+        out.writeFloat(options.rates.maxControlFrequency);
+
+        out.writeBool(options.useKernels);
+    }
+
+    // The options are compiled with on restore but are not covered by the
+    // validity hash, so they are checked like a saved program's fields
+    bool readOptions(juce::MemoryInputStream& in, EquationCompiler::Options& options)
+    {
+        auto& tables = options.lookupTables;
+        tables.enabled = in.readBool();
+        tables.size = in.readCompressedInt();
+        tables.inputMin = in.readFloat();
+        tables.inputMax = in.readFloat();
+        tables.exactOutsideRange = in.readBool();
+        tables.maxError = in.readFloat();
+        tables.minimumCost = in.readCompressedInt();
+
+        options.rates.enabled = in.readBool();
+        options.rates.controlInterval = in.readCompressedInt();
+        options.rates.maxControlFrequency = in.readFloat();
+
+        options.useKernels = in.readBool();
+
+        return tables.size >= 2 && tables.size <= maxSavedTableSize
+            && std::isfinite(tables.inputMin) && std::isfinite(tables.inputMax) && tables.inputMax > tables.inputMin
+            && std::isfinite(tables.maxError) && tables.maxError >= 0.0f
+            && tables.minimumCost >= 0
+            && options.rates.controlInterval >= 1
+            && options.rates.maxControlFrequency >= 0.0f; // Infinite sends every sin of t to control rate
+    }
+
+    //==============================================================================
+    void writeInstructions(juce::MemoryOutputStream& out, const std::vector<Instruction>& instructions)
+    {
+        out.writeCompressedInt(static_cast<int>(instructions.size()));
+        for (const auto& instruction : instructions)
+        {
+            out.writeByte(static_cast<char>(instruction.op));
+            out.writeByte(static_cast<char>(instruction.rate));
+            out.writeBool(instruction.perSample);
+            out.writeCompressedInt(instruction.a);
+            out.writeCompressedInt(instruction.b);
+            out.writeCompressedInt(instruction.slot);
+            out.writeDouble(instruction.constant);
+
+            for (const auto& range : { instruction.source, instruction.token })
+            {
+                out.writeCompressedInt(range.start);
+                out.writeCompressedInt(range.end);
+            }
+        }
+    }
+
+    // Operands must point at earlier registers, which is what keeps a
+    // program (or a table's exact subtree) runnable in order
+    bool readInstructions(juce::MemoryInputStream& in, std::vector<Instruction>& instructions)
+    {
+        const int numInstructions = in.readCompressedInt();
+        if (numInstructions < 0 || numInstructions > maxSavedInstructions)
+            return false;
+
+        instructions.resize((size_t) numInstructions);
+        for (int i = 0; i < numInstructions; ++i)
+        {
+            auto& instruction = instructions[(size_t) i];
+            const int op = in.readByte();
+            const int rate = in.readByte();
+            if (op < 0 || op > static_cast<int>(OpCode::SelectNot)
+                || rate < 0 || rate > static_cast<int>(CompiledEquation::Rate::Audio))
+                return false;
+
+            instruction.op = static_cast<OpCode>(op);
+            instruction.rate = static_cast<CompiledEquation::Rate>(rate);
+            instruction.perSample = in.readBool();
+            instruction.a = in.readCompressedInt();
+            instruction.b = in.readCompressedInt();
+            instruction.slot = in.readCompressedInt();
+            instruction.constant = in.readDouble();
+
+            // Only ever shown against the text, which checks them itself
+            for (auto* range : { &instruction.source, &instruction.token })
+            {
+                range->start = in.readCompressedInt();
+                range->end = in.readCompressedInt();
+            }
+
+            if (instruction.a < -1 || instruction.a >= i || instruction.b < -1 || instruction.b >= i)
+                return false;
+        }
+
+        return true;
+    }
+
+    void writeCoefficient(juce::MemoryOutputStream& out, const CompiledEquation::Coefficient& coefficient)
+    {
+        out.writeCompressedInt(coefficient.reg);
+        out.writeDouble(coefficient.scale);
+    }
+
+    CompiledEquation::Coefficient readCoefficient(juce::MemoryInputStream& in)
+    {
+        CompiledEquation::Coefficient coefficient;
+        coefficient.reg = in.readCompressedInt();
+        coefficient.scale = in.readDouble();
+        return coefficient;
+    }
+
+    //==============================================================================
+    void writeProgram(juce::MemoryOutputStream& out, const CompiledEquation& program)
+    {
+        out.writeCompressedInt(static_cast<int>(program.variableNames.size()));
+        for (const auto& name : program.variableNames)
+            out.writeString(juce::String(name));
+
+        out.writeCompressedInt(static_cast<int>(program.lookupTables.size()));
+        for (const auto& table : program.lookupTables)
+        {
+            out.writeFloat(table->inputMin);
+            out.writeFloat(table->inputMax);
+            out.writeFloat(table->scale);
+            out.writeBool(table->exactOutsideRange);
+            out.writeFloat(table->maxError);
+            out.writeFloat(table->maxErrorInput);
+            writeInstructions(out, table->exactProgram);
+
+            out.writeCompressedInt(static_cast<int>(table->values.size()));
+            out.write(table->values.data(), table->values.size() * sizeof(float));
+        }
+
+        writeInstructions(out, program.instructions);
+        out.writeCompressedInt(program.outputRegister);
+        out.writeCompressedInt(program.numDelayTaps);
+        out.writeCompressedInt(program.maxDelay);
+        out.writeBool(program.hasModulatedDelay);
+        out.writeBool(program.usesOutputFeedback);
+        out.writeCompressedInt(program.controlInterval);
+
+        out.writeCompressedInt(static_cast<int>(program.windows.size()));
+        for (const auto& window : program.windows)
+        {
+            out.writeCompressedInt(window.length);
+            out.writeDouble(window.attack);
+            out.writeDouble(window.release);
+        }
+
+        const auto& kernel = program.kernel;
+        out.writeByte(static_cast<char>(kernel.shape));
+        out.writeCompressedInt(static_cast<int>(kernel.tapDelays.size()));
+        for (size_t i = 0; i < kernel.tapDelays.size(); ++i)
+        {
+            out.writeCompressedInt(kernel.tapDelays[i]);
+            writeCoefficient(out, kernel.tapCoefficients[i]);
+        }
+
+        writeCoefficient(out, kernel.feedback[0]);
+        writeCoefficient(out, kernel.feedback[1]);
+        out.writeCompressedInt(kernel.wetRegister);
+        writeCoefficient(out, kernel.wetCoefficient);
+    }
+
+    std::shared_ptr<const CompiledEquation::LookupTable> readLookupTable(juce::MemoryInputStream& in)
+    {
+        auto table = std::make_shared<CompiledEquation::LookupTable>();
+        table->inputMin = in.readFloat();
+        table->inputMax = in.readFloat();
+        table->scale = in.readFloat();
+        table->exactOutsideRange = in.readBool();
+        table->maxError = in.readFloat();
+        table->maxErrorInput = in.readFloat();
+
+        if (!readInstructions(in, table->exactProgram)
+            || table->exactProgram.empty()
+            || static_cast<int>(table->exactProgram.size()) > CompiledEquation::maxLookupSubtreeSize)
+            return nullptr;
+
+        const int size = in.readCompressedInt();
+        if (size < 2 || size > maxSavedTableSize || in.getNumBytesRemaining() < (juce::int64) size * (juce::int64) sizeof(float))
+            return nullptr;
+
+        table->values.resize((size_t) size);
+        in.read(table->values.data(), size * static_cast<int>(sizeof(float)));
+
+        // Another instance may already have baked or restored the same table
+        auto key = CompiledEquation::LookupTable::makeSharingKey(size, table->inputMin, table->inputMax,
+                                                                 table->exactOutsideRange, table->exactProgram);
+        return SharedResources::getInstance().getOrCreate<CompiledEquation::LookupTable>(key, [&table] { return table; });
+    }
+
+    std::shared_ptr<const CompiledEquation> readProgram(juce::MemoryInputStream& in)
+    {
+        auto program = std::make_shared<CompiledEquation>();
+
+        const int numVariables = in.readCompressedInt();
+        if (numVariables < 0 || numVariables > maxSavedInstructions)
+            return nullptr;
+
+        for (int i = 0; i < numVariables; ++i)
+            program->variableNames.push_back(in.readString().toStdString());
+
+        const int numTables = in.readCompressedInt();
+        if (numTables < 0 || numTables > maxSavedInstructions)
+            return nullptr;
+
+        for (int i = 0; i < numTables; ++i)
+        {
+            auto table = readLookupTable(in);
+            if (table == nullptr)
+                return nullptr;
+
+            program->lookupTables.push_back(std::move(table));
+        }
+
+        if (!readInstructions(in, program->instructions))
+            return nullptr;
+
+        program->outputRegister = in.readCompressedInt();
+        program->numDelayTaps = in.readCompressedInt();
+        program->maxDelay = in.readCompressedInt();
+        program->hasModulatedDelay = in.readBool();
+        program->usesOutputFeedback = in.readBool();
+        program->controlInterval = in.readCompressedInt();
+
+        const int numRegisters = program->getNumRegisters();
+        auto isRegister = [numRegisters] (int reg) { return reg >= -1 && reg < numRegisters; };
+
+        const int numWindows = in.readCompressedInt();
+        if (numWindows < 0 || numWindows > numRegisters)
+            return nullptr;
+
+        for (int i = 0; i < numWindows; ++i)
+        {
+            CompiledEquation::Window window;
+            window.length = in.readCompressedInt();
+            window.attack = in.readDouble();
+            window.release = in.readDouble();
+
+            if (window.length < 1 || window.length > MatlabParser::maxWindowLength
+                || !(window.attack >= 0.0) || !(window.release >= 0.0))
+                return nullptr;
+
+            program->windows.push_back(window);
+        }
+
+        if (program->outputRegister < 0 || program->outputRegister >= numRegisters
+            || program->numDelayTaps < 0 || program->numDelayTaps > numRegisters
+            || program->maxDelay < 0 || program->maxDelay > MatlabParser::maxDelayLength
+            || program->controlInterval < 1)
+            return nullptr;
+
+        // Slots index the engine's per-program arrays, so check them all
+        for (const auto& instruction : program->instructions)
+        {
+            bool slotValid = true;
+            switch (instruction.op)
+            {
+                case OpCode::Variable:       slotValid = instruction.slot >= 0 && instruction.slot < numVariables; break;
+                case OpCode::Lookup:         slotValid = instruction.slot >= 0 && instruction.slot < numTables; break;
+                case OpCode::OutputHistory:  slotValid = instruction.slot == 1 || instruction.slot == 2; break;
+                case OpCode::ModulatedDelay: slotValid = instruction.slot >= 0 && instruction.slot < program->numDelayTaps; break;
+                case OpCode::Delay:          slotValid = instruction.slot >= 0 && instruction.slot < program->numDelayTaps
+                                                      && instruction.constant >= 0.0 && instruction.constant <= program->maxDelay; break;
+                case OpCode::Rand:
+                case OpCode::Randn:          slotValid = instruction.slot >= 0 && instruction.slot < numRegisters
+                                                      && (std::isnan(instruction.constant)
+                                                          || (instruction.constant >= 0.0 && instruction.constant < 4294967296.0)); break;
+                case OpCode::Oscillator:     slotValid = (instruction.slot == 0 || instruction.slot == 1) && instruction.a >= 0; break;
+                case OpCode::MovingMean:
+                case OpCode::MovingRms:
+                case OpCode::MovingMax:
+                case OpCode::MovingMin:
+                case OpCode::Envelope:       slotValid = instruction.slot >= 0 && instruction.slot < numWindows && instruction.a >= 0; break;
+                default: break;
+            }
+
+            if (!slotValid)
+                return nullptr;
+        }
+
+        auto& kernel = program->kernel;
+        const int shape = in.readByte();
+        if (shape < 0 || shape > static_cast<int>(CompiledEquation::KernelShape::DryWet))
+            return nullptr;
+
+        kernel.shape = static_cast<CompiledEquation::KernelShape>(shape);
+
+        const int numTaps = in.readCompressedInt();
+        if (numTaps < 0 || numTaps > CompiledEquation::maxKernelTaps)
+            return nullptr;
+
+        for (int i = 0; i < numTaps; ++i)
+        {
+            kernel.tapDelays.push_back(in.readCompressedInt());
+            kernel.tapCoefficients.push_back(readCoefficient(in));
+
+            if (kernel.tapDelays.back() < 0 || kernel.tapDelays.back() > program->maxDelay
+                || !isRegister(kernel.tapCoefficients.back().reg))
+                return nullptr;
+        }
+
+        kernel.feedback[0] = readCoefficient(in);
+        kernel.feedback[1] = readCoefficient(in);
+        kernel.wetRegister = in.readCompressedInt();
+        kernel.wetCoefficient = readCoefficient(in);
+
+        if (!isRegister(kernel.feedback[0].reg) || !isRegister(kernel.feedback[1].reg)
+            || !isRegister(kernel.wetRegister) || !isRegister(kernel.wetCoefficient.reg))
+            return nullptr;
+
+        return program;
+    }
+}
+
+//==============================================================================
+std::uint64_t PluginState::getValidityHash(const juce::String& equation, const EquationCompiler::Options& options,
+                                           const void* programData, size_t programSize)
+{
+    // 64-bit FNV-1a; this guards against stale compilers and damaged data,
+    // not against deliberate tampering
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+    auto addBytes = [&hash] (const void* data, size_t size)
+    {
+        auto bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    };
+
+    const int compilerVersion = CompiledEquation::formatVersion;
+    const auto key = EquationCache::makeKey(equation.toStdString(), options);
+    addBytes(&compilerVersion, sizeof(compilerVersion));
+    addBytes(key.data(), key.size());
+    addBytes(programData, programSize);
+    return hash;
+}
+
+void PluginState::write(const Contents& contents, juce::MemoryBlock& destData)
+{
+    juce::MemoryOutputStream out (destData, false);
+    out.writeInt(stateMagic);
+    out.writeCompressedInt(formatVersion);
+
+    out.writeString(contents.equation);
+    out.writeCompressedInt(contents.internalPrecision);
+    out.writeCompressedInt(static_cast<int>(contents.delayInterpolation));
+    writeOptions(out, contents.compilerOptions);
+
+    out.writeCompressedInt(static_cast<int>(contents.variables.size()));
+    for (const auto& variable : contents.variables)
+    {
+        out.writeString(juce::String(variable.first));
+        out.writeDouble(variable.second);
+    }
+
+    out.writeBool(contents.program != nullptr);
+    if (contents.program != nullptr)
+    {
+        juce::MemoryBlock programData;
+        {
+            juce::MemoryOutputStream programOut (programData, false);
+            writeProgram(programOut, *contents.program);
+        }
+
+        out.writeInt64(static_cast<juce::int64>(getValidityHash(contents.equation, contents.compilerOptions,
+                                                                programData.getData(), programData.getSize())));
+        out.writeCompressedInt(static_cast<int>(programData.getSize()));
+        out.write(programData.getData(), programData.getSize());
+    }
+}
+
+bool PluginState::read(const void* data, int sizeInBytes, Contents& contents)
+{
+    if (data == nullptr || sizeInBytes <= 0)
+        return false;
+
+    juce::MemoryInputStream in (data, (size_t) sizeInBytes, false);
+    if (in.readInt() != stateMagic)
+        return false;
+
+    // Later versions only ever append, so anything up to ours can be read
+    const int version = in.readCompressedInt();
+    if (version < 1 || version > formatVersion)
+        return false;
+
+    Contents result;
+    result.equation = in.readString();
+    result.internalPrecision = in.readCompressedInt();
+
+    const int interpolation = in.readCompressedInt();
+    if (interpolation < 0 || interpolation > static_cast<int>(DelayInterpolation::Thiran))
+        return false;
+
+    result.delayInterpolation = static_cast<DelayInterpolation>(interpolation);
+    if (!readOptions(in, result.compilerOptions))
+        return false;
+
+    const int numVariables = in.readCompressedInt();
+    if (numVariables < 0 || numVariables > maxSavedInstructions)
+        return false;
+
+    for (int i = 0; i < numVariables; ++i)
+    {
+        auto name = in.readString().toStdString();
+        result.variables[name] = in.readDouble();
+    }
+
+    if (in.isExhausted())
+        return false;
+
+    if (in.readBool())
+    {
+        const auto savedHash = static_cast<std::uint64_t>(in.readInt64());
+        const int programSize = in.readCompressedInt();
+
+        if (programSize > 0 && in.getNumBytesRemaining() >= programSize)
+        {
+            juce::MemoryBlock programData;
+            programData.setSize((size_t) programSize);
+            in.read(programData.getData(), programSize);
+
+            // A mismatch means another compiler version or damaged data;
+            // either way the caller compiles the source instead
+            if (getValidityHash(result.equation, result.compilerOptions, programData.getData(), programData.getSize()) == savedHash)
+            {
+                juce::MemoryInputStream programIn (programData.getData(), programData.getSize(), false);
+                result.program = readProgram(programIn);
+            }
+        }
+    }
+
+    contents = std::move(result);
+    return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "DSPEngine.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+// Versioned binary form of the plugin state saved with a session:
+//
+//   magic, formatVersion
+//   equation source, internal precision, delay interpolation, compiler options
+//   variables: count, then name/value pairs
+//   compiled program (optional): validity hash, size, program
+//
+// The program is what compiling the equation with those options gave. Its
+// validity hash covers the compiler's formatVersion, the equation and
+// options and the program bytes, so a restore can hand it straight to the
+// engines and only falls back to compiling the source when the compiler
+// has changed or the data is damaged.
+namespace PluginState
+{
+    static constexpr int formatVersion = 1;
+
+    struct Contents
+    {
+        juce::String equation;
+        int internalPrecision = 0; // OriginAudioProcessor::InternalPrecision
+        DelayInterpolation delayInterpolation = DelayInterpolation::Linear;
+        EquationCompiler::Options compilerOptions;
+        std::map<std::string, double> variables;
+        std::shared_ptr<const CompiledEquation> program; // nullptr to store the source only
+    };
+
+    void write(const Contents& contents, juce::MemoryBlock& destData);
+
+    // Returns false when the data is not a state this version can read or
+    // its settings are out of range. program is left null when none was
+    // saved or it failed validation.
+    bool read(const void* data, int sizeInBytes, Contents& contents);
+
+    // Exposed for tests and tooling: the hash a saved program must match
+    std::uint64_t getValidityHash(const juce::String& equation, const EquationCompiler::Options& options,
+                                  const void* programData, size_t programSize);
+}
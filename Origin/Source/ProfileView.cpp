@@ -0,0 +1,65 @@
+#include "ProfileView.h"
+
+ProfileView::ProfileView (const juce::TextEditor& editor)
+    : equationEditor (editor)
+{
+    setInterceptsMouseClicks (false, false);
+}
+
+void ProfileView::setReport (const EquationProfiler::Report& report)
+{
+    profiledEquation = juce::String (report.equation);
+    hotspots.clear();
+
+    // Whole-equation entries (a kernel, the engine) have nothing to point at
+    for (const auto& entry : report.entries)
+        if (! entry.token.isEmpty())
+            hotspots.push_back ({ { entry.token.start, entry.token.end }, static_cast<float> (entry.share) });
+
+    repaint();
+}
+
+void ProfileView::clear()
+{
+    profiledEquation.clear();
+    hotspots.clear();
+    repaint();
+}
+
+void ProfileView::paint (juce::Graphics& g)
+{
+    if (hotspots.empty() || equationEditor.getText() != profiledEquation)
+        return;
+
+    for (const auto& hotspot : hotspots)
+    {
+        // Anything under a percent or so would only be noise on the text
+        const float alpha = juce::jlimit (0.0f, 0.6f, hotspot.share * 1.2f);
+        if (alpha < 0.02f)
+            continue;
+
+        g.setColour (juce::Colours::orange.withAlpha (alpha));
+        for (const auto& area : equationEditor.getTextBounds (hotspot.token))
+            g.fillRect (area);
+    }
+}
+
+juce::String ProfileView::summarise (const EquationProfiler::Report& report, int maxEntries)
+{
+    if (report.numSamples == 0)
+        return "Profiling, waiting for audio...";
+
+    juce::String summary;
+    summary << juce::String (report.cyclesPerSample, 1) << " cycles/sample:";
+
+    const int count = juce::jmin (maxEntries, static_cast<int> (report.entries.size()));
+    for (int i = 0; i < count; ++i)
+    {
+        const auto& entry = report.entries[(size_t) i];
+        summary << (i > 0 ? ", " : " ")
+                << (entry.text.empty() || entry.text.length() > 16 ? juce::String (entry.label) : juce::String (entry.text))
+                << " " << juce::roundToInt (entry.share * 100.0) << "%";
+    }
+
+    return summary;
+}
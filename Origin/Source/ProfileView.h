@@ -0,0 +1,40 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "EquationProfiler.h"
+#include <vector>
+
+// Heat map laid over the equation editor: each operator, function name or
+// operand the profiler timed is tinted by its share of the equation's cost.
+//
+// Sits on top of the editor with the same bounds and never takes the
+// mouse. Nothing is drawn while the editor holds text other than the
+// profiled equation, since the ranges would land on the wrong characters.
+class ProfileView  : public juce::Component
+{
+public:
+    explicit ProfileView (const juce::TextEditor&);
+
+    void paint (juce::Graphics&) override;
+
+    // Message thread, from the editor's poll
+    void setReport (const EquationProfiler::Report&);
+    void clear();
+
+    // The few most expensive entries, e.g. "sin 41%, ^ 22%, engine 9%"
+    static juce::String summarise (const EquationProfiler::Report&, int maxEntries = 3);
+
+private:
+    const juce::TextEditor& equationEditor;
+
+    struct Hotspot
+    {
+        juce::Range<int> token;
+        float share = 0.0f;
+    };
+
+    juce::String profiledEquation;
+    std::vector<Hotspot> hotspots;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ProfileView)
+};
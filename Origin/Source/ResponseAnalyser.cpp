@@ -0,0 +1,314 @@
+#include "ResponseAnalyser.h"
+#include "DSPEngine.h"
+#include "EquationCache.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    using Complex = std::complex<double>;
+
+    constexpr double minFrequency = 20.0;
+    constexpr int blockSize = 1024;
+
+    // One low-priority thread for every instance in the process
+    juce::ThreadPool& getAnalysisPool()
+    {
+        static juce::ThreadPool pool (1);
+        return pool;
+    }
+
+    std::vector<double> makeFrequencies(double sampleRate)
+    {
+        const double nyquist = sampleRate * 0.5;
+        const double logRange = std::log(nyquist * 0.999 / minFrequency);
+
+        std::vector<double> frequencies((size_t) ResponseAnalyser::numFrequencies);
+        for (size_t i = 0; i < frequencies.size(); ++i)
+            frequencies[i] = minFrequency * std::exp(logRange * (double) i / (double) (frequencies.size() - 1));
+
+        return frequencies;
+    }
+
+    // Clamped to +-240 dB so a runaway measurement still draws
+    double toDecibels(Complex response)
+    {
+        const double magnitude = std::abs(response);
+        return std::isfinite(magnitude) ? 20.0 * std::log10(std::clamp(magnitude, 1.0e-12, 1.0e12)) : 240.0;
+    }
+
+    // Durand-Kerner on the polynomial sum of coefficients[i] z^i, which must
+    // have a non-zero leading coefficient. Returns empty if cancelled.
+    std::vector<Complex> findRoots(std::vector<double> coefficients, const std::function<bool()>& isCancelled)
+    {
+        const int order = static_cast<int>(coefficients.size()) - 1;
+        if (order < 1)
+            return {};
+
+        const double leading = coefficients.back();
+        for (auto& c : coefficients)
+            c /= leading;
+
+        auto evaluate = [&coefficients] (Complex z)
+        {
+            Complex value = 0.0;
+            for (auto it = coefficients.rbegin(); it != coefficients.rend(); ++it)
+                value = value * z + *it;
+            return value;
+        };
+
+        // Starting points spread around a circle that is not a root of unity
+        std::vector<Complex> roots((size_t) order);
+        for (int i = 0; i < order; ++i)
+            roots[(size_t) i] = std::pow(Complex(0.4, 0.9), i);
+
+        for (int iteration = 0; iteration < 500; ++iteration)
+        {
+            if (isCancelled())
+                return {};
+
+            double largestStep = 0.0;
+            for (int i = 0; i < order; ++i)
+            {
+                Complex denominator = 1.0;
+                for (int j = 0; j < order; ++j)
+                    if (j != i)
+                        denominator *= roots[(size_t) i] - roots[(size_t) j];
+
+                if (std::abs(denominator) < 1.0e-300)
+                    denominator = 1.0e-300;
+
+                const Complex step = evaluate(roots[(size_t) i]) / denominator;
+                roots[(size_t) i] -= step;
+                largestStep = std::max(largestStep, std::abs(step));
+            }
+
+            if (largestStep < 1.0e-12)
+                break;
+        }
+
+        return roots;
+    }
+
+    // An offline engine of the analysis' own, with the guard off so an
+    // unstable equation shows up as such instead of being clipped
+    std::unique_ptr<DSPEngine<double>> makeEngine(const ResponseAnalyser::Request& request,
+                                                  const EquationCompiler::Options& options)
+    {
+        auto engine = std::make_unique<DSPEngine<double>>();
+        engine->setStabilityGuardEnabled(false);
+        engine->prepare(request.sampleRate, blockSize);
+        for (const auto& variable : request.variables)
+            engine->setVariable(variable.first, variable.second);
+
+        engine->setCompilerOptions(options);
+        engine->setEquation(request.equation);
+        return engine;
+    }
+
+    bool analyseLinear(const DSPEngine<double>::TransferFunction& transfer, ResponseAnalyser::Result& result,
+                       const std::function<bool()>& isCancelled)
+    {
+        result.isLinear = true;
+
+        for (double frequency : result.frequencies)
+        {
+            const double omega = juce::MathConstants<double>::twoPi * frequency / result.sampleRate;
+            Complex numerator = 0.0;
+            for (size_t k = 0; k < transfer.b.size(); ++k)
+                numerator += transfer.b[k] * std::polar(1.0, -omega * transfer.delays[k]);
+
+            const Complex denominator = 1.0 - transfer.a1 * std::polar(1.0, -omega) - transfer.a2 * std::polar(1.0, -2.0 * omega);
+            const Complex response = numerator / denominator;
+
+            result.magnitudeDecibels.push_back(toDecibels(response));
+            result.phase.push_back(std::arg(response));
+        }
+
+        // Denominator z^2 - a1 z - a2 (or z - a1): at most two poles, always solvable
+        const int denominatorOrder = transfer.a2 != 0.0 ? 2 : (transfer.a1 != 0.0 ? 1 : 0);
+        if (denominatorOrder == 2)
+        {
+            const Complex root = std::sqrt(Complex(transfer.a1 * transfer.a1 + 4.0 * transfer.a2));
+            result.poles = { (transfer.a1 + root) * 0.5, (transfer.a1 - root) * 0.5 };
+        }
+        else if (denominatorOrder == 1)
+        {
+            result.poles = { Complex(transfer.a1) };
+        }
+
+        result.isStable = std::all_of(result.poles.begin(), result.poles.end(), [] (Complex p) { return std::abs(p) < 1.0; });
+
+        // Numerator times z^D is a polynomial in z whose roots are the zeros;
+        // the powers of z left over become poles or zeros at the origin
+        const int maxDelay = transfer.delays.empty() ? 0 : *std::max_element(transfer.delays.begin(), transfer.delays.end());
+        result.numPolesAtOrigin = std::max(0, maxDelay - denominatorOrder);
+
+        if (maxDelay <= ResponseAnalyser::maxFactoredOrder)
+        {
+            std::vector<double> numerator((size_t) maxDelay + 1, 0.0);
+            for (size_t k = 0; k < transfer.b.size(); ++k)
+                numerator[(size_t) (maxDelay - transfer.delays[k])] += transfer.b[k];
+
+            while (numerator.size() > 1 && numerator.back() == 0.0)
+                numerator.pop_back();
+
+            result.zeros = findRoots(numerator, isCancelled);
+            if (isCancelled())
+                return false;
+
+            for (int i = maxDelay; i < denominatorOrder; ++i)
+                result.zeros.push_back(0.0);
+        }
+
+        return true;
+    }
+
+    bool analyseMeasured(const ResponseAnalyser::Request& request, const EquationCompiler::Options& options,
+                         DSPEngine<double>& engine, ResponseAnalyser::Result& result,
+                         const std::function<bool()>& isCancelled)
+    {
+        std::vector<double> impulse((size_t) ResponseAnalyser::impulseLength, 0.0);
+        impulse[0] = 1.0;
+
+        for (int start = 0; start < ResponseAnalyser::impulseLength; start += blockSize)
+        {
+            if (isCancelled())
+                return false;
+
+            engine.processBlock(impulse.data() + start, blockSize);
+        }
+
+        // An equation that ignores x still produces output, so measure the
+        // response to silence too and keep only the difference
+        auto silentEngine = makeEngine(request, options);
+        std::vector<double> silence((size_t) ResponseAnalyser::impulseLength, 0.0);
+        for (int start = 0; start < ResponseAnalyser::impulseLength; start += blockSize)
+        {
+            if (isCancelled())
+                return false;
+
+            silentEngine->processBlock(silence.data() + start, blockSize);
+        }
+
+        double headPeak = 0.0, tailPeak = 0.0;
+        for (size_t n = 0; n < impulse.size(); ++n)
+        {
+            impulse[n] -= silence[n];
+            if (!std::isfinite(impulse[n]))
+            {
+                result.isStable = false;
+                impulse[n] = 0.0;
+            }
+
+            auto& peak = n < impulse.size() * 3 / 4 ? headPeak : tailPeak;
+            peak = std::max(peak, std::abs(impulse[n]));
+        }
+
+        result.isStable = result.isStable && tailPeak <= std::max(headPeak * 1.0e-3, 1.0e-9);
+
+        // Direct DFT at the display frequencies; there are far fewer of
+        // them than FFT bins would give
+        for (double frequency : result.frequencies)
+        {
+            if (isCancelled())
+                return false;
+
+            const Complex rotation = std::polar(1.0, -juce::MathConstants<double>::twoPi * frequency / result.sampleRate);
+            Complex phasor = 1.0, response = 0.0;
+            for (size_t n = 0; n < impulse.size(); ++n)
+            {
+                response += impulse[n] * phasor;
+                phasor *= rotation;
+
+                // Renormalise now and then so rounding cannot drift the magnitude
+                if ((n & 1023) == 1023)
+                    phasor /= std::abs(phasor);
+            }
+
+            result.magnitudeDecibels.push_back(toDecibels(response));
+            result.phase.push_back(std::arg(response));
+        }
+
+        return true;
+    }
+}
+
+//==============================================================================
+ResponseAnalyser::ResponseAnalyser()
+    : state(std::make_shared<State>())
+{
+}
+
+ResponseAnalyser::~ResponseAnalyser()
+{
+    // Makes any queued or running job for this analyser stale
+    ++state->generation;
+}
+
+void ResponseAnalyser::setActive(bool shouldBeActive)
+{
+    active = shouldBeActive;
+    if (active && hasRequest)
+        schedule();
+}
+
+void ResponseAnalyser::requestAnalysis(const Request& request)
+{
+    lastRequest = request;
+    hasRequest = true;
+
+    if (active)
+        schedule();
+}
+
+std::shared_ptr<const ResponseAnalyser::Result> ResponseAnalyser::getLatestResult() const
+{
+    std::lock_guard<std::mutex> guard(state->lock);
+    return state->latestResult;
+}
+
+void ResponseAnalyser::schedule()
+{
+    const std::uint64_t generation = ++state->generation;
+
+    getAnalysisPool().addJob([jobState = state, request = lastRequest, generation]
+    {
+        auto isCancelled = [&jobState, generation] { return jobState->generation.load() != generation; };
+
+        if (auto result = analyse(request, isCancelled))
+        {
+            std::lock_guard<std::mutex> guard(jobState->lock);
+            if (!isCancelled())
+                jobState->latestResult = std::move(result);
+        }
+    });
+}
+
+std::shared_ptr<ResponseAnalyser::Result> ResponseAnalyser::analyse(const Request& request,
+                                                                    const std::function<bool()>& isCancelled)
+{
+    if (isCancelled())
+        return nullptr;
+
+    // Kernel matching is what finds the coefficients, so it is always on here
+    auto options = request.compilerOptions;
+    options.useKernels = true;
+
+    std::string errorMessage;
+    if (EquationCache::getInstance().getOrCompile(request.equation, options, errorMessage) == nullptr)
+        return nullptr;
+
+    auto engine = makeEngine(request, options);
+
+    auto result = std::make_shared<Result>();
+    result->equation = request.equation;
+    result->sampleRate = request.sampleRate;
+    result->frequencies = makeFrequencies(request.sampleRate);
+
+    DSPEngine<double>::TransferFunction transfer;
+    const bool finished = engine->getTransferFunction(transfer) ? analyseLinear(transfer, *result, isCancelled)
+                                                                : analyseMeasured(request, options, *engine, *result, isCancelled);
+
+    return finished && !isCancelled() ? result : nullptr;
+}
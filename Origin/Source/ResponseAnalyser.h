@@ -0,0 +1,89 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "EquationCompiler.h"
+#include <atomic>
+#include <complex>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Frequency response (freqz) and pole-zero analysis of the current
+// equation, computed off the audio thread for the editor's response view.
+//
+// Equations that match a linear kernel shape are analysed exactly from
+// their coefficients, see DSPEngine::getTransferFunction(). Anything else
+// is measured: an offline engine of its own runs an impulse through the
+// equation and the response is taken from that, with no poles or zeros.
+//
+// Requests run one at a time on a thread shared by every instance. Each
+// new request makes the ones before it stale, and stale jobs stop at their
+// next check, so typing quickly only ever finishes the latest equation.
+// Nothing is scheduled while the analyser is inactive (no editor open);
+// the last request is kept and runs when it becomes active.
+class ResponseAnalyser
+{
+public:
+    struct Request
+    {
+        std::string equation;
+        EquationCompiler::Options compilerOptions;
+        double sampleRate = 44100.0;
+        std::map<std::string, double> variables;
+    };
+
+    struct Result
+    {
+        std::string equation;
+        double sampleRate = 44100.0;
+        bool isLinear = false; // From coefficients; otherwise measured from an impulse
+        bool isStable = true;  // Poles inside the unit circle, or an impulse response that dies away
+
+        std::vector<double> frequencies; // Hz, log spaced up to Nyquist
+        std::vector<double> magnitudeDecibels;
+        std::vector<double> phase;       // Radians, wrapped
+
+        std::vector<std::complex<double>> poles;
+        std::vector<std::complex<double>> zeros; // Empty when the numerator is too long to factor
+        int numPolesAtOrigin = 0;
+    };
+
+    ResponseAnalyser();
+    ~ResponseAnalyser();
+
+    void setActive(bool shouldBeActive);
+    void requestAnalysis(const Request& request);
+
+    // Most recent finished analysis, nullptr before the first one
+    std::shared_ptr<const Result> getLatestResult() const;
+
+    // The analysis itself, run synchronously; returns nullptr if
+    // isCancelled() turned true or the equation does not compile
+    static std::shared_ptr<Result> analyse(const Request& request, const std::function<bool()>& isCancelled);
+
+    static constexpr int numFrequencies = 256;
+    static constexpr int impulseLength = 16384;
+    static constexpr int maxFactoredOrder = 48; // Longest numerator whose zeros are worth finding
+
+private:
+    // Shared with the jobs, so a job that outlives the analyser is harmless
+    struct State
+    {
+        std::atomic<std::uint64_t> generation { 0 };
+        mutable std::mutex lock;
+        std::shared_ptr<const Result> latestResult;
+    };
+
+    std::shared_ptr<State> state;
+    Request lastRequest;
+    bool hasRequest = false;
+    bool active = false;
+
+    void schedule();
+
+    JUCE_DECLARE_NON_COPYABLE (ResponseAnalyser)
+};
@@ -0,0 +1,177 @@
+#include "ResponseView.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    constexpr float minDecibels = -60.0f;
+    constexpr float maxDecibels = 24.0f;
+
+    const juce::Colour magnitudeColour (0xff7cfc7c);
+    const juce::Colour phaseColour (0xff808080);
+}
+
+//==============================================================================
+ResponseView::ResponseView (OriginAudioProcessor& p)
+    : audioProcessor (p)
+{
+    setOpaque (true);
+    audioProcessor.getResponseAnalyser().setActive (true);
+    startTimerHz (pollRate);
+}
+
+ResponseView::~ResponseView()
+{
+    stopTimer();
+    audioProcessor.getResponseAnalyser().setActive (false);
+}
+
+//==============================================================================
+void ResponseView::paint (juce::Graphics& g)
+{
+    if (cachedImage.isNull())
+        g.fillAll (juce::Colour (0xff1e1e1e));
+    else
+        g.drawImageAt (cachedImage, 0, 0);
+}
+
+void ResponseView::resized()
+{
+    cachedImage = juce::Image();
+    render();
+}
+
+void ResponseView::timerCallback()
+{
+    auto result = audioProcessor.getResponseAnalyser().getLatestResult();
+    if (result != shownResult)
+    {
+        shownResult = std::move (result);
+        render();
+        repaint();
+    }
+}
+
+//==============================================================================
+void ResponseView::render()
+{
+    if (getWidth() <= 0 || getHeight() <= 0)
+        return;
+
+    if (cachedImage.isNull())
+        cachedImage = juce::Image (juce::Image::RGB, getWidth(), getHeight(), true);
+
+    juce::Graphics g (cachedImage);
+    g.fillAll (juce::Colour (0xff1e1e1e));
+
+    // The z-plane is square, the response takes what is left
+    auto bounds = getLocalBounds().toFloat();
+    auto poleZeroArea = bounds.removeFromRight (bounds.getHeight()).reduced (4.0f);
+    auto responseArea = bounds.reduced (4.0f);
+
+    drawResponse (g, responseArea);
+    drawPoleZero (g, poleZeroArea);
+}
+
+void ResponseView::drawResponse (juce::Graphics& g, juce::Rectangle<float> area)
+{
+    g.setColour (juce::Colours::darkgrey);
+    g.drawRect (area, 1.0f);
+
+    auto decibelsToY = [area] (double decibels)
+    {
+        const float clamped = juce::jlimit (minDecibels, maxDecibels, static_cast<float> (decibels));
+        return area.getY() + area.getHeight() * (maxDecibels - clamped) / (maxDecibels - minDecibels);
+    };
+
+    g.drawHorizontalLine ((int) decibelsToY (0.0), area.getX(), area.getRight());
+
+    if (shownResult == nullptr || shownResult->frequencies.size() < 2)
+        return;
+
+    // Frequencies are log spaced already, so points are evenly spread in x
+    const auto& result = *shownResult;
+    const float step = area.getWidth() / (float) (result.frequencies.size() - 1);
+    juce::Path magnitudePath, phasePath;
+
+    for (size_t i = 0; i < result.frequencies.size(); ++i)
+    {
+        const float x = area.getX() + step * (float) i;
+        const float magnitudeY = decibelsToY (result.magnitudeDecibels[i]);
+        const float phaseY = area.getCentreY() - area.getHeight() * 0.5f * static_cast<float> (result.phase[i] / juce::MathConstants<double>::pi);
+
+        if (i == 0)
+        {
+            magnitudePath.startNewSubPath (x, magnitudeY);
+            phasePath.startNewSubPath (x, phaseY);
+        }
+        else
+        {
+            magnitudePath.lineTo (x, magnitudeY);
+            phasePath.lineTo (x, phaseY);
+        }
+    }
+
+    g.setColour (phaseColour);
+    g.strokePath (phasePath, juce::PathStrokeType (1.0f));
+    g.setColour (magnitudeColour);
+    g.strokePath (magnitudePath, juce::PathStrokeType (1.5f));
+
+    g.setFont (juce::FontOptions (12.0f));
+    g.setColour (juce::Colours::lightgrey);
+    g.drawText (result.isLinear ? "coefficients" : "measured", area.reduced (4.0f), juce::Justification::topLeft);
+}
+
+void ResponseView::drawPoleZero (juce::Graphics& g, juce::Rectangle<float> area)
+{
+    g.setColour (juce::Colours::darkgrey);
+    g.drawRect (area, 1.0f);
+
+    // Room for poles a little outside the unit circle
+    const float radius = area.getWidth() * 0.5f / 1.5f;
+    const auto centre = area.getCentre();
+    g.drawEllipse (centre.x - radius, centre.y - radius, radius * 2.0f, radius * 2.0f, 1.0f);
+    g.drawHorizontalLine ((int) centre.y, area.getX(), area.getRight());
+    g.drawVerticalLine ((int) centre.x, area.getY(), area.getBottom());
+
+    if (shownResult == nullptr)
+        return;
+
+    auto toPoint = [&] (std::complex<double> z)
+    {
+        return juce::Point<float> (centre.x + radius * static_cast<float> (z.real()),
+                                   centre.y - radius * static_cast<float> (z.imag()));
+    };
+
+    constexpr float markSize = 4.0f;
+    g.setColour (magnitudeColour);
+    for (auto zero : shownResult->zeros)
+    {
+        const auto point = toPoint (zero);
+        if (area.contains (point))
+            g.drawEllipse (point.x - markSize, point.y - markSize, markSize * 2.0f, markSize * 2.0f, 1.0f);
+    }
+
+    g.setColour (shownResult->isStable ? juce::Colours::lightgrey : juce::Colours::orange);
+    auto poles = shownResult->poles;
+    if (shownResult->numPolesAtOrigin > 0)
+        poles.push_back (0.0);
+
+    for (auto pole : poles)
+    {
+        const auto point = toPoint (pole);
+        if (!area.contains (point))
+            continue;
+
+        g.drawLine (point.x - markSize, point.y - markSize, point.x + markSize, point.y + markSize, 1.0f);
+        g.drawLine (point.x - markSize, point.y + markSize, point.x + markSize, point.y - markSize, 1.0f);
+    }
+
+    g.setFont (juce::FontOptions (12.0f));
+    auto labelArea = area.reduced (4.0f);
+    if (shownResult->numPolesAtOrigin > 1)
+        g.drawText ("x" + juce::String (shownResult->numPolesAtOrigin) + " at 0", labelArea, juce::Justification::bottomLeft);
+
+    if (!shownResult->isStable)
+        g.drawText ("unstable", labelArea, juce::Justification::topRight);
+}
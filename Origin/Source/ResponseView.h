@@ -0,0 +1,36 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include <memory>
+
+// Frequency response (left: magnitude in green, phase in grey) and z-plane
+// (right: unit circle, x poles, o zeros) of the current equation.
+//
+// The processor's ResponseAnalyser does the work in the background; this
+// only polls for a new result and redraws a cached image when one
+// arrives, so it costs nothing between equation changes. The analyser is
+// active only while a view exists.
+class ResponseView  : public juce::Component, private juce::Timer
+{
+public:
+    explicit ResponseView (OriginAudioProcessor&);
+    ~ResponseView() override;
+
+    void paint (juce::Graphics&) override;
+    void resized() override;
+
+    static constexpr int pollRate = 10;
+
+private:
+    OriginAudioProcessor& audioProcessor;
+    std::shared_ptr<const ResponseAnalyser::Result> shownResult;
+    juce::Image cachedImage;
+
+    void timerCallback() override;
+    void render();
+    void drawResponse (juce::Graphics&, juce::Rectangle<float> area);
+    void drawPoleZero (juce::Graphics&, juce::Rectangle<float> area);
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ResponseView)
+};
@@ -0,0 +1,61 @@
+#include "SharedResources.h"
+
+SharedResources& SharedResources::getInstance()
+{
+    static SharedResources instance;
+    return instance;
+}
+
+std::shared_ptr<const void> SharedResources::find(const std::string& key)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto it = entries.find(key);
+    if (it == entries.end())
+        return nullptr;
+
+    return it->second.resource.lock();
+}
+
+std::shared_ptr<const void> SharedResources::insert(const std::string& key, std::shared_ptr<const void> resource,
+                                                    std::size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    removeExpiredEntries();
+
+    auto& entry = entries[key];
+    if (auto existing = entry.resource.lock())
+        return existing;
+
+    entry.resource = resource;
+    entry.bytes = bytes;
+    return resource;
+}
+
+void SharedResources::removeExpiredEntries()
+{
+    for (auto it = entries.begin(); it != entries.end();)
+    {
+        if (it->second.resource.expired())
+            it = entries.erase(it);
+        else
+            ++it;
+    }
+}
+
+SharedResources::MemoryReport SharedResources::getMemoryReport() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    MemoryReport report;
+    for (const auto& item : entries)
+    {
+        if (item.second.resource.expired())
+            continue;
+
+        ++report.numResources;
+        report.bytes += item.second.bytes;
+    }
+
+    return report;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+
+// Process-wide registry of immutable DSP data that does not need to be
+// copied per instance: baked lookup tables today, FFT plans and designed
+// filter coefficients as they are added. Anything mutable (delay lines,
+// y_prev, interpolator state, scratch blocks) stays in DSPEngine.
+//
+// Resources are keyed by type plus a caller-built string describing
+// everything that determines their contents. The registry only holds weak
+// references, so a resource is freed as soon as the last program or engine
+// using it goes away, and asking for the same key again while it is alive
+// returns the same object.
+class SharedResources
+{
+public:
+    struct MemoryReport
+    {
+        int numResources = 0;
+        std::size_t bytes = 0;
+    };
+
+    static SharedResources& getInstance();
+
+    // Returns the live resource for key, or calls create() and registers
+    // what it returns. Resource must provide getMemoryUsage(); create may
+    // return nullptr, which is passed back and not registered. create runs
+    // without the registry lock held, so it may take its time.
+    template <typename Resource, typename Create>
+    std::shared_ptr<const Resource> getOrCreate(const std::string& key, Create&& create)
+    {
+        const std::string fullKey = std::string(typeid(Resource).name()) + '\n' + key;
+
+        if (auto existing = find(fullKey))
+            return std::static_pointer_cast<const Resource>(existing);
+
+        std::shared_ptr<const Resource> created = create();
+        if (created == nullptr)
+            return nullptr;
+
+        return std::static_pointer_cast<const Resource>(insert(fullKey, created, created->getMemoryUsage()));
+    }
+
+    MemoryReport getMemoryReport() const;
+
+private:
+    SharedResources() = default;
+
+    struct Entry
+    {
+        std::weak_ptr<const void> resource;
+        std::size_t bytes = 0;
+    };
+
+    std::shared_ptr<const void> find(const std::string& key);
+
+    // If another thread registered the same key in the meantime, its
+    // resource wins and is returned instead
+    std::shared_ptr<const void> insert(const std::string& key, std::shared_ptr<const void> resource, std::size_t bytes);
+    void removeExpiredEntries();
+
+    mutable std::mutex lock;
+    std::unordered_map<std::string, Entry> entries;
+
+    JUCE_DECLARE_NON_COPYABLE (SharedResources)
+};
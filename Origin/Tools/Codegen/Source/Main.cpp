@@ -0,0 +1,90 @@
+/*
+  ==============================================================================
+
+    Writes an ORIGIN equation out as a self-contained C++ class.
+
+    For effects that ship with a fixed equation: the header it writes needs
+    nothing but the standard library, and runs the equation without the
+    parser, compiler or instruction dispatch. See EquationCodeGenerator.h.
+
+    Usage: Codegen --equation "0.5*x + 0.5*z^-1" --out FrozenEquation.h
+                   [--class FrozenEquation] [--double]
+                   [--interpolation linear|none|lagrange|thiran]
+                   [--no-tables] [--no-rates]
+
+           Codegen --verify [--compiler c++] [--keep]
+
+    --verify builds classes for a fixed set of equations with the given
+    compiler and checks them against DSPEngine, see Verify.cpp. Run it
+    after changing the generator or the engine.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "../../../Source/EquationCodeGenerator.h"
+#include "Verify.h"
+#include <cstdio>
+
+namespace
+{
+    DelayInterpolation parseInterpolation (const juce::String& name)
+    {
+        if (name == "none")     return DelayInterpolation::None;
+        if (name == "lagrange") return DelayInterpolation::Lagrange3rd;
+        if (name == "thiran")   return DelayInterpolation::Thiran;
+        return DelayInterpolation::Linear;
+    }
+
+    EquationCodeGenerator::Options parseOptions (const juce::ArgumentList& args)
+    {
+        EquationCodeGenerator::Options options;
+
+        auto className = args.getValueForOption ("--class");
+        if (className.isNotEmpty())
+            options.className = className.toStdString();
+
+        options.doublePrecision = args.containsOption ("--double");
+        options.delayInterpolation = parseInterpolation (args.getValueForOption ("--interpolation").toLowerCase());
+        options.compilerOptions.lookupTables.enabled = ! args.containsOption ("--no-tables");
+        options.compilerOptions.rates.enabled = ! args.containsOption ("--no-rates");
+        return options;
+    }
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    juce::ArgumentList args (argc, argv);
+
+    if (args.containsOption ("--verify"))
+        return runVerification (args);
+
+    if (! args.containsOption ("--equation") || ! args.containsOption ("--out"))
+    {
+        std::fprintf (stderr, "Usage: Codegen --equation EQ --out FILE.h [--class NAME] [--double] "
+                              "[--interpolation linear|none|lagrange|thiran] [--no-tables] [--no-rates]\n"
+                              "       Codegen --verify [--compiler c++] [--keep]\n");
+        return 1;
+    }
+
+    const auto equation = args.getValueForOption ("--equation").toStdString();
+    const auto output = args.getFileForOption ("--out");
+    const auto options = parseOptions (args);
+
+    std::string source, errorMessage;
+    if (! EquationCodeGenerator::generate (equation, options, source, errorMessage))
+    {
+        std::fprintf (stderr, "Invalid equation: %s\n", errorMessage.c_str());
+        return 1;
+    }
+
+    if (! output.replaceWithText (source))
+    {
+        std::fprintf (stderr, "Could not write %s\n", output.getFullPathName().toRawUTF8());
+        return 1;
+    }
+
+    std::printf ("wrote %s (class %s)\n", output.getFullPathName().toRawUTF8(), options.className.c_str());
+    return 0;
+}
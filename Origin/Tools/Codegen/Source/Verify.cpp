@@ -0,0 +1,399 @@
+/*
+  ==============================================================================
+
+    Codegen --verify: checks that generated classes run their equations the
+    way DSPEngine does.
+
+    Every case is generated in float and double, and the classes are built
+    with the system compiler into a small driver; they need nothing but the
+    standard library, so no other part of ORIGIN is compiled. The driver and
+    DSPEngine are fed the same input in the same ragged blocks, with a
+    variable changing half way, and their outputs compared. Only rounding
+    may differ: the engine's dedicated kernels add the same terms in
+    another order, and everything else should match bit for bit.
+
+  ==============================================================================
+*/
+
+#include "Verify.h"
+#include "../../../Source/EquationCodeGenerator.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+namespace
+{
+    struct Case
+    {
+        const char* equation;
+        DelayInterpolation interpolation = DelayInterpolation::Linear;
+    };
+
+    // One of each thing the generator writes differently: feedback, fixed
+    // delays, lookup tables, control rate LFOs and variables, noise, the
+    // strength reductions, moving windows and envelopes, comparisons and
+    // ifelse. g and f are variables; f changes half way through.
+    const char* const equations[] =
+    {
+        "0.2*sin(2*pi*440*t) * x + x^3 + 0.3*z^-100 + 0.1*y_prev",
+        "0.9*x + 0.1*y_prev",
+        "x * (0.5 + 0.5*sin(2*pi*3*t)) + 0.4*y_prev2",
+        "sin(3*x)*exp(-x*x)",
+        "x*g + sin(x*5)/(1+x^2) + t*0.01 + z^-3",
+        "abs(x) - 0.5*y_prev*g + sqrt(abs(x))*log(1+abs(x))",
+
+        "x + 0.1*rand - 0.05",
+        "0.5*x + 0.2*randn(3) + 0.1*z^-10",
+        "x*(1 + 0.1*randn) + 0.3*y_prev*rand(9)",
+        "randn + rand",
+
+        "x^2 + 0.1*x^3 - 0.01*x^16",
+        "x/4 + z^-3/3 + x/g",
+        "0.5*sin(2*pi*440*t) + 0.5*x",
+        "x*cos(2*pi*f*t + 0.3) + 0.2*sin(2*pi*f*t/2)*z^-5",
+        "0.3*sin(2*pi*1000*t)^2 + x/(1 + g) + 0.5*y_prev/3",
+        "sin(2*pi*440*t + x) + (x + 1)^5 * 0.01",
+        "sin(2*pi*0.5*t)*x + cos(-2*pi*(f + 100)*t)*0.1",
+
+        "movmean(x, 100) + movrms(x, 37)",
+        "movmax(x, 50) - movmin(z^-3, 700)",
+        "x / (envelope(x, 0.005, 0.2) + 0.01)",
+        "0.5*y_prev + movmean(y_prev, 8)*0.3 + 0.1*x",
+        "envelope(y_prev*0.5 + x, 0, 0.05) + movmax(y_prev, 20)*0.1",
+        "x + movmean(x^2, 2000)",
+        "movmax(abs(x), 1) + movmean(1, 5) + movmin(g, 3)",
+
+        "clamp(4*x, -0.5, 0.5)",
+        "ifelse(abs(x) > 0.2, x, 0)",
+        "ifelse(x >= 0, sqrt(x), -sqrt(-x))",
+        "x * (sin(2*pi*3*t) > 0)",
+        "max(x, g) - min(x, -g) + sign(x)*0.1 + (x == 0) + (x ~= 0.25) + (x <= 0.1)",
+        "ifelse(y_prev > 0.5, 0.3*y_prev, 0.9*y_prev) + 0.1*x",
+        "ifelse(f > 1000, x, -x)",
+        "ifelse(t < 1.5, x, 0.5*x) + min(sin(2*pi*2*t), 0.5)*x",
+        "ifelse(x > 0, z^-3, z^-5) * clamp(y_prev + x, -1, 1)",
+        "min(sin(x)*exp(x), 0.3) + ifelse(3 > 2, x, 1/0)",
+        "ifelse(sign(x) != 1, movmax(x, 30), envelope(x, 0.001, 0.1))"
+    };
+
+    // z^-(expr) reads between samples, so these run under every interpolation
+    const char* const modulatedDelayEquations[] =
+    {
+        "tan(x*g) + exp(z^-(10 + 5*sin(2*pi*0.5*t)))",
+        "x + 0.3*z^-(6 + 4*y_prev)"
+    };
+
+    constexpr double sampleRate = 48000.0;
+    constexpr int maxBlockSize = 512;
+    constexpr int numBlocks = 300;
+    constexpr int variableChangeBlock = numBlocks / 2;
+    constexpr juce::uint32 noiseSeed = 11;
+
+    // Outputs may differ by this much relative to the larger of 1 and their peak
+    constexpr double floatTolerance = 1.0e-6;
+    constexpr double doubleTolerance = 1.0e-12;
+
+    std::vector<Case> makeCases()
+    {
+        std::vector<Case> cases;
+        for (auto* equation : equations)
+            cases.push_back ({ equation });
+
+        for (auto* equation : modulatedDelayEquations)
+            for (auto interpolation : { DelayInterpolation::None, DelayInterpolation::Linear,
+                                        DelayInterpolation::Lagrange3rd, DelayInterpolation::Thiran })
+                cases.push_back ({ equation, interpolation });
+
+        return cases;
+    }
+
+    const char* getInterpolationName (DelayInterpolation interpolation)
+    {
+        switch (interpolation)
+        {
+            case DelayInterpolation::None:        return "none";
+            case DelayInterpolation::Lagrange3rd: return "lagrange";
+            case DelayInterpolation::Thiran:      return "thiran";
+            default:                              return "linear";
+        }
+    }
+
+    // Ragged, so the generated classes' block and control rate bookkeeping
+    // is exercised across boundaries, and never above maxBlockSize
+    int getBlockSize (int block)
+    {
+        return block % 3 == 0 ? maxBlockSize : 100 + (block * 37) % 400;
+    }
+
+    std::vector<double> makeInput()
+    {
+        std::vector<double> input;
+        for (int block = 0; block < numBlocks; ++block)
+        {
+            for (int i = 0; i < getBlockSize (block); ++i)
+            {
+                const auto n = static_cast<double> (input.size());
+                input.push_back (0.6 * std::sin (n * 0.013) + 0.3 * std::sin (n * 0.0021));
+            }
+        }
+
+        return input;
+    }
+
+    juce::String getClassName (int index, bool doublePrecision)
+    {
+        return "Case" + juce::String (index) + (doublePrecision ? "Double" : "Float");
+    }
+
+    template <typename SampleType>
+    std::vector<double> runEngine (const Case& testCase, const std::vector<double>& input)
+    {
+        DSPEngine<SampleType> engine;
+        engine.setVariable ("g", 0.5);
+        engine.setVariable ("f", 1234.5);
+        engine.setDelayInterpolation (testCase.interpolation);
+        engine.setNoiseSeed (noiseSeed);
+        engine.setStabilityGuardEnabled (false); // The generated classes have none
+        engine.setEquation (testCase.equation);
+        engine.prepare (sampleRate, maxBlockSize);
+
+        std::vector<SampleType> samples (input.begin(), input.end());
+        size_t position = 0;
+        for (int block = 0; block < numBlocks; ++block)
+        {
+            if (block == variableChangeBlock)
+                engine.setVariable ("f", 50.0);
+
+            engine.processBlock (samples.data() + position, getBlockSize (block));
+            position += (size_t) getBlockSize (block);
+        }
+
+        return { samples.begin(), samples.end() };
+    }
+
+    // Runs every class over the input the engine gets, in the same blocks,
+    // and writes each one's output next to its header
+    juce::String makeDriver (int numCases)
+    {
+        juce::String source;
+        source << "// Written by Codegen --verify\n\n";
+
+        for (int index = 0; index < numCases; ++index)
+            for (bool doublePrecision : { false, true })
+                source << "#include \"" << getClassName (index, doublePrecision) << ".h\"\n";
+
+        source << "#include <cstdio>\n"
+                  "#include <string>\n"
+                  "#include <vector>\n"
+                  "\n"
+                  "namespace\n"
+                  "{\n"
+                  "    const int blockSizes[] = {";
+
+        for (int block = 0; block < numBlocks; ++block)
+            source << (block % 16 == 0 ? "\n        " : " ") << getBlockSize (block) << (block + 1 < numBlocks ? "," : "");
+
+        source << "\n    };\n"
+                  "\n"
+                  "    // Only classes for equations with rand or randn have setNoiseSeed()\n"
+                  "    template <typename Equation>\n"
+                  "    auto seedNoise (Equation& equation, int) -> decltype (equation.setNoiseSeed (0u), void())\n"
+                  "    {\n"
+                  "        equation.setNoiseSeed (" << (int) noiseSeed << "u);\n"
+                  "    }\n"
+                  "\n"
+                  "    template <typename Equation>\n"
+                  "    void seedNoise (Equation&, long) {}\n"
+                  "\n"
+                  "    template <typename Equation>\n"
+                  "    bool run (const std::vector<double>& input, const std::string& outputPath)\n"
+                  "    {\n"
+                  "        Equation equation;\n"
+                  "        equation.prepare (" << sampleRate << ", " << maxBlockSize << ");\n"
+                  "        equation.setVariable (\"g\", 0.5);\n"
+                  "        equation.setVariable (\"f\", 1234.5);\n"
+                  "        seedNoise (equation, 0);\n"
+                  "\n"
+                  "        std::vector<typename Equation::SampleType> samples (input.begin(), input.end());\n"
+                  "        size_t position = 0;\n"
+                  "        for (int block = 0; block < " << numBlocks << "; ++block)\n"
+                  "        {\n"
+                  "            if (block == " << variableChangeBlock << ")\n"
+                  "                equation.setVariable (\"f\", 50.0);\n"
+                  "\n"
+                  "            equation.process (samples.data() + position, blockSizes[block]);\n"
+                  "            position += (size_t) blockSizes[block];\n"
+                  "        }\n"
+                  "\n"
+                  "        const std::vector<double> output (samples.begin(), samples.end());\n"
+                  "        auto* file = std::fopen (outputPath.c_str(), \"wb\");\n"
+                  "        if (file == nullptr)\n"
+                  "            return false;\n"
+                  "\n"
+                  "        const bool written = std::fwrite (output.data(), sizeof (double), output.size(), file) == output.size();\n"
+                  "        return std::fclose (file) == 0 && written;\n"
+                  "    }\n"
+                  "}\n"
+                  "\n"
+                  "int main (int argc, char* argv[])\n"
+                  "{\n"
+                  "    if (argc < 2)\n"
+                  "        return 1;\n"
+                  "\n"
+                  "    const std::string directory = argv[1];\n"
+                  "    std::vector<double> input ((size_t) " << (int) makeInput().size() << ");\n"
+                  "    auto* file = std::fopen ((directory + \"/input.bin\").c_str(), \"rb\");\n"
+                  "    if (file == nullptr || std::fread (input.data(), sizeof (double), input.size(), file) != input.size())\n"
+                  "        return 1;\n"
+                  "\n"
+                  "    std::fclose (file);\n"
+                  "    bool ok = true;\n";
+
+        for (int index = 0; index < numCases; ++index)
+            for (bool doublePrecision : { false, true })
+            {
+                const auto className = getClassName (index, doublePrecision);
+                source << "    ok = run<" << className << "> (input, directory + \"/" << className << ".out\") && ok;\n";
+            }
+
+        source << "    return ok ? 0 : 1;\n"
+                  "}\n";
+        return source;
+    }
+
+    bool runProcess (const juce::StringArray& arguments, int timeoutMs)
+    {
+        juce::ChildProcess process;
+        if (! process.start (arguments))
+        {
+            std::fprintf (stderr, "Could not run %s\n", arguments[0].toRawUTF8());
+            return false;
+        }
+
+        const auto output = process.readAllProcessOutput();
+        if (! process.waitForProcessToFinish (timeoutMs) || process.getExitCode() != 0)
+        {
+            std::fprintf (stderr, "%s failed:\n%s\n", arguments[0].toRawUTF8(), output.toRawUTF8());
+            return false;
+        }
+
+        return true;
+    }
+
+    // Largest difference relative to max(1, peak); infinities must match
+    // exactly and NaN never passes
+    double compareOutputs (const std::vector<double>& expected, const std::vector<double>& actual)
+    {
+        if (expected.size() != actual.size())
+            return std::numeric_limits<double>::infinity();
+
+        double peak = 1.0, worst = 0.0;
+        for (size_t i = 0; i < expected.size(); ++i)
+        {
+            if (expected[i] == actual[i])
+                continue;
+
+            const double difference = std::abs (expected[i] - actual[i]);
+            if (! std::isfinite (difference))
+                return std::numeric_limits<double>::infinity();
+
+            worst = std::max (worst, difference);
+        }
+
+        for (double value : expected)
+            if (std::isfinite (value))
+                peak = std::max (peak, std::abs (value));
+
+        return worst / peak;
+    }
+
+    std::vector<double> loadOutput (const juce::File& file)
+    {
+        juce::MemoryBlock data;
+        if (! file.loadFileAsData (data))
+            return {};
+
+        const auto* values = static_cast<const double*> (data.getData());
+        return { values, values + data.getSize() / sizeof (double) };
+    }
+}
+
+int runVerification (const juce::ArgumentList& args)
+{
+    const auto compiler = args.containsOption ("--compiler") ? args.getValueForOption ("--compiler") : juce::String ("c++");
+    const auto cases = makeCases();
+    const auto input = makeInput();
+
+    auto directory = juce::File::getSpecialLocation (juce::File::tempDirectory)
+                         .getNonexistentChildFile ("OriginCodegenVerify", "", false);
+    if (! directory.createDirectory())
+    {
+        std::fprintf (stderr, "Could not create %s\n", directory.getFullPathName().toRawUTF8());
+        return 1;
+    }
+
+    // Everything the driver needs: one header per class, the input and the driver itself
+    for (size_t index = 0; index < cases.size(); ++index)
+        for (bool doublePrecision : { false, true })
+        {
+            const auto className = getClassName ((int) index, doublePrecision);
+
+            EquationCodeGenerator::Options options;
+            options.className = className.toStdString();
+            options.doublePrecision = doublePrecision;
+            options.delayInterpolation = cases[index].interpolation;
+
+            std::string source, errorMessage;
+            if (! EquationCodeGenerator::generate (cases[index].equation, options, source, errorMessage))
+            {
+                std::fprintf (stderr, "Could not generate %s: %s\n", cases[index].equation, errorMessage.c_str());
+                directory.deleteRecursively();
+                return 1;
+            }
+
+            directory.getChildFile (className + ".h").replaceWithText (source);
+        }
+
+    const auto driver = directory.getChildFile ("Driver.cpp");
+    const auto executable = directory.getChildFile ("Driver");
+    directory.getChildFile ("input.bin").replaceWithData (input.data(), input.size() * sizeof (double));
+    driver.replaceWithText (makeDriver ((int) cases.size()));
+
+    std::printf ("building %d classes in %s\n", (int) cases.size() * 2, directory.getFullPathName().toRawUTF8());
+
+    constexpr int buildTimeoutMs = 10 * 60 * 1000;
+    constexpr int runTimeoutMs = 60 * 1000;
+    const juce::StringArray build (compiler, "-std=c++17", "-O2", "-o", executable.getFullPathName(), driver.getFullPathName());
+    const juce::StringArray run (executable.getFullPathName(), directory.getFullPathName());
+    if (! runProcess (build, buildTimeoutMs) || ! runProcess (run, runTimeoutMs))
+    {
+        std::fprintf (stderr, "Left %s for a look\n", directory.getFullPathName().toRawUTF8());
+        return 1;
+    }
+
+    int numFailed = 0;
+    for (size_t index = 0; index < cases.size(); ++index)
+        for (bool doublePrecision : { false, true })
+        {
+            const auto& testCase = cases[index];
+            const auto expected = doublePrecision ? runEngine<double> (testCase, input) : runEngine<float> (testCase, input);
+            const auto actual = loadOutput (directory.getChildFile (getClassName ((int) index, doublePrecision) + ".out"));
+
+            const double difference = compareOutputs (expected, actual);
+            const bool passed = difference <= (doublePrecision ? doubleTolerance : floatTolerance);
+            numFailed += passed ? 0 : 1;
+
+            std::printf ("%-4s %-74s %-8s %-6s maxdiff %.3g\n", passed ? "ok" : "FAIL", testCase.equation,
+                         getInterpolationName (testCase.interpolation), doublePrecision ? "double" : "float", difference);
+        }
+
+    if (args.containsOption ("--keep"))
+        std::printf ("kept %s\n", directory.getFullPathName().toRawUTF8());
+    else
+        directory.deleteRecursively();
+
+    std::printf ("%d of %d classes match DSPEngine\n", (int) cases.size() * 2 - numFailed, (int) cases.size() * 2);
+    return numFailed == 0 ? 0 : 1;
+}
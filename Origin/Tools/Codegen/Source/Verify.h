@@ -0,0 +1,10 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// Codegen --verify [--compiler c++] [--keep]
+//
+// Generates classes for a fixed set of equations, builds them with the
+// system compiler and checks their output against DSPEngine's. Returns the
+// process exit code: 0 when every case matches.
+int runVerification (const juce::ArgumentList& args);
@@ -0,0 +1,574 @@
+/*
+  ==============================================================================
+
+    Headless session load test.
+
+    Runs N OriginAudioProcessor instances the way a host runs a big session:
+    tracks spread over a few audio threads, varying block sizes, a pass per
+    sample rate, tracks that go quiet between clips, automation and
+    equation swaps arriving from a message thread, and periodic autosaves.
+    Reports aggregate CPU, per-period and per-instance block times, memory
+    and allocations, and the session size a machine can carry.
+
+    Usage: LoadTest [--instances N] [--seconds S] [--threads T]
+                    [--rates 44100,48000,96000] [--block 512] [--fixed-blocks]
+                    [--active 0.4] [--realtime] [--target 0.7] [--seed N]
+                    [--csv per-instance.csv] [--trace trace.json]
+
+    --trace saves the most recent blocks, compiles and swaps as a Chrome
+    trace; it needs a build with ORIGIN_TRACING=1, see PerformanceTrace.h.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "../../../Source/PluginProcessor.h"
+#include "../../../Source/ChannelWorkerPool.h"
+#include "../../../Source/PerformanceTrace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+//==============================================================================
+// Every allocation in the process goes through here, so the report can say
+// how much the instances cost and whether processBlock() ever allocates
+namespace AllocationTracker
+{
+    std::atomic<std::int64_t> numAllocations { 0 };
+    std::atomic<std::int64_t> numAudioThreadAllocations { 0 };
+    std::atomic<std::int64_t> liveBytes { 0 };
+    std::atomic<std::int64_t> peakBytes { 0 };
+    thread_local bool insideProcessBlock = false;
+
+    // Keeps the size in front of the block; malloc's alignment is preserved
+    constexpr std::size_t headerSize = alignof (std::max_align_t);
+
+    void* allocate (std::size_t size)
+    {
+        auto* block = static_cast<char*> (std::malloc (size + headerSize));
+        if (block == nullptr)
+            throw std::bad_alloc();
+
+        *reinterpret_cast<std::size_t*> (block) = size;
+        numAllocations.fetch_add (1, std::memory_order_relaxed);
+        if (insideProcessBlock)
+            numAudioThreadAllocations.fetch_add (1, std::memory_order_relaxed);
+
+        const auto live = liveBytes.fetch_add ((std::int64_t) size, std::memory_order_relaxed) + (std::int64_t) size;
+        auto peak = peakBytes.load (std::memory_order_relaxed);
+        while (live > peak && ! peakBytes.compare_exchange_weak (peak, live, std::memory_order_relaxed)) {}
+
+        return block + headerSize;
+    }
+
+    void release (void* pointer)
+    {
+        if (pointer == nullptr)
+            return;
+
+        auto* block = static_cast<char*> (pointer) - headerSize;
+        liveBytes.fetch_sub ((std::int64_t) *reinterpret_cast<std::size_t*> (block), std::memory_order_relaxed);
+        std::free (block);
+    }
+}
+
+void* operator new (std::size_t size)                                   { return AllocationTracker::allocate (size); }
+void* operator new[] (std::size_t size)                                 { return AllocationTracker::allocate (size); }
+void* operator new (std::size_t size, const std::nothrow_t&) noexcept   { try { return AllocationTracker::allocate (size); } catch (...) { return nullptr; } }
+void* operator new[] (std::size_t size, const std::nothrow_t&) noexcept { try { return AllocationTracker::allocate (size); } catch (...) { return nullptr; } }
+void operator delete (void* pointer) noexcept                           { AllocationTracker::release (pointer); }
+void operator delete[] (void* pointer) noexcept                         { AllocationTracker::release (pointer); }
+void operator delete (void* pointer, std::size_t) noexcept              { AllocationTracker::release (pointer); }
+void operator delete[] (void* pointer, std::size_t) noexcept            { AllocationTracker::release (pointer); }
+void operator delete (void* pointer, const std::nothrow_t&) noexcept    { AllocationTracker::release (pointer); }
+void operator delete[] (void* pointer, const std::nothrow_t&) noexcept  { AllocationTracker::release (pointer); }
+
+//==============================================================================
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Options
+    {
+        int numInstances = 200;
+        double seconds = 20.0;  // Audio time per sample rate pass
+        int numThreads = juce::jmax (1, juce::SystemStats::getNumPhysicalCpus());
+        std::vector<double> sampleRates { 44100.0, 48000.0, 96000.0 };
+        int maxBlockSize = 512;
+        bool variableBlockSizes = true;
+        double activeFraction = 0.4; // Share of time a track has a clip playing
+        bool realtime = false;       // Pace periods like a sound card instead of running flat out
+        double targetLoad = 0.7;     // Period load a session should stay under
+        int seed = 1;
+        juce::String csvPath;
+        juce::String tracePath;
+    };
+
+    // What a session of these plugins tends to hold. "g" is automated.
+    struct EquationChoice
+    {
+        const char* equation;
+        int weight;
+    };
+
+    const EquationChoice equationMix[] =
+    {
+        { "x", 4 },                                                  // Left on a track, bypassed
+        { "g * x", 6 },                                              // Gain
+        { "0.1 * x + 0.9 * y_prev", 8 },                             // One-pole low-pass
+        { "x - 0.95 * z^-1", 4 },                                    // High-pass
+        { "0.2 * x + 1.6 * y_prev - 0.8 * y_prev2", 6 },             // Resonant two-pole
+        { "0.25 * (x + z^-1 + z^-2 + z^-3)", 3 },                    // Short FIR
+        { "x + 0.4 * z^-13230", 5 },                                 // Slap echo
+        { "0.7 * x + 0.5 * z^-(220 + 40 * sin(2*pi*0.5*t))", 5 },    // Chorus
+        { "x * (0.6 + 0.4 * sin(2*pi*4*t))", 4 },                    // Tremolo
+        { "0.6 * x + 0.4 * tan(g * x) / tan(g)", 5 },                // Saturation
+        { "0.3 * tan(x) + 0.95 * y_prev", 3 },                       // Non-linear feedback
+        { "x * exp(-abs(x)) + 0.5 * sqrt(abs(z^-1)) * z^-1", 2 },    // Something general
+    };
+
+    const char* pickEquation (juce::Random& random)
+    {
+        int total = 0;
+        for (const auto& choice : equationMix)
+            total += choice.weight;
+
+        int pick = random.nextInt (total);
+        for (const auto& choice : equationMix)
+        {
+            if (pick < choice.weight)
+                return choice.equation;
+            pick -= choice.weight;
+        }
+
+        return equationMix[0].equation;
+    }
+
+    double percentile (std::vector<float> values, double fraction)
+    {
+        if (values.empty())
+            return 0.0;
+
+        auto nth = values.begin() + (std::ptrdiff_t) std::min (values.size() - 1, (size_t) (fraction * (double) values.size()));
+        std::nth_element (values.begin(), nth, values.end());
+        return *nth;
+    }
+
+    //==============================================================================
+    struct Track
+    {
+        std::unique_ptr<OriginAudioProcessor> processor;
+        juce::String equation;
+        int numChannels = 2;
+        bool hostUsesDouble = false;
+        bool automated = false;
+
+        juce::AudioBuffer<float> floatBuffer;
+        juce::AudioBuffer<double> doubleBuffer;
+        juce::MidiBuffer midi;
+
+        // Clips come and go; between them the track gets silence
+        juce::Random random;
+        bool playing = false;
+        double nextToggleTime = 0.0;
+        int noiseOffset = 0;
+
+        // Block time as a share of the block's duration, one per block
+        std::vector<float> blockLoads;
+    };
+
+    class Session
+    {
+    public:
+        explicit Session (const Options& o)
+            : options (o), random (o.seed), hostThreads (o.numThreads - 1, ChannelWorkerPool::Priority::Realtime)
+        {
+            // One shared stretch of noise stands in for every track's audio
+            noise.resize (1 << 16);
+            for (auto& sample : noise)
+                sample = (random.nextFloat() * 2.0f - 1.0f) * 0.25f;
+        }
+
+        void createInstances()
+        {
+            const auto liveBefore = AllocationTracker::liveBytes.load();
+            const auto allocationsBefore = AllocationTracker::numAllocations.load();
+            const auto start = Clock::now();
+
+            tracks.resize ((size_t) options.numInstances);
+            for (auto& track : tracks)
+            {
+                track.processor = std::make_unique<OriginAudioProcessor>();
+                track.numChannels = random.nextFloat() < 0.25f ? 1 : 2;
+                track.hostUsesDouble = random.nextFloat() < 0.15f;
+                track.equation = pickEquation (random);
+                track.automated = track.equation.containsWholeWord ("g");
+                track.random.setSeed (random.nextInt64());
+
+                if (random.nextFloat() < 0.1f)
+                    track.processor->setInternalPrecision (OriginAudioProcessor::InternalPrecision::Double);
+
+                track.processor->setVariable ("g", 0.5);
+                track.processor->setEquation (track.equation);
+            }
+
+            setupMilliseconds = std::chrono::duration<double, std::milli> (Clock::now() - start).count();
+            setupAllocations = AllocationTracker::numAllocations.load() - allocationsBefore;
+            heapBytesPerInstance = (double) (AllocationTracker::liveBytes.load() - liveBefore) / (double) options.numInstances;
+        }
+
+        void runPass (double sampleRate)
+        {
+            std::printf ("\n=== %.0f Hz, %d instances, %d audio thread%s, %s blocks up to %d, %s ===\n",
+                         sampleRate, options.numInstances, options.numThreads, options.numThreads == 1 ? "" : "s",
+                         options.variableBlockSizes ? "variable" : "fixed", options.maxBlockSize,
+                         options.realtime ? "real time" : "flat out");
+
+            prepare (sampleRate);
+
+            std::vector<float> periodLoads;
+            periodLoads.reserve ((size_t) (options.seconds * sampleRate / 16.0));
+            for (auto& track : tracks)
+            {
+                track.blockLoads.clear();
+                track.blockLoads.reserve (periodLoads.capacity());
+            }
+
+            const auto audioAllocationsBefore = AllocationTracker::numAudioThreadAllocations.load();
+            messageEvents = 0;
+            messageSeconds = 0.0;
+            audioTime = 0.0;
+            stopMessageThread = false;
+            std::thread messageThread ([this] { runMessageThread(); });
+
+            const auto passStart = Clock::now();
+            double processingSeconds = 0.0;
+            int numXruns = 0;
+
+            while (audioTime.load() < options.seconds)
+            {
+                const int blockSize = pickBlockSize();
+                const double budget = blockSize / sampleRate;
+                const double now = audioTime.load();
+
+                const auto periodStart = Clock::now();
+                auto processTrack = [this, blockSize, budget, now] (int index)
+                {
+                    process (tracks[(size_t) index], blockSize, budget, now);
+                };
+                hostThreads.parallelFor (options.numInstances, processTrack);
+                const double periodSeconds = std::chrono::duration<double> (Clock::now() - periodStart).count();
+
+                periodLoads.push_back ((float) (periodSeconds / budget));
+                processingSeconds += periodSeconds;
+                numXruns += periodSeconds > budget ? 1 : 0;
+                audioTime = now + budget;
+
+                // A sound card asks for the next block when this one is due
+                if (options.realtime)
+                    std::this_thread::sleep_until (passStart + std::chrono::duration_cast<Clock::duration> (std::chrono::duration<double> (audioTime.load())));
+            }
+
+            stopMessageThread = true;
+            messageThread.join();
+
+            const double wallSeconds = std::chrono::duration<double> (Clock::now() - passStart).count();
+            report (periodLoads, processingSeconds, wallSeconds, numXruns,
+                    AllocationTracker::numAudioThreadAllocations.load() - audioAllocationsBefore);
+        }
+
+        void writeCsv (const juce::File& file) const
+        {
+            juce::String csv ("equation,channels,host precision,p50 load,p99 load,max load\n");
+            for (const auto& track : tracks)
+            {
+                csv << "\"" << track.equation << "\"," << track.numChannels << "," << (track.hostUsesDouble ? "double" : "float") << ","
+                    << percentile (track.blockLoads, 0.5) << "," << percentile (track.blockLoads, 0.99) << ","
+                    << percentile (track.blockLoads, 1.0) << "\n";
+            }
+
+            file.replaceWithText (csv);
+        }
+
+        double setupMilliseconds = 0.0;
+        std::int64_t setupAllocations = 0;
+        double heapBytesPerInstance = 0.0;
+
+    private:
+        const Options options;
+        juce::Random random;
+        ChannelWorkerPool hostThreads; // The calling thread works too, like a host's main audio thread
+        std::vector<Track> tracks;
+        std::vector<float> noise;
+
+        std::atomic<double> audioTime { 0.0 };
+        std::atomic<bool> stopMessageThread { false };
+        int messageEvents = 0;
+        double messageSeconds = 0.0;
+
+        void prepare (double sampleRate)
+        {
+            // What a host does when the session's sample rate changes
+            for (auto& track : tracks)
+            {
+                auto& processor = *track.processor;
+                processor.releaseResources();
+                processor.setProcessingPrecision (track.hostUsesDouble ? juce::AudioProcessor::doublePrecision
+                                                                       : juce::AudioProcessor::singlePrecision);
+                processor.setPlayConfigDetails (track.numChannels, track.numChannels, sampleRate, options.maxBlockSize);
+                processor.prepareToPlay (sampleRate, options.maxBlockSize);
+
+                track.floatBuffer.setSize (track.numChannels, options.maxBlockSize);
+                track.doubleBuffer.setSize (track.numChannels, options.maxBlockSize);
+                track.playing = random.nextFloat() < options.activeFraction;
+                track.nextToggleTime = random.nextDouble() * 8.0;
+                track.noiseOffset = random.nextInt ((int) noise.size());
+            }
+        }
+
+        int pickBlockSize()
+        {
+            // Most hosts keep to the announced size; some split blocks
+            // around automation or loop points
+            if (! options.variableBlockSizes || random.nextFloat() < 0.7f)
+                return options.maxBlockSize;
+
+            return 16 + random.nextInt (options.maxBlockSize - 15);
+        }
+
+        void process (Track& track, int blockSize, double budget, double now)
+        {
+            // Clips and the gaps between them average 8 s together, split by activeFraction
+            if (now >= track.nextToggleTime)
+            {
+                track.playing = ! track.playing;
+                const double mean = 8.0 * (track.playing ? options.activeFraction : 1.0 - options.activeFraction);
+                track.nextToggleTime = now + mean * (0.5 + track.random.nextDouble());
+            }
+
+            auto fill = [&track, blockSize, this] (auto& buffer)
+            {
+                buffer.setSize (track.numChannels, blockSize, false, false, true);
+                for (int channel = 0; channel < track.numChannels; ++channel)
+                {
+                    auto* samples = buffer.getWritePointer (channel);
+                    for (int i = 0; i < blockSize; ++i)
+                        samples[i] = track.playing ? noise[(size_t) ((track.noiseOffset + channel * 101 + i) & (int) (noise.size() - 1))] : 0.0f;
+                }
+            };
+
+            track.noiseOffset = (track.noiseOffset + blockSize) & (int) (noise.size() - 1);
+
+            if (track.hostUsesDouble)
+                fill (track.doubleBuffer);
+            else
+                fill (track.floatBuffer);
+
+            AllocationTracker::insideProcessBlock = true;
+            const auto start = Clock::now();
+
+            if (track.hostUsesDouble)
+                track.processor->processBlock (track.doubleBuffer, track.midi);
+            else
+                track.processor->processBlock (track.floatBuffer, track.midi);
+
+            const double seconds = std::chrono::duration<double> (Clock::now() - start).count();
+            AllocationTracker::insideProcessBlock = false;
+
+            track.blockLoads.push_back ((float) (seconds / budget));
+        }
+
+        void runMessageThread()
+        {
+            // Events are timed in audio time, so a flat-out run sees as many
+            // per second of audio as a real-time one
+            constexpr double automationInterval = 1.0 / 30.0;
+            constexpr double swapInterval = 2.0;
+            constexpr double autosaveInterval = 10.0;
+
+            juce::Random messageRandom (options.seed + 1);
+            double nextAutomation = 0.0, nextSwap = swapInterval, nextAutosave = autosaveInterval;
+
+            while (! stopMessageThread.load())
+            {
+                const double now = audioTime.load();
+                const auto start = Clock::now();
+                bool didWork = false;
+
+                if (now >= nextAutomation)
+                {
+                    const double value = 0.5 + 0.4 * std::sin (juce::MathConstants<double>::twoPi * 0.25 * now);
+                    for (auto& track : tracks)
+                        if (track.automated)
+                            track.processor->setVariable ("g", value);
+
+                    nextAutomation = now + automationInterval;
+                    didWork = true;
+                }
+
+                if (now >= nextSwap)
+                {
+                    auto& track = tracks[(size_t) messageRandom.nextInt ((int) tracks.size())];
+                    track.equation = pickEquation (messageRandom);
+                    track.automated = track.equation.containsWholeWord ("g");
+                    track.processor->setEquation (track.equation);
+
+                    nextSwap = now + swapInterval;
+                    didWork = true;
+                }
+
+                if (now >= nextAutosave)
+                {
+                    for (auto& track : tracks)
+                    {
+                        juce::MemoryBlock state;
+                        track.processor->getStateInformation (state);
+                    }
+
+                    nextAutosave = now + autosaveInterval;
+                    didWork = true;
+                }
+
+                if (didWork)
+                {
+                    ++messageEvents;
+                    messageSeconds += std::chrono::duration<double> (Clock::now() - start).count();
+                }
+                else
+                {
+                    std::this_thread::sleep_for (std::chrono::milliseconds (1));
+                }
+            }
+        }
+
+        void report (const std::vector<float>& periodLoads, double processingSeconds, double wallSeconds,
+                     int numXruns, std::int64_t audioThreadAllocations)
+        {
+            const double audioSeconds = audioTime.load();
+            const double p99Period = percentile (periodLoads, 0.99);
+
+            std::printf ("audio %.1f s in %.1f s wall, %zu periods, %d over budget\n",
+                         audioSeconds, wallSeconds, periodLoads.size(), numXruns);
+            std::printf ("aggregate CPU   %.2f cores busy for real-time playback\n",
+                         processingSeconds * options.numThreads / audioSeconds);
+            std::printf ("period load     mean %.1f%%  p99 %.1f%%  max %.1f%% of the block's duration\n",
+                         100.0 * percentile (periodLoads, 0.5), 100.0 * p99Period, 100.0 * percentile (periodLoads, 1.0));
+
+            // p99 of every instance, then how those spread over the session
+            std::vector<float> instanceP99s;
+            const Track* worst = nullptr;
+            for (const auto& track : tracks)
+            {
+                instanceP99s.push_back ((float) percentile (track.blockLoads, 0.99));
+                if (worst == nullptr || instanceP99s.back() >= *std::max_element (instanceP99s.begin(), instanceP99s.end()))
+                    worst = &track;
+            }
+
+            std::printf ("instance p99    median %.3f%%  p90 %.3f%%  worst %.3f%% (%s)\n",
+                         100.0 * percentile (instanceP99s, 0.5), 100.0 * percentile (instanceP99s, 0.9),
+                         100.0 * percentile (instanceP99s, 1.0), worst != nullptr ? worst->equation.toRawUTF8() : "-");
+
+            OriginAudioProcessor::MemoryReport memory;
+            std::size_t instanceBytes = 0;
+            for (const auto& track : tracks)
+            {
+                memory = track.processor->getMemoryReport();
+                instanceBytes += memory.instanceBytes;
+            }
+
+            std::printf ("memory          %.1f KB engine state per instance, %.1f KB shared, heap %.1f MB live / %.1f MB peak\n",
+                         (double) instanceBytes / (double) tracks.size() / 1024.0,
+                         (double) (memory.sharedProgramBytes + memory.sharedResources.bytes) / 1024.0,
+                         (double) AllocationTracker::liveBytes.load() / (1024.0 * 1024.0),
+                         (double) AllocationTracker::peakBytes.load() / (1024.0 * 1024.0));
+            std::printf ("allocations     %lld inside processBlock%s\n", (long long) audioThreadAllocations,
+                         audioThreadAllocations > 0 ? "  <-- not real-time safe" : "");
+            std::printf ("message thread  %d events, %.1f ms total\n", messageEvents, messageSeconds * 1000.0);
+
+            // Load grows about linearly with the number of instances
+            if (p99Period > 0.0)
+                std::printf ("capacity        about %d instances keep p99 period load under %.0f%% on %d thread%s\n",
+                             (int) ((double) options.numInstances * options.targetLoad / p99Period),
+                             100.0 * options.targetLoad, options.numThreads, options.numThreads == 1 ? "" : "s");
+        }
+    };
+
+    Options parseOptions (const juce::ArgumentList& args)
+    {
+        Options options;
+
+        auto intOption = [&args] (const char* name, int fallback)
+        {
+            auto value = args.getValueForOption (name);
+            return value.isNotEmpty() ? value.getIntValue() : fallback;
+        };
+
+        auto doubleOption = [&args] (const char* name, double fallback)
+        {
+            auto value = args.getValueForOption (name);
+            return value.isNotEmpty() ? value.getDoubleValue() : fallback;
+        };
+
+        options.numInstances = juce::jmax (1, intOption ("--instances", options.numInstances));
+        options.seconds = juce::jmax (0.1, doubleOption ("--seconds", options.seconds));
+        options.numThreads = juce::jmax (1, intOption ("--threads", options.numThreads));
+        options.maxBlockSize = juce::jmax (16, intOption ("--block", options.maxBlockSize));
+        options.activeFraction = juce::jlimit (0.0, 1.0, doubleOption ("--active", options.activeFraction));
+        options.targetLoad = juce::jlimit (0.05, 1.0, doubleOption ("--target", options.targetLoad));
+        options.seed = intOption ("--seed", options.seed);
+        options.variableBlockSizes = ! args.containsOption ("--fixed-blocks");
+        options.realtime = args.containsOption ("--realtime");
+        options.csvPath = args.getValueForOption ("--csv");
+        options.tracePath = args.getValueForOption ("--trace");
+
+        auto rates = args.getValueForOption ("--rates");
+        if (rates.isNotEmpty())
+        {
+            options.sampleRates.clear();
+            for (const auto& rate : juce::StringArray::fromTokens (rates, ",", ""))
+                if (rate.getDoubleValue() > 0.0)
+                    options.sampleRates.push_back (rate.getDoubleValue());
+        }
+
+        return options;
+    }
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    juce::ArgumentList args (argc, argv);
+
+    const auto options = parseOptions (args);
+    Session session (options);
+    session.createInstances();
+
+    std::printf ("created %d instances in %.1f ms: %.1f KB heap each, %lld allocations\n",
+                 options.numInstances, session.setupMilliseconds, session.heapBytesPerInstance / 1024.0,
+                 (long long) session.setupAllocations);
+
+    for (double sampleRate : options.sampleRates)
+        session.runPass (sampleRate);
+
+    if (options.csvPath.isNotEmpty())
+        session.writeCsv (juce::File::getCurrentWorkingDirectory().getChildFile (options.csvPath));
+
+    if (options.tracePath.isNotEmpty())
+    {
+       #if ORIGIN_TRACING
+        PerformanceTrace::getInstance().writeTo (juce::File::getCurrentWorkingDirectory().getChildFile (options.tracePath));
+       #else
+        std::printf ("--trace ignored: this build has ORIGIN_TRACING off\n");
+       #endif
+    }
+
+    return 0;
+}